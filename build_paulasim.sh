@@ -0,0 +1,59 @@
+#!/bin/sh
+# Build script for the Paula simulator - compatible with both glibc and musl libc environments
+#   paulasim        replays a bus write trace through the Paula model
+#   pimodplay-sim   pimodplay on a simulated bus, runs on any Linux box
+set -eu
+
+# Allow overriding compiler via environment variable
+: "${CC:=gcc}"
+
+# Allow overriding pkg-config via environment variable
+: "${PKG_CONFIG:=pkg-config}"
+
+echo "Building paulasim..."
+echo "Using compiler: $CC"
+
+$CC -O2 -Wall -Wextra -std=c99 \
+    -I./ \
+    -Isrc/ \
+    -Iplatforms/amiga/registers/ \
+    src/paulasim.c \
+    src/paula_sim.c \
+    -o paulasim
+
+# Same sources as build_pimodplay.sh, with the simulated bus in place of
+# gpio/ and src/chip_ram.c.
+$CC -O2 -Wall -Wextra -std=c99 \
+    -I./ \
+    -Isrc/ \
+    -Iplatforms/amiga/registers/ \
+    src/pimodplay.c \
+    src/chip_cache.c \
+    src/chip_shadow.c \
+    src/xfer_sched.c \
+    src/amiga_detect.c \
+    src/paula_stream.c \
+    src/paula_dat.c \
+    src/paula_attach.c \
+    src/pcm_pipe.c \
+    src/pcm_cache.c \
+    src/pcm_convert.c \
+    src/resample.c \
+    src/dsp_chain.c \
+    src/wavesynth.c \
+    src/midi_in.c \
+    src/lat_hist.c \
+    src/paula_writer.c \
+    src/mod_replay.c \
+    src/cia_timer.c \
+    src/mod_upload.c \
+    src/playlist.c \
+    src/mod_mixer.c \
+    src/mix_stream.c \
+    src/mod_regs.c \
+    src/sim_bus.c \
+    src/paula_sim.c \
+    -lm -lpthread -o pimodplay-sim
+
+echo "Build completed successfully!"
+echo "Binaries: paulasim pimodplay-sim"
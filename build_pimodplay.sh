@@ -17,9 +17,33 @@ $CC -O2 -Wall -Wextra -std=c99 \
     -Isrc/ \
     -Iplatforms/amiga/registers/ \
     src/pimodplay.c \
+    src/chip_ram.c \
+    src/chip_cache.c \
+    src/chip_shadow.c \
+    src/xfer_sched.c \
+    src/amiga_detect.c \
+    src/paula_stream.c \
+    src/paula_dat.c \
+    src/paula_attach.c \
+    src/pcm_pipe.c \
+    src/pcm_cache.c \
+    src/pcm_convert.c \
+    src/resample.c \
+    src/dsp_chain.c \
+    src/wavesynth.c \
+    src/midi_in.c \
+    src/lat_hist.c \
+    src/paula_writer.c \
+    src/mod_replay.c \
+    src/cia_timer.c \
+    src/mod_upload.c \
+    src/playlist.c \
+    src/mod_mixer.c \
+    src/mix_stream.c \
+    src/mod_regs.c \
     gpio/ps_protocol.c \
     gpio/rpi_peri.c \
-    -lm -o pimodplay
+    -lm -lpthread -o pimodplay
 
 echo "Build completed successfully!"
 echo "Binary: pimodplay"
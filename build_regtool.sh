@@ -14,8 +14,13 @@ echo "Using compiler: $CC"
 # Build with appropriate flags
 $CC -O2 -Wall -Wextra -std=c99 \
     -I./ \
+    -Isrc/ \
     -Iplatforms/amiga/registers/ \
     src/regtool.c \
+    src/chip_ram.c \
+    src/xfer_sched.c \
+    src/amiga_detect.c \
+    src/memtest.c \
     gpio/ps_protocol.c \
     gpio/rpi_peri.c \
     -o regtool
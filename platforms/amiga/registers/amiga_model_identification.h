@@ -428,7 +428,7 @@ static const amiga_model_info_t amiga_models[] = {
 
 // Find model by name
 static inline amiga_model_t find_model_by_name(const char *name) {
-    for (int i = 0; i < sizeof(amiga_models)/sizeof(amiga_models[0]); i++) {
+    for (size_t i = 0; i < sizeof(amiga_models)/sizeof(amiga_models[0]); i++) {
         if (amiga_models[i].model_name && 
             strcmp(amiga_models[i].model_name, name) == 0) {
             return amiga_models[i].model_id;
@@ -313,14 +313,27 @@ typedef enum {
     AMIGA_A1200,
     AMIGA_A4000,
     AMIGA_CDTV,
-    AMIGA_CD32
+    AMIGA_CD32,
+    AMIGA_A3000
 } amiga_model_t;
 
+// Implemented in src/amiga_detect.c: Agnus/Denise IDs plus the cached chip
+// RAM probe, without writing chip RAM. Returns the model as the
+// amiga_model_t of amiga_model_identification.h, whose order differs.
+int amiga_detect_model_code(void);
+
 // Function to detect Amiga model based on chip features
 static inline amiga_model_t detect_amiga_model(void) {
-    // This would typically read from chip registers to determine model
-    // For now, return a generic value
-    return AMIGA_UNKNOWN;
+    // Indexed by amiga_model_identification.h's amiga_model_t.
+    static const amiga_model_t from_identification[] = {
+        AMIGA_UNKNOWN, AMIGA_A500, AMIGA_A500PLUS, AMIGA_A600, AMIGA_A1000,
+        AMIGA_A1200, AMIGA_A2000, AMIGA_A3000, AMIGA_A4000, AMIGA_CDTV, AMIGA_CD32
+    };
+    int code = amiga_detect_model_code();
+    if (code < 0 || code >= (int)(sizeof(from_identification) / sizeof(from_identification[0]))) {
+        return AMIGA_UNKNOWN;
+    }
+    return from_identification[code];
 }
 
 // Model-specific initialization
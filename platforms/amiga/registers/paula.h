@@ -46,6 +46,12 @@
 #define AUD3VOL  (PAULA_BASE + 0x0D8)  // Audio channel 3 volume
 #define AUD3DAT  (PAULA_BASE + 0x0DA)  // Audio channel 3 data
 
+// Each channel's registers are AUD0's plus ch * AUD_STRIDE
+#define AUD_STRIDE  0x10u                // AUD1LCH - AUD0LCH
+
+// Audio DMA addresses chip RAM through AUDxLCH bits 4..0: up to 2 MB
+#define CHIP_ADDR_MASK 0x1FFFFFu
+
 // Disk DMA Registers
 #define DSKDATR  (PAULA_BASE + 0x008)  // Disk data early read (dummy address)
 #define DSKBYTR  (PAULA_BASE + 0x01A)  // Disk data byte and status read
@@ -114,6 +120,19 @@
 #define ADKF_CH0PEN   0x0002  // Channel 0 in use for input
 #define ADKF_ADLNK    0x0001  // Audio channel linking
 
+// Audio attach bits (ADKCON bits 7-0): AUDn modulates the period or
+// volume of AUD(n+1) with its DMA data; AUD3's bits only silence it.
+// These share bits with the disk entries above, which do not follow the
+// Hardware Reference Manual's layout.
+#define ADKF_USE3PN   0x0080  // Channel 3 attached to nothing (period)
+#define ADKF_USE2P3   0x0040  // Channel 2 modulates channel 3 period
+#define ADKF_USE1P2   0x0020  // Channel 1 modulates channel 2 period
+#define ADKF_USE0P1   0x0010  // Channel 0 modulates channel 1 period
+#define ADKF_USE3VN   0x0008  // Channel 3 attached to nothing (volume)
+#define ADKF_USE2V3   0x0004  // Channel 2 modulates channel 3 volume
+#define ADKF_USE1V2   0x0002  // Channel 1 modulates channel 2 volume
+#define ADKF_USE0V1   0x0001  // Channel 0 modulates channel 1 volume
+
 // ADKCON bit numbers
 #define ADKB_SETCLR   15
 #define ADKB_MFMPREC  14
@@ -131,6 +150,14 @@
 #define ADKB_CH1PEN   2
 #define ADKB_CH0PEN   1
 #define ADKB_ADLNK    0
+#define ADKB_USE3PN   7
+#define ADKB_USE2P3   6
+#define ADKB_USE1P2   5
+#define ADKB_USE0P1   4
+#define ADKB_USE3VN   3
+#define ADKB_USE2V3   2
+#define ADKB_USE1V2   1
+#define ADKB_USE0V1   0
 
 // Interrupt Bits
 #define INTF_SETCLR   0x8000  // Set/Clear control bit
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: MIT
+// Runtime Amiga model, region and chip RAM detection over the PiStorm bus.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "amiga_detect.h"
+
+#define AGNUS_ID_NTSC     0x10u   // VPOSR ID bit 4 set on NTSC Agnus/Alice
+#define DENISE_ID_ECS     0xFCu   // 8373 Super Denise
+#define DENISE_ID_LISA    0xF8u   // AGA Lisa
+#define PROBE_ADDR        0x000000u
+#define PROBE_MARK_A      0x5A3Cu
+#define PROBE_MARK_B      0xA5C3u
+#define CACHE_VERSION     1
+
+static const amiga_model_info_t *model_info(const char *name) {
+  for (size_t i = 0; i < sizeof(amiga_models) / sizeof(amiga_models[0]); i++) {
+    if (!strcmp(amiga_models[i].model_name, name)) return &amiga_models[i];
+  }
+  return &amiga_models[0];
+}
+
+static uint8_t read_agnus_id(void) {
+  return (uint8_t)((ps_read_16(VPOSR) >> 8) & 0x7Fu);
+}
+
+// OCS Denise has no ID register; the bus floats, so only trust known IDs.
+static uint8_t denise_id_known(uint16_t raw) {
+  uint8_t id = (uint8_t)(raw & 0xFFu);
+  return (id == DENISE_ID_ECS || id == DENISE_ID_LISA) ? id : 0u;
+}
+
+static uint8_t read_denise_id(void) {
+  uint8_t id = denise_id_known((uint16_t)ps_read_16(DENISEID));
+  for (int i = 0; i < 3; i++) {
+    if (denise_id_known((uint16_t)ps_read_16(DENISEID)) != id) return 0;
+  }
+  return id;
+}
+
+static int agnus_is_aga(uint8_t agnus_id) {
+  uint8_t base = agnus_id & (uint8_t)~AGNUS_ID_NTSC;
+  return base == 0x22u || base == 0x23u;
+}
+
+static int agnus_is_ecs(uint8_t agnus_id) {
+  return (agnus_id & (uint8_t)~AGNUS_ID_NTSC) == 0x20u;
+}
+
+static uint32_t make_fingerprint(uint8_t agnus_id, uint8_t denise_id) {
+  return 0xA0000000u | ((uint32_t)agnus_id << 8) | denise_id;
+}
+
+// Returns 1 if chip RAM ends at size: either PROBE_ADDR + size aliases back
+// to PROBE_ADDR, or nothing answers there. Four reads and four writes; both
+// words are restored.
+static int chip_ends_at(uint32_t size) {
+  uint32_t lo = PROBE_ADDR;
+  uint32_t hi = PROBE_ADDR + size;
+  uint16_t lo_save = (uint16_t)ps_read_16(lo);
+  uint16_t hi_save = (uint16_t)ps_read_16(hi);
+  ps_write_16(lo, PROBE_MARK_A);
+  ps_write_16(hi, PROBE_MARK_B);
+  uint16_t lo_now = (uint16_t)ps_read_16(lo);
+  uint16_t hi_now = (uint16_t)ps_read_16(hi);
+  ps_write_16(hi, hi_save);
+  ps_write_16(lo, lo_save);
+  int aliased = lo_now == PROBE_MARK_B;
+  int present = hi_now == PROBE_MARK_B;
+  return aliased || !present;
+}
+
+static uint32_t probe_chip_ram(uint8_t agnus_id) {
+  if (chip_ends_at(0x080000u)) return 0x080000u;
+  // OCS and Fat Agnus address at most 1 MB of chip RAM.
+  if (!agnus_is_ecs(agnus_id) && !agnus_is_aga(agnus_id)) return 0x100000u;
+  if (chip_ends_at(0x100000u)) return 0x100000u;
+  return 0x200000u;
+}
+
+// What the chipset addresses as shipped, for when chip RAM may not be
+// probed: 2 MB on AGA, 1 MB on ECS (A500+, A600), 512 KB on OCS.
+static uint32_t standard_chip_ram(uint8_t agnus_id) {
+  if (agnus_is_aga(agnus_id)) return 0x200000u;
+  if (agnus_is_ecs(agnus_id)) return 0x100000u;
+  return 0x080000u;
+}
+
+// Models the chip IDs cannot tell apart, or NULL if the pick is certain.
+// AGA Alice and Lisa are the same in the A1200, A4000 and CD32. ECS Agnus
+// with Super Denise is in the A500+, A600 and A3000; chip RAM size is
+// only a hint there, since each can have 1 or 2 MB.
+static const char *model_candidates(uint8_t agnus_id, uint8_t denise_id) {
+  if (agnus_is_aga(agnus_id) || denise_id == DENISE_ID_LISA) return "A1200/A4000/CD32";
+  if (agnus_is_ecs(agnus_id) && denise_id == DENISE_ID_ECS) return "A500+/A600/A3000";
+  return NULL;
+}
+
+static const char *pick_model(uint8_t agnus_id, uint8_t denise_id,
+                              uint32_t chip_bytes) {
+  if (agnus_is_aga(agnus_id) || denise_id == DENISE_ID_LISA) return "A1200";
+  if (agnus_is_ecs(agnus_id)) {
+    if (denise_id == DENISE_ID_ECS) return chip_bytes >= 0x200000u ? "A600" : "A500+";
+    return "A2000_ECS";
+  }
+  return chip_bytes >= 0x100000u ? "A2000_FAT" : "A500";
+}
+
+static const char *cache_file(const char *path) {
+  if (path) return path;
+  const char *env = getenv(AMIGA_DETECT_CACHE_ENV);
+  return (env && env[0]) ? env : AMIGA_DETECT_CACHE_DEFAULT;
+}
+
+static int cache_load(const char *path, amiga_detect_t *d) {
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+  int ver = 0;
+  unsigned fp = 0;
+  unsigned chip = 0;
+  unsigned agnus = 0;
+  unsigned denise = 0;
+  char name[32];
+  int n = fscanf(f, "v%d fp=%x model=%31s chip=%x agnus=%x denise=%x",
+                 &ver, &fp, name, &chip, &agnus, &denise);
+  fclose(f);
+  if (n != 6 || ver != CACHE_VERSION) return -1;
+  d->fingerprint = fp;
+  d->info = model_info(name);
+  d->chip_ram_bytes = chip;
+  d->agnus_id = (uint8_t)agnus;
+  d->denise_id = (uint8_t)denise;
+  return 0;
+}
+
+static void cache_store(const char *path, const amiga_detect_t *d) {
+  char tmp[512];
+  snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+  FILE *f = fopen(tmp, "w");
+  if (!f) return;
+  fprintf(f, "v%d fp=%08X model=%s chip=%06X agnus=%02X denise=%02X\n",
+          CACHE_VERSION, d->fingerprint, d->info->model_name,
+          d->chip_ram_bytes, d->agnus_id, d->denise_id);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+int amiga_detect(amiga_detect_t *d, const char *cache_path, int flags) {
+  const char *path = cache_file(cache_path);
+  memset(d, 0, sizeof(*d));
+
+  uint8_t agnus_id = read_agnus_id();
+  d->region = (agnus_id & AGNUS_ID_NTSC) ? REGION_NTSC : REGION_PAL;
+
+  if (!(flags & AMIGA_DETECT_REPROBE) && cache_load(path, d) == 0 && d->agnus_id == agnus_id) {
+    // One DENISEID read confirms the cached fingerprint.
+    uint8_t denise_id = denise_id_known((uint16_t)ps_read_16(DENISEID));
+    if (make_fingerprint(agnus_id, denise_id) == d->fingerprint) {
+      d->from_cache = 1;
+      d->chip_probed = 1;
+      d->model_guessed = model_candidates(d->agnus_id, d->denise_id) != NULL;
+      return 0;
+    }
+  }
+
+  d->agnus_id = agnus_id;
+  d->denise_id = read_denise_id();
+  d->fingerprint = make_fingerprint(d->agnus_id, d->denise_id);
+  d->chip_probed = !(flags & AMIGA_DETECT_READ_ONLY);
+  d->chip_ram_bytes = d->chip_probed ? probe_chip_ram(agnus_id) : standard_chip_ram(agnus_id);
+  d->info = model_info(pick_model(d->agnus_id, d->denise_id, d->chip_ram_bytes));
+  d->model_guessed = model_candidates(d->agnus_id, d->denise_id) != NULL;
+  d->from_cache = 0;
+  if (d->chip_probed) cache_store(path, d);
+
+  uint8_t base = agnus_id & (uint8_t)~AGNUS_ID_NTSC;
+  return (base == 0x00u || agnus_is_ecs(agnus_id) || agnus_is_aga(agnus_id)) ? 0 : -1;
+}
+
+void amiga_detect_print(const amiga_detect_t *d, FILE *out) {
+  const char *candidates = model_candidates(d->agnus_id, d->denise_id);
+  fprintf(out, "[MODEL] %s%s%s%s region=%s chip=%uKB%s agnus=0x%02X denise=0x%02X%s\n",
+          d->info->model_name, candidates ? " (guess: " : "",
+          candidates ? candidates : "", candidates ? ")" : "",
+          d->region == REGION_PAL ? "PAL" : "NTSC",
+          d->chip_ram_bytes / 1024u, d->chip_probed ? "" : " (standard, not probed)",
+          d->agnus_id, d->denise_id, d->from_cache ? " (cached)" : "");
+}
+
+amiga_model_t amiga_detect_model(void) {
+  amiga_detect_t d;
+  amiga_detect(&d, NULL, AMIGA_DETECT_READ_ONLY);
+  return d.info->model_id;
+}
+
+// Backs detect_amiga_model() in amiga_models.h, which has an amiga_model_t
+// of its own and cannot include this one; it maps the value back.
+int amiga_detect_model_code(void) {
+  return (int)amiga_detect_model();
+}
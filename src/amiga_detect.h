@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+// Runtime Amiga model, region and chip RAM detection over the PiStorm bus.
+//
+// The model comes from the Agnus/Alice ID in VPOSR and the Denise/Lisa ID in
+// DENISEID; chip RAM size is found by alias probing. The result is cached in
+// a small file keyed by a fingerprint of the two chip IDs, so later runs
+// confirm it with two register reads instead of probing chip RAM again.
+// The probe writes chip RAM; a read-only detection without a cached
+// result reports the chipset's standard size instead.
+
+#ifndef AMIGA_DETECT_H
+#define AMIGA_DETECT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "amiga_model_identification.h"
+
+#define AMIGA_DETECT_CACHE_DEFAULT "/var/tmp/amiga-model.cache"
+#define AMIGA_DETECT_CACHE_ENV     "AMIGA_MODEL_CACHE"
+
+// amiga_detect() flags.
+#define AMIGA_DETECT_REPROBE   1   // ignore any cached result
+#define AMIGA_DETECT_READ_ONLY 2   // never write chip RAM
+
+typedef struct {
+  const amiga_model_info_t *info;   // entry in amiga_models[], never NULL
+  region_standard_t region;         // from the Agnus PAL/NTSC bit
+  uint32_t chip_ram_bytes;          // 512K, 1M or 2M
+  int chip_probed;                  // 0: chipset's standard size, not measured
+  int model_guessed;                // chip IDs are shared by several models
+  uint8_t agnus_id;                 // VPOSR bits 14..8
+  uint8_t denise_id;                // DENISEID low byte, 0 if not present (OCS)
+  uint32_t fingerprint;
+  int from_cache;
+} amiga_detect_t;
+
+// Fills d. cache_path may be NULL for the default ($AMIGA_MODEL_CACHE or
+// AMIGA_DETECT_CACHE_DEFAULT); flags are AMIGA_DETECT_*. Only a probed
+// result is cached. Returns 0 on success, -1 if the chip IDs are not
+// recognised (d is still filled with a best guess).
+int amiga_detect(amiga_detect_t *d, const char *cache_path, int flags);
+
+// Read-only detection as an amiga_model_t.
+amiga_model_t amiga_detect_model(void);
+
+void amiga_detect_print(const amiga_detect_t *d, FILE *out);
+
+#endif /* AMIGA_DETECT_H */
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: MIT
+// Content-addressed sample residency cache kept in chip RAM.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "chip_cache.h"
+
+#define CACHE_OFF_MAGIC   0u
+#define CACHE_OFF_VERSION 4u
+#define CACHE_OFF_GEN     8u
+#define CACHE_OFF_ENTRIES 12u
+#define CACHE_OFF_TAIL    (CHIP_CACHE_HEADER_BYTES - 4u)
+
+uint64_t chip_cache_hash(const uint8_t *data, size_t len) {
+  // FNV-1a; cheap on the Pi and only used to name content, not to verify it.
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 0x100000001B3ull;
+  }
+  return h ^ (uint64_t)len;
+}
+
+static uint32_t cache_data_start(const chip_cache_t *c) {
+  return (c->base + CHIP_CACHE_HEADER_BYTES + 7u) & ~7u;
+}
+
+// A header entry is only trusted if it lies inside the managed region;
+// the comparisons are arranged so a huge addr or len cannot wrap around.
+static int entry_in_region(const chip_cache_t *c, const chip_cache_entry_t *e) {
+  uint32_t start = cache_data_start(c);
+  return e->len != 0 && e->addr >= start && e->addr < c->limit &&
+         e->len <= c->limit - e->addr;
+}
+
+static void cache_remove(chip_cache_t *c, unsigned idx) {
+  c->entries[idx] = c->entries[c->count - 1u];
+  c->count--;
+}
+
+static int entries_overlap(const chip_cache_entry_t *a, const chip_cache_entry_t *b) {
+  return a->addr < b->addr + b->len && b->addr < a->addr + a->len;
+}
+
+static void cache_invalidate_header(chip_cache_t *c) {
+  if (!c->header_valid) return;
+  // A torn tail makes the next open discard the header if we die mid-update.
+  ps_write_32(c->base + CACHE_OFF_TAIL, ~c->generation);
+  c->header_valid = 0;
+}
+
+void chip_cache_open(chip_cache_t *c, uint32_t base, uint32_t limit, int reset) {
+  memset(c, 0, sizeof(*c));
+  c->base = base & ~1u;
+  // Nothing past what audio DMA can address is chip RAM.
+  c->limit = limit <= CHIP_ADDR_MASK + 1u ? limit : CHIP_ADDR_MASK + 1u;
+  c->generation = 1;
+  c->pinned = 1;
+
+  if (reset) {
+    ps_write_32(c->base + CACHE_OFF_MAGIC, 0);
+    return;
+  }
+  if (ps_read_32(c->base + CACHE_OFF_MAGIC) != CHIP_CACHE_MAGIC) return;
+
+  uint32_t ver_count = ps_read_32(c->base + CACHE_OFF_VERSION);
+  uint32_t gen = ps_read_32(c->base + CACHE_OFF_GEN);
+  uint32_t tail = ps_read_32(c->base + CACHE_OFF_TAIL);
+  unsigned count = ver_count & 0xFFFFu;
+  if ((ver_count >> 16) != CHIP_CACHE_VERSION || gen != tail ||
+      count > CHIP_CACHE_MAX_ENTRIES) {
+    return;
+  }
+
+  uint32_t off = c->base + CACHE_OFF_ENTRIES;
+  for (unsigned i = 0; i < count; i++, off += CHIP_CACHE_ENTRY_BYTES) {
+    chip_cache_entry_t e;
+    e.hash = ((uint64_t)ps_read_32(off) << 32) | ps_read_32(off + 4);
+    e.addr = ps_read_32(off + 8);
+    e.len = ps_read_32(off + 12);
+    e.last_used = ps_read_32(off + 16);
+    if (!entry_in_region(c, &e)) continue;
+    // Two entries claiming the same bytes cannot both be intact; drop both.
+    int clash = 0;
+    for (unsigned j = 0; j < c->count;) {
+      if (entries_overlap(&e, &c->entries[j])) {
+        cache_remove(c, j);
+        clash = 1;
+      } else {
+        j++;
+      }
+    }
+    if (!clash) c->entries[c->count++] = e;
+  }
+  c->generation = gen + 1u;
+  c->pinned = c->generation;
+  c->header_valid = 1;
+}
+
+// Compares a handful of words spread over the sample against the local copy.
+// Catches samples that other Amiga-side software has since overwritten.
+static int cache_probe(const chip_cache_entry_t *e, const uint8_t *data) {
+  uint32_t words = e->len / 2u;
+  if (words == 0) {
+    return (uint8_t)ps_read_8(e->addr) == data[0];
+  }
+  int probes = words < CHIP_CACHE_PROBE_WORDS ? (int)words : CHIP_CACHE_PROBE_WORDS;
+  for (int i = 0; i < probes; i++) {
+    uint32_t w = probes > 1 ? (uint32_t)((uint64_t)(words - 1u) * (uint32_t)i / (uint32_t)(probes - 1)) : 0u;
+    uint16_t want = ((uint16_t)data[w * 2u] << 8) | data[w * 2u + 1u];
+    if ((uint16_t)ps_read_16(e->addr + w * 2u) != want) return 0;
+  }
+  return 1;
+}
+
+// First-fit search for a free span between resident entries.
+static uint32_t cache_find_gap(const chip_cache_t *c, uint32_t need) {
+  unsigned order[CHIP_CACHE_MAX_ENTRIES];
+  for (unsigned i = 0; i < c->count; i++) {
+    unsigned j = i;
+    while (j > 0 && c->entries[order[j - 1u]].addr > c->entries[i].addr) {
+      order[j] = order[j - 1u];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  uint32_t cursor = cache_data_start(c);
+  for (unsigned i = 0; i < c->count; i++) {
+    const chip_cache_entry_t *e = &c->entries[order[i]];
+    if (e->addr >= cursor && e->addr - cursor >= need) return cursor;
+    uint32_t end = (e->addr + e->len + 7u) & ~7u;
+    if (end > cursor) cursor = end;
+  }
+  if (cursor < c->limit && c->limit - cursor >= need) return cursor;
+  return 0;
+}
+
+// Evicts the least recently used entry not pinned by this run.
+static int cache_evict_one(chip_cache_t *c) {
+  int victim = -1;
+  for (unsigned i = 0; i < c->count; i++) {
+    if (c->entries[i].last_used >= c->pinned) continue;
+    if (victim < 0 || c->entries[i].last_used < c->entries[victim].last_used) {
+      victim = (int)i;
+    }
+  }
+  if (victim < 0) return 0;
+  cache_remove(c, (unsigned)victim);
+  return 1;
+}
+
+uint32_t chip_cache_acquire(chip_cache_t *c, const uint8_t *data, uint32_t len) {
+  int upload = 0;
+  uint32_t addr = chip_cache_reserve(c, data, len, &upload);
+  if (addr && upload) write_chip_ram(addr, data, len);
+  return addr;
+}
+
+uint32_t chip_cache_reserve(chip_cache_t *c, const uint8_t *data, uint32_t len,
+                            int *upload) {
+  *upload = 0;
+  if (!data || len == 0) return 0;
+  uint64_t hash = chip_cache_hash(data, len);
+
+  for (unsigned i = 0; i < c->count; i++) {
+    chip_cache_entry_t *e = &c->entries[i];
+    if (e->hash != hash || e->len != len) continue;
+    if (cache_probe(e, data)) {
+      e->last_used = c->generation;
+      c->hits++;
+      c->bytes_reused += len;
+      return e->addr;
+    }
+    cache_invalidate_header(c);
+    cache_remove(c, i);
+    break;
+  }
+
+  if (c->count == CHIP_CACHE_MAX_ENTRIES && !cache_evict_one(c)) return 0;
+
+  uint32_t need = (len + 7u) & ~7u;
+  uint32_t addr = cache_find_gap(c, need);
+  while (!addr && cache_evict_one(c)) {
+    addr = cache_find_gap(c, need);
+  }
+  if (!addr) return 0;
+
+  cache_invalidate_header(c);
+  *upload = 1;
+  chip_cache_entry_t *e = &c->entries[c->count++];
+  e->hash = hash;
+  e->addr = addr;
+  e->len = len;
+  e->last_used = c->generation;
+  c->misses++;
+  c->bytes_uploaded += len;
+  return addr;
+}
+
+void chip_cache_drop(chip_cache_t *c, uint32_t addr) {
+  for (unsigned i = 0; i < c->count; i++) {
+    if (c->entries[i].addr != addr) continue;
+    cache_invalidate_header(c);
+    c->bytes_uploaded -= c->entries[i].len;
+    c->misses--;
+    cache_remove(c, i);
+    return;
+  }
+}
+
+void chip_cache_next_generation(chip_cache_t *c) {
+  c->pinned = c->generation;
+  c->generation++;
+}
+
+void chip_cache_unpin_previous(chip_cache_t *c) {
+  c->pinned = c->generation;
+}
+
+void chip_cache_commit(chip_cache_t *c) {
+  cache_invalidate_header(c);
+
+  uint32_t off = c->base + CACHE_OFF_ENTRIES;
+  for (unsigned i = 0; i < c->count; i++, off += CHIP_CACHE_ENTRY_BYTES) {
+    const chip_cache_entry_t *e = &c->entries[i];
+    ps_write_32(off, (uint32_t)(e->hash >> 32));
+    ps_write_32(off + 4, (uint32_t)e->hash);
+    ps_write_32(off + 8, e->addr);
+    ps_write_32(off + 12, e->len);
+    ps_write_32(off + 16, e->last_used);
+  }
+  ps_write_32(c->base + CACHE_OFF_MAGIC, CHIP_CACHE_MAGIC);
+  ps_write_32(c->base + CACHE_OFF_VERSION, (CHIP_CACHE_VERSION << 16) | c->count);
+  ps_write_32(c->base + CACHE_OFF_GEN, c->generation);
+  ps_write_32(c->base + CACHE_OFF_TAIL, c->generation);
+  c->header_valid = 1;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: MIT
+// Content-addressed sample residency cache kept in chip RAM.
+//
+// A small header at the start of the managed region maps content hashes to
+// chip RAM addresses, so a later run can reuse samples that are still
+// resident instead of re-uploading them over the bus.
+
+#ifndef CHIP_CACHE_H
+#define CHIP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHIP_CACHE_MAGIC        0x504D5243u  // 'PMRC'
+#define CHIP_CACHE_VERSION      1u
+#define CHIP_CACHE_MAX_ENTRIES  64
+#define CHIP_CACHE_ENTRY_BYTES  20u
+#define CHIP_CACHE_PROBE_WORDS  8
+// magic + version/count + generation + entries + generation tail
+#define CHIP_CACHE_HEADER_BYTES \
+  (12u + CHIP_CACHE_ENTRY_BYTES * CHIP_CACHE_MAX_ENTRIES + 4u)
+
+typedef struct {
+  uint64_t hash;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t last_used;   // generation of the last run that used the entry
+} chip_cache_entry_t;
+
+typedef struct {
+  uint32_t base;        // header address in chip RAM
+  uint32_t limit;       // end of managed region (exclusive)
+  uint32_t generation;  // this run's generation
+  uint32_t pinned;      // entries used in this generation or later stay put
+  unsigned count;
+  chip_cache_entry_t entries[CHIP_CACHE_MAX_ENTRIES];
+  int header_valid;     // chip RAM header currently matches entries[]
+  unsigned hits;
+  unsigned misses;
+  size_t bytes_reused;
+  size_t bytes_uploaded;
+} chip_cache_t;
+
+// Reads and validates the header at base. A missing or torn header yields an
+// empty cache; entries that reach outside [header end, limit) or overlap
+// another entry are dropped. If reset is set, any existing header is ignored.
+void chip_cache_open(chip_cache_t *c, uint32_t base, uint32_t limit, int reset);
+
+// Returns the chip RAM address of data, uploading it only if no verified
+// resident copy exists. Returns 0 if the region has no room left.
+uint32_t chip_cache_acquire(chip_cache_t *c, const uint8_t *data, uint32_t len);
+
+// Like chip_cache_acquire() but leaves the upload to the caller: *upload
+// is set when data is not resident and must be written to the returned
+// address before the cache is committed.
+uint32_t chip_cache_reserve(chip_cache_t *c, const uint8_t *data, uint32_t len,
+                            int *upload);
+
+// Forgets a reserved entry whose upload never finished.
+void chip_cache_drop(chip_cache_t *c, uint32_t addr);
+
+// Starts a new generation for the next playlist item. Entries of the
+// current generation stay pinned, so the item still playing keeps its
+// samples while the next one is being uploaded.
+void chip_cache_next_generation(chip_cache_t *c);
+
+// Lets entries of earlier generations be evicted again.
+void chip_cache_unpin_previous(chip_cache_t *c);
+
+// Writes the header back so the next run can find this run's samples.
+void chip_cache_commit(chip_cache_t *c);
+
+uint64_t chip_cache_hash(const uint8_t *data, size_t len);
+
+#endif /* CHIP_CACHE_H */
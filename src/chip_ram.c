@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: MIT
+// Chip RAM block transfer helpers shared by the Pi-side tools.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "gpio/ps_protocol.h"
+#include "chip_ram.h"
+
+// GPIO block mapped by ps_setup_protocol().
+extern volatile unsigned int *gpio;
+
+static chip_ram_writer_fn bulk_writer = NULL;
+static size_t bulk_min_len = 0;
+
+void chip_ram_set_bulk_writer(chip_ram_writer_fn fn, size_t min_len) {
+  bulk_writer = fn;
+  bulk_min_len = min_len;
+}
+
+void write_chip_ram(uint32_t addr, const uint8_t *buf, size_t len) {
+  if (bulk_writer && len >= bulk_min_len) {
+    bulk_writer(addr, buf, len);
+    return;
+  }
+  size_t i = 0;
+  for (; i + 1 < len; i += 2) {
+    uint16_t v = ((uint16_t)buf[i] << 8) | (uint16_t)buf[i + 1];
+    ps_write_16(addr + (uint32_t)i, v);
+  }
+  if (i < len) {
+    ps_write_8(addr + (uint32_t)i, buf[i]);
+  }
+}
+
+void write_chip_ram_burst(uint32_t addr, const uint8_t *buf, size_t len) {
+  size_t i = 0;
+  if (len >= 2) {
+    GPFSEL_OUTPUT;
+    for (; i + 1 < len; i += 2) {
+      uint32_t a = addr + (uint32_t)i;
+      uint32_t v = ((uint32_t)buf[i] << 8) | (uint32_t)buf[i + 1];
+      uint32_t lo = a & 0xFFFFu;
+      uint32_t hi = a >> 16;
+      GPIO_WRITEREG(REG_DATA, v);
+      GPIO_WRITEREG(REG_ADDR_LO, lo);
+      GPIO_WRITEREG(REG_ADDR_HI, hi);
+      WAIT_TXN;
+    }
+    GPFSEL_INPUT;
+  }
+  if (i < len) {
+    ps_write_8(addr + (uint32_t)i, buf[i]);
+  }
+}
+
+void write_chip_ram_run(uint32_t addr, const uint8_t *buf, size_t len) {
+  if (bulk_writer && len >= bulk_min_len) {
+    bulk_writer(addr, buf, len);
+    return;
+  }
+  write_chip_ram_burst(addr, buf, len);
+}
+
+void read_chip_ram(uint32_t addr, uint8_t *buf, size_t len) {
+  size_t i = 0;
+  for (; i + 1 < len; i += 2) {
+    uint16_t v = (uint16_t)ps_read_16(addr + (uint32_t)i);
+    buf[i] = (uint8_t)(v >> 8);
+    buf[i + 1] = (uint8_t)v;
+  }
+  if (i < len) {
+    buf[i] = (uint8_t)ps_read_8(addr + (uint32_t)i);
+  }
+}
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: MIT
+// Chip RAM block transfer helpers shared by the Pi-side tools.
+
+#ifndef CHIP_RAM_H
+#define CHIP_RAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*chip_ram_writer_fn)(uint32_t addr, const uint8_t *buf,
+                                   size_t len);
+
+// Writes len bytes to chip RAM as big-endian words (odd tail as a byte).
+void write_chip_ram(uint32_t addr, const uint8_t *buf, size_t len);
+
+// Sends write_chip_ram() calls of at least min_len bytes to fn instead
+// (e.g. a transfer scheduler). fn must not call write_chip_ram() itself.
+void chip_ram_set_bulk_writer(chip_ram_writer_fn fn, size_t min_len);
+
+// Same as write_chip_ram() but keeps the GPIO data pins driven for the
+// whole run instead of flipping them per word. Meant for long sequential
+// runs; the CPLD only drives PI_D during reads, so this is safe for writes.
+void write_chip_ram_burst(uint32_t addr, const uint8_t *buf, size_t len);
+
+// A long sequential run: goes to the bulk writer when write_chip_ram()
+// would, otherwise out as a burst.
+void write_chip_ram_run(uint32_t addr, const uint8_t *buf, size_t len);
+
+// Reads len bytes from chip RAM using word reads (odd tail as a byte).
+void read_chip_ram(uint32_t addr, uint8_t *buf, size_t len);
+
+#endif /* CHIP_RAM_H */
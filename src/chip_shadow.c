@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: MIT
+// Pi-side shadow copies of chip RAM regions for delta uploads.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "chip_ram.h"
+#include "chip_shadow.h"
+
+int chip_shadow_init(chip_shadow_t *s, uint32_t addr, size_t len) {
+  memset(s, 0, sizeof(*s));
+  if (addr & 1u) return -1;
+  size_t blocks = (len + CHIP_SHADOW_BLOCK_BYTES - 1u) >> CHIP_SHADOW_BLOCK_SHIFT;
+  s->data = (uint8_t *)malloc(len ? len : 1u);
+  s->valid = (uint8_t *)calloc(blocks ? blocks : 1u, 1);
+  if (!s->data || !s->valid) {
+    chip_shadow_free(s);
+    return -1;
+  }
+  s->addr = addr;
+  s->len = len;
+  return 0;
+}
+
+void chip_shadow_free(chip_shadow_t *s) {
+  free(s->data);
+  free(s->valid);
+  memset(s, 0, sizeof(*s));
+}
+
+void chip_shadow_invalidate(chip_shadow_t *s, uint32_t addr, size_t len) {
+  if (!s->valid || len == 0) return;
+  uint32_t end = addr + (uint32_t)len;
+  if (end <= s->addr || addr >= s->addr + s->len) return;
+  size_t from = addr > s->addr ? addr - s->addr : 0u;
+  size_t to = end - s->addr;
+  if (to > s->len) to = s->len;
+  for (size_t b = from >> CHIP_SHADOW_BLOCK_SHIFT;
+       b <= (to - 1u) >> CHIP_SHADOW_BLOCK_SHIFT; b++) {
+    s->valid[b] = 0;
+  }
+}
+
+void chip_shadow_invalidate_all(chip_shadow_t *s) {
+  if (!s->valid) return;
+  memset(s->valid, 0, (s->len + CHIP_SHADOW_BLOCK_BYTES - 1u) >> CHIP_SHADOW_BLOCK_SHIFT);
+}
+
+size_t chip_delta_find_diff(const uint8_t *a, const uint8_t *b, size_t from,
+                            size_t len) {
+  size_t i = from;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 16u <= len; i += 16u) {
+    uint64x2_t x = vreinterpretq_u64_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    if (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) break;
+  }
+#else
+  for (; i + 8u <= len; i += 8u) {
+    uint64_t x;
+    uint64_t y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y) break;
+  }
+#endif
+  while (i < len && a[i] == b[i]) i++;
+  return i;
+}
+
+static void delta_emit(uint32_t addr, const uint8_t *buf, size_t len,
+                       chip_delta_stats_t *st) {
+  if (len / 2u >= CHIP_SHADOW_BURST_WORDS) {
+    write_chip_ram_run(addr, buf, len);
+    st->bursts++;
+  } else {
+    write_chip_ram(addr, buf, len);
+  }
+  st->runs++;
+  st->bytes_sent += len;
+}
+
+// Changed bytes waiting to go out. Runs that touch, also across block
+// boundaries, are sent as one, so a rewritten slot is a single transfer
+// the bulk writer can schedule.
+typedef struct {
+  uint32_t addr;
+  const uint8_t *buf;
+  size_t len;
+  chip_delta_stats_t *st;
+} delta_run_t;
+
+static void run_flush(delta_run_t *r) {
+  if (r->len) delta_emit(r->addr, r->buf, r->len, r->st);
+  r->len = 0;
+}
+
+// addr and buf advance together within one upload, so touching addresses
+// mean touching source bytes.
+static void run_add(delta_run_t *r, uint32_t addr, const uint8_t *buf, size_t len) {
+  if (r->len && r->addr + r->len == addr) {
+    r->len += len;
+    return;
+  }
+  run_flush(r);
+  r->addr = addr;
+  r->buf = buf;
+  r->len = len;
+}
+
+// Diffs one block-sized chunk whose shadow content is known.
+static void delta_chunk(uint8_t *shadow, uint32_t addr, const uint8_t *buf,
+                        size_t n, delta_run_t *r) {
+  size_t i = 0;
+  while (i < n) {
+    size_t d = chip_delta_find_diff(shadow, buf, i, n);
+    if (d >= n) break;
+    i = d & ~(size_t)1u;
+    size_t j = i;
+    while (j + 1u < n && (shadow[j] != buf[j] || shadow[j + 1u] != buf[j + 1u])) {
+      j += 2u;
+    }
+    if (j + 1u == n && shadow[j] != buf[j]) j = n;
+    run_add(r, addr + (uint32_t)i, buf + i, j - i);
+    memcpy(shadow + i, buf + i, j - i);
+    i = j;
+  }
+}
+
+void upload_delta(chip_shadow_t *s, uint32_t addr, const uint8_t *buf,
+                  size_t len, chip_delta_stats_t *stats) {
+  chip_delta_stats_t st;
+  memset(&st, 0, sizeof(st));
+
+  if (!s->data || addr < s->addr || addr + len > s->addr + s->len ||
+      ((addr - s->addr) & 1u)) {
+    delta_emit(addr, buf, len, &st);
+  } else {
+    delta_run_t run = {0, NULL, 0, &st};
+    size_t off = addr - s->addr;
+    size_t done = 0;
+    while (done < len) {
+      size_t pos = off + done;
+      size_t blk = pos >> CHIP_SHADOW_BLOCK_SHIFT;
+      size_t blk_end = (blk + 1u) << CHIP_SHADOW_BLOCK_SHIFT;
+      size_t n = blk_end - pos;
+      if (n > len - done) n = len - done;
+
+      if (s->valid[blk]) {
+        delta_chunk(s->data + pos, addr + (uint32_t)done, buf + done, n, &run);
+      } else {
+        run_add(&run, addr + (uint32_t)done, buf + done, n);
+        memcpy(s->data + pos, buf + done, n);
+        // Only a fully rewritten block is known to match chip RAM.
+        if (pos == (blk << CHIP_SHADOW_BLOCK_SHIFT) &&
+            (n == CHIP_SHADOW_BLOCK_BYTES || pos + n == s->len)) {
+          s->valid[blk] = 1;
+        }
+      }
+      done += n;
+    }
+    run_flush(&run);
+  }
+
+  st.bytes_saved = len - st.bytes_sent;
+  s->total_sent += st.bytes_sent;
+  s->total_saved += st.bytes_saved;
+  if (stats) *stats = st;
+}
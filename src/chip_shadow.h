@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MIT
+// Pi-side shadow copies of chip RAM regions for delta uploads.
+//
+// upload_delta() compares new content against the shadow and only writes the
+// words that changed. The shadow only knows about writes made through it, so
+// callers must invalidate ranges that Amiga-side DMA (blitter, disk, copper
+// writes) may have modified.
+//
+// paula_stream refills its ring slots this way; the wavetable synth's
+// tables and MOD samples are written once and go straight to chip RAM.
+
+#ifndef CHIP_SHADOW_H
+#define CHIP_SHADOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHIP_SHADOW_BLOCK_SHIFT 8                        // 256-byte valid blocks
+#define CHIP_SHADOW_BLOCK_BYTES (1u << CHIP_SHADOW_BLOCK_SHIFT)
+#define CHIP_SHADOW_BURST_WORDS 4                        // runs this long use write_chip_ram_run()
+
+typedef struct {
+  uint32_t addr;        // chip RAM start (even)
+  size_t len;           // shadowed bytes
+  uint8_t *data;        // last content written through the shadow
+  uint8_t *valid;       // one flag per block; 0 = chip RAM content unknown
+  size_t total_sent;
+  size_t total_saved;
+} chip_shadow_t;
+
+typedef struct {
+  size_t bytes_sent;    // bytes actually written over the bus
+  size_t bytes_saved;   // bytes skipped because chip RAM already matched
+  unsigned runs;        // changed word runs emitted
+  unsigned bursts;      // runs written with write_chip_ram_run()
+} chip_delta_stats_t;
+
+// Allocates an (initially invalid) shadow for [addr, addr + len).
+int chip_shadow_init(chip_shadow_t *s, uint32_t addr, size_t len);
+void chip_shadow_free(chip_shadow_t *s);
+
+// Marks [addr, addr + len) as unknown, e.g. after Amiga-side DMA wrote it.
+void chip_shadow_invalidate(chip_shadow_t *s, uint32_t addr, size_t len);
+void chip_shadow_invalidate_all(chip_shadow_t *s);
+
+// Writes buf to chip RAM at addr, emitting only changed words. Ranges outside
+// the shadow are written in full. stats may be NULL.
+void upload_delta(chip_shadow_t *s, uint32_t addr, const uint8_t *buf,
+                  size_t len, chip_delta_stats_t *stats);
+
+// Returns the byte offset of the first difference between a and b at or after
+// from, or len if they match.
+size_t chip_delta_find_diff(const uint8_t *a, const uint8_t *b, size_t from,
+                            size_t len);
+
+#endif /* CHIP_SHADOW_H */
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: MIT
+// MOD tick clock from CIAB Timer A.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "cia.h"
+#include "pi_time.h"
+#include "cia_timer.h"
+
+// E clock ticks per MOD tick are clock * 2.5 / bpm; ProTracker rounds the
+// PAL constant down to 1773447.
+static uint16_t latch_for(uint32_t clock_hz, unsigned bpm) {
+  uint32_t ticks = (uint32_t)((uint64_t)clock_hz * 5u / 2u / (bpm ? bpm : 125u));
+  return (uint16_t)(ticks > 0xFFFFu ? 0xFFFFu : ticks);
+}
+
+static uint16_t read_counter(void) {
+  uint8_t hi = (uint8_t)ps_read_8(CIABTAHI);
+  uint8_t lo = (uint8_t)ps_read_8(CIABTALO);
+  uint8_t hi2 = (uint8_t)ps_read_8(CIABTAHI);
+  if (hi2 != hi) {
+    // Low byte wrapped between the reads.
+    lo = (uint8_t)ps_read_8(CIABTALO);
+    hi = hi2;
+  }
+  return (uint16_t)((hi << 8) | lo);
+}
+
+// Reading CIABICR clears every flag in it, the ones the OS waits on for
+// its level 6 handler included. Flags other than Timer A that a read
+// takes are kept so the report can show them.
+static uint8_t read_icr(cia_timer_t *t) {
+  uint8_t icr = (uint8_t)ps_read_8(CIABICR);
+  uint8_t other = icr & (uint8_t)~(CIAICR_TAIRQ | CIAICR_IRRQ);
+  if (other) {
+    t->icr_taken |= other;
+    t->icr_reads_taken++;
+  }
+  return icr;
+}
+
+static uint64_t period_ns_for(uint32_t clock_hz, uint16_t latch) {
+  return (uint64_t)latch * 1000000000ull / clock_hz;
+}
+
+int cia_timer_start(cia_timer_t *t, int is_pal, unsigned bpm) {
+  memset(t, 0, sizeof(*t));
+  t->clock_hz = is_pal ? CIA_TIMER_FREQ_PAL : CIA_TIMER_FREQ_NTSC;
+  t->cra_saved = (uint8_t)ps_read_8(CIABCRA);
+
+  ps_write_8(CIABCRA, t->cra_saved & ~(CIACRA_START | CIACRA_RUNMODE));
+  ps_write_8(CIABICR, CIAICR_TAIRQ);             // mask: no level 6 for the OS
+  cia_timer_set_bpm(t, bpm);
+  // CIACRA_LOAD below loads the latch at once, not at an underflow.
+  t->latch = t->next_latch;
+  t->period_ns = t->next_period_ns;
+  t->pending = 0;
+  (void)read_icr(t);                             // drop a stale flag
+  ps_write_8(CIABCRA, (t->cra_saved & ~(CIACRA_RUNMODE | CIACRA_INMODE |
+                                        CIACRA_PBON)) |
+                      CIACRA_START | CIACRA_LOAD);
+  t->last_ns = pi_now_ns();
+
+  // The counter must be moving, or there is no CIA answering.
+  uint16_t a = read_counter();
+  pi_sleep_ns(200000u);
+  if (read_counter() == a) {
+    fprintf(stderr, "cia: CIAB Timer A is not counting\n");
+    cia_timer_stop(t);
+    return -1;
+  }
+  return 0;
+}
+
+void cia_timer_set_bpm(cia_timer_t *t, unsigned bpm) {
+  t->next_latch = latch_for(t->clock_hz, bpm);
+  t->next_period_ns = period_ns_for(t->clock_hz, t->next_latch);
+  t->pending = 1;
+  // Written while running, the latch takes over at the next underflow.
+  ps_write_8(CIABTALO, t->next_latch & 0xFFu);
+  ps_write_8(CIABTAHI, t->next_latch >> 8);
+}
+
+unsigned cia_timer_wait(cia_timer_t *t, volatile sig_atomic_t *stop,
+                        uint64_t *late_ns) {
+  uint64_t expect = t->last_ns + t->period_ns;
+  if (expect > CIA_TIMER_POLL_NS) {
+    pi_sleep_until_ns(expect - CIA_TIMER_POLL_NS, 0);
+  }
+  // Poll the counter, not CIABICR: it reloads from the latch at the
+  // underflow, so a count above the last one is the wrap. ICR is read
+  // once per tick, after the wrap, to clear the Timer A flag. If the
+  // tick is already due, the wrap may be gone before the first read;
+  // then the flag is the only witness.
+  uint16_t prev = read_counter();
+  int seen = pi_now_ns() >= expect && (read_icr(t) & CIAICR_TAIRQ);
+  while (!seen) {
+    if (stop && *stop) return 0;
+    t->polls++;
+    uint16_t c = read_counter();
+    if (c > prev) {
+      (void)read_icr(t);
+      seen = 1;
+    }
+    prev = c;
+  }
+  uint64_t now = pi_now_ns();
+  // The first underflow ends a tick at the old rate and loads any new
+  // latch, which every later one runs at.
+  uint64_t first_ns = t->period_ns;
+  if (t->pending) {
+    t->latch = t->next_latch;
+    t->period_ns = t->next_period_ns;
+    t->pending = 0;
+  }
+  uint16_t count = read_counter();
+  uint32_t since = count <= t->latch ? (uint32_t)(t->latch - count) : 0u;
+  uint64_t late = (uint64_t)since * 1000000000ull / t->clock_hz;
+  uint64_t edge = now - late;
+
+  // The flag only says "at least one"; the host clock tells how many.
+  unsigned n = 1;
+  if (edge > t->last_ns + first_ns) {
+    uint64_t gap = edge - t->last_ns - first_ns;
+    n += (unsigned)((gap + t->period_ns / 2u) / t->period_ns);
+  }
+  t->missed += n - 1u;
+  t->ticks += n;
+  t->last_ns = edge;
+  if (late_ns) *late_ns = late;
+  return n;
+}
+
+void cia_timer_stop(cia_timer_t *t) {
+  ps_write_8(CIABCRA, t->cra_saved & ~(CIACRA_START | CIACRA_LOAD));
+  (void)read_icr(t);
+}
+
+void cia_timer_report(const cia_timer_t *t, FILE *out) {
+  fprintf(out, "[CIA] clock=%uHz latch=%u ticks=%llu missed=%llu polls/tick=%.1f\n",
+          t->clock_hz, t->latch, (unsigned long long)t->ticks,
+          (unsigned long long)t->missed,
+          t->ticks ? (double)t->polls / (double)t->ticks : 0.0);
+  if (t->icr_taken) {
+    fprintf(out, "[CIA] took other CIAB flags 0x%02x in %llu ICR reads "
+                 "(the OS level 6 handler did not see them)\n",
+            t->icr_taken, (unsigned long long)t->icr_reads_taken);
+  }
+}
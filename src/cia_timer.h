@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MIT
+// MOD tick clock from CIAB Timer A, the timer ProTracker itself uses.
+//
+// The timer counts the E clock (709379 Hz PAL, 715909 Hz NTSC), which is
+// divided from the same crystal as Paula's sample clock, so ticks paced
+// by it cannot drift against audio DMA. It runs in continuous mode with
+// its interrupt masked at the CIA; the Pi sleeps until shortly before
+// the next underflow and then polls the counter for the reload. CIABICR
+// is read once per tick after that: a read clears all of its flags, and
+// those of the other CIAB sources belong to the OS. After the reload, the
+// counter itself says how long ago the underflow was.
+
+#ifndef CIA_TIMER_H
+#define CIA_TIMER_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CIA_TIMER_POLL_NS 1000000ull  // start polling 1 ms before a tick
+
+typedef struct {
+  uint32_t clock_hz;
+  uint16_t latch;           // loaded at the last underflow
+  uint64_t period_ns;
+  uint16_t next_latch;      // written, taken at the next underflow
+  uint64_t next_period_ns;
+  int pending;
+  uint64_t last_ns;         // host time of the last underflow
+  uint8_t cra_saved;
+
+  uint64_t ticks;
+  uint64_t missed;          // underflows that passed unseen
+  uint64_t polls;
+  uint8_t icr_taken;        // non-Timer A flags our ICR reads cleared
+  uint64_t icr_reads_taken; // reads that cleared any of them
+} cia_timer_t;
+
+// Takes over CIAB Timer A and starts it at the tick rate for bpm.
+int cia_timer_start(cia_timer_t *t, int is_pal, unsigned bpm);
+
+// Writes the latch for bpm. The tick already counting keeps the old rate;
+// cia_timer_wait() switches to the new one at the underflow that loads it.
+void cia_timer_set_bpm(cia_timer_t *t, unsigned bpm);
+
+// Waits for the next underflow and returns the number of underflows since
+// the previous call (more than 1 if some were missed), or 0 if stop was
+// raised. *late_ns is the time since the last underflow, from the counter.
+unsigned cia_timer_wait(cia_timer_t *t, volatile sig_atomic_t *stop,
+                        uint64_t *late_ns);
+
+// Stops the timer and restores its control register. The CIA cannot read
+// back its interrupt mask or latch, so those stay as the tick clock left
+// them: Timer A masked, latch at the last tempo.
+void cia_timer_stop(cia_timer_t *t);
+
+void cia_timer_report(const cia_timer_t *t, FILE *out);
+
+#endif /* CIA_TIMER_H */
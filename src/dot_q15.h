@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT
+// Q15 dot product shared by the FIR stages of the resampler and DSP chain.
+
+#ifndef DOT_Q15_H
+#define DOT_Q15_H
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Sum of x[k] * h[k] over taps coefficients, in Q30. The NEON loop takes
+// eight at a time, so callers pad taps to a multiple of 8 with zeros.
+static inline int32_t dot_q15(const int16_t *x, const int16_t *h, unsigned taps) {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (unsigned k = 0; k < taps; k += 8u) {
+    int16x8_t xv = vld1q_s16(x + k);
+    int16x8_t hv = vld1q_s16(h + k);
+    acc = vmlal_s16(acc, vget_low_s16(xv), vget_low_s16(hv));
+    acc = vmlal_s16(acc, vget_high_s16(xv), vget_high_s16(hv));
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  return vget_lane_s32(vpadd_s32(s, s), 0);
+#else
+  int32_t acc = 0;
+  for (unsigned k = 0; k < taps; k++) acc += (int32_t)x[k] * h[k];
+  return acc;
+#endif
+}
+
+#endif /* DOT_Q15_H */
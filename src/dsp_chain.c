@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: MIT
+// Fixed-point DSP chain for the audio ingest path.
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_HAVE_NEON 1
+#endif
+
+#include "dot_q15.h"
+#include "dsp_chain.h"
+
+#define DSP_PI           3.141592653589793
+#define DSP_LIM_FRAMES   32u        // limiter gain is updated per block
+#define DSP_LIM_RELEASE  0.1        // seconds to recover ~63% of the gain
+
+static int16_t sat16(int32_t v) {
+  return (int16_t)(v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+}
+
+void dsp_chain_init(dsp_chain_t *c) {
+  memset(c, 0, sizeof(*c));
+}
+
+int dsp_chain_add(dsp_chain_t *c, dsp_kind_t kind, double hz, double q, double db) {
+  if (c->count >= DSP_MAX_STAGES) {
+    fprintf(stderr, "dsp: at most %u stages\n", DSP_MAX_STAGES);
+    return -1;
+  }
+  dsp_stage_t *s = &c->stage[c->count++];
+  memset(s, 0, sizeof(*s));
+  s->kind = kind;
+  s->hz = hz;
+  s->q = q;
+  s->db = db;
+  return 0;
+}
+
+int dsp_chain_parse(dsp_chain_t *c, const char *spec) {
+  char *copy = strdup(spec);
+  if (!copy) return -1;
+  int rc = 0;
+  char *save = NULL;
+  for (char *tok = strtok_r(copy, ",", &save); tok && rc == 0;
+       tok = strtok_r(NULL, ",", &save)) {
+    char *arg = strchr(tok, ':');
+    double v1 = 0.0;
+    double v2 = 0.0;
+    if (arg) {
+      *arg++ = '\0';
+      char *end = NULL;
+      v1 = strtod(arg, &end);
+      if (end && *end == ':') v2 = strtod(end + 1, NULL);
+    }
+    if (!strcmp(tok, "lpf") && v1 > 0.0) {
+      rc = dsp_chain_add(c, DSP_LPF1, v1, 0.0, 0.0);
+    } else if (!strcmp(tok, "lp") && v1 > 0.0) {
+      rc = dsp_chain_add(c, DSP_LOWPASS, v1, v2 > 0.0 ? v2 : 0.7071, 0.0);
+    } else if (!strcmp(tok, "hp") && v1 > 0.0) {
+      rc = dsp_chain_add(c, DSP_HIGHPASS, v1, v2 > 0.0 ? v2 : 0.7071, 0.0);
+    } else if (!strcmp(tok, "dc")) {
+      rc = dsp_chain_add(c, DSP_DC_BLOCK, v1 > 0.0 ? v1 : 20.0, 0.0, 0.0);
+    } else if (!strcmp(tok, "fir") && v1 > 0.0) {
+      rc = dsp_chain_add(c, DSP_FIR_LOWPASS, v1, v2 > 0.0 ? v2 : 31.0, 0.0);
+    } else if (!strcmp(tok, "gain") && arg) {
+      rc = dsp_chain_add(c, DSP_GAIN, 0.0, 0.0, v1);
+    } else if (!strcmp(tok, "limit") && arg) {
+      rc = dsp_chain_add(c, DSP_LIMITER, 0.0, 0.0, v1);
+    } else {
+      fprintf(stderr, "dsp: bad stage '%s'\n", tok);
+      rc = -1;
+    }
+  }
+  free(copy);
+  return rc;
+}
+
+// Normalised biquad (a0 = 1) to Q28.
+static void set_biquad(dsp_stage_t *s, double b0, double b1, double b2,
+                       double a1, double a2) {
+  const double one = 268435456.0;
+  s->b[0] = (int32_t)llround(b0 * one);
+  s->b[1] = (int32_t)llround(b1 * one);
+  s->b[2] = (int32_t)llround(b2 * one);
+  s->a[0] = (int32_t)llround(a1 * one);
+  s->a[1] = (int32_t)llround(a2 * one);
+}
+
+static void design_fir(dsp_stage_t *s, double fc) {
+  unsigned n = (unsigned)s->q;
+  if (n < 3) n = 3;
+  if (n > DSP_FIR_MAX_TAPS) n = DSP_FIR_MAX_TAPS;
+  s->ntaps = (n + 7u) & ~7u;
+  double h[DSP_FIR_MAX_TAPS];
+  double sum = 0.0;
+  for (unsigned j = 0; j < n; j++) {
+    double d = (double)j - (double)(n - 1u) / 2.0;
+    double x = 2.0 * fc * d;
+    double sinc = fabs(x) < 1e-12 ? 1.0 : sin(DSP_PI * x) / (DSP_PI * x);
+    double w = 2.0 * DSP_PI * (double)j / (double)(n - 1u);
+    h[j] = sinc * (0.42 - 0.5 * cos(w) + 0.08 * cos(2.0 * w));
+    sum += h[j];
+  }
+  // Stored reversed and zero-padded in front, so the newest sample lines
+  // up with the last tap.
+  memset(s->taps, 0, sizeof(s->taps));
+  int32_t total = 0;
+  unsigned peak = 0;
+  for (unsigned j = 0; j < n; j++) {
+    unsigned k = s->ntaps - 1u - j;
+    s->taps[k] = (int16_t)lrint(h[j] / sum * 32768.0);
+    total += s->taps[k];
+    if (s->taps[k] > s->taps[peak]) peak = k;
+  }
+  s->taps[peak] = (int16_t)(s->taps[peak] + (32768 - total));
+}
+
+int dsp_chain_prepare(dsp_chain_t *c, unsigned channels, double rate_hz) {
+  if ((channels != 1 && channels != 2) || rate_hz <= 0.0) {
+    fprintf(stderr, "dsp: bad format %u ch %.1f Hz\n", channels, rate_hz);
+    return -1;
+  }
+  c->channels = channels;
+  c->rate_hz = rate_hz;
+  for (unsigned i = 0; i < c->count; i++) {
+    dsp_stage_t *s = &c->stage[i];
+    memset(s->x1, 0, sizeof(s->x1));
+    memset(s->x2, 0, sizeof(s->x2));
+    memset(s->y1, 0, sizeof(s->y1));
+    memset(s->y2, 0, sizeof(s->y2));
+    memset(s->hist, 0, sizeof(s->hist));
+    double nyq = rate_hz * 0.49;
+    double hz = s->hz > nyq ? nyq : s->hz;
+    double w0 = 2.0 * DSP_PI * hz / rate_hz;
+    switch (s->kind) {
+      case DSP_LPF1: {
+        double x = 2.0 * DSP_PI * hz;
+        double alpha = x / (x + rate_hz);
+        set_biquad(s, alpha, 0.0, 0.0, -(1.0 - alpha), 0.0);
+        break;
+      }
+      case DSP_LOWPASS:
+      case DSP_HIGHPASS: {
+        double cw = cos(w0);
+        double alpha = sin(w0) / (2.0 * s->q);
+        double a0 = 1.0 + alpha;
+        if (s->kind == DSP_LOWPASS) {
+          set_biquad(s, (1.0 - cw) / 2.0 / a0, (1.0 - cw) / a0, (1.0 - cw) / 2.0 / a0,
+                     -2.0 * cw / a0, (1.0 - alpha) / a0);
+        } else {
+          set_biquad(s, (1.0 + cw) / 2.0 / a0, -(1.0 + cw) / a0, (1.0 + cw) / 2.0 / a0,
+                     -2.0 * cw / a0, (1.0 - alpha) / a0);
+        }
+        break;
+      }
+      case DSP_DC_BLOCK:
+        set_biquad(s, 1.0, -1.0, 0.0, -exp(-w0), 0.0);
+        break;
+      case DSP_FIR_LOWPASS:
+        design_fir(s, hz / rate_hz);
+        break;
+      case DSP_GAIN: {
+        double g = pow(10.0, s->db / 20.0) * 4096.0;
+        s->gain = (int16_t)(g > 32767.0 ? 32767.0 : lrint(g));
+        break;
+      }
+      case DSP_LIMITER: {
+        double t = pow(10.0, (s->db > 0.0 ? 0.0 : s->db) / 20.0) * 32767.0;
+        s->threshold = (int32_t)lrint(t);
+        if (s->threshold < 1) s->threshold = 1;
+        s->lim_gain = 4096;
+        double r = 1.0 - exp(-(double)DSP_LIM_FRAMES / (DSP_LIM_RELEASE * rate_hz));
+        s->release = (int32_t)lrint(r * 65536.0);
+        if (s->release < 1) s->release = 1;
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+static void run_biquad(dsp_stage_t *s, unsigned ch, int16_t *buf, size_t frames) {
+  for (unsigned c = 0; c < ch; c++) {
+    int32_t x1 = s->x1[c], x2 = s->x2[c];
+    int32_t y1 = s->y1[c], y2 = s->y2[c];
+    for (size_t i = 0; i < frames; i++) {
+      int32_t x = buf[i * ch + c];
+      // Inputs are Q28 products, outputs carry 8 extra fraction bits so
+      // low corners do not stall on rounding.
+      int64_t acc = (int64_t)s->b[0] * x + (int64_t)s->b[1] * x1 +
+                    (int64_t)s->b[2] * x2 -
+                    (((int64_t)s->a[0] * y1 + (int64_t)s->a[1] * y2) >> 8);
+      int64_t y = (acc + (1 << 19)) >> 20;
+      if (y > (1 << 30)) y = 1 << 30;
+      if (y < -(1 << 30)) y = -(1 << 30);
+      x2 = x1;
+      x1 = x;
+      y2 = y1;
+      y1 = (int32_t)y;
+      buf[i * ch + c] = sat16((y1 + 128) >> 8);
+    }
+    s->x1[c] = x1;
+    s->x2[c] = x2;
+    s->y1[c] = y1;
+    s->y2[c] = y2;
+  }
+}
+
+static void run_fir(dsp_stage_t *s, unsigned ch, int16_t *buf, size_t frames) {
+  int16_t work[DSP_FIR_MAX_TAPS + DSP_BLOCK_FRAMES];
+  size_t keep = s->ntaps - 1u;
+  for (unsigned c = 0; c < ch; c++) {
+    memcpy(work, s->hist[c], keep * sizeof(int16_t));
+    for (size_t i = 0; i < frames; i++) work[keep + i] = buf[i * ch + c];
+    for (size_t i = 0; i < frames; i++) {
+      int32_t acc = dot_q15(work + i, s->taps, s->ntaps);
+      buf[i * ch + c] = sat16((acc + (1 << 14)) >> 15);
+    }
+    memcpy(s->hist[c], work + frames, keep * sizeof(int16_t));
+  }
+}
+
+// buf[i] = buf[i] * g / 4096, rounded and saturated.
+static void scale_q12(int16_t *buf, size_t n, int16_t g) {
+  size_t i = 0;
+#ifdef DSP_HAVE_NEON
+  for (; i + 8u <= n; i += 8u) {
+    int16x8_t v = vld1q_s16(buf + i);
+    int32x4_t lo = vmull_n_s16(vget_low_s16(v), g);
+    int32x4_t hi = vmull_n_s16(vget_high_s16(v), g);
+    vst1q_s16(buf + i, vcombine_s16(vqrshrn_n_s32(lo, 12), vqrshrn_n_s32(hi, 12)));
+  }
+#endif
+  for (; i < n; i++) buf[i] = sat16(((int32_t)buf[i] * g + 2048) >> 12);
+}
+
+static int32_t peak_abs(const int16_t *buf, size_t n) {
+  size_t i = 0;
+  int32_t peak = 0;
+#ifdef DSP_HAVE_NEON
+  int16x8_t m = vdupq_n_s16(0);
+  for (; i + 8u <= n; i += 8u) m = vmaxq_s16(m, vqabsq_s16(vld1q_s16(buf + i)));
+  int16x4_t h = vmax_s16(vget_low_s16(m), vget_high_s16(m));
+  h = vpmax_s16(h, h);
+  h = vpmax_s16(h, h);
+  peak = vget_lane_s16(h, 0);
+#endif
+  for (; i < n; i++) {
+    int32_t v = buf[i] < 0 ? -(int32_t)buf[i] : buf[i];
+    if (v > peak) peak = v;
+  }
+  return peak;
+}
+
+// Block limiter: the gain drops at once to keep a block's peak under the
+// threshold and recovers exponentially. No look-ahead, so no added delay.
+static void run_limiter(dsp_stage_t *s, unsigned ch, int16_t *buf, size_t frames) {
+  for (size_t pos = 0; pos < frames; pos += DSP_LIM_FRAMES) {
+    size_t n = frames - pos < DSP_LIM_FRAMES ? frames - pos : DSP_LIM_FRAMES;
+    int16_t *blk = buf + pos * ch;
+    int32_t peak = peak_abs(blk, n * ch);
+    int32_t target = peak > s->threshold ? (s->threshold * 4096) / peak : 4096;
+    if (target < s->lim_gain) {
+      s->lim_gain = target;
+    } else if (s->lim_gain < 4096) {
+      int32_t step = (int32_t)(((int64_t)(4096 - s->lim_gain) * s->release) >> 16);
+      s->lim_gain += step > 0 ? step : 1;
+      if (s->lim_gain > target) s->lim_gain = target;
+    }
+    if (s->lim_gain < 4096) scale_q12(blk, n * ch, (int16_t)s->lim_gain);
+  }
+}
+
+void dsp_chain_process(dsp_chain_t *c, int16_t *buf, size_t frames) {
+  const unsigned ch = c->channels;
+  for (size_t pos = 0; pos < frames; pos += DSP_BLOCK_FRAMES) {
+    size_t n = frames - pos < DSP_BLOCK_FRAMES ? frames - pos : DSP_BLOCK_FRAMES;
+    int16_t *blk = buf + pos * ch;
+    for (unsigned i = 0; i < c->count; i++) {
+      dsp_stage_t *s = &c->stage[i];
+      switch (s->kind) {
+        case DSP_LPF1:
+        case DSP_LOWPASS:
+        case DSP_HIGHPASS:
+        case DSP_DC_BLOCK:
+          run_biquad(s, ch, blk, n);
+          break;
+        case DSP_FIR_LOWPASS:
+          run_fir(s, ch, blk, n);
+          break;
+        case DSP_GAIN:
+          scale_q12(blk, n * ch, s->gain);
+          break;
+        case DSP_LIMITER:
+          run_limiter(s, ch, blk, n);
+          break;
+      }
+    }
+  }
+}
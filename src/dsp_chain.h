@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+// Fixed-point DSP chain for the audio ingest path.
+//
+// Stages run in order over interleaved s16 frames, one chunk at a time,
+// and keep their state between chunks, so a stream can be filtered as it
+// is played instead of pre-processing the whole file. The chain is
+// described first (dsp_chain_add/dsp_chain_parse) and turned into
+// coefficients once the channel count and rate are known
+// (dsp_chain_prepare).
+//
+// FIR, gain and the limiter's peak scan and gain apply use NEON when
+// available. Biquads (which also implement the one-pole low-pass and the
+// DC blocker) are recursive, so they run sample by sample.
+
+#ifndef DSP_CHAIN_H
+#define DSP_CHAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_MAX_STAGES   8u
+#define DSP_FIR_MAX_TAPS 64u
+#define DSP_BLOCK_FRAMES 256u
+
+typedef enum {
+  DSP_LPF1 = 0,             // one-pole low-pass, the old --lpf
+  DSP_LOWPASS,              // biquad low-pass
+  DSP_HIGHPASS,             // biquad high-pass
+  DSP_DC_BLOCK,
+  DSP_FIR_LOWPASS,          // windowed-sinc FIR low-pass
+  DSP_GAIN,
+  DSP_LIMITER
+} dsp_kind_t;
+
+typedef struct {
+  dsp_kind_t kind;
+  double hz;                // corner frequency
+  double q;                 // biquad Q, FIR tap count
+  double db;                // gain, or limiter threshold in dBFS
+
+  // Filled in by dsp_chain_prepare().
+  int32_t b[3];             // biquad, Q28
+  int32_t a[2];
+  int32_t x1[2], x2[2];     // biquad inputs
+  int32_t y1[2], y2[2];     // biquad outputs, Q8
+  unsigned ntaps;           // FIR, padded to a multiple of 8
+  int16_t taps[DSP_FIR_MAX_TAPS];         // reversed, Q15
+  int16_t hist[2][DSP_FIR_MAX_TAPS];
+  int16_t gain;             // Q12
+  int32_t threshold;        // limiter, s16 units
+  int32_t lim_gain;         // Q12
+  int32_t release;          // Q16 per limiter block
+} dsp_stage_t;
+
+typedef struct {
+  unsigned count;
+  unsigned channels;
+  double rate_hz;
+  dsp_stage_t stage[DSP_MAX_STAGES];
+} dsp_chain_t;
+
+void dsp_chain_init(dsp_chain_t *c);
+
+// Appends a stage. Unused parameters are ignored. Returns -1 when full.
+int dsp_chain_add(dsp_chain_t *c, dsp_kind_t kind, double hz, double q, double db);
+
+// Appends stages from a comma-separated list:
+//   lpf:HZ  lp:HZ[:Q]  hp:HZ[:Q]  dc[:HZ]  fir:HZ[:TAPS]  gain:DB  limit:DBFS
+int dsp_chain_parse(dsp_chain_t *c, const char *spec);
+
+// Computes coefficients for channels (1 or 2) at rate_hz and clears state.
+int dsp_chain_prepare(dsp_chain_t *c, unsigned channels, double rate_hz);
+
+// Filters interleaved frames in place.
+void dsp_chain_process(dsp_chain_t *c, int16_t *buf, size_t frames);
+
+#endif /* DSP_CHAIN_H */
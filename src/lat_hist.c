@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+// Latency histogram with 1 us bins, for timing reports.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lat_hist.h"
+
+void lat_hist_init(lat_hist_t *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+void lat_hist_add(lat_hist_t *h, uint64_t ns) {
+  uint64_t us = ns / 1000u;
+  if (us < LAT_HIST_BINS) h->bins[us]++;
+  else h->over++;
+  h->count++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns) h->max_ns = ns;
+}
+
+uint64_t lat_hist_percentile_ns(const lat_hist_t *h, double p) {
+  if (h->count == 0) return 0;
+  uint64_t want = (uint64_t)(p * (double)h->count + 0.5);
+  if (want == 0) want = 1;
+  uint64_t seen = 0;
+  for (uint32_t us = 0; us < LAT_HIST_BINS; us++) {
+    seen += h->bins[us];
+    if (seen >= want) return (uint64_t)(us + 1u) * 1000u;
+  }
+  return h->max_ns;
+}
+
+void lat_hist_report(const lat_hist_t *h, const char *name, uint64_t target_ns,
+                     FILE *out) {
+  static const uint32_t edges_us[] = {50, 100, 250, 500, 1000, 2000, 5000, LAT_HIST_BINS};
+  fprintf(out, "[%s] n=%llu mean=%.1fus p50=%.0fus p90=%.0fus p99=%.0fus max=%.1fus\n",
+          name, (unsigned long long)h->count,
+          h->count ? (double)h->sum_ns / (double)h->count / 1000.0 : 0.0,
+          (double)lat_hist_percentile_ns(h, 0.50) / 1000.0,
+          (double)lat_hist_percentile_ns(h, 0.90) / 1000.0,
+          (double)lat_hist_percentile_ns(h, 0.99) / 1000.0,
+          (double)h->max_ns / 1000.0);
+  if (h->count == 0) return;
+  uint32_t lo = 0;
+  uint64_t under_target = 0;
+  for (size_t i = 0; i < sizeof(edges_us) / sizeof(edges_us[0]); i++) {
+    uint64_t n = 0;
+    for (uint32_t us = lo; us < edges_us[i]; us++) n += h->bins[us];
+    double pct = 100.0 * (double)n / (double)h->count;
+    fprintf(out, "  %5u-%5uus %8llu %5.1f%% ", lo, edges_us[i], (unsigned long long)n, pct);
+    for (int b = 0; b < (int)(pct / 2.0); b++) fputc('#', out);
+    fputc('\n', out);
+    lo = edges_us[i];
+  }
+  if (h->over) {
+    fprintf(out, "  >=%uus     %8llu\n", LAT_HIST_BINS, (unsigned long long)h->over);
+  }
+  for (uint32_t us = 0; us < LAT_HIST_BINS && (uint64_t)us * 1000u < target_ns; us++) {
+    under_target += h->bins[us];
+  }
+  fprintf(out, "  under %.1fms: %.2f%%\n", (double)target_ns / 1e6,
+          100.0 * (double)under_target / (double)h->count);
+}
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: MIT
+// Latency histogram with 1 us bins, for timing reports.
+
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LAT_HIST_BINS 10000u        // 1 us each, so 0-10 ms exact
+
+typedef struct {
+  uint32_t bins[LAT_HIST_BINS];
+  uint64_t over;            // samples of 10 ms or more
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+} lat_hist_t;
+
+void lat_hist_init(lat_hist_t *h);
+void lat_hist_add(lat_hist_t *h, uint64_t ns);
+
+// Latency below which fraction p (0-1) of the samples fall, in ns,
+// to 1 us resolution. Returns max_ns when it lies in the overflow.
+uint64_t lat_hist_percentile_ns(const lat_hist_t *h, double p);
+
+// Prints a one-line summary tagged with name, then a coarse
+// distribution with the share of samples under target_ns.
+void lat_hist_report(const lat_hist_t *h, const char *name, uint64_t target_ns,
+                     FILE *out);
+
+#endif /* LAT_HIST_H */
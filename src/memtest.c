@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: MIT
+// Chip RAM integrity test and bandwidth/latency map.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "memtest.h"
+
+// BLTCON0 as documented in the Hardware Reference Manual: USEA..USED in
+// bits 11..8, minterm in bits 7..0 with A=0xF0, B=0xCC, C=0xAA.
+#define MT_BLT_USEA      0x0800u
+#define MT_BLT_USED      0x0100u
+#define MT_MINTERM_A     0xF0u
+#define MT_BLT_WORDS     64u                       // BLTSIZE width 0 = 64 words
+#define MT_ROW_BYTES     (MT_BLT_WORDS * 2u)
+#define MT_TILE_BYTES    0x1000u
+#define MT_BENCH_BYTES   0x4000u
+#define MT_BLIT_SPINS    1000000u
+#define MT_QUIET_DMA     (DMAF_RASTER | DMAF_SPRITE | DMAF_COPPER)
+#define MT_STATE_VERSION 1
+
+static const char *const pass_names[MEMTEST_PASSES] = {
+  "walking_ones", "address", "random"
+};
+
+static const char *const dma_names[MEMTEST_DMA_MODES] = {
+  "normal", "quiet"
+};
+
+const char *memtest_pass_name(memtest_pass_t pass) {
+  return pass < MEMTEST_PASSES ? pass_names[pass] : "?";
+}
+
+static uint32_t xorshift32(uint32_t *s) {
+  uint32_t x = *s;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *s = x;
+  return x;
+}
+
+// DMAF_BLTDONE is DMACONR bit 14 (BBUSY). The first read after starting a
+// blit can still show idle on old Agnus, so always read it twice.
+static int blit_wait(void) {
+  (void)ps_read_16(DMACONR);
+  for (unsigned i = 0; i < MT_BLIT_SPINS; i++) {
+    if (!(ps_read_16(DMACONR) & DMAF_BLTDONE)) return 0;
+  }
+  fprintf(stderr, "memtest: blitter still busy, giving up\n");
+  return -1;
+}
+
+static void blit_set_ptr(uint32_t hi_reg, uint32_t addr) {
+  ps_write_16(hi_reg, (addr >> 16) & 0x1Fu);
+  ps_write_16(hi_reg + 2u, addr & 0xFFFEu);
+}
+
+// Fills rows * 128 bytes at addr with value. A is disabled, so BLTADAT is
+// used as a constant source.
+static int blit_fill(uint32_t addr, unsigned rows, uint16_t value) {
+  if (blit_wait() != 0) return -1;
+  ps_write_16(BLTCON0, MT_BLT_USED | MT_MINTERM_A);
+  ps_write_16(BLTCON1, 0);
+  ps_write_16(BLTAFWM, 0xFFFFu);
+  ps_write_16(BLTALWM, 0xFFFFu);
+  ps_write_16(BLTADAT, value);
+  ps_write_16(BLTDMOD, 0);
+  blit_set_ptr(BLTDPTH, addr);
+  ps_write_16(BLTSIZE, (uint16_t)((rows & 0x3FFu) << 6));
+  return blit_wait();
+}
+
+static int blit_copy(uint32_t src, uint32_t dst, unsigned rows) {
+  if (blit_wait() != 0) return -1;
+  ps_write_16(BLTCON0, MT_BLT_USEA | MT_BLT_USED | MT_MINTERM_A);
+  ps_write_16(BLTCON1, 0);
+  ps_write_16(BLTAFWM, 0xFFFFu);
+  ps_write_16(BLTALWM, 0xFFFFu);
+  ps_write_16(BLTAMOD, 0);
+  ps_write_16(BLTDMOD, 0);
+  blit_set_ptr(BLTAPTH, src);
+  blit_set_ptr(BLTDPTH, dst);
+  ps_write_16(BLTSIZE, (uint16_t)((rows & 0x3FFu) << 6));
+  return blit_wait();
+}
+
+// Reads the region back and counts words that differ from expect.
+static uint32_t verify(memtest_region_t *r, uint8_t *scratch,
+                       const uint8_t *expect) {
+  read_chip_ram(r->addr, scratch, MEMTEST_REGION_BYTES);
+  uint32_t bad = 0;
+  if (!memcmp(scratch, expect, MEMTEST_REGION_BYTES)) return 0;
+  for (uint32_t i = 0; i < MEMTEST_REGION_BYTES; i += 2u) {
+    if (scratch[i] == expect[i] && scratch[i + 1u] == expect[i + 1u]) continue;
+    int first = r->errors[0] + r->errors[1] + r->errors[2] + bad == 0;
+    if (first) {
+      r->bad_addr = r->addr + i;
+      r->bad_expected = (uint16_t)((expect[i] << 8) | expect[i + 1u]);
+      r->bad_got = (uint16_t)((scratch[i] << 8) | scratch[i + 1u]);
+    }
+    bad++;
+  }
+  return bad;
+}
+
+static int pass_walking(memtest_region_t *r, uint8_t *scratch, uint8_t *expect) {
+  for (unsigned bit = 0; bit < 16u; bit++) {
+    uint16_t v = (uint16_t)(1u << bit);
+    for (uint32_t i = 0; i < MEMTEST_REGION_BYTES; i += 2u) {
+      expect[i] = (uint8_t)(v >> 8);
+      expect[i + 1u] = (uint8_t)v;
+    }
+    if (blit_fill(r->addr, MEMTEST_REGION_BYTES / MT_ROW_BYTES, v) != 0) return -1;
+    r->errors[MEMTEST_WALKING] += verify(r, scratch, expect);
+  }
+  return 0;
+}
+
+static int pass_address(memtest_region_t *r, uint8_t *scratch, uint8_t *expect) {
+  for (uint32_t i = 0; i < MEMTEST_REGION_BYTES; i += 4u) {
+    uint32_t a = r->addr + i;
+    expect[i] = (uint8_t)(a >> 24);
+    expect[i + 1u] = (uint8_t)(a >> 16);
+    expect[i + 2u] = (uint8_t)(a >> 8);
+    expect[i + 3u] = (uint8_t)a;
+  }
+  write_chip_ram_burst(r->addr, expect, MEMTEST_REGION_BYTES);
+  r->errors[MEMTEST_ADDRESS] += verify(r, scratch, expect);
+  return 0;
+}
+
+static int pass_random(memtest_region_t *r, uint8_t *scratch, uint8_t *expect,
+                       uint32_t seed) {
+  uint32_t s = (seed ^ r->addr) | 1u;
+  for (uint32_t i = 0; i < MT_TILE_BYTES; i += 4u) {
+    uint32_t v = xorshift32(&s);
+    memcpy(expect + i, &v, 4);
+  }
+  for (uint32_t off = MT_TILE_BYTES; off < MEMTEST_REGION_BYTES; off += MT_TILE_BYTES) {
+    memcpy(expect + off, expect, MT_TILE_BYTES);
+  }
+  write_chip_ram_burst(r->addr, expect, MT_TILE_BYTES);
+  for (uint32_t off = MT_TILE_BYTES; off < MEMTEST_REGION_BYTES; off += MT_TILE_BYTES) {
+    if (blit_copy(r->addr, r->addr + off, MT_TILE_BYTES / MT_ROW_BYTES) != 0) return -1;
+  }
+  r->errors[MEMTEST_RANDOM] += verify(r, scratch, expect);
+  return 0;
+}
+
+static void measure(memtest_region_t *r, memtest_dma_t mode, uint8_t *scratch,
+                    uint32_t seed) {
+  memtest_bw_t *bw = &r->bw[mode];
+  uint64_t t0 = pi_now_ns();
+  read_chip_ram(r->addr, scratch, MT_BENCH_BYTES);
+  uint64_t t1 = pi_now_ns();
+  write_chip_ram_burst(r->addr, scratch, MT_BENCH_BYTES);
+  uint64_t t2 = pi_now_ns();
+  double kb = (double)MT_BENCH_BYTES / 1024.0;
+  bw->read_kbs = t1 > t0 ? kb / ((double)(t1 - t0) / 1e9) : 0.0;
+  bw->write_kbs = t2 > t1 ? kb / ((double)(t2 - t1) / 1e9) : 0.0;
+
+  uint32_t s = (seed ^ r->addr ^ 0x9E3779B9u) | 1u;
+  uint64_t sum = 0;
+  bw->lat_min_ns = UINT32_MAX;
+  bw->lat_max_ns = 0;
+  for (unsigned i = 0; i < MEMTEST_LAT_SAMPLES; i++) {
+    uint32_t a = r->addr + (xorshift32(&s) & (MEMTEST_REGION_BYTES - 2u));
+    uint64_t a0 = pi_now_ns();
+    (void)ps_read_16(a);
+    uint32_t dt = (uint32_t)(pi_now_ns() - a0);
+    sum += dt;
+    if (dt < bw->lat_min_ns) bw->lat_min_ns = dt;
+    if (dt > bw->lat_max_ns) bw->lat_max_ns = dt;
+  }
+  bw->lat_avg_ns = (uint32_t)(sum / MEMTEST_LAT_SAMPLES);
+}
+
+// Bitplane, sprite and copper DMA are switched off and Amiga interrupts
+// are held off from the save to the restore. The display and the copper
+// list may live in the region, and with the level 3 and 6 handlers held
+// off the OS does not write it behind our back; what we restore is then
+// still current. The normal-DMA bandwidth is measured after the restore,
+// so the region holds its own contents again when DMA comes back.
+static int test_region(memtest_t *m, memtest_region_t *r, uint8_t *saved,
+                       uint8_t *scratch, uint8_t *expect) {
+  memset(r->errors, 0, sizeof(r->errors));
+  r->bad_addr = 0;
+  r->bad_expected = 0;
+  r->bad_got = 0;
+
+  uint16_t intena = (uint16_t)(ps_read_16(INTENAR) & INTF_INTEN);
+  if (intena) ps_write_16(INTENA, INTF_INTEN);
+  uint16_t quiet = (uint16_t)(ps_read_16(DMACONR) & MT_QUIET_DMA);
+  if (quiet) ps_write_16(DMACON, quiet);
+
+  read_chip_ram(r->addr, saved, MEMTEST_REGION_BYTES);
+  int rc = pass_walking(r, scratch, expect);
+  if (rc == 0) rc = pass_address(r, scratch, expect);
+  if (rc == 0) rc = pass_random(r, scratch, expect, m->seed);
+  if (rc == 0) measure(r, MEMTEST_DMA_QUIET, scratch, m->seed);
+
+  write_chip_ram_burst(r->addr, saved, MEMTEST_REGION_BYTES);
+  read_chip_ram(r->addr, scratch, MEMTEST_REGION_BYTES);
+  r->restored = !memcmp(saved, scratch, MEMTEST_REGION_BYTES);
+
+  if (quiet) ps_write_16(DMACON, DMAF_SETCLR | quiet);
+  if (rc == 0) measure(r, MEMTEST_DMA_NORMAL, scratch, m->seed);
+  if (intena) ps_write_16(INTENA, INTF_SETCLR | INTF_INTEN);
+  r->tested = rc == 0;
+  return rc;
+}
+
+int memtest_init(memtest_t *m, uint32_t start, uint32_t len,
+                 uint32_t chip_bytes, uint32_t seed) {
+  memset(m, 0, sizeof(*m));
+  start &= ~(MEMTEST_REGION_BYTES - 1u);
+  uint32_t end = len ? start + len : chip_bytes;
+  if (end > chip_bytes) end = chip_bytes;
+  if (end > MEMTEST_MAX_REGIONS * MEMTEST_REGION_BYTES) {
+    end = MEMTEST_MAX_REGIONS * MEMTEST_REGION_BYTES;
+  }
+  if (end <= start) return -1;
+  m->start = start;
+  m->seed = seed;
+  for (uint32_t a = start; a < end; a += MEMTEST_REGION_BYTES) {
+    m->regions[m->count++].addr = a;
+  }
+  m->len = m->count * MEMTEST_REGION_BYTES;
+  return 0;
+}
+
+unsigned memtest_remaining(const memtest_t *m) {
+  unsigned n = 0;
+  for (unsigned i = 0; i < m->count; i++) {
+    if (!m->regions[i].tested) n++;
+  }
+  return n;
+}
+
+int memtest_run(memtest_t *m, unsigned max_regions, FILE *log) {
+  uint8_t *saved = (uint8_t *)malloc(MEMTEST_REGION_BYTES);
+  uint8_t *scratch = (uint8_t *)malloc(MEMTEST_REGION_BYTES);
+  uint8_t *expect = (uint8_t *)malloc(MEMTEST_REGION_BYTES);
+  if (!saved || !scratch || !expect) {
+    fprintf(stderr, "memtest: out of memory\n");
+    free(saved);
+    free(scratch);
+    free(expect);
+    return -1;
+  }
+
+  // The blitter needs master and blitter DMA; put DMACON back afterwards.
+  uint16_t dmacon = (uint16_t)ps_read_16(DMACONR);
+  uint16_t need = (uint16_t)((DMAF_MASTER | DMAF_BLITTER) & ~dmacon);
+  if (need) ps_write_16(DMACON, DMAF_SETCLR | need);
+
+  int done = 0;
+  for (unsigned i = 0; i < m->count; i++) {
+    memtest_region_t *r = &m->regions[i];
+    if (r->tested) continue;
+    if (max_regions && (unsigned)done >= max_regions) break;
+    if (test_region(m, r, saved, scratch, expect) != 0) {
+      done = -1;
+      break;
+    }
+    done++;
+    if (log) {
+      uint32_t errs = r->errors[0] + r->errors[1] + r->errors[2];
+      fprintf(log, "[MEMTEST] 0x%06X walk=%u addr=%u rand=%u "
+                   "read=%.0f/%.0fKB/s write=%.0f/%.0fKB/s lat=%u/%uns %s%s\n",
+              r->addr, r->errors[MEMTEST_WALKING], r->errors[MEMTEST_ADDRESS],
+              r->errors[MEMTEST_RANDOM],
+              r->bw[MEMTEST_DMA_NORMAL].read_kbs, r->bw[MEMTEST_DMA_QUIET].read_kbs,
+              r->bw[MEMTEST_DMA_NORMAL].write_kbs, r->bw[MEMTEST_DMA_QUIET].write_kbs,
+              r->bw[MEMTEST_DMA_NORMAL].lat_avg_ns, r->bw[MEMTEST_DMA_QUIET].lat_avg_ns,
+              errs ? "FAIL" : "PASS", r->restored ? "" : " (restore mismatch)");
+    }
+  }
+
+  if (need) ps_write_16(DMACON, need);
+  free(saved);
+  free(scratch);
+  free(expect);
+  return done;
+}
+
+void memtest_load(memtest_t *m, const char *state_path) {
+  FILE *f = fopen(state_path, "r");
+  if (!f) return;
+  int ver = 0;
+  unsigned start = 0;
+  unsigned len = 0;
+  unsigned seed = 0;
+  if (fscanf(f, "v%d start=%x len=%x seed=%u\n", &ver, &start, &len, &seed) != 4 ||
+      ver != MT_STATE_VERSION || start != m->start || len != m->len) {
+    fclose(f);
+    return;
+  }
+  m->seed = seed;
+
+  memtest_region_t r;
+  for (;;) {
+    memset(&r, 0, sizeof(r));
+    unsigned addr = 0;
+    unsigned bad = 0;
+    unsigned exp = 0;
+    unsigned got = 0;
+    int n = fscanf(f, " r %x %d %u %u %u %x %x %x", &addr, &r.restored,
+                   &r.errors[0], &r.errors[1], &r.errors[2], &bad, &exp, &got);
+    if (n != 8) break;
+    for (int d = 0; d < MEMTEST_DMA_MODES; d++) {
+      memtest_bw_t *bw = &r.bw[d];
+      if (fscanf(f, " %lf %lf %u %u %u", &bw->read_kbs, &bw->write_kbs,
+                 &bw->lat_min_ns, &bw->lat_avg_ns, &bw->lat_max_ns) != 5) {
+        n = 0;
+      }
+    }
+    if (n != 8) break;
+    r.bad_addr = bad;
+    r.bad_expected = (uint16_t)exp;
+    r.bad_got = (uint16_t)got;
+    for (unsigned i = 0; i < m->count; i++) {
+      if (m->regions[i].addr == addr) {
+        r.addr = addr;
+        r.tested = 1;
+        m->regions[i] = r;
+      }
+    }
+  }
+  fclose(f);
+}
+
+// Writes to a temporary file and renames it, so an interrupted run never
+// leaves a truncated file behind.
+static FILE *open_atomic(const char *path, char *tmp, size_t tmp_len) {
+  snprintf(tmp, tmp_len, "%s.%ld", path, (long)getpid());
+  FILE *f = fopen(tmp, "w");
+  if (!f) fprintf(stderr, "memtest: cannot write %s\n", tmp);
+  return f;
+}
+
+static int close_atomic(FILE *f, const char *tmp, const char *path) {
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    fprintf(stderr, "memtest: cannot write %s\n", path);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int memtest_save(const memtest_t *m, const char *state_path) {
+  char tmp[512];
+  FILE *f = open_atomic(state_path, tmp, sizeof(tmp));
+  if (!f) return -1;
+  fprintf(f, "v%d start=%06X len=%06X seed=%u\n", MT_STATE_VERSION,
+          m->start, m->len, m->seed);
+  for (unsigned i = 0; i < m->count; i++) {
+    const memtest_region_t *r = &m->regions[i];
+    if (!r->tested) continue;
+    fprintf(f, "r %06X %d %u %u %u %06X %04X %04X", r->addr, r->restored,
+            r->errors[0], r->errors[1], r->errors[2],
+            r->bad_addr, r->bad_expected, r->bad_got);
+    for (int d = 0; d < MEMTEST_DMA_MODES; d++) {
+      const memtest_bw_t *bw = &r->bw[d];
+      fprintf(f, " %.1f %.1f %u %u %u", bw->read_kbs, bw->write_kbs,
+              bw->lat_min_ns, bw->lat_avg_ns, bw->lat_max_ns);
+    }
+    fprintf(f, "\n");
+  }
+  return close_atomic(f, tmp, state_path);
+}
+
+int memtest_write_json(const memtest_t *m, const char *path,
+                       const char *model, uint32_t chip_bytes) {
+  char tmp[512];
+  FILE *f = open_atomic(path, tmp, sizeof(tmp));
+  if (!f) return -1;
+
+  unsigned failed = 0;
+  for (unsigned i = 0; i < m->count; i++) {
+    const memtest_region_t *r = &m->regions[i];
+    if (r->tested && (r->errors[0] | r->errors[1] | r->errors[2])) failed++;
+  }
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"model\": \"%s\",\n", model);
+  fprintf(f, "  \"chip_ram_bytes\": %u,\n", chip_bytes);
+  fprintf(f, "  \"start\": \"0x%06X\",\n", m->start);
+  fprintf(f, "  \"length\": %u,\n", m->len);
+  fprintf(f, "  \"region_bytes\": %u,\n", MEMTEST_REGION_BYTES);
+  fprintf(f, "  \"seed\": %u,\n", m->seed);
+  fprintf(f, "  \"complete\": %s,\n", memtest_remaining(m) ? "false" : "true");
+  fprintf(f, "  \"failed_regions\": %u,\n", failed);
+  fprintf(f, "  \"regions\": [");
+  int first = 1;
+  for (unsigned i = 0; i < m->count; i++) {
+    const memtest_region_t *r = &m->regions[i];
+    if (!r->tested) continue;
+    uint32_t errs = r->errors[0] + r->errors[1] + r->errors[2];
+    fprintf(f, "%s\n    {\n", first ? "" : ",");
+    first = 0;
+    fprintf(f, "      \"addr\": \"0x%06X\",\n", r->addr);
+    fprintf(f, "      \"status\": \"%s\",\n", errs ? "fail" : "pass");
+    fprintf(f, "      \"restored\": %s,\n", r->restored ? "true" : "false");
+    fprintf(f, "      \"errors\": {");
+    for (int p = 0; p < MEMTEST_PASSES; p++) {
+      fprintf(f, "%s\"%s\": %u", p ? ", " : "", pass_names[p], r->errors[p]);
+    }
+    fprintf(f, "},\n");
+    if (errs) {
+      fprintf(f, "      \"first_error\": {\"addr\": \"0x%06X\", \"expected\": \"0x%04X\", "
+                 "\"got\": \"0x%04X\"},\n",
+              r->bad_addr, r->bad_expected, r->bad_got);
+    }
+    fprintf(f, "      \"bandwidth\": {");
+    for (int d = 0; d < MEMTEST_DMA_MODES; d++) {
+      const memtest_bw_t *bw = &r->bw[d];
+      fprintf(f, "%s\n        \"%s\": {\"read_kbs\": %.1f, \"write_kbs\": %.1f, "
+                 "\"latency_ns\": {\"min\": %u, \"avg\": %u, \"max\": %u}}",
+              d ? "," : "", dma_names[d], bw->read_kbs, bw->write_kbs,
+              bw->lat_min_ns, bw->lat_avg_ns, bw->lat_max_ns);
+    }
+    fprintf(f, "\n      }\n    }");
+  }
+  fprintf(f, "%s]\n}\n", first ? "" : "\n  ");
+  return close_atomic(f, tmp, path);
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+// Chip RAM integrity test and bandwidth/latency map.
+//
+// Each 64 KB region is saved to the Pi, tested, and restored, so a test can
+// run one region at a time between other jobs. Patterns are filled by the
+// blitter (walking ones, replicated random tiles) or written with burst
+// writes (address-in-address) and verified with block reads. Progress is
+// kept in a state file so later runs continue where the last one stopped.
+
+#ifndef MEMTEST_H
+#define MEMTEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MEMTEST_REGION_BYTES  0x10000u
+#define MEMTEST_MAX_REGIONS   32u          // 2 MB of chip RAM
+#define MEMTEST_LAT_SAMPLES   256u
+
+typedef enum {
+  MEMTEST_WALKING = 0,  // 1 << bit in every word, blitter fill
+  MEMTEST_ADDRESS,      // each longword holds its own address, burst write
+  MEMTEST_RANDOM,       // random 4 KB tile replicated by the blitter
+  MEMTEST_PASSES
+} memtest_pass_t;
+
+typedef enum {
+  MEMTEST_DMA_NORMAL = 0,   // DMACON as found
+  MEMTEST_DMA_QUIET,        // bitplane, sprite and copper DMA off
+  MEMTEST_DMA_MODES
+} memtest_dma_t;
+
+typedef struct {
+  double read_kbs;
+  double write_kbs;
+  uint32_t lat_min_ns;      // single ps_read_16, includes clock_gettime cost
+  uint32_t lat_avg_ns;
+  uint32_t lat_max_ns;
+} memtest_bw_t;
+
+typedef struct {
+  uint32_t addr;
+  int tested;
+  int restored;             // saved contents read back intact
+  uint32_t errors[MEMTEST_PASSES];   // mismatching words per pass
+  uint32_t bad_addr;        // first mismatch, valid if any errors
+  uint16_t bad_expected;
+  uint16_t bad_got;
+  memtest_bw_t bw[MEMTEST_DMA_MODES];
+} memtest_region_t;
+
+typedef struct {
+  uint32_t start;
+  uint32_t len;
+  uint32_t seed;
+  unsigned count;
+  memtest_region_t regions[MEMTEST_MAX_REGIONS];
+} memtest_t;
+
+// Splits [start, start + len) into 64 KB regions. start is rounded down and
+// the range is clipped to chip_bytes. Returns -1 if nothing is left.
+int memtest_init(memtest_t *m, uint32_t start, uint32_t len,
+                 uint32_t chip_bytes, uint32_t seed);
+
+// Loads results from an earlier run over the same range. Missing or
+// mismatching state is not an error; the run simply starts over.
+void memtest_load(memtest_t *m, const char *state_path);
+int memtest_save(const memtest_t *m, const char *state_path);
+
+// Tests up to max_regions untested regions (0 = all). Returns the number
+// tested, or -1 if the blitter never finished.
+int memtest_run(memtest_t *m, unsigned max_regions, FILE *log);
+
+int memtest_write_json(const memtest_t *m, const char *path,
+                       const char *model, uint32_t chip_bytes);
+
+unsigned memtest_remaining(const memtest_t *m);
+const char *memtest_pass_name(memtest_pass_t pass);
+
+#endif /* MEMTEST_H */
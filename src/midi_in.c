@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MIT
+// Raw MIDI byte input from an ALSA rawmidi device or a FIFO.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "midi_in.h"
+
+int midi_in_open(midi_in_t *m, const char *path) {
+  memset(m, 0, sizeof(*m));
+  struct stat st;
+  int flags = O_RDONLY;
+  if (stat(path, &st) == 0 && S_ISFIFO(st.st_mode)) flags = O_RDWR;
+  m->fd = open(path, flags | O_NONBLOCK);
+  if (m->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+void midi_in_close(midi_in_t *m) {
+  if (m->fd >= 0) close(m->fd);
+  m->fd = -1;
+}
+
+int midi_in_parse(midi_in_t *m, uint8_t b, midi_msg_t *msg) {
+  if (b >= 0xF8u) return 0;                 // real-time: clock, start, ...
+  if (b >= 0xF0u) {
+    m->in_sysex = b == 0xF0u;
+    m->status = 0;
+    return 0;
+  }
+  if (b & 0x80u) {
+    m->in_sysex = 0;
+    m->status = b;
+    m->have = 0;
+    uint8_t type = b & 0xF0u;
+    m->need = (type == MIDI_PROGRAM || type == 0xD0u) ? 1u : 2u;
+    return 0;
+  }
+  if (m->in_sysex || m->status == 0) return 0;
+  m->data[m->have++] = b;
+  if (m->have < m->need) return 0;
+  m->have = 0;
+  msg->type = m->status & 0xF0u;
+  msg->channel = m->status & 0x0Fu;
+  msg->d1 = m->data[0];
+  msg->d2 = m->need > 1 ? m->data[1] : 0;
+  return 1;
+}
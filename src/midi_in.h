@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+// Raw MIDI byte input from an ALSA rawmidi device or a FIFO.
+//
+// ALSA exposes rawmidi ports as character devices (/dev/snd/midiC1D0),
+// so plain read() works and no library is needed. A FIFO is opened
+// read-write so it never reports end of file when a test writer closes.
+
+#ifndef MIDI_IN_H
+#define MIDI_IN_H
+
+#include <stdint.h>
+
+#define MIDI_NOTE_OFF    0x80u
+#define MIDI_NOTE_ON     0x90u
+#define MIDI_CONTROL     0xB0u
+#define MIDI_PROGRAM     0xC0u
+#define MIDI_PITCH_BEND  0xE0u
+
+typedef struct {
+  uint8_t type;             // status & 0xF0
+  uint8_t channel;          // 0-15
+  uint8_t d1;
+  uint8_t d2;
+} midi_msg_t;
+
+typedef struct {
+  int fd;
+  uint8_t status;           // running status, 0 = none
+  uint8_t data[2];
+  unsigned need;
+  unsigned have;
+  int in_sysex;
+} midi_in_t;
+
+// Opens path non-blocking. Returns -1 on error.
+int midi_in_open(midi_in_t *m, const char *path);
+void midi_in_close(midi_in_t *m);
+
+// Feeds one byte to the parser. Returns 1 and fills msg when a channel
+// message is complete. Real-time bytes, system common and SysEx are
+// skipped; running status is honoured.
+int midi_in_parse(midi_in_t *m, uint8_t b, midi_msg_t *msg);
+
+#endif /* MIDI_IN_H */
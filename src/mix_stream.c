@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: MIT
+// Paula streams for the Pi-mixed MOD channels.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "paula_stream.h"
+#include "mix_stream.h"
+
+static size_t slot_bytes_for(double rate_hz) {
+  if (rate_hz <= 0.0) rate_hz = 3579545.0 / PAULA_MIN_PERIOD;
+  size_t n = (size_t)(rate_hz * (double)MIX_STREAM_SLOT_NS / 1e9);
+  return (n + 1u) & ~(size_t)1u;
+}
+
+size_t mix_stream_chip_bytes(double rate_hz) {
+  return MIX_SIDES * MIX_STREAM_SLOTS * slot_bytes_for(rate_hz);
+}
+
+static uint32_t slot_addr(const mix_stream_t *s, unsigned side, uint64_t block) {
+  unsigned slot = (unsigned)(block % MIX_STREAM_SLOTS);
+  return s->base + (uint32_t)((side * MIX_STREAM_SLOTS + slot) * s->slot_bytes);
+}
+
+static void set_location(unsigned voice, uint32_t addr, size_t len_bytes) {
+  uint32_t reg = AUD0LCH + voice * AUD_STRIDE;
+  ps_write_16(reg, (addr >> 16) & 0x1Fu);
+  ps_write_16(reg + 2u, addr & 0xFFFEu);
+  ps_write_16(reg + 4u, (uint16_t)(len_bytes / 2u));
+}
+
+uint64_t mix_stream_need(const mix_stream_t *s) {
+  return (s->rendered + MIX_STREAM_SLOTS) * s->slot_bytes;
+}
+
+// Mixes block s->rendered and writes it to its slot.
+static void render_block(mix_stream_t *s, mod_mixer_t *m) {
+  mod_mixer_render(m, s->buf, s->slot_bytes);
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    write_chip_ram(slot_addr(s, side, s->rendered), (const uint8_t *)s->buf[side],
+                   s->slot_bytes);
+  }
+  s->rendered++;
+}
+
+int mix_stream_init(mix_stream_t *s, uint32_t base, const mod_mixer_t *m) {
+  memset(s, 0, sizeof(*s));
+  s->base = base & ~1u;
+  s->period = m->plan.period;
+  s->rate_hz = m->plan.rate_hz;
+  s->slot_bytes = slot_bytes_for(s->rate_hz);
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    s->voice[side] = m->plan.stream[side];
+    s->buf[side] = (int8_t *)malloc(s->slot_bytes);
+    if (!s->buf[side]) {
+      fprintf(stderr, "mix: out of memory\n");
+      free(s->buf[0]);
+      s->buf[0] = NULL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void mix_stream_prime(mix_stream_t *s, mod_mixer_t *m) {
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    s->dma_mask |= (uint16_t)(DMAF_AUD0 << s->voice[side]);
+    s->int_mask |= (uint16_t)(INTF_AUD0 << s->voice[side]);
+  }
+  ps_write_16(DMACON, s->dma_mask);
+  while (s->rendered < MIX_STREAM_SLOTS) render_block(s, m);
+  ps_write_16(INTREQ, s->int_mask);
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    uint32_t reg = AUD0LCH + s->voice[side] * AUD_STRIDE;
+    set_location(s->voice[side], slot_addr(s, side, 0), s->slot_bytes);
+    ps_write_16(reg + 6u, s->period);
+    ps_write_16(reg + 8u, 64);
+  }
+}
+
+void mix_stream_go(mix_stream_t *s) {
+  ps_write_16(DMACON, DMAF_SETCLR | DMAF_MASTER | s->dma_mask);
+  s->go_ns = pi_now_ns();
+}
+
+int mix_stream_service(mix_stream_t *s, mod_mixer_t *m) {
+  if (!(ps_read_16(INTREQR) & (INTF_AUD0 << s->voice[0]))) return 0;
+  ps_write_16(INTREQ, s->int_mask);
+  uint64_t now = pi_now_ns();
+  // Both voices run at one period from the same DMACON write, so the
+  // left voice's interrupt stands for both.
+  uint64_t block_ns = (uint64_t)((double)s->slot_bytes * 1e9 / s->rate_hz);
+  uint64_t due = s->go_ns + s->latched * block_ns;
+  uint64_t late = now > due ? now - due : 0;
+  if (late > s->max_late_ns) s->max_late_ns = late;
+  if (late > block_ns) s->underruns++;
+  uint64_t block = s->latched++;
+
+  // The next block goes into the registers Paula just copied; the slot
+  // it replays from was freed by the block before.
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    set_location(s->voice[side], slot_addr(s, side, block + 1u), s->slot_bytes);
+  }
+  if (s->rendered == block + 1u) render_block(s, m);
+  return 1;
+}
+
+void mix_stream_stop(mix_stream_t *s) {
+  if (s->dma_mask) {
+    ps_write_16(DMACON, s->dma_mask);
+    for (unsigned side = 0; side < MIX_SIDES; side++) {
+      ps_write_16(AUD0LCH + s->voice[side] * AUD_STRIDE + 8u, 0);
+    }
+    ps_write_16(INTREQ, s->int_mask);
+    s->dma_mask = 0;
+  }
+  for (unsigned side = 0; side < MIX_SIDES; side++) {
+    free(s->buf[side]);
+    s->buf[side] = NULL;
+  }
+}
+
+void mix_stream_report(const mix_stream_t *s, const mod_mixer_t *m, FILE *out) {
+  double audio_ns = m->plan.rate_hz > 0.0 ? (double)m->rendered * 1e9 / m->plan.rate_hz : 0.0;
+  fprintf(out, "[MIX] blocks=%llu (%zuB) underruns=%llu late max=%.1fms mixing=%.2f%% CPU\n",
+          (unsigned long long)s->latched, s->slot_bytes, (unsigned long long)s->underruns,
+          (double)s->max_late_ns / 1e6,
+          audio_ns > 0.0 ? 100.0 * (double)m->render_ns / audio_ns : 0.0);
+}
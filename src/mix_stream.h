@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+// Paula streams for the Pi-mixed MOD channels.
+//
+// Each side's mix plays on one Paula voice from two chip RAM slots, the
+// same block-latch scheme as paula_stream but driven from the MOD tick
+// loop instead of owning it: the player calls mix_stream_service() once
+// per tick, which checks INTREQR without waiting. When Paula has latched
+// a slot, the other slot's location is queued and the slot that just
+// finished is rendered from the mixer and uploaded. A slot lasts several
+// ticks, so one check per tick is enough.
+
+#ifndef MIX_STREAM_H
+#define MIX_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mod_mixer.h"
+
+#define MIX_STREAM_SLOTS    2u
+#define MIX_STREAM_SLOT_NS  160000000ull   // per slot; sets the mixer's lead
+
+typedef struct {
+  uint32_t base;
+  size_t slot_bytes;
+  uint8_t voice[MIX_SIDES];
+  uint16_t period;
+  double rate_hz;
+  uint16_t dma_mask;
+  uint16_t int_mask;
+  int8_t *buf[MIX_SIDES];
+  uint64_t latched;         // blocks Paula has started
+  uint64_t rendered;        // blocks rendered and uploaded
+  uint64_t go_ns;           // host time DMA started
+  uint64_t underruns;       // latches seen after the next block was due
+  uint64_t max_late_ns;
+} mix_stream_t;
+
+// Chip RAM used by the slots of both sides at the given rate;
+// mix_stream_chip_bytes(0) is enough for any rate.
+size_t mix_stream_chip_bytes(double rate_hz);
+
+// Sizes the slots for the mixer's rate and allocates the Pi-side
+// buffers. Returns -1 if they cannot be allocated.
+int mix_stream_init(mix_stream_t *s, uint32_t base, const mod_mixer_t *m);
+
+// Mixer output samples that must be covered before the next prime or
+// service, with a block to spare.
+uint64_t mix_stream_need(const mix_stream_t *s);
+
+// Renders and uploads the first blocks and sets up the stream voices
+// with DMA still off.
+void mix_stream_prime(mix_stream_t *s, mod_mixer_t *m);
+
+// Starts DMA on both stream voices; call right after the first tick.
+void mix_stream_go(mix_stream_t *s);
+
+// Non-blocking: queues and refills a slot if Paula has latched one.
+// Returns 1 if it did.
+int mix_stream_service(mix_stream_t *s, mod_mixer_t *m);
+
+// Switches the stream voices off and frees the buffers.
+void mix_stream_stop(mix_stream_t *s);
+void mix_stream_report(const mix_stream_t *s, const mod_mixer_t *m, FILE *out);
+
+#endif /* MIX_STREAM_H */
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MIT
+// Pi-side mixing of the MOD channels Paula has no voice for.
+//
+// A 6- or 8-channel module still plays on Paula's four voices. Channels
+// are panned the Amiga way, LRRL per group of four, so each side has two
+// voices: one plays that side's busiest channel from sample DMA as usual,
+// the other plays a stream that the Pi mixes from the side's remaining
+// channels. mod_mix_plan() makes that choice from a silent run of the song
+// and picks the stream rate from the bus and CPU time it may use.
+//
+// The mixer emulates the Paula voices it replaces: a voice started by a
+// frame plays its block and then whatever block its location registers
+// hold, at clock / period with no interpolation, the way DMA would. Frames
+// take effect at the output sample of their song time. It reads sample
+// data from the module in Pi memory and does no bus I/O. Mixed channels
+// keep the level a Paula voice would give them, so where they peak
+// together the 8-bit sum saturates.
+
+#ifndef MOD_MIXER_H
+#define MOD_MIXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mod_replay.h"
+
+#define MIX_SIDES         2u
+#define MIX_CHUNK         256u                 // output samples per pass
+#define MIX_QUEUE         256u                 // frames waiting for their sample
+#define MIX_MIN_RATE_HZ   8000.0
+#define MIX_CPU_SHARE     0.25                 // of one core
+#define MIX_SCAN_NS       (10ull * 60ull * 1000000000ull)   // first 10 min
+
+typedef struct {
+  unsigned channels;
+  int8_t paula[MOD_MAX_CHANNELS];   // Paula voice of a native channel, -1 if mixed
+  uint8_t side[MOD_MAX_CHANNELS];   // 0 left, 1 right
+  uint8_t stream[MIX_SIDES];        // Paula voice that plays each side's mix
+  unsigned mixed;                   // channels mixed on the Pi
+  uint8_t native_voices;            // Paula voices driven by sample DMA
+  double load[MOD_MAX_CHANNELS];    // average samples/s the channel plays
+  double clock_hz;
+  uint16_t period;                  // of the mix streams
+  double rate_hz;                   // clock_hz / period
+  double mix_ns;                    // measured cost of one voice sample
+} mod_mix_plan_t;
+
+typedef struct {
+  const int8_t *data;       // block playing, NULL when off
+  uint32_t len;             // bytes
+  uint32_t pos;             // byte in the block
+  uint32_t frac;            // 16-bit fraction of pos
+  uint32_t step;            // 16.16 bytes per output sample
+  const int8_t *next;       // what the location registers hold
+  uint32_t next_len;
+  int8_t vol;
+} mix_voice_t;
+
+typedef struct {
+  uint64_t at;              // output sample the frame applies from
+  paula_frame_t f[MOD_FRAMES];
+} mix_event_t;
+
+typedef struct {
+  const mod_file_t *mod;
+  mod_mix_plan_t plan;
+  mix_voice_t v[MOD_MAX_CHANNELS];
+  mix_event_t q[MIX_QUEUE];
+  unsigned q_head;
+  unsigned q_len;
+  uint64_t pos;             // output samples rendered
+  uint64_t covered;         // samples the queued frames describe
+  int ended;                // no more frames; silence from here
+  int16_t acc[MIX_SIDES][MIX_CHUNK];
+  int8_t tmp[MIX_CHUNK];
+  uint64_t render_ns;
+  uint64_t rendered;
+} mod_mixer_t;
+
+// Decides which channels are mixed and at what rate. budget_bps limits
+// the bytes per second the two streams may add to the bus, 0 for no
+// limit. Modules of four channels or fewer get the identity route and
+// rate 0. Returns -1 if the song cannot be mixed at MIX_MIN_RATE_HZ.
+int mod_mix_plan(mod_mix_plan_t *p, const mod_file_t *mod, int is_pal,
+                 double budget_bps);
+void mod_mix_plan_report(const mod_mix_plan_t *p, FILE *out);
+
+// The part of the channel frames that goes to Paula's DMA voices.
+void mod_mix_route(const mod_mix_plan_t *p, const paula_frame_t f[MOD_FRAMES],
+                   paula_frame_t *native);
+
+void mod_mixer_init(mod_mixer_t *m, const mod_file_t *mod, const mod_mix_plan_t *p);
+
+// Queues the frames of the tick at song_ns; next_ns is when the tick
+// after it is due. Returns -1 if the queue is full.
+int mod_mixer_frame(mod_mixer_t *m, const paula_frame_t f[MOD_FRAMES],
+                    uint64_t song_ns, uint64_t next_ns);
+
+// The song has no more ticks; everything after the last frame renders.
+void mod_mixer_end(mod_mixer_t *m);
+
+// Output samples that can be rendered from the frames queued so far.
+uint64_t mod_mixer_covered(const mod_mixer_t *m);
+
+// Renders n samples per side into out[0] (left) and out[1] (right).
+void mod_mixer_render(mod_mixer_t *m, int8_t *const out[MIX_SIDES], size_t n);
+
+// Mixing kernels: acc[i] += s[i] * vol, and out[i] = acc[i] / 64 rounded
+// and clamped to 8 bits.
+void mix_accumulate_s8(int16_t *acc, const int8_t *s, int8_t vol, size_t n);
+void mix_narrow_s8(const int16_t *acc, int8_t *out, size_t n);
+
+// Nanoseconds to mix one voice sample, measured on this CPU.
+double mod_mixer_bench(void);
+
+// Checks the kernels against the scalar reference and prints throughput.
+// Returns the number of mismatches.
+int mod_mixer_selftest(FILE *out);
+
+#endif /* MOD_MIXER_H */
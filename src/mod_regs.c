@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: MIT
+// Precompiled MOD register streams.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mod_regs.h"
+
+// Header fields, little-endian.
+#define HDR_MAGIC        0u
+#define HDR_VERSION      4u       // u16
+#define HDR_CHANNELS     6u       // u16
+#define HDR_TICKS        8u
+#define HDR_BPM          12u      // u16, tempo of the first tick
+#define HDR_FLAGS        14u      // u16
+#define HDR_IMAGE_OFF    16u
+#define HDR_IMAGE_BYTES  20u
+#define HDR_EVENTS_OFF   24u
+#define HDR_EVENTS_BYTES 28u
+#define HDR_SONG_NS      32u      // u64
+#define HDR_NAME         40u      // 20 bytes
+
+#define FLAG_TRUNCATED   0x0001u
+
+// Event records. An opcode below 0x80 is a run of op + 1 ticks that change
+// nothing. Otherwise its bits say what follows, in this order.
+#define EV_CHANGE        0x80u
+#define EV_TEMPO         0x01u    // u8 BPM from the gap after this tick
+#define EV_FILTER        0x02u    // u8 0/1
+#define EV_DMA           0x04u    // u8 start | stop << 4, u8 loop
+#define EV_VOICE0        0x08u    // bits 3-6: voices with a field mask
+#define EV_MAX_RUN       0x80u
+
+// Voice field mask and the fields it announces.
+#define VF_LC            0x01u    // u24 image offset
+#define VF_LEN           0x02u    // u16
+#define VF_PER           0x04u    // u16
+#define VF_VOL           0x08u    // u8
+#define VF_LOOP_LC       0x10u    // u24 image offset
+#define VF_LOOP_LEN      0x20u    // u16
+
+static void put_le(uint8_t *p, uint64_t v, unsigned bytes) {
+  for (unsigned i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static uint64_t get_le(const uint8_t *p, unsigned bytes) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8u * i);
+  return v;
+}
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  int failed;
+} ev_buf_t;
+
+static void emit(ev_buf_t *b, uint64_t v, unsigned bytes) {
+  if (b->len + bytes > b->cap) {
+    size_t cap = b->cap ? b->cap * 2u : 4096u;
+    uint8_t *p = (uint8_t *)realloc(b->buf, cap);
+    if (!p) {
+      b->failed = 1;
+      return;
+    }
+    b->buf = p;
+    b->cap = cap;
+  }
+  put_le(b->buf + b->len, v, bytes);
+  b->len += bytes;
+}
+
+static void flush_idle(ev_buf_t *b, unsigned *idle) {
+  while (*idle) {
+    unsigned run = *idle > EV_MAX_RUN ? EV_MAX_RUN : *idle;
+    emit(b, run - 1u, 1);
+    *idle -= run;
+  }
+}
+
+// Appends the difference between f and the registers in prev, and folds
+// f into prev.
+static void encode_tick(ev_buf_t *b, paula_frame_t *prev, const paula_frame_t *f,
+                        int tempo, unsigned bpm, unsigned *idle) {
+  uint8_t vmask[PAULA_VOICES];
+  unsigned op = 0;
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    const paula_voice_regs_t *v = &f->v[ch];
+    const paula_voice_regs_t *p = &prev->v[ch];
+    unsigned m = 0;
+    if (v->lc != p->lc) m |= VF_LC;
+    if (v->len != p->len) m |= VF_LEN;
+    if (v->per != p->per) m |= VF_PER;
+    if (v->vol != p->vol) m |= VF_VOL;
+    if (f->dma_loop & (1u << ch)) {
+      if (f->loop_lc[ch] != prev->loop_lc[ch]) m |= VF_LOOP_LC;
+      if (f->loop_len[ch] != prev->loop_len[ch]) m |= VF_LOOP_LEN;
+    }
+    vmask[ch] = (uint8_t)m;
+    if (m) op |= EV_VOICE0 << ch;
+  }
+  if (tempo) op |= EV_TEMPO;
+  if (f->filter >= 0) op |= EV_FILTER;
+  if (f->dma_start || f->dma_stop) op |= EV_DMA;
+  if (!op) {
+    (*idle)++;
+    return;
+  }
+  flush_idle(b, idle);
+  emit(b, EV_CHANGE | op, 1);
+  if (op & EV_TEMPO) emit(b, bpm, 1);
+  if (op & EV_FILTER) emit(b, (unsigned)f->filter, 1);
+  if (op & EV_DMA) {
+    emit(b, (f->dma_start & 0x0Fu) | ((f->dma_stop & 0x0Fu) << 4), 1);
+    emit(b, f->dma_loop & 0x0Fu, 1);
+  }
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    unsigned m = vmask[ch];
+    if (!m) continue;
+    const paula_voice_regs_t *v = &f->v[ch];
+    emit(b, m, 1);
+    if (m & VF_LC) emit(b, v->lc, 3);
+    if (m & VF_LEN) emit(b, v->len, 2);
+    if (m & VF_PER) emit(b, v->per, 2);
+    if (m & VF_VOL) emit(b, v->vol, 1);
+    if (m & VF_LOOP_LC) emit(b, f->loop_lc[ch], 3);
+    if (m & VF_LOOP_LEN) emit(b, f->loop_len[ch], 2);
+    prev->v[ch] = *v;
+    if (f->dma_loop & (1u << ch)) {
+      prev->loop_lc[ch] = f->loop_lc[ch];
+      prev->loop_len[ch] = f->loop_len[ch];
+    }
+  }
+}
+
+int mod_regs_compile(const mod_file_t *mod, const char *path, mod_regs_info_t *info) {
+  memset(info, 0, sizeof(*info));
+  if (mod->channels != MOD_CHANNELS) {
+    fprintf(stderr, "compile: %u-channel modules are mixed at play time, "
+                    "only 4-channel ones compile\n", mod->channels);
+    return -1;
+  }
+
+  // The image packs the samples from offset 0, so the engine's chip
+  // addresses are image offsets.
+  mod_file_t m = *mod;
+  uint32_t image_bytes = 0;
+  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+    mod_sample_t *s = &m.samples[i];
+    if (!s->data || s->length_bytes == 0) continue;
+    s->chip_addr = image_bytes;
+    image_bytes += (s->length_bytes + 1u) & ~1u;
+  }
+  uint8_t *image = (uint8_t *)calloc(image_bytes ? image_bytes : 1u, 1);
+  if (!image) {
+    fprintf(stderr, "compile: out of memory\n");
+    return -1;
+  }
+  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+    const mod_sample_t *s = &m.samples[i];
+    if (s->data && s->length_bytes) memcpy(image + s->chip_addr, s->data, s->length_bytes);
+  }
+
+  mod_replay_t r;
+  paula_frame_t f[MOD_FRAMES];
+  paula_frame_t prev;
+  ev_buf_t ev;
+  unsigned idle = 0;
+  memset(&prev, 0, sizeof(prev));
+  memset(&ev, 0, sizeof(ev));
+  // Offset 0 is a location like any other, so each one is sent the
+  // first time it is used.
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    prev.v[ch].lc = UINT32_MAX;
+    prev.loop_lc[ch] = UINT32_MAX;
+  }
+  mod_replay_init(&r, &m);
+  unsigned first_bpm = r.seg_bpm;
+  while (!ev.failed) {
+    if (mod_replay_song_ns(&r) >= MOD_REGS_MAX_NS) {
+      info->truncated = 1;
+      break;
+    }
+    unsigned seg_bpm = r.seg_bpm;
+    if (mod_replay_tick(&r, f) != 0) break;
+    encode_tick(&ev, &prev, &f[0], r.seg_bpm != seg_bpm, r.seg_bpm, &idle);
+    info->ticks++;
+  }
+  flush_idle(&ev, &idle);
+  if (ev.failed) {
+    fprintf(stderr, "compile: out of memory\n");
+    free(ev.buf);
+    free(image);
+    return -1;
+  }
+  memcpy(info->name, mod->name, sizeof(info->name));
+  info->song_ns = mod_replay_song_ns(&r);
+  info->image_bytes = image_bytes;
+  info->events_bytes = (uint32_t)ev.len;
+
+  uint8_t hdr[MOD_REGS_HEADER_BYTES];
+  uint32_t events_off = (MOD_REGS_HEADER_BYTES + image_bytes + 3u) & ~3u;
+  memset(hdr, 0, sizeof(hdr));
+  put_le(hdr + HDR_MAGIC, MOD_REGS_MAGIC, 4);
+  put_le(hdr + HDR_VERSION, MOD_REGS_VERSION, 2);
+  put_le(hdr + HDR_CHANNELS, MOD_CHANNELS, 2);
+  put_le(hdr + HDR_TICKS, info->ticks, 4);
+  put_le(hdr + HDR_BPM, first_bpm, 2);
+  put_le(hdr + HDR_FLAGS, info->truncated ? FLAG_TRUNCATED : 0u, 2);
+  put_le(hdr + HDR_IMAGE_OFF, MOD_REGS_HEADER_BYTES, 4);
+  put_le(hdr + HDR_IMAGE_BYTES, image_bytes, 4);
+  put_le(hdr + HDR_EVENTS_OFF, events_off, 4);
+  put_le(hdr + HDR_EVENTS_BYTES, ev.len, 4);
+  put_le(hdr + HDR_SONG_NS, info->song_ns, 8);
+  memcpy(hdr + HDR_NAME, mod->name, 20);
+
+  static const uint8_t pad[4];
+  FILE *out = fopen(path, "wb");
+  int ok = out != NULL;
+  if (ok) {
+    ok = fwrite(hdr, 1, sizeof(hdr), out) == sizeof(hdr) &&
+         fwrite(image, 1, image_bytes, out) == image_bytes &&
+         fwrite(pad, 1, events_off - MOD_REGS_HEADER_BYTES - image_bytes, out) ==
+             events_off - MOD_REGS_HEADER_BYTES - image_bytes &&
+         fwrite(ev.buf, 1, ev.len, out) == ev.len;
+    ok = (fclose(out) == 0) && ok;
+  }
+  if (!ok) perror(path);
+  free(ev.buf);
+  free(image);
+  return ok ? 0 : -1;
+}
+
+int mod_regs_open(mod_regs_t *s, const char *path, uint32_t base) {
+  memset(s, 0, sizeof(*s));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)MOD_REGS_HEADER_BYTES) {
+    fprintf(stderr, "%s: not a register stream\n", path);
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  s->map = (const uint8_t *)map;
+  s->map_len = (size_t)st.st_size;
+
+  const uint8_t *h = s->map;
+  uint64_t image_off = get_le(h + HDR_IMAGE_OFF, 4);
+  uint64_t events_off = get_le(h + HDR_EVENTS_OFF, 4);
+  s->info.image_bytes = (uint32_t)get_le(h + HDR_IMAGE_BYTES, 4);
+  s->info.events_bytes = (uint32_t)get_le(h + HDR_EVENTS_BYTES, 4);
+  if (get_le(h + HDR_MAGIC, 4) != MOD_REGS_MAGIC ||
+      get_le(h + HDR_VERSION, 2) != MOD_REGS_VERSION ||
+      get_le(h + HDR_CHANNELS, 2) != MOD_CHANNELS ||
+      image_off + s->info.image_bytes > s->map_len ||
+      events_off + s->info.events_bytes > s->map_len) {
+    fprintf(stderr, "%s: not a version %u register stream\n", path, MOD_REGS_VERSION);
+    mod_regs_close(s);
+    return -1;
+  }
+  s->info.ticks = (uint32_t)get_le(h + HDR_TICKS, 4);
+  s->info.song_ns = get_le(h + HDR_SONG_NS, 8);
+  s->info.truncated = (get_le(h + HDR_FLAGS, 2) & FLAG_TRUNCATED) != 0;
+  memcpy(s->info.name, h + HDR_NAME, 20);
+  s->info.name[20] = '\0';
+  s->image = s->map + image_off;
+  s->ev = s->map + events_off;
+  s->ev_end = s->ev + s->info.events_bytes;
+  s->base = base;
+  s->seg_bpm = (unsigned)get_le(h + HDR_BPM, 2);
+  if (!s->seg_bpm) s->seg_bpm = 125;
+  s->frame.filter = -1;
+  return 0;
+}
+
+void mod_regs_close(mod_regs_t *s) {
+  if (s->map) munmap((void *)s->map, s->map_len);
+  s->map = NULL;
+}
+
+uint64_t mod_regs_song_ns(const mod_regs_t *s) {
+  return s->seg_ns + s->seg_ticks * 2500000000ull / s->seg_bpm;
+}
+
+// Reads bytes little-endian from the event stream, or fails at its end.
+static int take(mod_regs_t *s, unsigned bytes, uint32_t *v) {
+  if ((size_t)(s->ev_end - s->ev) < bytes) return -1;
+  *v = (uint32_t)get_le(s->ev, bytes);
+  s->ev += bytes;
+  return 0;
+}
+
+int mod_regs_next(mod_regs_t *s, uint64_t *song_ns) {
+  paula_frame_t *f = &s->frame;
+  if (s->tick >= s->info.ticks) return 1;
+  f->dma_start = 0;
+  f->dma_stop = 0;
+  f->dma_loop = 0;
+  f->filter = -1;
+  *song_ns = mod_regs_song_ns(s);
+
+  uint32_t op = 0;
+  if (s->idle) {
+    s->idle--;
+  } else {
+    if (take(s, 1, &op) != 0) return -1;
+    if (op < EV_CHANGE) {
+      s->idle = op;           // this tick is the first of the run
+      op = 0;
+    }
+  }
+  uint32_t v = 0;
+  if ((op & EV_TEMPO) && (take(s, 1, &v) != 0 || v == 0)) return -1;
+  unsigned bpm = v;
+  if (op & EV_FILTER) {
+    if (take(s, 1, &v) != 0) return -1;
+    f->filter = (int8_t)(v != 0);
+  }
+  if (op & EV_DMA) {
+    if (take(s, 1, &v) != 0) return -1;
+    f->dma_start = (uint16_t)(v & 0x0Fu);
+    f->dma_stop = (uint16_t)(v >> 4);
+    if (take(s, 1, &v) != 0) return -1;
+    f->dma_loop = (uint16_t)(v & 0x0Fu);
+  }
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    if (!(op & (EV_VOICE0 << ch))) continue;
+    paula_voice_regs_t *r = &f->v[ch];
+    uint32_t m;
+    if (take(s, 1, &m) != 0) return -1;
+    if (m & VF_LC) {
+      if (take(s, 3, &v) != 0) return -1;
+      r->lc = s->base + v;
+    }
+    if (m & VF_LEN) {
+      if (take(s, 2, &v) != 0) return -1;
+      r->len = (uint16_t)v;
+    }
+    if (m & VF_PER) {
+      if (take(s, 2, &v) != 0) return -1;
+      r->per = (uint16_t)v;
+    }
+    if (m & VF_VOL) {
+      if (take(s, 1, &v) != 0) return -1;
+      r->vol = (uint16_t)v;
+    }
+    if (m & VF_LOOP_LC) {
+      if (take(s, 3, &v) != 0) return -1;
+      f->loop_lc[ch] = s->base + v;
+    }
+    if (m & VF_LOOP_LEN) {
+      if (take(s, 2, &v) != 0) return -1;
+      f->loop_len[ch] = (uint16_t)v;
+    }
+  }
+
+  // The same segment arithmetic as mod_replay_song_ns().
+  if (op & EV_TEMPO) {
+    s->seg_ns = *song_ns;
+    s->seg_ticks = 0;
+    s->seg_bpm = bpm;
+  }
+  s->seg_ticks++;
+  s->tick++;
+  return 0;
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+// Precompiled MOD register streams.
+//
+// The replay engine is deterministic, so a song can be run once offline
+// and its Paula frames stored; playback then needs no pattern, effect or
+// timing logic, only a decoder and paula_writer_commit() at each tick's
+// deadline. A stream file holds:
+//
+//   header      MOD_REGS_HEADER_BYTES, little-endian, see mod_regs.c
+//   image       the samples as laid out in chip RAM from offset 0; every
+//               location in the stream is an offset into it, so the
+//               player relocates the song by adding its load address
+//   events      one record per tick, delta-encoded against the previous
+//               tick, with runs of unchanged ticks collapsed
+//
+// Tick times are absolute: a tempo record starts a new segment and tick n
+// of a segment is due at its start plus n * 2.5 s / BPM, the same integer
+// arithmetic as the engine, so the deadlines match it to the nanosecond.
+// Only 4-channel modules compile; 6/8-channel ones are mixed at play time.
+
+#ifndef MOD_REGS_H
+#define MOD_REGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mod_replay.h"
+#include "paula_writer.h"
+
+#define MOD_REGS_MAGIC        0x53524D50u   // 'PMRS'
+#define MOD_REGS_VERSION      1u
+#define MOD_REGS_HEADER_BYTES 64u
+#define MOD_REGS_MAX_NS       (30ull * 60ull * 1000000000ull)   // songs that loop
+
+typedef struct {
+  char name[21];
+  uint32_t ticks;
+  uint64_t song_ns;         // when the last tick ends
+  uint32_t image_bytes;
+  uint32_t events_bytes;
+  int truncated;            // stopped at MOD_REGS_MAX_NS
+} mod_regs_info_t;
+
+// Runs mod through the engine and writes the stream to path. Returns -1
+// with a message on stderr if it cannot.
+int mod_regs_compile(const mod_file_t *mod, const char *path, mod_regs_info_t *info);
+
+typedef struct {
+  mod_regs_info_t info;
+  const uint8_t *map;       // the whole file, mmapped
+  size_t map_len;
+  const uint8_t *image;
+  const uint8_t *ev;
+  const uint8_t *ev_end;
+  uint32_t base;            // chip address of the image
+  paula_frame_t frame;      // registers carry over from tick to tick
+  unsigned idle;            // unchanged ticks still to replay
+  uint32_t tick;
+  unsigned seg_bpm;
+  uint64_t seg_ns;
+  uint64_t seg_ticks;
+} mod_regs_t;
+
+// Maps a stream and checks its header. base is where the image will be
+// loaded; locations come out relocated to it.
+int mod_regs_open(mod_regs_t *s, const char *path, uint32_t base);
+void mod_regs_close(mod_regs_t *s);
+
+// Decodes the next tick into s->frame and sets *song_ns to its due time.
+// Returns 0 for a tick, 1 at the end of the stream and -1 if the stream is
+// corrupt.
+int mod_regs_next(mod_regs_t *s, uint64_t *song_ns);
+
+// Song time at which the next tick is due.
+uint64_t mod_regs_song_ns(const mod_regs_t *s);
+
+#endif /* MOD_REGS_H */
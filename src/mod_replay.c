@@ -0,0 +1,665 @@
+// SPDX-License-Identifier: MIT
+// ProTracker MOD loader and replay engine.
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "paula.h"
+#include "mod_replay.h"
+
+#define MOD_NOTES       36            // C-1 .. B-3
+#define MOD_PERIOD_MIN  113u
+#define MOD_PERIOD_MAX  856u
+
+// ProTracker's finetune 0 row. The other fifteen rows are that row
+// detuned in 1/8 semitone steps; ProTracker's own table differs from the
+// computed one by a period here and there, well under a cent.
+static const uint16_t pt_periods[MOD_NOTES] = {
+  856, 808, 762, 720, 678, 640, 604, 570, 538, 508, 480, 453,
+  428, 404, 381, 360, 339, 320, 302, 285, 269, 254, 240, 226,
+  214, 202, 190, 180, 170, 160, 151, 143, 135, 127, 120, 113
+};
+
+static const uint8_t vib_sine[32] = {
+    0,  24,  49,  74,  97, 120, 141, 161, 180, 197, 212, 224, 235, 244, 250, 253,
+  255, 253, 250, 244, 235, 224, 212, 197, 180, 161, 141, 120,  97,  74,  49,  24
+};
+
+static uint16_t period_table[16][MOD_NOTES];   // by finetune & 15
+static int period_table_ready;
+
+static void build_period_table(void) {
+  for (int ft = 0; ft < 16; ft++) {
+    int tune = ft < 8 ? ft : ft - 16;
+    for (int n = 0; n < MOD_NOTES; n++) {
+      period_table[ft][n] = tune ? (uint16_t)lrint(pt_periods[n] * pow(2.0, -tune / 96.0))
+                                 : pt_periods[n];
+    }
+  }
+  period_table_ready = 1;
+}
+
+static const uint16_t *tuned(int8_t finetune) {
+  return period_table[finetune & 15];
+}
+
+// Index of the first note at or above period in pitch, the way ProTracker
+// looks notes up; -1 when the period is off the end of the table.
+static int note_index(const uint16_t *row, uint16_t period) {
+  for (int n = 0; n < MOD_NOTES; n++) {
+    if (period >= row[n]) return n;
+  }
+  return -1;
+}
+
+static int mod_read_u16(const uint8_t *p) {
+  return ((int)p[0] << 8) | (int)p[1];
+}
+
+// Channel count for a format tag, 0 if unknown. FLT8 stores each 8-channel
+// pattern as two 4-channel halves.
+static unsigned mod_tag_channels(const uint8_t *tag, int *flt8) {
+  *flt8 = 0;
+  if (!memcmp(tag, "M.K.", 4) || !memcmp(tag, "M!K!", 4) ||
+      !memcmp(tag, "4CHN", 4) || !memcmp(tag, "FLT4", 4)) {
+    return 4;
+  }
+  if (!memcmp(tag, "6CHN", 4)) return 6;
+  if (!memcmp(tag, "8CHN", 4) || !memcmp(tag, "OCTA", 4) || !memcmp(tag, "CD81", 4)) {
+    return 8;
+  }
+  if (!memcmp(tag, "FLT8", 4)) {
+    *flt8 = 1;
+    return 8;
+  }
+  return 0;
+}
+
+static uint8_t *mod_read_file(const char *path, size_t *out_len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) != 0) {
+    fclose(f);
+    return NULL;
+  }
+  long len = ftell(f);
+  if (len < 0) {
+    fclose(f);
+    return NULL;
+  }
+  rewind(f);
+  uint8_t *buf = (uint8_t *)malloc(len ? (size_t)len : 1u);
+  if (!buf || fread(buf, 1, (size_t)len, f) != (size_t)len) {
+    fclose(f);
+    free(buf);
+    return NULL;
+  }
+  fclose(f);
+  *out_len = (size_t)len;
+  return buf;
+}
+
+int mod_load(const char *path, mod_file_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->data = mod_read_file(path, &out->data_len);
+  if (!out->data || out->data_len < 1084) return -1;
+
+  const uint8_t *p = out->data;
+  memcpy(out->name, p, 20);
+  out->name[20] = '\0';
+  p += 20;
+
+  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+    mod_sample_t *s = &out->samples[i];
+    memcpy(s->name, p, 22);
+    p += 22;
+    uint16_t len_words = (uint16_t)mod_read_u16(p);
+    p += 2;
+    uint8_t finetune = *p++;
+    uint8_t volume = *p++;
+    uint16_t loop_start = (uint16_t)mod_read_u16(p);
+    p += 2;
+    uint16_t loop_len = (uint16_t)mod_read_u16(p);
+    p += 2;
+
+    s->length_bytes = (uint32_t)len_words * 2u;
+    s->finetune = (int8_t)(finetune & 0x0F);
+    if (s->finetune & 0x08) s->finetune -= 16;
+    s->volume = volume > 64 ? 64 : volume;
+    s->loop_start_bytes = (uint32_t)loop_start * 2u;
+    s->loop_len_bytes = (uint32_t)loop_len * 2u;
+  }
+
+  out->song_len = *p++;
+  out->restart = *p++;
+  memcpy(out->orders, p, 128);
+  p += 128;
+
+  if ((size_t)(p - out->data + 4) > out->data_len) return -1;
+  int flt8 = 0;
+  unsigned channels = mod_tag_channels(p, &flt8);
+  if (!channels) {
+    fprintf(stderr, "Unsupported MOD tag: %.4s (4, 6 or 8 channels supported)\n", p);
+    return -1;
+  }
+  out->channels = (uint8_t)channels;
+  p += 4;
+
+  uint8_t max_pat = 0;
+  for (int i = 0; i < 128; i++) {
+    // FLT8 orders name the first 4-channel half, always even.
+    if (flt8) out->orders[i] >>= 1;
+    if (out->orders[i] > max_pat) max_pat = out->orders[i];
+  }
+  size_t row_bytes = (size_t)channels * 4u;
+  size_t pat_bytes = MOD_ROWS * row_bytes;
+  out->num_patterns = (uint8_t)(max_pat + 1u);
+  out->pattern_offset = 1084;
+  out->sample_offset = out->pattern_offset + (size_t)out->num_patterns * pat_bytes;
+  if (out->sample_offset > out->data_len) return -1;
+
+  size_t total_events = (size_t)out->num_patterns * MOD_ROWS * channels;
+  out->patterns = (mod_event_t *)calloc(total_events, sizeof(mod_event_t));
+  if (!out->patterns) return -1;
+
+  for (unsigned pat = 0; pat < out->num_patterns; pat++) {
+    size_t base = out->pattern_offset + (size_t)pat * pat_bytes;
+    for (int row = 0; row < MOD_ROWS; row++) {
+      for (unsigned ch = 0; ch < channels; ch++) {
+        size_t off = base + (size_t)row * row_bytes + (size_t)ch * 4u;
+        if (flt8) {
+          off = base + (ch / 4u) * 1024u + (size_t)row * 16u + (ch % 4u) * 4u;
+        }
+        if (off + 3 >= out->data_len) return -1;
+        uint8_t b0 = out->data[off + 0];
+        uint8_t b1 = out->data[off + 1];
+        uint8_t b2 = out->data[off + 2];
+        uint8_t b3 = out->data[off + 3];
+        mod_event_t *e = &out->patterns[(pat * MOD_ROWS + row) * channels + ch];
+        e->sample = (uint8_t)((b0 & 0xF0) | ((b2 & 0xF0) >> 4));
+        e->period = (uint16_t)(((b0 & 0x0F) << 8) | b1);
+        e->effect = (uint8_t)(b2 & 0x0F);
+        e->param = b3;
+      }
+    }
+  }
+
+  size_t sample_pos = out->sample_offset;
+  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+    mod_sample_t *s = &out->samples[i];
+    if (s->length_bytes == 0) {
+      s->data = NULL;
+      continue;
+    }
+    if (sample_pos + s->length_bytes > out->data_len) return -1;
+    s->data = out->data + sample_pos;
+    sample_pos += s->length_bytes;
+  }
+  return 0;
+}
+
+void mod_free(mod_file_t *mod) {
+  free(mod->patterns);
+  free(mod->data);
+  memset(mod, 0, sizeof(*mod));
+}
+
+void mod_replay_init(mod_replay_t *r, const mod_file_t *mod) {
+  if (!period_table_ready) build_period_table();
+  memset(r, 0, sizeof(*r));
+  r->mod = mod;
+  r->speed = 6;
+  r->bpm = 125;
+  r->seg_bpm = r->bpm;
+  r->jump_pos = -1;
+  r->break_row = -1;
+  r->loop_to = -1;
+  r->filter = -1;
+  for (int ch = 0; ch < MOD_MAX_CHANNELS; ch++) r->v[ch].note = -1;
+  r->ended = mod->song_len == 0;
+}
+
+uint64_t mod_replay_tick_ns(const mod_replay_t *r) {
+  return 2500000000ull / r->bpm;
+}
+
+uint64_t mod_replay_song_ns(const mod_replay_t *r) {
+  return r->seg_ns + r->seg_ticks * 2500000000ull / r->seg_bpm;
+}
+
+static uint16_t words(uint32_t bytes) {
+  uint32_t w = (bytes + 1u) / 2u;
+  return (uint16_t)(w > 0xFFFFu ? 0xFFFFu : w);
+}
+
+// Points the voice at its sample from byte offset and restarts DMA. The
+// first block runs to the loop end and Paula continues with the loop.
+static void voice_start(mod_replay_t *r, mod_voice_t *v, uint32_t offset) {
+  const mod_sample_t *s = v->sample ? &r->mod->samples[v->sample - 1] : NULL;
+  v->latch_loop = 0;
+  if (!s || !s->data || s->length_bytes < 2u) {
+    v->stop = 1;
+    return;
+  }
+  int looped = s->loop_len_bytes > 2u;
+  uint32_t end = s->length_bytes;
+  if (looped && s->loop_start_bytes + s->loop_len_bytes < end) {
+    end = s->loop_start_bytes + s->loop_len_bytes;
+  }
+  uint32_t base = s->chip_addr & CHIP_ADDR_MASK;
+  // One-shots end on a one-word loop at the sample start, which trackers
+  // leave silent.
+  v->loop_lc = looped ? base + s->loop_start_bytes : base;
+  v->loop_len = looped ? words(s->loop_len_bytes) : 1u;
+  offset &= ~1u;
+  if (offset >= end) {
+    // ProTracker plays on from the loop, or nothing for a one-shot.
+    if (!looped) {
+      v->stop = 1;
+      return;
+    }
+    v->out.lc = v->loop_lc;
+    v->out.len = v->loop_len;
+  } else {
+    v->out.lc = base + offset;
+    v->out.len = words(end - offset);
+    v->latch_loop = v->out.lc != v->loop_lc || v->out.len != v->loop_len;
+  }
+  v->start = 1;
+  v->stop = 0;
+}
+
+static uint16_t clamp_period(int p) {
+  if (p < (int)MOD_PERIOD_MIN) return MOD_PERIOD_MIN;
+  if (p > (int)MOD_PERIOD_MAX) return MOD_PERIOD_MAX;
+  return (uint16_t)p;
+}
+
+static void volume_slide(mod_voice_t *v, uint8_t param) {
+  int vol = v->volume;
+  if (param >> 4) {
+    vol += param >> 4;
+  } else {
+    vol -= param & 0x0F;
+  }
+  v->volume = (uint8_t)(vol < 0 ? 0 : (vol > 64 ? 64 : vol));
+}
+
+static void tone_porta(mod_voice_t *v) {
+  if (!v->porta_target || !v->period) return;
+  int p = v->period;
+  if (p < v->porta_target) {
+    p += v->porta_speed;
+    if (p > v->porta_target) p = v->porta_target;
+  } else if (p > v->porta_target) {
+    p -= v->porta_speed;
+    if (p < v->porta_target) p = v->porta_target;
+  }
+  v->period = (uint16_t)p;
+  v->out.per = v->period;
+  if (v->glissando) {
+    const uint16_t *row = tuned(v->finetune);
+    int n = note_index(row, v->period);
+    if (n >= 0) v->out.per = row[n];
+  }
+}
+
+// Waveform value 0-255 and sign for vibrato and tremolo position pos.
+static int wave_value(uint8_t wave, uint8_t pos) {
+  unsigned i = pos & 31u;
+  int val;
+  switch (wave & 3u) {
+  case 0:
+    val = vib_sine[i];
+    break;
+  case 1:
+    val = (int)(i * 8u);
+    if (pos & 32u) val = 255 - val;
+    break;
+  default:
+    val = 255;
+    break;
+  }
+  return (pos & 32u) ? -val : val;
+}
+
+static void vibrato(mod_voice_t *v) {
+  int delta = wave_value(v->vib_wave, v->vib_pos) * v->vib_depth / 128;
+  v->out.per = clamp_period(v->period + delta);
+  v->vib_pos = (uint8_t)((v->vib_pos + v->vib_speed) & 63u);
+}
+
+static void tremolo(mod_voice_t *v) {
+  int vol = v->volume + wave_value(v->trem_wave, v->trem_pos) * v->trem_depth / 64;
+  v->out.vol = (uint16_t)(vol < 0 ? 0 : (vol > 64 ? 64 : vol));
+  v->trem_pos = (uint8_t)((v->trem_pos + v->trem_speed) & 63u);
+}
+
+static void arpeggio(mod_replay_t *r, mod_voice_t *v) {
+  unsigned step = r->tick % 3u;
+  if (!step) return;
+  const uint16_t *row = tuned(v->finetune);
+  int n = note_index(row, v->period);
+  if (n < 0) return;
+  n += step == 1 ? v->param >> 4 : v->param & 0x0F;
+  v->out.per = row[n < MOD_NOTES ? n : MOD_NOTES - 1];
+}
+
+// Extended commands that act on later ticks, or on tick 0 of a row
+// without a note.
+static void e_tick(mod_replay_t *r, mod_voice_t *v) {
+  unsigned x = v->param & 0x0Fu;
+  switch (v->param >> 4) {
+  case 0x9:
+    if (x && r->tick % x == 0 && (r->tick || !v->has_note)) {
+      voice_start(r, v, 0);
+    }
+    break;
+  case 0xC:
+    if (r->tick == x) v->volume = 0;
+    v->out.vol = v->volume;
+    break;
+  case 0xD:
+    if (v->delayed && r->tick == x) {
+      v->delayed = 0;
+      voice_start(r, v, 0);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Effects that run on every tick but the first of a row.
+static void voice_tick(mod_replay_t *r, mod_voice_t *v) {
+  switch (v->effect) {
+  case 0x0:
+    if (v->param) arpeggio(r, v);
+    break;
+  case 0x1:
+    v->period = clamp_period(v->period - v->param);
+    v->out.per = v->period;
+    break;
+  case 0x2:
+    v->period = clamp_period(v->period + v->param);
+    v->out.per = v->period;
+    break;
+  case 0x3:
+    tone_porta(v);
+    break;
+  case 0x4:
+    vibrato(v);
+    break;
+  case 0x5:
+    tone_porta(v);
+    volume_slide(v, v->param);
+    v->out.vol = v->volume;
+    break;
+  case 0x6:
+    vibrato(v);
+    volume_slide(v, v->param);
+    v->out.vol = v->volume;
+    break;
+  case 0x7:
+    tremolo(v);
+    break;
+  case 0xA:
+    volume_slide(v, v->param);
+    v->out.vol = v->volume;
+    break;
+  case 0xE:
+    e_tick(r, v);
+    break;
+  default:
+    break;
+  }
+}
+
+static void voice_row(mod_replay_t *r, mod_voice_t *v, const mod_event_t *e) {
+  unsigned x = e->param >> 4;
+  unsigned y = e->param & 0x0Fu;
+  unsigned ecmd = e->effect == 0xE ? x : 0x10u;
+
+  v->effect = e->effect;
+  v->param = e->param;
+  v->has_note = e->period != 0;
+  v->delayed = 0;
+
+  if (e->sample && e->sample <= MOD_MAX_SAMPLES) {
+    const mod_sample_t *s = &r->mod->samples[e->sample - 1];
+    v->sample = e->sample;
+    v->volume = s->volume;
+    v->finetune = s->finetune;
+  }
+  if (ecmd == 0x5) v->finetune = (int8_t)(y & 8u ? (int)y - 16 : (int)y);
+  if (e->effect == 0x9 && e->param) v->offset = e->param;
+
+  if (e->period) {
+    const uint16_t *row = tuned(v->finetune);
+    int n = note_index(pt_periods, e->period);
+    uint16_t period = n >= 0 ? row[n] : e->period;
+    if (e->effect == 0x3 || e->effect == 0x5) {
+      v->porta_target = period;
+    } else {
+      v->note = n;
+      v->period = period;
+      v->porta_target = 0;
+      if (!(v->vib_wave & 4u)) v->vib_pos = 0;
+      if (!(v->trem_wave & 4u)) v->trem_pos = 0;
+      if (ecmd == 0xD && y) {
+        v->delayed = 1;
+      } else {
+        voice_start(r, v, e->effect == 0x9 ? (uint32_t)v->offset * 256u : 0u);
+      }
+    }
+  }
+  v->out.per = v->period;
+  v->out.vol = v->volume;
+
+  switch (e->effect) {
+  case 0x3:
+    if (e->param) v->porta_speed = e->param;
+    break;
+  case 0x4:
+    if (x) v->vib_speed = (uint8_t)x;
+    if (y) v->vib_depth = (uint8_t)y;
+    break;
+  case 0x7:
+    if (x) v->trem_speed = (uint8_t)x;
+    if (y) v->trem_depth = (uint8_t)y;
+    break;
+  case 0xB:
+    r->jump_pos = e->param;
+    break;
+  case 0xC:
+    v->volume = e->param > 64 ? 64 : e->param;
+    v->out.vol = v->volume;
+    break;
+  case 0xD:
+    r->break_row = (int)(x * 10u + y);
+    if (r->break_row >= MOD_ROWS) r->break_row = 0;
+    break;
+  case 0xF:
+    if (e->param == 0) {
+      r->ended = 1;
+    } else if (e->param < 32) {
+      r->speed = e->param;
+    } else {
+      r->bpm = e->param;
+    }
+    break;
+  case 0xE:
+    switch (ecmd) {
+    case 0x0:
+      r->filter = (int8_t)!(y & 1u);
+      break;
+    case 0x1:
+      v->period = clamp_period(v->period - (int)y);
+      v->out.per = v->period;
+      break;
+    case 0x2:
+      v->period = clamp_period(v->period + (int)y);
+      v->out.per = v->period;
+      break;
+    case 0x3:
+      v->glissando = (uint8_t)y;
+      break;
+    case 0x4:
+      v->vib_wave = (uint8_t)y;
+      break;
+    case 0x6:
+      if (!y) {
+        v->loop_row = r->row;
+      } else if (!v->loop_count) {
+        v->loop_count = (uint8_t)y;
+        r->loop_to = v->loop_row;
+      } else if (--v->loop_count) {
+        r->loop_to = v->loop_row;
+      }
+      break;
+    case 0x7:
+      v->trem_wave = (uint8_t)y;
+      break;
+    case 0xA:
+      volume_slide(v, (uint8_t)(y << 4));
+      v->out.vol = v->volume;
+      break;
+    case 0xB:
+      volume_slide(v, (uint8_t)y);
+      v->out.vol = v->volume;
+      break;
+    case 0xE:
+      if (!r->repeating) r->row_delay = y;
+      break;
+    default:
+      break;
+    }
+    e_tick(r, v);
+    break;
+  default:
+    break;
+  }
+}
+
+static void next_row(mod_replay_t *r) {
+  if (r->row_delay) {
+    r->row_delay--;
+    r->repeating = 1;
+    return;
+  }
+  r->repeating = 0;
+  if (r->loop_to >= 0) {
+    r->row = (uint8_t)r->loop_to;
+  } else if (r->jump_pos >= 0 || r->break_row >= 0) {
+    r->pos = (uint8_t)(r->jump_pos >= 0 ? r->jump_pos : r->pos + 1);
+    r->row = (uint8_t)(r->break_row >= 0 ? r->break_row : 0);
+  } else if (++r->row >= MOD_ROWS) {
+    r->row = 0;
+    r->pos++;
+  }
+  r->jump_pos = -1;
+  r->break_row = -1;
+  r->loop_to = -1;
+  if (r->pos >= r->mod->song_len) r->ended = 1;
+}
+
+int mod_replay_tick(mod_replay_t *r, paula_frame_t f[MOD_FRAMES]) {
+  unsigned channels = r->mod->channels;
+  memset(f, 0, MOD_FRAMES * sizeof(*f));
+  for (unsigned k = 0; k < MOD_FRAMES; k++) f[k].filter = -1;
+  if (!r->ended && r->mod->orders[r->pos] >= r->mod->num_patterns) r->ended = 1;
+  if (r->ended) {
+    for (unsigned ch = 0; ch < channels; ch++) {
+      paula_frame_t *fk = &f[ch / MOD_CHANNELS];
+      fk->v[ch % MOD_CHANNELS] = r->v[ch].out;
+      fk->v[ch % MOD_CHANNELS].vol = 0;
+      fk->dma_stop |= (uint16_t)(1u << (ch % MOD_CHANNELS));
+    }
+    return 1;
+  }
+
+  r->now_ns = mod_replay_song_ns(r);
+  for (unsigned ch = 0; ch < channels; ch++) {
+    mod_voice_t *v = &r->v[ch];
+    v->start = 0;
+    v->stop = 0;
+    v->out.per = v->period;
+    v->out.vol = v->volume;
+  }
+
+  if (r->tick == 0 && !r->repeating) {
+    uint8_t pat = r->mod->orders[r->pos];
+    const mod_event_t *ev = &r->mod->patterns[(pat * MOD_ROWS + r->row) * channels];
+    for (unsigned ch = 0; ch < channels; ch++) voice_row(r, &r->v[ch], &ev[ch]);
+  } else {
+    for (unsigned ch = 0; ch < channels; ch++) voice_tick(r, &r->v[ch]);
+  }
+
+  for (unsigned ch = 0; ch < channels; ch++) {
+    mod_voice_t *v = &r->v[ch];
+    paula_frame_t *fk = &f[ch / MOD_CHANNELS];
+    unsigned pc = ch % MOD_CHANNELS;
+    fk->v[pc] = v->out;
+    if (v->start) fk->dma_start |= (uint16_t)(1u << pc);
+    if (v->stop) fk->dma_stop |= (uint16_t)(1u << pc);
+    if (v->start && v->latch_loop) {
+      fk->dma_loop |= (uint16_t)(1u << pc);
+      fk->loop_lc[pc] = v->loop_lc;
+      fk->loop_len[pc] = v->loop_len;
+      // What the registers hold from here on.
+      v->out.lc = v->loop_lc;
+      v->out.len = v->loop_len;
+      v->latch_loop = 0;
+    }
+  }
+  f[0].filter = r->filter;
+  r->filter = -1;
+
+  if (r->bpm != r->seg_bpm) {
+    // The new tempo sets the gap to the next tick.
+    r->seg_ns = r->now_ns;
+    r->seg_ticks = 0;
+    r->seg_bpm = r->bpm;
+  }
+  r->seg_ticks++;
+  r->ticks++;
+  if (++r->tick >= r->speed) {
+    r->tick = 0;
+    next_row(r);
+  }
+  return 0;
+}
+
+unsigned mod_replay_first_use(const mod_file_t *mod, uint64_t first_ns[MOD_MAX_SAMPLES],
+                              uint64_t limit_ns) {
+  mod_replay_t r;
+  paula_frame_t f[MOD_FRAMES];
+  unsigned used = 0;
+  unsigned wanted = 0;
+  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+    first_ns[i] = UINT64_MAX;
+    if (mod->samples[i].data) wanted++;
+  }
+  mod_replay_init(&r, mod);
+  while (used < wanted && mod_replay_song_ns(&r) < limit_ns) {
+    uint64_t now = mod_replay_song_ns(&r);
+    if (mod_replay_tick(&r, f) != 0) break;
+    for (unsigned ch = 0; ch < mod->channels; ch++) {
+      unsigned smp = r.v[ch].sample;
+      if (!(f[ch / MOD_CHANNELS].dma_start & (1u << (ch % MOD_CHANNELS))) || !smp) continue;
+      if (first_ns[smp - 1] == UINT64_MAX) {
+        first_ns[smp - 1] = now;
+        used++;
+      }
+    }
+  }
+  return used;
+}
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+// ProTracker MOD loader and replay engine.
+//
+// The engine does no bus I/O. Each call to mod_replay_tick() advances the
+// song by one tick and describes the Paula state for that tick in a
+// paula_frame_t, which the caller hands to paula_writer_commit() (or
+// records). Timing follows ProTracker 2.3 in CIA mode: speed ticks per row,
+// 2.5 s / BPM per tick. The engine keeps its own song clock in whole
+// nanoseconds, restarted at each tempo change, so tick times do not drift
+// however long the song runs. Loops are left to Paula: a started voice
+// carries its loop in the frame and the writer latches it once DMA has
+// picked up the first block.
+//
+// Effects: 0 arpeggio, 1/2 portamento, 3 tone portamento, 4 vibrato,
+// 5/6 tone portamento/vibrato plus volume slide, 7 tremolo, 9 sample
+// offset, A volume slide, B position jump, C volume, D pattern break,
+// F speed/tempo, and E0 filter, E1/E2 fine portamento, E3 glissando,
+// E4/E7 vibrato/tremolo waveform, E5 finetune, E6 pattern loop, E9
+// retrigger, EA/EB fine volume slide, EC note cut, ED note delay and EE
+// pattern delay. EF (invert loop) rewrites sample data and is ignored.
+//
+// Besides the 4-channel tags, 6CHN, 8CHN/OCTA/CD81 and StarTrekker's FLT8
+// load with 6 or 8 channels. Channel ch is reported in frame ch / 4, so
+// the caller decides which channels reach Paula and which are mixed.
+
+#ifndef MOD_REPLAY_H
+#define MOD_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "paula_writer.h"
+
+#define MOD_MAX_SAMPLES 31
+#define MOD_CHANNELS    4       // per frame, one per Paula voice
+#define MOD_MAX_CHANNELS 8
+#define MOD_FRAMES      (MOD_MAX_CHANNELS / MOD_CHANNELS)
+#define MOD_ROWS        64
+
+typedef struct {
+  char name[22];
+  uint32_t length_bytes;
+  int8_t finetune;
+  uint8_t volume;
+  uint32_t loop_start_bytes;
+  uint32_t loop_len_bytes;
+  uint32_t chip_addr;       // set by the caller once uploaded
+  const uint8_t *data;
+} mod_sample_t;
+
+typedef struct {
+  uint8_t sample;
+  uint16_t period;
+  uint8_t effect;
+  uint8_t param;
+} mod_event_t;
+
+typedef struct {
+  char name[21];
+  uint8_t song_len;
+  uint8_t restart;
+  uint8_t orders[128];
+  uint8_t num_patterns;
+  uint8_t channels;         // 4, 6 or 8
+  mod_sample_t samples[MOD_MAX_SAMPLES];
+  mod_event_t *patterns;
+  uint8_t *data;
+  size_t data_len;
+  size_t pattern_offset;
+  size_t sample_offset;
+} mod_file_t;
+
+int mod_load(const char *path, mod_file_t *out);
+void mod_free(mod_file_t *mod);
+
+typedef struct {
+  uint8_t sample;           // 1-31, 0 = none yet
+  int8_t finetune;
+  int note;                 // period table index, -1 for off-table periods
+  uint16_t period;          // base period, what slides act on
+  uint16_t porta_target;
+  uint8_t porta_speed;
+  uint8_t glissando;
+  uint8_t volume;
+  uint8_t vib_pos, vib_speed, vib_depth, vib_wave;
+  uint8_t trem_pos, trem_speed, trem_depth, trem_wave;
+  uint8_t offset;           // 9xx memory, in 256-byte units
+  uint8_t loop_row;
+  uint8_t loop_count;
+  uint8_t effect;           // effect of the current row
+  uint8_t param;
+  int has_note;             // current row carries a period
+  int delayed;              // ED note waiting for its tick
+
+  // Paula state.
+  paula_voice_regs_t out;
+  int start;                // restart DMA this tick
+  int stop;                 // switch DMA off this tick
+  int latch_loop;           // first block differs from the loop
+  uint32_t loop_lc;
+  uint16_t loop_len;
+} mod_voice_t;
+
+typedef struct {
+  const mod_file_t *mod;
+  mod_voice_t v[MOD_MAX_CHANNELS];
+  unsigned speed;
+  unsigned bpm;
+  unsigned tick;
+  uint8_t pos;
+  uint8_t row;
+  unsigned row_delay;       // EE repeats left
+  int repeating;            // current row is an EE repeat
+  int jump_pos;             // pending B, -1 = none
+  int break_row;            // pending D, -1 = none
+  int loop_to;              // pending E6 jump, -1 = none
+  int8_t filter;
+  int ended;
+  uint64_t ticks;
+  uint64_t now_ns;          // song time of the current tick
+  uint64_t seg_ns;          // song time of the last tempo change
+  uint64_t seg_ticks;       // ticks since then
+  unsigned seg_bpm;
+} mod_replay_t;
+
+// Chip addresses of the samples must be filled in before the first tick.
+void mod_replay_init(mod_replay_t *r, const mod_file_t *mod);
+
+// Advances one tick and fills f; channel ch is f[ch / 4].v[ch % 4] and
+// frames past the song's channels stay empty. Returns 0 while the song
+// plays and 1 once it has ended, in which case f stops every voice.
+int mod_replay_tick(mod_replay_t *r, paula_frame_t f[MOD_FRAMES]);
+
+// Time until the next tick at the current tempo.
+uint64_t mod_replay_tick_ns(const mod_replay_t *r);
+
+// Song time at which the next tick is due, counted from the first tick.
+uint64_t mod_replay_song_ns(const mod_replay_t *r);
+
+// Plays the song silently, following jumps, breaks and loops, and stores
+// the song time at which each sample first starts; UINT64_MAX for samples
+// never played within limit_ns. Returns the number of samples played.
+unsigned mod_replay_first_use(const mod_file_t *mod, uint64_t first_ns[MOD_MAX_SAMPLES],
+                              uint64_t limit_ns);
+
+#endif /* MOD_REPLAY_H */
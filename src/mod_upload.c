@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: MIT
+// Progressive MOD sample upload.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "mod_upload.h"
+
+void mod_upload_init(mod_upload_t *u) {
+  memset(u, 0, sizeof(*u));
+  u->byte_ns = 1000.0;      // pessimistic until the first chunk is timed
+}
+
+void mod_upload_add(mod_upload_t *u, unsigned sample, uint32_t addr,
+                    const uint8_t *data, uint32_t len) {
+  if (u->count == MOD_MAX_SAMPLES || !len) return;
+  mod_upload_item_t *it = &u->item[u->count++];
+  it->sample = (uint8_t)sample;
+  it->addr = addr;
+  it->data = data;
+  it->len = len;
+  it->done = 0;
+  it->first_ns = UINT64_MAX;
+  u->bytes_total += len;
+}
+
+void mod_upload_plan(mod_upload_t *u, const mod_file_t *mod) {
+  uint64_t first[MOD_MAX_SAMPLES];
+  mod_replay_first_use(mod, first, MOD_UPLOAD_SCAN_NS);
+  mod_upload_sort(u, first);
+}
+
+void mod_upload_sort(mod_upload_t *u, const uint64_t first[MOD_MAX_SAMPLES]) {
+  for (unsigned i = 0; i < u->count; i++) {
+    u->item[i].first_ns = first[u->item[i].sample - 1u];
+  }
+  // Insertion sort, stable so unused samples keep file order.
+  for (unsigned i = 1; i < u->count; i++) {
+    mod_upload_item_t it = u->item[i];
+    unsigned j = i;
+    while (j > 0 && u->item[j - 1u].first_ns > it.first_ns) {
+      u->item[j] = u->item[j - 1u];
+      j--;
+    }
+    u->item[j] = it;
+  }
+  u->next = 0;
+}
+
+static mod_upload_item_t *find(const mod_upload_t *u, unsigned sample) {
+  for (unsigned i = u->next; i < u->count; i++) {
+    if (u->item[i].sample == sample) return (mod_upload_item_t *)&u->item[i];
+  }
+  return NULL;
+}
+
+int mod_upload_pending(const mod_upload_t *u, unsigned sample) {
+  const mod_upload_item_t *it = find(u, sample);
+  return it && it->done < it->len;
+}
+
+int mod_upload_done(const mod_upload_t *u) {
+  return u->next >= u->count;
+}
+
+static void advance(mod_upload_t *u) {
+  while (u->next < u->count && u->item[u->next].done >= u->item[u->next].len) {
+    u->next++;
+  }
+}
+
+// Writes bytes of it and folds the measured rate into the estimate.
+static void put(mod_upload_t *u, mod_upload_item_t *it, uint32_t bytes) {
+  uint64_t t0 = pi_now_ns();
+  write_chip_ram(it->addr + it->done, it->data + it->done, bytes);
+  uint64_t dt = pi_now_ns() - t0;
+  it->done += bytes;
+  u->bytes_done += bytes;
+  if (bytes >= MOD_UPLOAD_MIN_CHUNK) {
+    u->byte_ns = 0.75 * u->byte_ns + 0.25 * (double)dt / (double)bytes;
+  }
+}
+
+void mod_upload_finish(mod_upload_t *u, unsigned sample, int stall) {
+  mod_upload_item_t *it = find(u, sample);
+  if (!it || it->done >= it->len) return;
+  uint64_t t0 = pi_now_ns();
+  put(u, it, it->len - it->done);
+  if (stall) {
+    u->stalls++;
+    u->stall_ns += pi_now_ns() - t0;
+  }
+  advance(u);
+}
+
+void mod_upload_until(mod_upload_t *u, uint64_t song_ns) {
+  for (unsigned i = u->next; i < u->count && u->item[i].first_ns < song_ns; i++) {
+    mod_upload_item_t *it = &u->item[i];
+    if (it->done < it->len) put(u, it, it->len - it->done);
+  }
+  advance(u);
+}
+
+size_t mod_upload_step(mod_upload_t *u, uint64_t deadline) {
+  size_t total = 0;
+  while (u->next < u->count) {
+    uint64_t now = pi_now_ns();
+    if (now + MOD_UPLOAD_GUARD_NS >= deadline) break;
+    double fit = (double)(deadline - MOD_UPLOAD_GUARD_NS - now) / u->byte_ns;
+    if (fit < (double)MOD_UPLOAD_MIN_CHUNK) break;
+    mod_upload_item_t *it = &u->item[u->next];
+    uint32_t bytes = fit > (double)MOD_UPLOAD_MAX_CHUNK ? MOD_UPLOAD_MAX_CHUNK : (uint32_t)fit;
+    bytes &= ~1u;
+    if (bytes > it->len - it->done) bytes = it->len - it->done;
+    put(u, it, bytes);
+    u->bytes_background += bytes;
+    total += bytes;
+    advance(u);
+  }
+  return total;
+}
+
+void mod_upload_report(const mod_upload_t *u, FILE *out) {
+  fprintf(out, "[UPLOAD] samples=%u bytes=%llu/%llu background=%llu rate=%.0fKB/s "
+               "stalls=%llu (%.1fms)\n",
+          u->count, (unsigned long long)u->bytes_done,
+          (unsigned long long)u->bytes_total,
+          (unsigned long long)u->bytes_background,
+          u->byte_ns > 0.0 ? 1e9 / u->byte_ns / 1024.0 : 0.0,
+          (unsigned long long)u->stalls, (double)u->stall_ns / 1e6);
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MIT
+// Progressive MOD sample upload.
+//
+// Samples are queued with their chip RAM addresses already assigned and
+// are written in the order the song first plays them, found by a silent
+// run of the replay engine. The player waits only for the samples of the
+// first tick; the rest go up in chunks between ticks, each sized from the
+// measured bus rate to end before the next tick is due. A sample that is
+// needed before its turn is finished on the spot and counted as a stall.
+
+#ifndef MOD_UPLOAD_H
+#define MOD_UPLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mod_replay.h"
+
+#define MOD_UPLOAD_MIN_CHUNK  256u
+#define MOD_UPLOAD_MAX_CHUNK  16384u
+#define MOD_UPLOAD_GUARD_NS   1000000ull   // stop 1 ms short of a tick
+#define MOD_UPLOAD_SCAN_NS    (30ull * 60ull * 1000000000ull)   // first 30 min
+
+typedef struct {
+  uint8_t sample;           // 1-31
+  uint32_t addr;
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t done;            // bytes written so far
+  uint64_t first_ns;        // song time of first use, UINT64_MAX if never
+} mod_upload_item_t;
+
+typedef struct {
+  mod_upload_item_t item[MOD_MAX_SAMPLES];
+  unsigned count;
+  unsigned next;            // first unfinished item
+  double byte_ns;           // running estimate of bus time per byte
+  uint64_t bytes_total;
+  uint64_t bytes_done;
+  uint64_t bytes_background;  // written between ticks
+  uint64_t stalls;
+  uint64_t stall_ns;
+} mod_upload_t;
+
+void mod_upload_init(mod_upload_t *u);
+void mod_upload_add(mod_upload_t *u, unsigned sample, uint32_t addr,
+                    const uint8_t *data, uint32_t len);
+
+// Sorts the queue by first use in the song.
+void mod_upload_plan(mod_upload_t *u, const mod_file_t *mod);
+
+// Same, from first-use times already found by mod_replay_first_use().
+void mod_upload_sort(mod_upload_t *u, const uint64_t first_ns[MOD_MAX_SAMPLES]);
+
+int mod_upload_pending(const mod_upload_t *u, unsigned sample);
+int mod_upload_done(const mod_upload_t *u);
+
+// Finishes sample now; counted as a stall once playback is running.
+void mod_upload_finish(mod_upload_t *u, unsigned sample, int stall);
+
+// Finishes every sample first used before song_ns.
+void mod_upload_until(mod_upload_t *u, uint64_t song_ns);
+
+// Uploads as much as fits before deadline (pi_now_ns() time) less the
+// guard. Returns the number of bytes written.
+size_t mod_upload_step(mod_upload_t *u, uint64_t deadline);
+
+void mod_upload_report(const mod_upload_t *u, FILE *out);
+
+#endif /* MOD_UPLOAD_H */
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: MIT
+// Modulation tables for Paula's attach mode.
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "paula_stream.h"
+#include "paula_writer.h"
+#include "paula_attach.h"
+
+#define MAX_PERIOD      0xFFFFu
+#define MAX_VOLUME      64u
+
+static void put(paula_attach_t *a, uint32_t reg, uint16_t val) {
+  ps_write_16(reg, val);
+  a->reg_writes++;
+}
+
+static int both(const paula_attach_t *a) {
+  return (a->adk_bits & (ADKF_USE0V1 << a->modulator)) &&
+         (a->adk_bits & (ADKF_USE0P1 << a->modulator));
+}
+
+// Modulator periods per table step, and words per step.
+static unsigned step_periods(const paula_attach_t *a) {
+  return (a->adk_bits & (ADKF_USE0P1 << a->modulator)) ? 2u : 1u;
+}
+
+static unsigned step_words(const paula_attach_t *a) {
+  return both(a) ? 2u : 1u;
+}
+
+int paula_attach_plan(paula_attach_t *a, const paula_sweep_t *sw, unsigned modulator,
+                      int is_pal) {
+  memset(a, 0, sizeof(*a));
+  if (modulator > 2u) {
+    fprintf(stderr, "attach: AUD%u has no channel to modulate\n", modulator);
+    return -1;
+  }
+  if (!sw->use_period && !sw->use_volume) {
+    fprintf(stderr, "attach: sweep modulates neither period nor volume\n");
+    return -1;
+  }
+  if (sw->use_period && (sw->period < PAULA_MIN_PERIOD ||
+                         (sw->shape == PAULA_SWEEP_RAMP && sw->period_to < PAULA_MIN_PERIOD))) {
+    fprintf(stderr, "attach: period below %u\n", PAULA_MIN_PERIOD);
+    return -1;
+  }
+  if (sw->use_volume && (sw->vol > MAX_VOLUME || sw->vol_to > MAX_VOLUME)) {
+    fprintf(stderr, "attach: volume above %u\n", MAX_VOLUME);
+    return -1;
+  }
+  if (!(sw->seconds > 0.0)) {
+    fprintf(stderr, "attach: sweep length must be positive\n");
+    return -1;
+  }
+  a->modulator = modulator;
+  a->clock_hz = is_pal ? 3546895.0 : 3579545.0;
+  if (sw->use_volume) a->adk_bits |= (uint16_t)(ADKF_USE0V1 << modulator);
+  if (sw->use_period) a->adk_bits |= (uint16_t)(ADKF_USE0P1 << modulator);
+
+  unsigned wps = step_words(a);
+  double steps = floor(sw->seconds * PAULA_ATTACH_STEP_HZ + 0.5);
+  if (steps < 1.0) steps = 1.0;
+  if (steps * wps > PAULA_ATTACH_MAX_WORDS) steps = PAULA_ATTACH_MAX_WORDS / wps;
+  double per = floor(sw->seconds * a->clock_hz / (steps * step_periods(a)) + 0.5);
+  if (per < PAULA_MIN_PERIOD) {
+    fprintf(stderr, "attach: %.6fs is too short to sweep\n", sw->seconds);
+    return -1;
+  }
+  if (per > MAX_PERIOD) {
+    fprintf(stderr, "attach: %.1fs is too long for one table\n", sw->seconds);
+    return -1;
+  }
+  a->mod_period = (uint16_t)per;
+  a->steps = (uint32_t)steps;
+  a->words = a->steps * wps;
+  a->hold_words = sw->shape == PAULA_SWEEP_RAMP ? wps : 0u;
+  a->step_s = per * step_periods(a) / a->clock_hz;
+  return 0;
+}
+
+size_t paula_attach_chip_bytes(const paula_attach_t *a) {
+  return (size_t)(a->words + a->hold_words) * 2u;
+}
+
+static uint16_t clamp_period(double p) {
+  if (p < PAULA_MIN_PERIOD) return PAULA_MIN_PERIOD;
+  if (p > MAX_PERIOD) return MAX_PERIOD;
+  return (uint16_t)floor(p + 0.5);
+}
+
+static uint16_t clamp_volume(double v) {
+  if (v < 0.0) return 0;
+  if (v > MAX_VOLUME) return MAX_VOLUME;
+  return (uint16_t)floor(v + 0.5);
+}
+
+// Values at x, which runs from 0 to 1 over the table.
+static void sweep_at(const paula_sweep_t *sw, double x, uint16_t *per, uint16_t *vol) {
+  if (sw->shape == PAULA_SWEEP_LFO) {
+    double s = sin(2.0 * M_PI * x);
+    *per = clamp_period((double)sw->period * exp2(-sw->cents * s / 1200.0));
+    *vol = clamp_volume((double)sw->vol + (double)sw->vol_depth * s);
+  } else {
+    *per = clamp_period((double)sw->period *
+                        pow((double)sw->period_to / (double)sw->period, x));
+    *vol = clamp_volume((double)sw->vol + ((double)sw->vol_to - (double)sw->vol) * x);
+  }
+}
+
+static uint8_t *put_step(const paula_sweep_t *sw, uint8_t *p, uint16_t per,
+                         uint16_t vol) {
+  // Volume first when both are attached.
+  if (sw->use_volume) {
+    *p++ = (uint8_t)(vol >> 8);
+    *p++ = (uint8_t)vol;
+  }
+  if (sw->use_period) {
+    *p++ = (uint8_t)(per >> 8);
+    *p++ = (uint8_t)per;
+  }
+  return p;
+}
+
+int paula_attach_start(paula_attach_t *a, const paula_sweep_t *sw, uint32_t addr) {
+  size_t bytes = paula_attach_chip_bytes(a);
+  uint8_t *buf = (uint8_t *)malloc(bytes);
+  if (!buf) {
+    fprintf(stderr, "attach: out of memory\n");
+    return -1;
+  }
+  uint8_t *p = buf;
+  uint16_t per = 0;
+  uint16_t vol = 0;
+  for (uint32_t i = 0; i < a->steps; i++) {
+    // An LFO wraps around to its first step; a ramp ends on its last.
+    double x = sw->shape == PAULA_SWEEP_LFO ? (double)i / a->steps
+             : a->steps > 1u ? (double)i / (a->steps - 1u) : 1.0;
+    sweep_at(sw, x, &per, &vol);
+    p = put_step(sw, p, per, vol);
+  }
+  if (a->hold_words) p = put_step(sw, p, per, vol);
+  addr &= ~1u;
+  write_chip_ram(addr, buf, bytes);
+  free(buf);
+  a->addr = addr;
+  a->reg_writes = 0;
+
+  uint32_t base = AUD0LCH + a->modulator * AUD_STRIDE;
+  uint16_t dma = (uint16_t)(DMAF_AUD0 << a->modulator);
+  uint16_t irq = (uint16_t)(INTF_AUD0 << a->modulator);
+  put(a, DMACON, dma);
+  put(a, ADKCON, (uint16_t)(ADKF_SETCLR | a->adk_bits));
+  put(a, base + 0x0u, (uint16_t)((addr >> 16) & 0x1Fu));
+  put(a, base + 0x2u, (uint16_t)(addr & 0xFFFFu));
+  put(a, base + 0x4u, (uint16_t)a->words);
+  put(a, base + 0x6u, a->mod_period);
+  put(a, base + 0x8u, 0);
+  put(a, INTREQ, irq);
+  put(a, DMACON, (uint16_t)(DMAF_SETCLR | DMAF_MASTER | dma));
+  if (!a->hold_words) return 0;
+
+  // Paula copied the ramp's location as DMA started; once it says so,
+  // point the registers at the hold step, which then loops after the ramp.
+  uint64_t t0 = pi_now_ns();
+  while (!(ps_read_16(INTREQR) & irq)) {
+    if (pi_now_ns() - t0 > PAULA_LATCH_TIMEOUT_NS) {
+      fprintf(stderr, "attach: no AUD%u interrupt, sweep stopped\n", a->modulator);
+      paula_attach_stop(a);
+      return -1;
+    }
+  }
+  uint32_t hold = addr + a->words * 2u;
+  put(a, base + 0x0u, (uint16_t)((hold >> 16) & 0x1Fu));
+  put(a, base + 0x2u, (uint16_t)(hold & 0xFFFFu));
+  put(a, base + 0x4u, (uint16_t)a->hold_words);
+  put(a, INTREQ, irq);
+  return 0;
+}
+
+void paula_attach_stop(paula_attach_t *a) {
+  put(a, DMACON, (uint16_t)(DMAF_AUD0 << a->modulator));
+  put(a, ADKCON, a->adk_bits);
+  put(a, INTREQ, (uint16_t)(INTF_AUD0 << a->modulator));
+}
+
+void paula_attach_report(const paula_attach_t *a, FILE *out) {
+  const char *what = both(a) ? "period+volume"
+                   : (a->adk_bits & (ADKF_USE0P1 << a->modulator)) ? "period" : "volume";
+  fprintf(out, "[ATTACH] AUD%u -> AUD%u %s %s: %u steps of %.3fms (period %u), "
+          "%zu bytes chip, %llu register writes\n",
+          a->modulator, a->modulator + 1u, what, a->hold_words ? "ramp" : "lfo",
+          a->steps, a->step_s * 1e3, a->mod_period, paula_attach_chip_bytes(a),
+          (unsigned long long)a->reg_writes);
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+// Hardware pitch and volume sweeps through Paula's attach mode.
+//
+// With ADKCON's USEnPm/USEnVm bits set, channel n stops making sound and
+// its DMA data goes into the period or volume register of channel n+1
+// instead. A table of values in chip RAM then sweeps the carrier with no
+// register writes from the Pi at all: an LFO table loops by itself, and a
+// ramp plays once and then loops a one-step table holding its end value.
+//
+// Paula takes one volume word per modulator period, and one period word
+// per two; with both attached, words alternate volume then period, a
+// pair per two periods. The planner picks the modulator period so the
+// table steps at about PAULA_ATTACH_STEP_HZ and fits in one AUDxLEN.
+
+#ifndef PAULA_ATTACH_H
+#define PAULA_ATTACH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PAULA_ATTACH_STEP_HZ 1000.0
+#define PAULA_ATTACH_MAX_WORDS 0xFFFFu
+
+typedef enum {
+  PAULA_SWEEP_LFO = 0,      // sine around the start value, loops
+  PAULA_SWEEP_RAMP          // start to end once, then holds the end
+} paula_sweep_shape_t;
+
+typedef struct {
+  paula_sweep_shape_t shape;
+  int use_period;
+  int use_volume;
+  uint16_t period;          // LFO centre or ramp start
+  uint16_t period_to;       // ramp end; the ramp is linear in pitch
+  double cents;             // LFO depth, +-cents
+  uint16_t vol;             // LFO centre or ramp start, 0-64
+  uint16_t vol_to;          // ramp end
+  unsigned vol_depth;       // LFO depth, +-steps
+  double seconds;           // LFO cycle or ramp length
+} paula_sweep_t;
+
+typedef struct {
+  // Filled in by paula_attach_plan().
+  unsigned modulator;       // AUD0-2, modulating AUD1-3
+  double clock_hz;
+  uint16_t mod_period;
+  uint32_t steps;
+  uint32_t words;           // table length
+  uint32_t hold_words;      // ramp end step, 0 for an LFO
+  double step_s;
+  uint16_t adk_bits;
+
+  // Filled in by paula_attach_start().
+  uint32_t addr;
+  uint64_t reg_writes;      // register writes, the table upload aside
+} paula_attach_t;
+
+// Checks the sweep and sizes its table. Returns -1 with a message if the
+// sweep or modulator is unusable.
+int paula_attach_plan(paula_attach_t *a, const paula_sweep_t *sw, unsigned modulator,
+                      int is_pal);
+
+// Chip RAM for the table and the hold step.
+size_t paula_attach_chip_bytes(const paula_attach_t *a);
+
+// Builds the table, uploads it to addr (word aligned) and starts the
+// modulator. The carrier, AUD(modulator+1), should already be playing
+// from its own DMA. Returns -1 if memory runs out, or with the modulator
+// stopped and detached again if Paula never starts the ramp.
+int paula_attach_start(paula_attach_t *a, const paula_sweep_t *sw, uint32_t addr);
+
+// Stops the modulator and detaches it. The carrier keeps the last
+// values it was given.
+void paula_attach_stop(paula_attach_t *a);
+
+void paula_attach_report(const paula_attach_t *a, FILE *out);
+
+#endif /* PAULA_ATTACH_H */
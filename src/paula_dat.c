@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: MIT
+// CPU-driven audio through AUDxDAT, paced by the audio interrupt.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "pi_time.h"
+#include "paula_stream.h"
+#include "paula_dat.h"
+
+#define DAT_DMA_MASK    (DMAF_AUD0 | DMAF_AUD1)
+#define DAT_INT_MASK    (INTF_AUD0 | INTF_AUD1)
+#define DAT_SPIN_NS     300000ull           // poll INTREQR for the last 300 us
+#define DAT_TIMEOUT_NS  100000000ull        // give up 100 ms after a missed word
+#define DAT_PROBE_WORDS 4096u
+
+static double clock_hz(int is_pal) {
+  return is_pal ? 3546895.0 : 3579545.0;
+}
+
+static void write_words(const int8_t *l, const int8_t *r) {
+  ps_write_16(AUD0DAT, ((uint16_t)(uint8_t)l[0] << 8) | (uint8_t)l[1]);
+  ps_write_16(AUD1DAT, ((uint16_t)(uint8_t)r[0] << 8) | (uint8_t)r[1]);
+}
+
+// Takes the next two frames from the source. Whatever it cannot supply
+// yet is padded with the last sample, so the channels keep running.
+// Returns 0 for a full word, 1 for a padded one, -1 at the end.
+static int next_word(paula_dat_fill_fn fill, void *ctx, int8_t *l, int8_t *r,
+                     uint64_t *frames) {
+  size_t have = 0;
+  while (have < 2u) {
+    int8_t *const bufs[PAULA_DAT_CHANNELS] = {l + have, r + have};
+    int n = fill(ctx, bufs, 2u - have);
+    if (n < 0) {
+      if (have == 0) return -1;
+      break;
+    }
+    if (n == 0) break;
+    have += (size_t)n;
+  }
+  *frames += have;
+  if (have == 2u) return 0;
+  // Hold the sample that is playing now.
+  for (size_t i = have; i < 2u; i++) {
+    l[i] = i ? l[i - 1u] : l[1];
+    r[i] = i ? r[i - 1u] : r[1];
+  }
+  return 1;
+}
+
+// Polls until AUD0 and AUD1 have both taken their word, or the timeout
+// after due passes.
+static int wait_words(uint64_t due, volatile sig_atomic_t *stop, uint64_t *seen) {
+  uint64_t now = pi_now_ns();
+  if (due > now + DAT_SPIN_NS) pi_sleep_ns(due - now - DAT_SPIN_NS);
+  for (;;) {
+    if ((ps_read_16(INTREQR) & DAT_INT_MASK) == DAT_INT_MASK) break;
+    if (stop && *stop) return -1;
+    now = pi_now_ns();
+    if (now > due + DAT_TIMEOUT_NS) {
+      fprintf(stderr, "dat: no AUD0/AUD1 interrupt, is audio DMA still on?\n");
+      return -1;
+    }
+  }
+  ps_write_16(INTREQ, DAT_INT_MASK);
+  *seen = pi_now_ns();
+  return 0;
+}
+
+void paula_dat_probe(paula_dat_probe_t *p, int is_pal) {
+  memset(p, 0, sizeof(*p));
+  lat_hist_t *h = (lat_hist_t *)malloc(sizeof(*h));
+  if (!h) return;
+  lat_hist_init(h);
+  ps_write_16(DMACON, DAT_DMA_MASK);
+  ps_write_16(AUD0VOL, 0);
+  ps_write_16(AUD1VOL, 0);
+  ps_write_16(AUD0PER, PAULA_MIN_PERIOD);
+  ps_write_16(AUD1PER, PAULA_MIN_PERIOD);
+  uint64_t poll_ns = 0;
+  for (unsigned i = 0; i < DAT_PROBE_WORDS; i++) {
+    // The same accesses as a word in paula_dat_run(), minus the wait.
+    uint64_t t0 = pi_now_ns();
+    (void)ps_read_16(INTREQR);
+    uint64_t t1 = pi_now_ns();
+    ps_write_16(INTREQ, DAT_INT_MASK);
+    ps_write_16(AUD0DAT, 0);
+    ps_write_16(AUD1DAT, 0);
+    uint64_t t2 = pi_now_ns();
+    poll_ns += t1 - t0;
+    lat_hist_add(h, t2 - t0);
+  }
+  ps_write_16(INTREQ, DAT_INT_MASK);
+  p->word_ns = h->sum_ns / DAT_PROBE_WORDS;
+  p->worst_ns = lat_hist_percentile_ns(h, 0.999);
+  // A word has to be written while the previous one plays, and the poll
+  // that sees its interrupt may have just missed it.
+  double need_ns = (double)p->worst_ns + (double)poll_ns / DAT_PROBE_WORDS;
+  double clock_max = clock_hz(is_pal) / (double)PAULA_MIN_PERIOD;
+  p->max_rate_hz = need_ns > 0.0 ? 2e9 / need_ns : clock_max;
+  if (p->max_rate_hz > clock_max) p->max_rate_hz = clock_max;
+  free(h);
+}
+
+int paula_dat_run(paula_dat_t *d, paula_dat_fill_fn fill, void *ctx,
+                  volatile sig_atomic_t *stop, int is_pal) {
+  d->words = 0;
+  d->frames = 0;
+  d->underruns = 0;
+  d->late = 0;
+  lat_hist_init(&d->service);
+  lat_hist_init(&d->latency);
+  if (d->period < PAULA_MIN_PERIOD) {
+    fprintf(stderr, "dat: period %u is below %u\n", d->period, PAULA_MIN_PERIOD);
+    return -1;
+  }
+  double word_s = 2.0 * (double)d->period / clock_hz(is_pal);
+  d->word_ns = (uint64_t)(word_s * 1e9);
+  uint64_t max_words = d->seconds ? (uint64_t)((double)d->seconds / word_s) : 0u;
+
+  ps_write_16(DMACON, DAT_DMA_MASK);
+  ps_write_16(INTREQ, DAT_INT_MASK);
+  ps_write_16(AUD0PER, d->period);
+  ps_write_16(AUD1PER, d->period);
+  ps_write_16(AUD0VOL, d->vol);
+  ps_write_16(AUD1VOL, d->vol);
+
+  int8_t l[2] = {0, 0};
+  int8_t r[2] = {0, 0};
+  int rc = 0;
+  uint64_t due = 0;                   // when Paula takes the word just written
+  int got = next_word(fill, ctx, l, r, &d->frames);
+  while (got >= 0) {
+    if (got > 0) d->underruns++;
+    uint64_t fetched = pi_now_ns();
+    write_words(l, r);
+    uint64_t written = pi_now_ns();
+    lat_hist_add(&d->latency, written - fetched);
+    if (d->words > 0) lat_hist_add(&d->service, written - due);
+    if (d->words == 0 || written > due + d->word_ns) {
+      // The first word starts both channels. A late one finds them idle,
+      // the word before it having ended, and restarts them the same way:
+      // they take it at once.
+      if (d->words > 0) d->late++;
+      due = written;
+    } else {
+      due += d->word_ns;
+    }
+    d->words++;
+    if ((max_words && d->words >= max_words) || (stop && *stop)) break;
+
+    uint64_t seen = 0;
+    if (wait_words(due, stop, &seen) != 0) {
+      rc = (stop && *stop) ? 0 : -1;
+      break;
+    }
+    if (seen < due) due = seen;       // Paula's clock ran ahead of ours
+    got = next_word(fill, ctx, l, r, &d->frames);
+  }
+
+  // Park both channels at zero, as the streamer's silent tail does, and
+  // mute them once that word has played.
+  // At the end of the source AUDxDAT is already free; after a stop the
+  // last word may still be waiting in it.
+  static const int8_t zero[2] = {0, 0};
+  if (d->words > 0 && rc == 0) {
+    uint64_t seen = 0;
+    if (got < 0 || wait_words(due, NULL, &seen) == 0) write_words(zero, zero);
+    pi_sleep_ns(d->word_ns * 2u);
+  }
+  ps_write_16(AUD0VOL, 0);
+  ps_write_16(AUD1VOL, 0);
+  ps_write_16(INTREQ, DAT_INT_MASK);
+  return rc;
+}
+
+void paula_dat_report(const paula_dat_t *d, FILE *out) {
+  fprintf(out, "[DAT] words=%llu frames=%llu underruns=%llu late=%llu word=%.1fus\n",
+          (unsigned long long)d->words, (unsigned long long)d->frames,
+          (unsigned long long)d->underruns, (unsigned long long)d->late,
+          (double)d->word_ns / 1e3);
+  lat_hist_report(&d->service, "DAT service", d->word_ns, out);
+  // A frame waits up to a word for the next fetch, then for the word
+  // playing to end; the second of a pair plays a period after the first.
+  uint64_t e2e = d->word_ns * 2u + d->latency.max_ns + d->word_ns / 2u;
+  fprintf(out, "[DAT] source to DAC: at most %.1fus (2.5 words + %.1fus bus)\n",
+          (double)e2e / 1e3, (double)d->latency.max_ns / 1e3);
+}
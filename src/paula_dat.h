@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MIT
+// CPU-driven audio through AUDxDAT, for sub-millisecond latency.
+//
+// With a channel's DMA off, a word written to AUDxDAT plays as two bytes
+// at the channel's period. Paula raises the channel's interrupt as it
+// takes the word into its output buffer, so the next word can be written
+// while this one plays; if none has arrived when it ends, the channel
+// falls idle holding its last byte. The writer polls INTREQR until AUD0
+// and AUD1 have both taken their word, then writes the next sample pair
+// of each. Nothing is buffered in chip RAM: a frame the source has ready
+// waits at most one word (two periods) to be fetched and one more for the
+// word playing to end.
+//
+// Every word costs an INTREQR poll and three writes on the bus, so the
+// rate the bus can keep up with is much lower than for DMA.
+// paula_dat_probe() times that loop on the machine it runs on.
+
+#ifndef PAULA_DAT_H
+#define PAULA_DAT_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lat_hist.h"
+
+#define PAULA_DAT_CHANNELS 2u         // AUD0 left, AUD1 right
+
+// Writes up to max_frames signed 8-bit frames into bufs[0..1] without
+// blocking. Returns the frames written, 0 if none are ready yet, or -1
+// once the source has ended.
+typedef int (*paula_dat_fill_fn)(void *ctx, int8_t *const *bufs, size_t max_frames);
+
+typedef struct {
+  // Set by the caller before paula_dat_run().
+  uint16_t period;
+  uint16_t vol;
+  unsigned seconds;         // 0 = until the source ends
+
+  // Results.
+  uint64_t words;           // sample pairs written per channel
+  uint64_t frames;          // frames taken from the source
+  uint64_t underruns;       // words held because the source had nothing
+  uint64_t late;            // words Paula ran out before we wrote the next
+  lat_hist_t service;       // interrupt due -> both words written
+  lat_hist_t latency;       // frames fetched -> both words written
+  uint64_t word_ns;
+} paula_dat_t;
+
+typedef struct {
+  uint64_t word_ns;         // mean bus time per word
+  uint64_t worst_ns;        // 99.9th percentile, with scheduling jitter
+  double max_rate_hz;       // samples per second the worst case keeps up with
+} paula_dat_probe_t;
+
+// Times the per-word bus work with the volume at 0. Leaves AUD0/AUD1
+// idle with DMA off.
+void paula_dat_probe(paula_dat_probe_t *p, int is_pal);
+
+// Plays until the source ends, d->seconds elapse or *stop is set. Turns
+// AUD0/AUD1 DMA off first. Returns -1 if Paula stops raising the audio
+// interrupt.
+int paula_dat_run(paula_dat_t *d, paula_dat_fill_fn fill, void *ctx,
+                  volatile sig_atomic_t *stop, int is_pal);
+
+void paula_dat_report(const paula_dat_t *d, FILE *out);
+
+#endif /* PAULA_DAT_H */
@@ -0,0 +1,516 @@
+// SPDX-License-Identifier: MIT
+// Software model of Paula's audio DMA, for measuring playback paths.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "paula.h"
+#include "paula_sim.h"
+
+#define MIN_PERIOD      124u            // DMA cannot fetch faster
+#define CIA_BASE        0xBFD000u
+#define CIA_END         0xBFF000u
+#define WAV_HEADER      44u
+#define WAV_BUF_BYTES   65536u
+
+// Beam counters for VPOSR/VHPOSR, in colour clocks and lines.
+#define LINE_CLKS       227u
+#define LINES_PAL       313u
+#define LINES_NTSC      263u
+#define AGNUS_ID_PAL    0x20u           // ECS Agnus
+#define AGNUS_ID_NTSC   0x30u
+#define DENISE_ID_ECS   0xFCu
+
+static void put_le(uint8_t *p, uint32_t v, unsigned bytes) {
+  for (unsigned i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8u * i));
+}
+
+static void wav_header(uint8_t *h, unsigned rate_hz, uint32_t data_bytes) {
+  memcpy(h, "RIFF", 4);
+  put_le(h + 4, 36u + data_bytes, 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put_le(h + 16, 16u, 4);
+  put_le(h + 20, 1u, 2);                // PCM
+  put_le(h + 22, 2u, 2);                // stereo
+  put_le(h + 24, rate_hz, 4);
+  put_le(h + 28, rate_hz * 4u, 4);
+  put_le(h + 32, 4u, 2);
+  put_le(h + 34, 16u, 2);
+  memcpy(h + 36, "data", 4);
+  put_le(h + 40, data_bytes, 4);
+}
+
+int paula_sim_init(paula_sim_t *s, int is_pal, unsigned rate_hz, const char *wav_path) {
+  memset(s, 0, sizeof(*s));
+  s->clock_hz = is_pal ? 3546895.0 : 3579545.0;
+  s->rate_hz = rate_hz ? rate_hz : PAULA_SIM_RATE_HZ;
+  s->click_level = PAULA_SIM_CLICK;
+  s->gap_max_ns = PAULA_SIM_GAP_MAX_NS;
+  s->agnus_id = is_pal ? AGNUS_ID_PAL : AGNUS_ID_NTSC;
+  s->chip = (uint8_t *)calloc(PAULA_SIM_CHIP_BYTES, 1);
+  if (!s->chip) {
+    fprintf(stderr, "sim: out of memory\n");
+    return -1;
+  }
+  if (wav_path) {
+    s->wav_buf = (uint8_t *)malloc(WAV_BUF_BYTES);
+    s->wav = fopen(wav_path, "wb");
+    uint8_t h[WAV_HEADER];
+    wav_header(h, s->rate_hz, 0);
+    if (!s->wav_buf || !s->wav || fwrite(h, 1, sizeof(h), s->wav) != sizeof(h)) {
+      perror(wav_path);
+      if (s->wav) fclose(s->wav);
+      free(s->wav_buf);
+      free(s->chip);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static uint64_t clk_at(paula_sim_t *s, uint64_t t_ns) {
+  if (!s->started) {
+    s->started = 1;
+    s->t0_ns = t_ns;
+  }
+  if (t_ns < s->t0_ns) return 0;
+  uint64_t clk = (uint64_t)((double)(t_ns - s->t0_ns) * s->clock_hz / 1e9);
+  return clk > s->clk ? clk : s->clk;
+}
+
+static uint64_t frame_clk(const paula_sim_t *s, uint64_t frame) {
+  return (uint64_t)((double)frame * s->clock_hz / (double)s->rate_hz);
+}
+
+static int level(const paula_sim_voice_t *v) {
+  if (v->attach) return 0;
+  unsigned vol = (v->vol & 0x40u) ? 64u : (v->vol & 0x3Fu);
+  return (int)v->sample * (int)vol;
+}
+
+static void log_event(paula_sim_t *s, unsigned kind, unsigned ch, uint64_t clk,
+                      uint64_t frame, uint64_t amount) {
+  uint64_t n = s->total[kind]++;
+  s->v[ch].count[kind]++;
+  if (n >= PAULA_SIM_LIST) return;
+  paula_sim_event_t *e = &s->list[kind][n];
+  e->voice = (uint8_t)ch;
+  e->clk = clk;
+  e->frame = frame;
+  e->amount = amount;
+}
+
+static void check_click(paula_sim_t *s, unsigned ch, int before) {
+  int step = level(&s->v[ch]) - before;
+  if (step < 0) step = -step;
+  if ((unsigned)step > s->click_level) {
+    log_event(s, SIM_CLICK, ch, s->clk, s->frames, (uint64_t)step);
+  }
+}
+
+static void flush_wav(paula_sim_t *s) {
+  if (s->wav && s->wav_fill) fwrite(s->wav_buf, 1, s->wav_fill, s->wav);
+  s->wav_fill = 0;
+}
+
+// Output frames due before clk, channels 0/3 left and 1/2 right.
+static void render(paula_sim_t *s, uint64_t clk) {
+  while (frame_clk(s, s->frames) < clk) {
+    int side[2] = {
+      (level(&s->v[0]) + level(&s->v[3])) * 2,
+      (level(&s->v[1]) + level(&s->v[2])) * 2,
+    };
+    for (unsigned i = 0; i < 2; i++) {
+      int x = side[i] > 32767 ? 32767 : side[i];
+      if (x > s->peak) s->peak = (int16_t)x;
+      if (s->wav) {
+        put_le(s->wav_buf + s->wav_fill, (uint16_t)(int16_t)x, 2);
+        s->wav_fill += 2;
+      }
+    }
+    if (s->wav_fill == WAV_BUF_BYTES) flush_wav(s);
+    s->frames++;
+  }
+}
+
+// Starts a block from the location registers and raises the interrupt.
+// A reload while the last interrupt is still unacknowledged means the
+// driver missed this block.
+static void copy_block(paula_sim_t *s, unsigned ch, int reload) {
+  paula_sim_voice_t *v = &s->v[ch];
+  v->ptr = v->lc & (PAULA_SIM_CHIP_BYTES - 1u) & ~1u;
+  v->left = v->len ? v->len : 0x10000u;
+  v->blocks++;
+  v->stale = 0;
+  if (reload) {
+    if (!v->written) v->repeats++;
+    if (v->pending) {
+      if (!v->missed) {
+        v->missed_clk = s->clk;
+        v->missed_frame = s->frames;
+        v->missed_step = 0;
+      }
+      v->missed++;
+      v->stale = !v->written;
+    }
+  } else {
+    v->missed = 0;
+  }
+  v->written = 0;
+  v->pending = 1;
+  s->intreq = (uint16_t)(s->intreq | (INTF_AUD0 << ch));
+}
+
+// With DMA off the next word comes from AUDxDAT, and taking it raises
+// the interrupt. Returns 0 if none was written: the channel goes idle and
+// holds its last byte.
+static int take_dat(paula_sim_t *s, unsigned ch) {
+  paula_sim_voice_t *v = &s->v[ch];
+  if (!v->dat_full) {
+    v->manual = 0;
+    v->starved = 1;
+    v->starve_clk = s->clk;
+    v->starve_frame = s->frames;
+    return 0;
+  }
+  v->word = v->dat;
+  v->dat_full = 0;
+  v->blocks++;
+  v->pending = 1;
+  s->intreq = (uint16_t)(s->intreq | (INTF_AUD0 << ch));
+  v->sample = (int8_t)(v->word >> 8);
+  v->low = 1;
+  return 1;
+}
+
+// Sends an attached channel's word to the next channel. Volume alone
+// takes a word per period; period alone one per two, the second period
+// fetching nothing; both alternate volume and period words. AUD3 has no
+// channel to modulate and is only silenced.
+static void attach_word(paula_sim_t *s, unsigned ch) {
+  paula_sim_voice_t *v = &s->v[ch];
+  paula_sim_voice_t *t = ch + 1u < PAULA_SIM_VOICES ? &s->v[ch + 1u] : NULL;
+  switch (v->attach) {
+    case SIM_ATTACH_VOL:
+      if (t) t->vol = v->word;
+      break;
+    case SIM_ATTACH_PER:
+      if (t) t->per = v->word;
+      v->low = 1;
+      break;
+    default:
+      if (t && v->low) t->per = v->word;
+      if (t && !v->low) t->vol = v->word;
+      v->low = !v->low;
+      break;
+  }
+}
+
+// Plays the next byte: the low half of the current word, or a new word,
+// starting the next block first when this one is used up.
+static void step(paula_sim_t *s, unsigned ch) {
+  paula_sim_voice_t *v = &s->v[ch];
+  if (v->low && v->attach != (SIM_ATTACH_VOL | SIM_ATTACH_PER)) {
+    if (!v->attach) v->sample = (int8_t)(v->word & 0xFFu);
+    v->low = 0;
+  } else if (v->manual) {
+    if (!take_dat(s, ch)) return;
+  } else {
+    int before = level(v);
+    int reloaded = !v->left;
+    if (reloaded) copy_block(s, ch, 1);
+    v->word = (uint16_t)((s->chip[v->ptr] << 8) | s->chip[v->ptr + 1u]);
+    v->ptr = (v->ptr + 2u) & (PAULA_SIM_CHIP_BYTES - 1u);
+    v->left--;
+    if (v->attach) {
+      attach_word(s, ch);
+    } else {
+      v->sample = (int8_t)(v->word >> 8);
+      v->low = 1;
+    }
+    if (reloaded && v->stale && v->missed == 1) {
+      // A click only if the driver turns out to be late, see write_intreq().
+      int jump = level(v) - before;
+      v->missed_step = (unsigned)(jump < 0 ? -jump : jump);
+    }
+  }
+  v->next_clk += v->per < MIN_PERIOD ? MIN_PERIOD : v->per;
+}
+
+// Runs the channels up to clk; bytes due at clk are played before a
+// write made at that time takes effect.
+static void run(paula_sim_t *s, uint64_t clk) {
+  for (;;) {
+    uint64_t next = clk;
+    for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+      if ((s->v[ch].on || s->v[ch].manual) && s->v[ch].next_clk < next) {
+        next = s->v[ch].next_clk;
+      }
+    }
+    render(s, next);
+    s->clk = next;
+    for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+      while ((s->v[ch].on || s->v[ch].manual) && s->v[ch].next_clk <= next) step(s, ch);
+    }
+    if (next == clk) break;
+  }
+}
+
+static void write_dmacon(paula_sim_t *s, uint16_t val) {
+  if (val & DMAF_SETCLR) {
+    s->dmacon = (uint16_t)(s->dmacon | (val & 0x7FFFu));
+  } else {
+    s->dmacon = (uint16_t)(s->dmacon & ~val);
+  }
+  uint64_t gap_clk = (uint64_t)((double)s->gap_max_ns * s->clock_hz / 1e9);
+  for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+    paula_sim_voice_t *v = &s->v[ch];
+    // Touching the DMA bit resets AUDxDAT playback too, so an idle
+    // channel restarted afterwards is a new start, not a late word.
+    if (val & (DMAF_AUD0 << ch)) v->starved = 0;
+    int on = (s->dmacon & DMAF_MASTER) && (s->dmacon & (DMAF_AUD0 << ch));
+    if (on == v->on) continue;
+    if (!on) {
+      // The output holds the last byte played.
+      v->on = 0;
+      v->off_clk = s->clk;
+      v->off_frame = s->frames;
+      continue;
+    }
+    if (v->ever_on && !v->attach && s->clk - v->off_clk <= gap_clk) {
+      log_event(s, SIM_GAP, ch, v->off_clk, v->off_frame, s->clk - v->off_clk);
+    }
+    int before = level(v);
+    v->on = 1;
+    v->manual = 0;
+    v->ever_on = 1;
+    v->low = 0;
+    v->next_clk = s->clk;
+    copy_block(s, ch, 0);
+    step(s, ch);
+    check_click(s, ch, before);
+  }
+}
+
+static void write_intreq(paula_sim_t *s, uint16_t val) {
+  if (val & INTF_SETCLR) {
+    s->intreq = (uint16_t)(s->intreq | (val & 0x7FFFu));
+    return;
+  }
+  s->intreq = (uint16_t)(s->intreq & ~val);
+  for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+    paula_sim_voice_t *v = &s->v[ch];
+    if (!(val & (INTF_AUD0 << ch))) continue;
+    if (v->on && v->pending && v->missed) {
+      log_event(s, SIM_LATE, ch, v->missed_clk, v->missed_frame, s->clk - v->missed_clk);
+      if (v->missed_step > s->click_level) {
+        log_event(s, SIM_CLICK, ch, v->missed_clk, v->missed_frame, v->missed_step);
+      }
+    }
+    v->pending = 0;
+    v->missed = 0;
+  }
+}
+
+static void write_custom(paula_sim_t *s, uint32_t addr, uint16_t val) {
+  if (addr >= AUD0LCH && addr < AUD0LCH + PAULA_SIM_VOICES * AUD_STRIDE) {
+    unsigned ch = (addr - AUD0LCH) / AUD_STRIDE;
+    paula_sim_voice_t *v = &s->v[ch];
+    switch ((addr - AUD0LCH) % AUD_STRIDE) {
+      case 0x0:
+        v->lc = (v->lc & 0xFFFFu) | ((uint32_t)(val & 0x1Fu) << 16);
+        v->written = 1;
+        break;
+      case 0x2:
+        v->lc = (v->lc & 0xFFFF0000u) | (val & 0xFFFEu);
+        v->written = 1;
+        break;
+      case 0x4:
+        v->len = val;
+        v->written = 1;
+        break;
+      case 0x6:
+        v->per = val;
+        break;
+      case 0x8: {
+        int before = level(v);
+        v->vol = val;
+        check_click(s, ch, before);
+        break;
+      }
+      case 0xA:
+        v->dat = val;
+        v->dat_full = 1;
+        if (!v->on && !v->manual) {
+          // An idle channel takes the word at once. If it ran dry before,
+          // the driver was late by the time it stood idle.
+          if (v->starved) {
+            log_event(s, SIM_LATE, ch, v->starve_clk, v->starve_frame,
+                      s->clk - v->starve_clk);
+            v->starved = 0;
+          }
+          v->manual = 1;
+          v->low = 0;
+          v->next_clk = s->clk;
+          step(s, ch);
+        }
+        break;
+      default:
+        break;
+    }
+    return;
+  }
+  switch (addr) {
+    case DMACON:
+      write_dmacon(s, val);
+      break;
+    case INTREQ:
+      write_intreq(s, val);
+      break;
+    case INTENA:
+      s->intena = (val & INTF_SETCLR) ? (uint16_t)(s->intena | (val & 0x7FFFu))
+                                      : (uint16_t)(s->intena & ~val);
+      break;
+    case ADKCON:
+      s->adkcon = (val & ADKF_SETCLR) ? (uint16_t)(s->adkcon | (val & 0x7FFFu))
+                                      : (uint16_t)(s->adkcon & ~val);
+      for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+        unsigned att = 0;
+        if (s->adkcon & (ADKF_USE0V1 << ch)) att |= SIM_ATTACH_VOL;
+        if (s->adkcon & (ADKF_USE0P1 << ch)) att |= SIM_ATTACH_PER;
+        if (att != s->v[ch].attach) s->v[ch].low = 0;
+        s->v[ch].attach = att;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static uint16_t read_custom(const paula_sim_t *s, uint32_t addr) {
+  unsigned lines = s->agnus_id == AGNUS_ID_PAL ? LINES_PAL : LINES_NTSC;
+  uint64_t line = (s->clk / LINE_CLKS) % lines;
+  switch (addr) {
+    case DMACONR:
+      return s->dmacon;
+    case INTREQR:
+      return s->intreq;
+    case INTENAR:
+      return s->intena;
+    case ADKCONR:
+      return s->adkcon;
+    case VPOSR:
+      return (uint16_t)((s->agnus_id << 8) | (line >> 8));
+    case VHPOSR:
+      return (uint16_t)(((line & 0xFFu) << 8) | (s->clk % LINE_CLKS));
+    case DENISEID:
+      return DENISE_ID_ECS;
+    default:
+      return 0;
+  }
+}
+
+void paula_sim_write(paula_sim_t *s, uint64_t t_ns, uint32_t addr, unsigned size,
+                     uint32_t val) {
+  run(s, clk_at(s, t_ns));
+  addr &= 0xFFFFFFu;
+  if (size == 32) {
+    paula_sim_write(s, t_ns, addr, 16, val >> 16);
+    paula_sim_write(s, t_ns, addr + 2u, 16, val & 0xFFFFu);
+    return;
+  }
+  if (addr < PAULA_SIM_CHIP_BYTES) {
+    if (size == 8) {
+      s->chip[addr] = (uint8_t)val;
+    } else {
+      s->chip[addr & ~1u] = (uint8_t)(val >> 8);
+      s->chip[addr | 1u] = (uint8_t)val;
+    }
+    return;
+  }
+  if (addr >= CIA_BASE && addr < CIA_END) {
+    s->cia[(addr >> 12) & 1u][(addr >> 8) & 0x0Fu] = (uint8_t)val;
+    return;
+  }
+  if (addr >= CUSTOM_BASE && addr < CUSTOM_BASE + 0x200u && size == 16) {
+    write_custom(s, addr & ~1u, (uint16_t)val);
+  }
+}
+
+uint32_t paula_sim_read(paula_sim_t *s, uint64_t t_ns, uint32_t addr, unsigned size) {
+  run(s, clk_at(s, t_ns));
+  addr &= 0xFFFFFFu;
+  if (size == 32) {
+    uint32_t hi = paula_sim_read(s, t_ns, addr, 16);
+    return (hi << 16) | paula_sim_read(s, t_ns, addr + 2u, 16);
+  }
+  if (addr < PAULA_SIM_CHIP_BYTES) {
+    if (size == 8) return s->chip[addr];
+    return ((uint32_t)s->chip[addr & ~1u] << 8) | s->chip[addr | 1u];
+  }
+  if (addr >= CIA_BASE && addr < CIA_END) return s->cia[(addr >> 12) & 1u][(addr >> 8) & 0x0Fu];
+  if (addr >= CUSTOM_BASE && addr < CUSTOM_BASE + 0x200u) {
+    uint16_t v = read_custom(s, addr & ~1u);
+    if (size == 8) return (addr & 1u) ? (v & 0xFFu) : (uint32_t)(v >> 8);
+    return v;
+  }
+  return 0;
+}
+
+void paula_sim_advance(paula_sim_t *s, uint64_t t_ns) {
+  run(s, clk_at(s, t_ns));
+}
+
+void paula_sim_finish(paula_sim_t *s, uint64_t t_ns) {
+  paula_sim_advance(s, t_ns);
+  if (s->wav) {
+    flush_wav(s);
+    uint8_t h[WAV_HEADER];
+    wav_header(h, s->rate_hz, (uint32_t)(s->frames * 4u));
+    if (fseek(s->wav, 0, SEEK_SET) == 0) fwrite(h, 1, sizeof(h), s->wav);
+    fclose(s->wav);
+    s->wav = NULL;
+  }
+  free(s->wav_buf);
+  free(s->chip);
+  s->wav_buf = NULL;
+  s->chip = NULL;
+}
+
+void paula_sim_report(const paula_sim_t *s, FILE *out) {
+  static const char *const kind_name[SIM_KINDS] = {"late", "gap", "click"};
+  double secs = (double)s->frames / (double)s->rate_hz;
+  fprintf(out, "[SIM] %.3fs rendered (%llu frames at %u Hz) peak=%.1f%% late=%llu gaps=%llu "
+               "clicks=%llu\n",
+          secs, (unsigned long long)s->frames, s->rate_hz, 100.0 * s->peak / 32767.0,
+          (unsigned long long)s->total[SIM_LATE], (unsigned long long)s->total[SIM_GAP],
+          (unsigned long long)s->total[SIM_CLICK]);
+  for (unsigned ch = 0; ch < PAULA_SIM_VOICES; ch++) {
+    const paula_sim_voice_t *v = &s->v[ch];
+    if (!v->blocks) continue;
+    fprintf(out, "[SIM] AUD%u blocks=%llu repeats=%llu late=%llu gaps=%llu clicks=%llu\n", ch,
+            (unsigned long long)v->blocks, (unsigned long long)v->repeats,
+            (unsigned long long)v->count[SIM_LATE], (unsigned long long)v->count[SIM_GAP],
+            (unsigned long long)v->count[SIM_CLICK]);
+  }
+  for (unsigned k = 0; k < SIM_KINDS; k++) {
+    uint64_t n = s->total[k] < PAULA_SIM_LIST ? s->total[k] : PAULA_SIM_LIST;
+    for (uint64_t i = 0; i < n; i++) {
+      const paula_sim_event_t *e = &s->list[k][i];
+      fprintf(out, "[SIM] %-5s AUD%u frame %llu (%.6fs) ", kind_name[k], e->voice,
+              (unsigned long long)e->frame, (double)e->frame / (double)s->rate_hz);
+      if (k == SIM_CLICK) {
+        fprintf(out, "step %llu\n", (unsigned long long)e->amount);
+      } else {
+        fprintf(out, "%s %.3fms\n", k == SIM_LATE ? "by" : "for",
+                (double)e->amount * 1e3 / s->clock_hz);
+      }
+    }
+    if (s->total[k] > n) {
+      fprintf(out, "[SIM] %-5s ... %llu more\n", kind_name[k],
+              (unsigned long long)(s->total[k] - n));
+    }
+  }
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: MIT
+// Software model of Paula's audio DMA, for measuring playback paths.
+//
+// Bus writes go in with the host time they were made at. Between writes
+// the model runs the four audio channels in colour clocks: a channel
+// whose DMA is switched on copies AUDxLC/AUDxLEN, raises its interrupt
+// and plays the block, one byte per period; at the end of each block it
+// copies the registers again and raises the interrupt again. Volume is
+// applied per sample, a channel whose DMA stops holds its last byte, and
+// channels 0/3 and 1/2 are summed into a 16-bit stereo WAV at the output
+// rate, sample and hold as Paula's DACs do.
+//
+// With a channel's DMA off, words written to AUDxDAT play the same way,
+// each raising the interrupt as it is taken; a channel that runs out of
+// them goes idle holding its last byte.
+//
+// Three kinds of trouble are logged with the output frame they happen at:
+//
+//   late    the driver acknowledged an audio interrupt only after the
+//           block it announced had already ended, so Paula replayed the
+//           stale location; acknowledgements while the channel's DMA is
+//           off are resets and never count; with AUDxDAT, a channel
+//           that stood idle until the next word was written
+//   gap     a channel was switched off and on again within gap_max_ns
+//   click   a DMA start, a volume write or a late stale reload moved a
+//           channel's output by more than click_level (0-8192 scale)
+//
+// Chip RAM is modelled too, so sample uploads and the residency cache
+// behave as on the machine, and so is ADKCON attach: a modulator's DMA
+// words go to the next channel's volume and period instead of its DAC.
+// The audio filter and the CIA timers are not.
+
+#ifndef PAULA_SIM_H
+#define PAULA_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PAULA_SIM_VOICES      4u
+#define PAULA_SIM_CHIP_BYTES  0x200000u
+#define PAULA_SIM_LIST        32u       // events listed per kind
+#define PAULA_SIM_RATE_HZ     44100u
+#define PAULA_SIM_CLICK       1024u
+#define PAULA_SIM_GAP_MAX_NS  50000000ull
+
+enum {
+  SIM_LATE = 0,
+  SIM_GAP,
+  SIM_CLICK,
+  SIM_KINDS
+};
+
+#define SIM_ATTACH_VOL  1u
+#define SIM_ATTACH_PER  2u
+
+typedef struct {
+  uint8_t voice;
+  uint64_t frame;           // output frame it happened at
+  uint64_t clk;
+  uint64_t amount;          // late/gap: colour clocks; click: level step
+} paula_sim_event_t;
+
+typedef struct {
+  // Registers as written.
+  uint32_t lc;
+  uint16_t len;
+  uint16_t per;
+  uint16_t vol;
+
+  // DMA state.
+  int on;
+  uint32_t ptr;             // next word to fetch
+  uint32_t left;            // words of the block still to fetch
+  uint16_t word;
+  int low;                  // the low byte of word plays next
+  uint64_t next_clk;        // when the next byte starts
+  int8_t sample;
+
+  // AUDxDAT playback with DMA off.
+  int manual;
+  uint16_t dat;
+  int dat_full;             // written and not yet taken
+  int starved;              // went idle for want of a word
+  uint64_t starve_clk;
+  uint64_t starve_frame;
+
+  // ADKCON attach: SIM_ATTACH_VOL/PER bits, the channel is silent.
+  unsigned attach;
+
+  // Diagnostics.
+  int written;              // LC/LEN written since the last copy
+  int pending;              // interrupt raised and not acknowledged
+  unsigned missed;          // blocks started since, with stale registers
+  uint64_t missed_clk;
+  uint64_t missed_frame;
+  unsigned missed_step;     // output step where the first missed block began
+  int stale;                // the block playing was a stale reload
+  int ever_on;
+  uint64_t off_clk;
+  uint64_t off_frame;
+  uint64_t blocks;
+  uint64_t repeats;         // blocks started from unchanged registers
+  uint64_t count[SIM_KINDS];
+} paula_sim_voice_t;
+
+typedef struct {
+  double clock_hz;
+  unsigned rate_hz;
+  unsigned click_level;
+  uint64_t gap_max_ns;
+  uint8_t *chip;
+  uint16_t dmacon;
+  uint16_t intreq;
+  uint16_t intena;
+  uint16_t adkcon;
+  uint8_t agnus_id;
+  uint8_t cia[2][16];       // CIAA, CIAB registers as last written
+  paula_sim_voice_t v[PAULA_SIM_VOICES];
+  int started;
+  uint64_t t0_ns;           // host time of clock 0
+  uint64_t clk;
+  uint64_t frames;          // output frames rendered
+  int16_t peak;
+  FILE *wav;
+  uint8_t *wav_buf;
+  size_t wav_fill;
+  paula_sim_event_t list[SIM_KINDS][PAULA_SIM_LIST];
+  uint64_t total[SIM_KINDS];
+} paula_sim_t;
+
+// wav_path may be NULL to render nothing. Returns -1 with a message if
+// memory or the file cannot be had.
+int paula_sim_init(paula_sim_t *s, int is_pal, unsigned rate_hz, const char *wav_path);
+
+// Bus accesses at host time t_ns; times must not go backwards. size is
+// 8, 16 or 32 bits.
+void paula_sim_write(paula_sim_t *s, uint64_t t_ns, uint32_t addr, unsigned size,
+                     uint32_t val);
+uint32_t paula_sim_read(paula_sim_t *s, uint64_t t_ns, uint32_t addr, unsigned size);
+
+// Runs the model up to t_ns without an access, so that the next one does
+// not pay for the whole stretch. The first call or access sets clock 0.
+void paula_sim_advance(paula_sim_t *s, uint64_t t_ns);
+
+// Renders up to t_ns, completes the WAV file and frees the model.
+void paula_sim_finish(paula_sim_t *s, uint64_t t_ns);
+
+void paula_sim_report(const paula_sim_t *s, FILE *out);
+
+#endif /* PAULA_SIM_H */
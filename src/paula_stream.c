@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+// Gapless audio streaming driven by Paula's location/length latch.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "chip_shadow.h"
+#include "pi_time.h"
+#include "paula_stream.h"
+
+#define STREAM_SPIN_NS    2000000ull          // poll INTREQR for the last 2 ms
+#define STREAM_TIMEOUT_NS 1000000000ull       // give up 1 s after a missed latch
+
+typedef struct {
+  paula_stream_t *s;
+  paula_stream_fill_fn fill;
+  void *ctx;
+  uint8_t *bufs[PAULA_STREAM_MAX_CHANNELS];
+  size_t len[64];           // bytes per slot, indexed by seq % slots
+  uint64_t staged;          // sequence number of the next slot to fill
+  uint64_t max_frames;      // frame budget from s->seconds, 0 = unlimited
+  int eof;
+  uint16_t dma_mask;
+  uint16_t int_mask;
+  chip_shadow_t shadow;     // the rings as last written, to skip unchanged words
+} stream_state_t;
+
+static uint32_t slot_addr(const paula_stream_t *s, unsigned ch, unsigned slot) {
+  return s->base + (uint32_t)((ch * s->slots + slot) * s->slot_bytes);
+}
+
+static uint32_t silence_addr(const paula_stream_t *s) {
+  return s->base + (uint32_t)(s->channels * s->slots * s->slot_bytes);
+}
+
+size_t paula_stream_chip_bytes(const paula_stream_t *s) {
+  return (size_t)s->channels * s->slots * s->slot_bytes + 2u;
+}
+
+static void set_location(unsigned ch, uint32_t addr, size_t len_bytes) {
+  uint32_t reg = AUD0LCH + ch * AUD_STRIDE;
+  ps_write_16(reg, (addr >> 16) & 0x1Fu);
+  ps_write_16(reg + 2u, addr & 0xFFFEu);
+  ps_write_16(reg + 4u, (uint16_t)((len_bytes + 1u) / 2u));
+}
+
+// Pulls the next block from the source into the Pi-side buffers and
+// records its length for slot staged % slots. Returns the frame count.
+static size_t pull(stream_state_t *st) {
+  paula_stream_t *s = st->s;
+  size_t want = s->slot_bytes;
+  if (st->max_frames) {
+    if (s->frames >= st->max_frames) want = 0;
+    else if (st->max_frames - s->frames < want) want = (size_t)(st->max_frames - s->frames);
+  }
+  size_t n = want ? st->fill(st->ctx, st->bufs, want) : 0;
+  if (n > want) n = want;
+  if (n == 0) {
+    st->eof = 1;
+    return 0;
+  }
+  size_t bytes = (n + 1u) & ~(size_t)1u;
+  for (unsigned c = 0; c < s->channels; c++) {
+    if (bytes != n) st->bufs[c][n] = 0;
+  }
+  st->len[st->staged % s->slots] = bytes;
+  s->frames += n;
+  return n;
+}
+
+// Copies the pulled block into its chip RAM slot. Paula only reads the
+// rings, so words the slot already holds (silence, looped material) are
+// left alone.
+static void upload(stream_state_t *st) {
+  paula_stream_t *s = st->s;
+  unsigned slot = (unsigned)(st->staged % s->slots);
+  for (unsigned c = 0; c < s->channels; c++) {
+    upload_delta(&st->shadow, slot_addr(s, c, slot), st->bufs[c], st->len[slot], NULL);
+  }
+  st->staged++;
+}
+
+static void stage(stream_state_t *st) {
+  if (pull(st)) upload(st);
+}
+
+static void queue_slot(stream_state_t *st, uint64_t seq) {
+  paula_stream_t *s = st->s;
+  unsigned slot = (unsigned)(seq % s->slots);
+  for (unsigned c = 0; c < s->channels; c++) {
+    set_location(c, slot_addr(s, c, slot), st->len[slot]);
+  }
+}
+
+static void queue_silence(stream_state_t *st) {
+  for (unsigned c = 0; c < st->s->channels; c++) {
+    set_location(c, silence_addr(st->s), 2u);
+  }
+}
+
+static uint64_t block_ns(const paula_stream_t *s, size_t bytes) {
+  return (uint64_t)((double)bytes * 1e9 / s->rate_hz);
+}
+
+// Sleeps until shortly before deadline, then polls INTREQR for the AUD0
+// interrupt. All channels share one period, so AUD0 stands for all of them.
+static int wait_latch(stream_state_t *st, uint64_t deadline,
+                      volatile sig_atomic_t *stop, uint64_t *seen) {
+  uint64_t now = pi_now_ns();
+  if (deadline > now + STREAM_SPIN_NS) pi_sleep_ns(deadline - now - STREAM_SPIN_NS);
+  for (;;) {
+    if (ps_read_16(INTREQR) & INTF_AUD0) break;
+    if (stop && *stop) return -1;
+    now = pi_now_ns();
+    if (now > deadline + STREAM_TIMEOUT_NS) {
+      fprintf(stderr, "stream: no AUD0 interrupt, is audio DMA still running?\n");
+      return -1;
+    }
+  }
+  ps_write_16(INTREQ, st->int_mask);
+  *seen = pi_now_ns();
+  return 0;
+}
+
+int paula_stream_run(paula_stream_t *s, paula_stream_fill_fn fill, void *ctx,
+                     volatile sig_atomic_t *stop) {
+  stream_state_t st;
+  memset(&st, 0, sizeof(st));
+  s->blocks = 0;
+  s->frames = 0;
+  s->underruns = 0;
+  s->max_late_ns = 0;
+  s->upload_bytes = 0;
+  s->upload_saved = 0;
+  if (s->channels < 1 || s->channels > PAULA_STREAM_MAX_CHANNELS ||
+      s->slots < 2 || s->slots > sizeof(st.len) / sizeof(st.len[0]) ||
+      s->rate_hz <= 0.0 || (s->base & 1u)) {
+    fprintf(stderr, "stream: bad parameters\n");
+    return -1;
+  }
+  s->slot_bytes &= ~(size_t)1u;
+  if (s->slot_bytes == 0 || s->slot_bytes > PAULA_STREAM_MAX_SLOT) {
+    s->slot_bytes = PAULA_STREAM_MAX_SLOT;
+  }
+
+  st.s = s;
+  st.fill = fill;
+  st.ctx = ctx;
+  st.max_frames = s->seconds ? (uint64_t)(s->rate_hz * s->seconds) : 0u;
+  for (unsigned c = 0; c < s->channels; c++) {
+    st.bufs[c] = (uint8_t *)malloc(s->slot_bytes);
+    if (!st.bufs[c]) {
+      for (unsigned k = 0; k < c; k++) free(st.bufs[k]);
+      fprintf(stderr, "stream: out of memory\n");
+      return -1;
+    }
+    st.dma_mask |= (uint16_t)(DMAF_AUD0 << c);
+    st.int_mask |= (uint16_t)(INTF_AUD0 << c);
+  }
+
+  // Without a shadow every slot is written in full.
+  chip_shadow_init(&st.shadow, s->base, (size_t)s->channels * s->slots * s->slot_bytes);
+  static const uint8_t zero_word[2] = {0, 0};
+  write_chip_ram(silence_addr(s), zero_word, 2u);
+  while (!st.eof && st.staged < s->slots) stage(&st);
+
+  int rc = 0;
+  if (st.staged > 0) {
+    ps_write_16(DMACON, st.dma_mask);
+    ps_write_16(INTREQ, st.int_mask);
+    queue_slot(&st, 0);
+    for (unsigned c = 0; c < s->channels; c++) {
+      uint32_t reg = AUD0LCH + c * AUD_STRIDE;
+      ps_write_16(reg + 6u, s->period);
+      ps_write_16(reg + 8u, s->vols ? s->vols[c] : s->vol);
+    }
+    ps_write_16(DMACON, DMAF_SETCLR | DMAF_MASTER | st.dma_mask);
+
+    uint64_t playing = 0;           // sequence number Paula is playing
+    int queued_silence = 0;
+    uint64_t seen = 0;
+    uint64_t deadline = pi_now_ns();
+    for (;;) {
+      if (wait_latch(&st, deadline, stop, &seen) != 0) {
+        rc = (stop && *stop) ? 0 : -1;
+        break;
+      }
+      if (s->blocks > 0) {
+        // The previously queued block just started.
+        if (queued_silence) break;
+        uint64_t end = deadline;
+        uint64_t late = seen > end ? seen - end : 0;
+        if (late > s->max_late_ns) s->max_late_ns = late;
+        uint64_t queued_len = block_ns(s, st.len[(playing + 1u) % s->slots]);
+        if (late > queued_len) s->underruns += late / (queued_len ? queued_len : 1u);
+        playing++;
+      }
+      s->blocks++;
+      deadline = seen + block_ns(s, st.len[playing % s->slots]);
+
+      // Queue the next block first; chip RAM uploads come after, while
+      // Paula is busy with the block it just latched.
+      if (playing + 1u < st.staged) {
+        queue_slot(&st, playing + 1u);
+      } else if (!st.eof && pull(&st)) {
+        queue_slot(&st, playing + 1u);
+        upload(&st);
+      } else {
+        queue_silence(&st);
+        queued_silence = 1;
+      }
+      while (!st.eof && st.staged < playing + s->slots) stage(&st);
+      if (s->idle && deadline > STREAM_SPIN_NS) s->idle(s->idle_ctx, deadline - STREAM_SPIN_NS);
+    }
+  }
+
+  for (unsigned c = 0; c < s->channels; c++) {
+    ps_write_16(AUD0LCH + c * AUD_STRIDE + 8u, 0);
+    free(st.bufs[c]);
+  }
+  s->upload_bytes = st.shadow.total_sent;
+  s->upload_saved = st.shadow.total_saved;
+  chip_shadow_free(&st.shadow);
+  ps_write_16(DMACON, st.dma_mask);
+  ps_write_16(INTREQ, st.int_mask);
+  return rc;
+}
+
+void paula_stream_report(const paula_stream_t *s, FILE *out) {
+  fprintf(out, "[STREAM] blocks=%llu frames=%llu underruns=%llu max_late=%.2fms "
+          "uploaded=%llu unchanged=%llu\n",
+          (unsigned long long)s->blocks, (unsigned long long)s->frames,
+          (unsigned long long)s->underruns, (double)s->max_late_ns / 1e6,
+          (unsigned long long)s->upload_bytes, (unsigned long long)s->upload_saved);
+}
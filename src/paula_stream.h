@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+// Gapless audio streaming driven by Paula's location/length latch.
+//
+// Paula copies AUDxLC/AUDxLEN into its internal counters when a block
+// starts and raises the AUDx interrupt. From then on the registers are free
+// for the next block, which Paula picks up on its own when the current one
+// ends. The streamer polls INTREQR for that interrupt, writes the next
+// slot's pointer and length straight after it, acknowledges it in INTREQ
+// and refills the slot that just finished. DMA is never restarted
+// mid-stream. Refills go through a chip_shadow of the rings, so only the
+// words that differ from the slot's previous block cross the bus.
+
+#ifndef PAULA_STREAM_H
+#define PAULA_STREAM_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PAULA_STREAM_MAX_CHANNELS 4u
+#define PAULA_STREAM_MAX_SLOT     (0xFFFFu * 2u)   // AUDxLEN is in words
+#define PAULA_MIN_PERIOD          124u    // shortest period DMA keeps up with
+
+// Writes up to max_frames signed 8-bit samples into bufs[0..channels-1]
+// and returns the number of frames written. 0 ends the stream.
+typedef size_t (*paula_stream_fill_fn)(void *ctx, uint8_t *const *bufs,
+                                       size_t max_frames);
+
+typedef struct {
+  // Set by the caller before paula_stream_run().
+  unsigned channels;        // AUD0..AUD(channels-1)
+  uint32_t base;            // chip RAM for the rings, see paula_stream_chip_bytes()
+  size_t slot_bytes;        // per-channel block size
+  unsigned slots;           // blocks per channel ring, at least 2
+  uint16_t period;
+  uint16_t vol;
+  const uint16_t *vols;     // per-channel volumes, NULL = vol on all
+  double rate_hz;           // samples per second per channel
+  unsigned seconds;         // 0 = until the source ends
+  // Optional background work, called once per block with the time by
+  // which it must hand the bus back.
+  void (*idle)(void *ctx, uint64_t deadline);
+  void *idle_ctx;
+
+  // Results.
+  uint64_t blocks;          // blocks latched by Paula
+  uint64_t frames;          // frames queued
+  uint64_t underruns;       // a latch was missed and a block played twice
+  uint64_t max_late_ns;     // worst delay between block end and our write
+  uint64_t upload_bytes;    // ring bytes written to chip RAM
+  uint64_t upload_saved;    // ring bytes skipped, chip RAM already held them
+} paula_stream_t;
+
+// Chip RAM used by the rings plus one silent word for the tail.
+size_t paula_stream_chip_bytes(const paula_stream_t *s);
+
+// Streams until the source ends, s->seconds elapse or *stop is set.
+// Returns 0 on success or -1 if the parameters are unusable or Paula stops
+// answering.
+int paula_stream_run(paula_stream_t *s, paula_stream_fill_fn fill, void *ctx,
+                     volatile sig_atomic_t *stop);
+
+void paula_stream_report(const paula_stream_t *s, FILE *out);
+
+#endif /* PAULA_STREAM_H */
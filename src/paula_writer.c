@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: MIT
+// Per-tick Paula register writer that only sends what changed.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "cia.h"
+#include "pi_time.h"
+#include "paula_writer.h"
+
+void paula_writer_init(paula_writer_t *w) {
+  memset(w, 0, sizeof(*w));
+  w->filter = -1;
+  w->voices = 0x0Fu;
+}
+
+static void put(paula_writer_t *w, uint32_t reg, uint16_t val) {
+  ps_write_16(reg, val);
+  w->stats.writes++;
+}
+
+// Writes reg when it differs from *shadow or the voice is not known yet.
+static void diff(paula_writer_t *w, int known, uint32_t reg, uint16_t *shadow,
+                 uint16_t val) {
+  if (known && *shadow == val) {
+    w->stats.skipped++;
+    return;
+  }
+  put(w, reg, val);
+  *shadow = val;
+}
+
+// Waits for the AUDx interrupt of each looping voice and writes its loop
+// into the registers Paula has just finished copying.
+static void latch_loops(paula_writer_t *w, const paula_frame_t *f,
+                        uint16_t ints) {
+  uint64_t t0 = pi_now_ns();
+  uint64_t waited = 0;
+  while (ints) {
+    uint16_t seen = (uint16_t)(ps_read_16(INTREQR) & ints);
+    waited = pi_now_ns() - t0;
+    if (!seen && waited > PAULA_LATCH_TIMEOUT_NS) {
+      // No interrupt: latch anyway, the loop starts one block late.
+      w->stats.latch_timeouts++;
+      seen = ints;
+    }
+    for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+      if (!(seen & (INTF_AUD0 << ch))) continue;
+      uint32_t base = AUD0LCH + ch * AUD_STRIDE;
+      paula_voice_regs_t *s = &w->shadow[ch];
+      uint32_t lc = f->loop_lc[ch];
+      if ((lc >> 16) != (s->lc >> 16)) put(w, base + 0x0u, (uint16_t)((lc >> 16) & 0x1Fu));
+      if ((lc & 0xFFFFu) != (s->lc & 0xFFFFu)) put(w, base + 0x2u, (uint16_t)(lc & 0xFFFFu));
+      if (f->loop_len[ch] != s->len) put(w, base + 0x4u, f->loop_len[ch]);
+      s->lc = lc;
+      s->len = f->loop_len[ch];
+      w->stats.loops++;
+    }
+    if (seen) put(w, INTREQ, seen);
+    ints = (uint16_t)(ints & ~seen);
+  }
+  if (waited > w->stats.latch_ns_max) w->stats.latch_ns_max = waited;
+}
+
+unsigned paula_writer_commit(paula_writer_t *w, const paula_frame_t *f,
+                             uint64_t tick_ns) {
+  uint64_t t0 = pi_now_ns();
+  uint64_t before = w->stats.writes;
+  uint16_t start = (uint16_t)(f->dma_start & w->voices);
+  uint16_t off = (uint16_t)((start | f->dma_stop) & w->dma_on);
+  uint64_t off_ns = 0;
+
+  if (off) {
+    put(w, DMACON, off);
+    w->dma_on = (uint16_t)(w->dma_on & ~off);
+    off_ns = pi_now_ns();
+  }
+
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    if (!(w->voices & (1u << ch))) continue;
+    const paula_voice_regs_t *v = &f->v[ch];
+    paula_voice_regs_t *s = &w->shadow[ch];
+    uint32_t base = AUD0LCH + ch * AUD_STRIDE;
+    int known = (w->known >> ch) & 1;
+    uint16_t lch = (uint16_t)((v->lc >> 16) & 0x1Fu);
+    uint16_t lcl = (uint16_t)(v->lc & 0xFFFFu);
+    uint16_t sh = (uint16_t)(s->lc >> 16);
+    uint16_t sl = (uint16_t)(s->lc & 0xFFFFu);
+    diff(w, known, base + 0x0u, &sh, lch);
+    diff(w, known, base + 0x2u, &sl, lcl);
+    s->lc = ((uint32_t)sh << 16) | sl;
+    diff(w, known, base + 0x4u, &s->len, v->len);
+    diff(w, known, base + 0x6u, &s->per, v->per);
+    diff(w, known, base + 0x8u, &s->vol, v->vol);
+    w->known = (uint8_t)(w->known | (1u << ch));
+  }
+
+  if (start) {
+    uint16_t loop = f->dma_loop & start;
+    uint16_t ints = (uint16_t)(loop << 7);   // AUDx is INTF_AUD0 << x
+    if (ints) put(w, INTREQ, ints);
+    // Paula only restarts a channel that has seen its DMA bit clear for
+    // a DMA slot; the register writes above usually cover that already.
+    if (off) {
+      while (pi_now_ns() - off_ns < PAULA_DMA_SETTLE_NS) {
+      }
+    }
+    put(w, DMACON, DMAF_SETCLR | DMAF_MASTER | start);
+    w->dma_on = (uint16_t)(w->dma_on | start);
+    if (ints) latch_loops(w, f, ints);
+  }
+
+  if (f->filter >= 0 && f->filter != w->filter) {
+    uint8_t pra = (uint8_t)ps_read_8(CIAAPRA);
+    // /LED low lights the power LED and switches the filter in.
+    pra = f->filter ? (uint8_t)(pra & ~CIAA_LED) : (uint8_t)(pra | CIAA_LED);
+    ps_write_8(CIAAPRA, pra);
+    w->stats.writes++;
+    w->filter = f->filter;
+  }
+
+  uint64_t dt = pi_now_ns() - t0;
+  w->stats.ticks++;
+  w->stats.bus_ns_sum += dt;
+  if (dt > w->stats.bus_ns_max) {
+    w->stats.bus_ns_max = dt;
+    w->stats.budget_ns = tick_ns;
+  }
+  if (tick_ns && dt > tick_ns) {
+    if (!w->stats.overruns) {
+      fprintf(stderr, "paula: tick %llu took %llu us of a %llu us tick\n",
+              (unsigned long long)w->stats.ticks,
+              (unsigned long long)(dt / 1000u),
+              (unsigned long long)(tick_ns / 1000u));
+    }
+    w->stats.overruns++;
+  }
+  return (unsigned)(w->stats.writes - before);
+}
+
+void paula_writer_stop(paula_writer_t *w) {
+  if (w->dma_on) ps_write_16(DMACON, w->dma_on);
+  for (unsigned ch = 0; ch < PAULA_VOICES; ch++) {
+    if (w->voices & (1u << ch)) ps_write_16(AUD0VOL + ch * AUD_STRIDE, 0);
+  }
+  w->dma_on = 0;
+  w->known = 0;
+}
+
+void paula_writer_report(const paula_writer_t *w, FILE *out) {
+  const paula_writer_stats_t *s = &w->stats;
+  double ticks = s->ticks ? (double)s->ticks : 1.0;
+  double max_pct = s->budget_ns ? 100.0 * (double)s->bus_ns_max / (double)s->budget_ns : 0.0;
+  fprintf(out,
+          "[PAULA] ticks=%llu writes=%llu (%.1f/tick) skipped=%llu "
+          "bus avg=%.1fus max=%.1fus (%.2f%% of tick) overruns=%llu\n",
+          (unsigned long long)s->ticks, (unsigned long long)s->writes,
+          (double)s->writes / ticks, (unsigned long long)s->skipped,
+          (double)s->bus_ns_sum / ticks / 1000.0, (double)s->bus_ns_max / 1000.0,
+          max_pct, (unsigned long long)s->overruns);
+  if (s->loops || s->latch_timeouts) {
+    fprintf(out, "[PAULA] loops latched=%llu wait max=%.1fus timeouts=%llu\n",
+            (unsigned long long)s->loops, (double)s->latch_ns_max / 1000.0,
+            (unsigned long long)s->latch_timeouts);
+  }
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+// Per-tick Paula register writer that only sends what changed.
+//
+// A player describes the state it wants for AUD0-3 each tick in a
+// paula_frame_t. The writer compares it with what it last wrote and emits
+// just the differing registers. Voices that (re)start a sample are
+// switched off with one DMACON write, reprogrammed, and switched back on
+// together with a second DMACON write, so their DMA starts on the same
+// audio cycle. A voice that goes on to a loop gets the loop's location and
+// length as soon as Paula raises its AUDx interrupt, which it does once it
+// has copied the first block's registers into its counters; from then on
+// Paula replays the loop by itself. Each commit is timed against the tick
+// period it has to fit in.
+
+#ifndef PAULA_WRITER_H
+#define PAULA_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PAULA_VOICES           4u
+#define PAULA_DMA_SETTLE_NS    130000ull    // DMA off for two raster lines
+#define PAULA_LATCH_TIMEOUT_NS 2000000ull   // AUDx interrupt after a DMA start
+
+typedef struct {
+  uint32_t lc;              // chip address, latched for the next block
+  uint16_t len;             // words
+  uint16_t per;
+  uint16_t vol;
+} paula_voice_regs_t;
+
+typedef struct {
+  paula_voice_regs_t v[PAULA_VOICES];
+  uint16_t dma_start;       // AUDx bits restarted from lc/len this tick
+  uint16_t dma_stop;        // AUDx bits switched off
+  uint16_t dma_loop;        // started voices that continue on loop_lc/len
+  uint32_t loop_lc[PAULA_VOICES];
+  uint16_t loop_len[PAULA_VOICES];
+  int8_t filter;            // audio filter: -1 unchanged, 0 off, 1 on
+} paula_frame_t;
+
+typedef struct {
+  uint64_t ticks;
+  uint64_t writes;          // bus writes issued
+  uint64_t skipped;         // register writes saved by the diff
+  uint64_t bus_ns_sum;
+  uint64_t bus_ns_max;
+  uint64_t budget_ns;       // tick period of the slowest commit
+  uint64_t overruns;        // commits that took longer than their tick
+  uint64_t loops;           // loops latched after a block start
+  uint64_t latch_ns_max;    // longest wait for the AUDx interrupt
+  uint64_t latch_timeouts;
+} paula_writer_stats_t;
+
+typedef struct {
+  paula_voice_regs_t shadow[PAULA_VOICES];
+  uint8_t known;            // voices whose shadow matches the hardware
+  uint8_t voices;           // voices the writer drives, all four by default
+  uint16_t dma_on;
+  int filter;
+  paula_writer_stats_t stats;
+} paula_writer_t;
+
+void paula_writer_init(paula_writer_t *w);
+
+// Writes the difference between f and the last committed frame. tick_ns
+// is the time until the next commit; a commit that takes longer is
+// counted as an overrun and reported once on stderr. Returns the number
+// of bus writes.
+unsigned paula_writer_commit(paula_writer_t *w, const paula_frame_t *f,
+                             uint64_t tick_ns);
+
+// Switches off DMA for every voice the writer started and forgets the
+// shadow state. Voices outside w->voices are never touched, so another
+// user such as a stream can own them.
+void paula_writer_stop(paula_writer_t *w);
+
+void paula_writer_report(const paula_writer_t *w, FILE *out);
+
+#endif /* PAULA_WRITER_H */
@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: MIT
+// On-disk cache of decoded audio, mapped at playback.
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcm_convert.h"
+#include "pcm_cache.h"
+
+#define CACHE_VERSION   1
+#define HASH_BLOCK      0x10000u
+#define STALE_TMP_S     3600        // temporaries older than this were abandoned
+#define FNV_SEED        0xCBF29CE484222325ull
+#define PATH_BYTES      320u        // the directory plus an entry name
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+  // FNV-1a, as chip_cache_hash(); names content, the header verifies it.
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001B3ull;
+  }
+  return h;
+}
+
+static uint64_t identity_key(const struct stat *st) {
+  const uint64_t id[5] = {
+    (uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+    (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec,
+  };
+  return fnv(FNV_SEED, id, sizeof(id));
+}
+
+static int same_identity(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int hash_file(pcm_cache_t *c, const char *path, uint64_t *out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  uint8_t *buf = (uint8_t *)malloc(HASH_BLOCK);
+  if (!buf) {
+    close(fd);
+    return -1;
+  }
+  uint64_t h = FNV_SEED;
+  uint64_t len = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, HASH_BLOCK)) > 0) {
+    h = fnv(h, buf, (size_t)n);
+    len += (uint64_t)n;
+  }
+  free(buf);
+  close(fd);
+  if (n < 0) {
+    perror(path);
+    return -1;
+  }
+  c->hash_bytes = len;
+  *out = h ^ len;
+  return 0;
+}
+
+// Writes text to path through a temporary, so readers never see half of it.
+static void store_atomic(const char *path, const char *text) {
+  char tmp[PCM_CACHE_TMP_BYTES];
+  snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+  FILE *f = fopen(tmp, "w");
+  if (!f) return;
+  fputs(text, f);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// Content hash of path, from the index when its identity is known.
+static int content_hash(pcm_cache_t *c, const char *path, const struct stat *st,
+                        uint64_t *out) {
+  char idx[PATH_BYTES];
+  snprintf(idx, sizeof(idx), "%s/%016llx.id", c->dir,
+           (unsigned long long)identity_key(st));
+  FILE *f = fopen(idx, "r");
+  if (f) {
+    int ver = 0;
+    unsigned long long hash = 0;
+    unsigned long long size = 0;
+    int n = fscanf(f, "v%d content=%llx size=%llu", &ver, &hash, &size);
+    fclose(f);
+    if (n == 3 && ver == CACHE_VERSION && size == (unsigned long long)st->st_size) {
+      // Index files age out with the entries, so keep this one fresh too.
+      utimensat(AT_FDCWD, idx, NULL, 0);
+      *out = hash;
+      return 0;
+    }
+  }
+  if (hash_file(c, path, out) != 0) return -1;
+  // A file that changed while it was read has no stable hash to index.
+  struct stat after;
+  if (stat(path, &after) == 0 && same_identity(st, &after)) {
+    char text[96];
+    snprintf(text, sizeof(text), "v%d content=%016llx size=%llu\n", CACHE_VERSION,
+             (unsigned long long)*out, (unsigned long long)st->st_size);
+    store_atomic(idx, text);
+  }
+  return 0;
+}
+
+static void entry_path(const pcm_cache_t *c, char *out, size_t len) {
+  snprintf(out, len, "%s/%016llx.pcm", c->dir, (unsigned long long)c->key);
+}
+
+static void format_header(const pcm_cache_t *c, char *h) {
+  memset(h, 0, PCM_CACHE_HEADER_BYTES);
+  snprintf(h, PCM_CACHE_HEADER_BYTES,
+           "pcmcache v%d channels=%u frames=%llu period=%u rate=%.6f content=%016llx\n%s\n",
+           CACHE_VERSION, c->channels, (unsigned long long)c->frames, c->period, c->rate_hz,
+           (unsigned long long)c->content_hash, c->params);
+}
+
+// Checks a mapped entry against what was asked for and fills in its
+// description. A mismatch is a hash collision or a damaged file.
+static int parse_header(pcm_cache_t *c, const char *h, size_t len) {
+  if (len < PCM_CACHE_HEADER_BYTES || memchr(h, 0, PCM_CACHE_HEADER_BYTES) == NULL) return -1;
+  int ver = 0;
+  unsigned channels = 0;
+  unsigned long long frames = 0;
+  unsigned period = 0;
+  double rate = 0.0;
+  unsigned long long hash = 0;
+  int n = sscanf(h, "pcmcache v%d channels=%u frames=%llu period=%u rate=%lf content=%llx",
+                 &ver, &channels, &frames, &period, &rate, &hash);
+  if (n != 6 || ver != CACHE_VERSION || hash != c->content_hash) return -1;
+  if (channels < 1u || channels > PAULA_STREAM_MAX_CHANNELS || period > 0xFFFFu) return -1;
+  const char *p = strchr(h, '\n');
+  size_t plen = strlen(c->params);
+  if (!p || strncmp(p + 1, c->params, plen) != 0 || p[1 + plen] != '\n') return -1;
+  if ((uint64_t)(len - PCM_CACHE_HEADER_BYTES) != (uint64_t)frames * channels) return -1;
+  c->channels = channels;
+  c->frames = frames;
+  c->period = (uint16_t)period;
+  c->rate_hz = rate;
+  return 0;
+}
+
+static int map_entry(pcm_cache_t *c) {
+  char path[PATH_BYTES];
+  entry_path(c, path, sizeof(path));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)PCM_CACHE_HEADER_BYTES) {
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+  if (parse_header(c, (const char *)map, (size_t)st.st_size) != 0) {
+    fprintf(stderr, "pcm cache: %s does not match, replacing it\n", path);
+    munmap(map, (size_t)st.st_size);
+    close(fd);
+    return 0;
+  }
+  // The mtime is the LRU stamp.
+  futimens(fd, NULL);
+  close(fd);
+  madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+  c->map = map;
+  c->map_len = (size_t)st.st_size;
+  c->data = (const int8_t *)map + PCM_CACHE_HEADER_BYTES;
+  c->hit = 1;
+  return 1;
+}
+
+int pcm_cache_open(pcm_cache_t *c, const char *dir, uint64_t max_bytes, const char *path,
+                   const char *params) {
+  memset(c, 0, sizeof(*c));
+  if (!dir) {
+    const char *env = getenv(PCM_CACHE_DIR_ENV);
+    dir = (env && env[0]) ? env : PCM_CACHE_DIR_DEFAULT;
+  }
+  c->max_bytes = max_bytes ? max_bytes : PCM_CACHE_MAX_DEFAULT;
+  if (strlen(dir) >= sizeof(c->dir) || strlen(params) >= sizeof(c->params) ||
+      strchr(params, '\n')) {
+    fprintf(stderr, "pcm cache: directory or parameters too long\n");
+    return -1;
+  }
+  strcpy(c->dir, dir);
+  strcpy(c->params, params);
+  if (mkdir(c->dir, 0777) != 0 && errno != EEXIST) {
+    perror(c->dir);
+    return -1;
+  }
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "pcm cache: %s is not a regular file\n", path);
+    return -1;
+  }
+  if (content_hash(c, path, &st, &c->content_hash) != 0) return -1;
+  c->key = fnv(fnv(FNV_SEED, &c->content_hash, sizeof(c->content_hash)), c->params,
+               strlen(c->params));
+  return map_entry(c);
+}
+
+size_t pcm_cache_fill(void *ctx, uint8_t *const *bufs, size_t max_frames) {
+  pcm_cache_t *c = (pcm_cache_t *)ctx;
+  uint64_t left = c->frames - c->pos;
+  size_t n = left < max_frames ? (size_t)left : max_frames;
+  const int8_t *in = c->data + c->pos * c->channels;
+  if (c->channels == 1u) {
+    memcpy(bufs[0], in, n);
+  } else if (c->channels == 2u) {
+    pcm_deinterleave_s8(in, (int8_t *)bufs[0], (int8_t *)bufs[1], n);
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      for (unsigned ch = 0; ch < c->channels; ch++) bufs[ch][i] = (uint8_t)in[i * c->channels + ch];
+    }
+  }
+  c->pos += n;
+  return n;
+}
+
+static int begin_entry(pcm_cache_t *c) {
+  char path[PATH_BYTES];
+  entry_path(c, path, sizeof(path));
+  snprintf(c->tmp, sizeof(c->tmp), "%s.tmp.%ld", path, (long)getpid());
+  c->out = fopen(c->tmp, "wb");
+  if (!c->out) {
+    perror(c->tmp);
+    return -1;
+  }
+  // The header goes in last, once the length is known.
+  static const char blank[PCM_CACHE_HEADER_BYTES];
+  if (fwrite(blank, 1, sizeof(blank), c->out) != sizeof(blank)) c->failed = 1;
+  c->frames = 0;
+  return 0;
+}
+
+int pcm_cache_record(pcm_cache_t *c, paula_stream_fill_fn src, void *src_ctx) {
+  if (c->hit || c->channels < 1u || c->channels > PAULA_STREAM_MAX_CHANNELS) return -1;
+  c->src = src;
+  c->src_ctx = src_ctx;
+  return begin_entry(c);
+}
+
+int pcm_cache_write(pcm_cache_t *c, const int8_t *frames, size_t n) {
+  if (!c->out && (c->hit || begin_entry(c) != 0)) return -1;
+  if (c->failed) return -1;
+  size_t bytes = n * c->channels;
+  if (fwrite(frames, 1, bytes, c->out) != bytes) {
+    c->failed = 1;
+    return -1;
+  }
+  c->frames += n;
+  return 0;
+}
+
+size_t pcm_cache_record_fill(void *ctx, uint8_t *const *bufs, size_t max_frames) {
+  pcm_cache_t *c = (pcm_cache_t *)ctx;
+  size_t n = c->src(c->src_ctx, bufs, max_frames);
+  if (n == 0) {
+    if (max_frames) c->ended = 1;
+    return 0;
+  }
+  if (c->failed) return n;
+  if (n > c->ilv_frames) {
+    int8_t *p = (int8_t *)realloc(c->ilv, n * c->channels);
+    if (!p) {
+      c->failed = 1;
+      return n;
+    }
+    c->ilv = p;
+    c->ilv_frames = n;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (unsigned ch = 0; ch < c->channels; ch++) c->ilv[i * c->channels + ch] = (int8_t)bufs[ch][i];
+  }
+  pcm_cache_write(c, c->ilv, n);
+  return n;
+}
+
+typedef struct {
+  char name[64];
+  uint64_t bytes;
+  struct timespec mtime;
+} cache_file_t;
+
+static int older(const void *a, const void *b) {
+  const struct timespec *x = &((const cache_file_t *)a)->mtime;
+  const struct timespec *y = &((const cache_file_t *)b)->mtime;
+  if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+  if (x->tv_nsec != y->tv_nsec) return x->tv_nsec < y->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+static int ends_with(const char *s, const char *tail) {
+  size_t n = strlen(s);
+  size_t t = strlen(tail);
+  return n >= t && !strcmp(s + n - t, tail);
+}
+
+// Deletes the least recently played entries until the directory fits in
+// max_bytes, keeping the entry just written. Another player may be doing
+// the same; a file already gone is simply skipped.
+static void evict(pcm_cache_t *c) {
+  DIR *d = opendir(c->dir);
+  if (!d) return;
+  char keep[32];
+  snprintf(keep, sizeof(keep), "%016llx.pcm", (unsigned long long)c->key);
+  cache_file_t *files = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  uint64_t total = 0;
+  time_t now = time(NULL);
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    int tmp = strstr(e->d_name, ".tmp.") != NULL;
+    if (!tmp && !ends_with(e->d_name, ".pcm") && !ends_with(e->d_name, ".id")) continue;
+    if (strlen(e->d_name) >= sizeof(files[0].name)) continue;
+    char path[sizeof(c->dir) + 1u + sizeof(e->d_name)];
+    snprintf(path, sizeof(path), "%s/%s", c->dir, e->d_name);
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+    if (tmp) {
+      if (now - st.st_mtime > STALE_TMP_S) unlink(path);
+      continue;
+    }
+    total += (uint64_t)st.st_size;
+    if (!strcmp(e->d_name, keep)) continue;
+    if (count == cap) {
+      size_t ncap = cap ? cap * 2u : 64u;
+      cache_file_t *p = (cache_file_t *)realloc(files, ncap * sizeof(*files));
+      if (!p) break;
+      files = p;
+      cap = ncap;
+    }
+    strcpy(files[count].name, e->d_name);
+    files[count].bytes = (uint64_t)st.st_size;
+    files[count].mtime = st.st_mtim;
+    count++;
+  }
+  closedir(d);
+  qsort(files, count, sizeof(*files), older);
+  for (size_t i = 0; i < count && total > c->max_bytes; i++) {
+    char path[sizeof(c->dir) + 1u + sizeof(files[i].name)];
+    snprintf(path, sizeof(path), "%s/%s", c->dir, files[i].name);
+    if (unlink(path) != 0) continue;
+    total -= files[i].bytes;
+    c->evicted++;
+    c->evicted_bytes += files[i].bytes;
+  }
+  free(files);
+}
+
+static void drop_entry(pcm_cache_t *c) {
+  if (!c->out) return;
+  fclose(c->out);
+  c->out = NULL;
+  unlink(c->tmp);
+}
+
+int pcm_cache_commit(pcm_cache_t *c) {
+  if (!c->out) return -1;
+  if (c->failed || (c->src && !c->ended) || c->frames == 0) {
+    drop_entry(c);
+    return -1;
+  }
+  char h[PCM_CACHE_HEADER_BYTES];
+  format_header(c, h);
+  int ok = fseek(c->out, 0, SEEK_SET) == 0 && fwrite(h, 1, sizeof(h), c->out) == sizeof(h) &&
+           fflush(c->out) == 0 && fsync(fileno(c->out)) == 0;
+  if (!ok) {
+    perror(c->tmp);
+    drop_entry(c);
+    return -1;
+  }
+  fclose(c->out);
+  c->out = NULL;
+  char path[PATH_BYTES];
+  entry_path(c, path, sizeof(path));
+  if (rename(c->tmp, path) != 0) {
+    perror(path);
+    unlink(c->tmp);
+    return -1;
+  }
+  evict(c);
+  return 0;
+}
+
+void pcm_cache_close(pcm_cache_t *c) {
+  drop_entry(c);
+  if (c->map) munmap(c->map, c->map_len);
+  c->map = NULL;
+  c->data = NULL;
+  free(c->ilv);
+  c->ilv = NULL;
+  c->ilv_frames = 0;
+}
+
+void pcm_cache_report(const pcm_cache_t *c, FILE *out) {
+  fprintf(out, "[PCMCACHE] %s %016llx: %llu frames x%u, %.1f KB%s",
+          c->hit ? "hit" : "stored", (unsigned long long)c->key,
+          (unsigned long long)c->frames, c->channels,
+          (double)((uint64_t)c->frames * c->channels) / 1024.0,
+          c->hit ? " mapped" : "");
+  if (c->hash_bytes) fprintf(out, ", hashed %.1f KB of input", (double)c->hash_bytes / 1024.0);
+  if (c->evicted) {
+    fprintf(out, ", evicted %u (%.1f KB)", c->evicted, (double)c->evicted_bytes / 1024.0);
+  }
+  fputc('\n', out);
+}
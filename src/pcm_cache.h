@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: MIT
+// On-disk cache of decoded audio, ready for Paula.
+//
+// An entry holds the final signed 8-bit frames of one input file after
+// conversion, resampling, filtering and dithering, interleaved across
+// the channels it plays on. It is named by a hash of the input's content
+// and of a caller-supplied parameter string that describes the processing.
+// A repeat play maps the entry and streams from it with no decoding.
+//
+// Hashing a long file costs a read of it, so a small index file also maps
+// the file's identity (device, inode, size and mtime) to its content hash.
+// Once that hash is known, a lookup is a stat() and two opens.
+//
+// Entries are written to a temporary file and renamed into place, so a
+// concurrent player sees either the whole entry or none. A player that
+// has an entry mapped keeps it through eviction or replacement. The
+// directory is held to max_bytes by deleting the least recently played
+// entries, by mtime, which a hit touches.
+
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "paula_stream.h"
+
+#define PCM_CACHE_DIR_DEFAULT "/var/tmp/pimodplay-pcm"
+#define PCM_CACHE_DIR_ENV     "PIMODPLAY_PCM_CACHE"
+#define PCM_CACHE_MAX_DEFAULT (256ull << 20)
+#define PCM_CACHE_HEADER_BYTES 1024u
+#define PCM_CACHE_PARAMS_MAX   (PCM_CACHE_HEADER_BYTES - 192u)
+#define PCM_CACHE_TMP_BYTES    352u
+
+typedef struct {
+  // Describes the entry: read from it on a hit, set by the caller before
+  // pcm_cache_record() on a miss.
+  unsigned channels;        // interleaved per frame, 1-4
+  uint16_t period;
+  double rate_hz;
+  uint64_t frames;
+
+  // Internal.
+  char dir[256];
+  uint64_t max_bytes;
+  char params[PCM_CACHE_PARAMS_MAX];
+  uint64_t content_hash;
+  uint64_t key;
+  int hit;
+  void *map;
+  size_t map_len;
+  const int8_t *data;
+  uint64_t pos;             // next frame pcm_cache_fill() returns
+  FILE *out;
+  char tmp[PCM_CACHE_TMP_BYTES];
+  paula_stream_fill_fn src;
+  void *src_ctx;
+  int8_t *ilv;              // interleaving scratch
+  size_t ilv_frames;
+  int ended;                // the recorded source ran out
+  int failed;               // a write failed; the entry will not be kept
+
+  // Results.
+  uint64_t hash_bytes;      // input read to hash it, 0 when indexed
+  unsigned evicted;
+  uint64_t evicted_bytes;
+} pcm_cache_t;
+
+// Looks up the entry for path processed as described by params. dir may
+// be NULL for $PIMODPLAY_PCM_CACHE or PCM_CACHE_DIR_DEFAULT, max_bytes 0
+// for PCM_CACHE_MAX_DEFAULT. Returns 1 on a hit, with the entry mapped
+// and described, 0 on a miss, or -1 if the cache cannot be used, with a
+// message; the caller then plays without it.
+int pcm_cache_open(pcm_cache_t *c, const char *dir, uint64_t max_bytes, const char *path,
+                   const char *params);
+
+// paula_stream_fill_fn over a mapped entry.
+size_t pcm_cache_fill(void *ctx, uint8_t *const *bufs, size_t max_frames);
+
+// On a miss: starts an entry. pcm_cache_record_fill() then passes src's
+// frames through and appends them to it. Returns -1 if it cannot be
+// created; src can still be played directly.
+int pcm_cache_record(pcm_cache_t *c, paula_stream_fill_fn src, void *src_ctx);
+size_t pcm_cache_record_fill(void *ctx, uint8_t *const *bufs, size_t max_frames);
+
+// Appends interleaved frames to the entry, for callers that hold the
+// whole output in memory.
+int pcm_cache_write(pcm_cache_t *c, const int8_t *frames, size_t n);
+
+// Publishes the entry and evicts old ones down to max_bytes. Only
+// complete output should be kept: with pcm_cache_record(), an entry
+// whose source did not run out is dropped.
+int pcm_cache_commit(pcm_cache_t *c);
+
+// Unmaps the entry, or deletes one that was started and not committed.
+void pcm_cache_close(pcm_cache_t *c);
+
+void pcm_cache_report(const pcm_cache_t *c, FILE *out);
+
+#endif /* PCM_CACHE_H */
@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: MIT
+// PCM sample conversion kernels for the audio ingest path.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_HAVE_NEON 1
+#endif
+
+#include "pi_time.h"
+#include "selftest.h"
+#include "pcm_convert.h"
+
+static int16_t load_s16le(const uint8_t *p) {
+  return (int16_t)(uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Scalar reference kernels; also handle the tails of the NEON loops.
+
+static void ref_s16_to_s8(const uint8_t *in, int8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = (int8_t)(load_s16le(in + i * 2u) / 256);
+}
+
+static void ref_u8_to_s8(const uint8_t *in, int8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = (int8_t)((int)in[i] - 128);
+}
+
+static void ref_s8_to_u8(const int8_t *in, uint8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = (uint8_t)((int)in[i] + 128);
+}
+
+static void ref_deinterleave_s8(const int8_t *in, int8_t *l, int8_t *r, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    l[i] = in[i * 2u + 0];
+    r[i] = in[i * 2u + 1];
+  }
+}
+
+static void ref_downmix_s8(const int8_t *in, int8_t *out, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    out[i] = (int8_t)(((int)in[i * 2u] + (int)in[i * 2u + 1]) / 2);
+  }
+}
+
+static void ref_downmix_s16_to_s8(const uint8_t *in, int8_t *out, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    int l = load_s16le(in + i * 4u);
+    int r = load_s16le(in + i * 4u + 2u);
+    out[i] = (int8_t)((l + r) / 512);
+  }
+}
+
+// step is the distance between samples in bytes: 2 for mono, 4 for one
+// side of interleaved stereo.
+static void ref_split14(const uint8_t *in, size_t step, int8_t *hi, int8_t *lo,
+                        size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    int s = load_s16le(in + i * step);
+    hi[i] = (int8_t)(s >> 8);
+    lo[i] = (int8_t)((s >> 2) & 63);
+  }
+}
+
+static void cal_split14(const pcm_split14_cal_t *cal, const uint8_t *in, size_t step,
+                        int8_t *hi, int8_t *lo, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint16_t pair = cal->pair[(load_s16le(in + i * step) >> 2) + 8192];
+    hi[i] = (int8_t)(pair >> 8);
+    lo[i] = (int8_t)(pair & 0xFFu);
+  }
+}
+
+void pcm_s16_to_s8(const uint8_t *in, int8_t *out, size_t n) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const int16x8_t bias_mask = vdupq_n_s16(255);
+  for (; i + 16u <= n; i += 16u) {
+    int16x8_t a = vreinterpretq_s16_u8(vld1q_u8(in + i * 2u));
+    int16x8_t b = vreinterpretq_s16_u8(vld1q_u8(in + i * 2u + 16u));
+    // Add 255 to negative samples so the shift truncates toward zero.
+    a = vaddq_s16(a, vandq_s16(vshrq_n_s16(a, 15), bias_mask));
+    b = vaddq_s16(b, vandq_s16(vshrq_n_s16(b, 15), bias_mask));
+    vst1q_s8(out + i, vcombine_s8(vshrn_n_s16(a, 8), vshrn_n_s16(b, 8)));
+  }
+#endif
+  ref_s16_to_s8(in + i * 2u, out + i, n - i);
+}
+
+void pcm_u8_to_s8(const uint8_t *in, int8_t *out, size_t n) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const uint8x16_t sign = vdupq_n_u8(0x80);
+  for (; i + 16u <= n; i += 16u) {
+    vst1q_u8((uint8_t *)out + i, veorq_u8(vld1q_u8(in + i), sign));
+  }
+#endif
+  ref_u8_to_s8(in + i, out + i, n - i);
+}
+
+void pcm_s8_to_u8(const int8_t *in, uint8_t *out, size_t n) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const uint8x16_t sign = vdupq_n_u8(0x80);
+  for (; i + 16u <= n; i += 16u) {
+    vst1q_u8(out + i, veorq_u8(vld1q_u8((const uint8_t *)in + i), sign));
+  }
+#endif
+  ref_s8_to_u8(in + i, out + i, n - i);
+}
+
+void pcm_deinterleave_s8(const int8_t *in, int8_t *l, int8_t *r, size_t frames) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  for (; i + 16u <= frames; i += 16u) {
+    int8x16x2_t v = vld2q_s8(in + i * 2u);
+    vst1q_s8(l + i, v.val[0]);
+    vst1q_s8(r + i, v.val[1]);
+  }
+#endif
+  ref_deinterleave_s8(in + i * 2u, l + i, r + i, frames - i);
+}
+
+void pcm_downmix_s8(const int8_t *in, int8_t *out, size_t frames) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const int16x8_t one = vdupq_n_s16(1);
+  for (; i + 16u <= frames; i += 16u) {
+    int8x16x2_t v = vld2q_s8(in + i * 2u);
+    int16x8_t lo = vaddl_s8(vget_low_s8(v.val[0]), vget_low_s8(v.val[1]));
+    int16x8_t hi = vaddl_s8(vget_high_s8(v.val[0]), vget_high_s8(v.val[1]));
+    lo = vaddq_s16(lo, vandq_s16(vshrq_n_s16(lo, 15), one));
+    hi = vaddq_s16(hi, vandq_s16(vshrq_n_s16(hi, 15), one));
+    vst1q_s8(out + i, vcombine_s8(vshrn_n_s16(lo, 1), vshrn_n_s16(hi, 1)));
+  }
+#endif
+  ref_downmix_s8(in + i * 2u, out + i, frames - i);
+}
+
+void pcm_downmix_s16_to_s8(const uint8_t *in, int8_t *out, size_t frames) {
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const int32x4_t bias_mask = vdupq_n_s32(511);
+  for (; i + 8u <= frames; i += 8u) {
+    int16x8_t a = vreinterpretq_s16_u8(vld1q_u8(in + i * 4u));
+    int16x8_t b = vreinterpretq_s16_u8(vld1q_u8(in + i * 4u + 16u));
+    int16x8x2_t lr = vuzpq_s16(a, b);
+    int32x4_t lo = vaddl_s16(vget_low_s16(lr.val[0]), vget_low_s16(lr.val[1]));
+    int32x4_t hi = vaddl_s16(vget_high_s16(lr.val[0]), vget_high_s16(lr.val[1]));
+    lo = vaddq_s32(lo, vandq_s32(vshrq_n_s32(lo, 31), bias_mask));
+    hi = vaddq_s32(hi, vandq_s32(vshrq_n_s32(hi, 31), bias_mask));
+    int16x8_t m = vcombine_s16(vshrn_n_s32(lo, 9), vshrn_n_s32(hi, 9));
+    vst1_s8(out + i, vmovn_s16(m));
+  }
+#endif
+  ref_downmix_s16_to_s8(in + i * 4u, out + i, frames - i);
+}
+
+int pcm_split14_cal_init(pcm_split14_cal_t *cal, const int32_t level[256]) {
+  for (unsigned h = 1; h < 256u; h++) {
+    if (level[h] <= level[h - 1u]) return -1;
+  }
+  // For each 14-bit target take the highest hi byte at or below it and
+  // make up the rest with lo, which may go past 63 where the DAC has a
+  // wide step.
+  unsigned h = 0;
+  for (int t = -8192; t < 8192; t++) {
+    while (h < 255u && level[h + 1u] <= t) h++;
+    int32_t lo = t - level[h];
+    if (lo < -128) lo = -128;
+    if (lo > 127) lo = 127;
+    cal->pair[t + 8192] = (uint16_t)(((h - 128u) & 0xFFu) << 8 | ((uint32_t)lo & 0xFFu));
+  }
+  return 0;
+}
+
+void pcm_split14(const pcm_split14_cal_t *cal, const uint8_t *in, int8_t *hi,
+                 int8_t *lo, size_t n) {
+  if (cal) {
+    cal_split14(cal, in, 2u, hi, lo, n);
+    return;
+  }
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const int16x8_t low_mask = vdupq_n_s16(0xFC);
+  for (; i + 16u <= n; i += 16u) {
+    int16x8_t a = vreinterpretq_s16_u8(vld1q_u8(in + i * 2u));
+    int16x8_t b = vreinterpretq_s16_u8(vld1q_u8(in + i * 2u + 16u));
+    vst1q_s8(hi + i, vcombine_s8(vshrn_n_s16(a, 8), vshrn_n_s16(b, 8)));
+    vst1q_s8(lo + i, vcombine_s8(vshrn_n_s16(vandq_s16(a, low_mask), 2),
+                                 vshrn_n_s16(vandq_s16(b, low_mask), 2)));
+  }
+#endif
+  ref_split14(in + i * 2u, 2u, hi + i, lo + i, n - i);
+}
+
+void pcm_split14_stereo(const pcm_split14_cal_t *cal, const uint8_t *in,
+                        int8_t *hi_l, int8_t *hi_r, int8_t *lo_l, int8_t *lo_r,
+                        size_t frames) {
+  if (cal) {
+    cal_split14(cal, in, 4u, hi_l, lo_l, frames);
+    cal_split14(cal, in + 2u, 4u, hi_r, lo_r, frames);
+    return;
+  }
+  size_t i = 0;
+#ifdef PCM_HAVE_NEON
+  const int16x8_t low_mask = vdupq_n_s16(0xFC);
+  for (; i + 8u <= frames; i += 8u) {
+    int16x8_t a = vreinterpretq_s16_u8(vld1q_u8(in + i * 4u));
+    int16x8_t b = vreinterpretq_s16_u8(vld1q_u8(in + i * 4u + 16u));
+    int16x8x2_t lr = vuzpq_s16(a, b);
+    vst1_s8(hi_l + i, vshrn_n_s16(lr.val[0], 8));
+    vst1_s8(hi_r + i, vshrn_n_s16(lr.val[1], 8));
+    vst1_s8(lo_l + i, vshrn_n_s16(vandq_s16(lr.val[0], low_mask), 2));
+    vst1_s8(lo_r + i, vshrn_n_s16(vandq_s16(lr.val[1], low_mask), 2));
+  }
+#endif
+  ref_split14(in + i * 4u, 4u, hi_l + i, lo_l + i, frames - i);
+  ref_split14(in + i * 4u + 2u, 4u, hi_r + i, lo_r + i, frames - i);
+}
+
+void pcm_dither_init(pcm_dither_t *d, unsigned channels, int shape, uint32_t seed) {
+  memset(d, 0, sizeof(*d));
+  d->rng = seed ? seed : 0x2545F491u;
+  d->channels = channels == 2 ? 2u : 1u;
+  d->shape = shape;
+}
+
+// The error feedback is a per-sample recurrence, so this stays scalar; at
+// a few ns per sample it is far below the bus cost of uploading the result.
+void pcm_s16_to_s8_dither(pcm_dither_t *d, const uint8_t *in, int8_t *out,
+                          size_t n) {
+  uint32_t rng = d->rng;
+  unsigned ch = d->ch;
+  for (size_t i = 0; i < n; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    // Sum of two uniform values: triangular over +-1 output LSB.
+    int32_t tpdf = (int32_t)(rng & 0xFFu) - (int32_t)((rng >> 8) & 0xFFu);
+    int32_t w = (int32_t)load_s16le(in + i * 2u) - (d->shape ? d->err[ch] : 0);
+    int32_t q = (w + tpdf + 128) >> 8;
+    if (q < -128) q = -128;
+    if (q > 127) q = 127;
+    int32_t e = q * 256 - w;
+    // Keep the loop stable when the output clips.
+    if (e > 512) e = 512;
+    if (e < -512) e = -512;
+    d->err[ch] = e;
+    out[i] = (int8_t)q;
+    ch = d->channels == 2 ? ch ^ 1u : 0u;
+  }
+  d->rng = rng;
+  d->ch = ch;
+}
+
+static void bench(const char *name, double samples, uint64_t ns, FILE *out) {
+  double msps = ns ? samples * 1000.0 / (double)ns : 0.0;
+  // 28 kHz stereo needs 0.056 Msamples/s.
+  fprintf(out, "  %-22s %8.1f Msamples/s (%.0fx 28 kHz stereo)\n", name, msps,
+          msps / 0.056);
+}
+
+int pcm_convert_selftest(FILE *out) {
+  // Odd sizes exercise the scalar tails after the vector loops.
+  const size_t n = 65536u + 13u;
+  uint8_t *s16 = (uint8_t *)malloc(n * 4u);
+  int8_t *a = (int8_t *)malloc(n * 2u);
+  int8_t *b = (int8_t *)malloc(n * 2u);
+  int8_t *c = (int8_t *)malloc(n);
+  int8_t *e = (int8_t *)malloc(n);
+  if (!s16 || !a || !b || !c || !e) {
+    fprintf(stderr, "selftest: out of memory\n");
+    free(s16); free(a); free(b); free(c); free(e);
+    return 1;
+  }
+  uint32_t seed = 12345u;
+  static const int16_t edges[] = {-32768, 32767, -1, 0, 1, -256, 255, -257, 256, -255};
+  for (size_t i = 0; i < n * 2u; i++) {
+    int16_t v = (i < sizeof(edges) / sizeof(edges[0])) ? edges[i]
+                                                        : (int16_t)selftest_rng(&seed);
+    s16[i * 2u] = (uint8_t)v;
+    s16[i * 2u + 1u] = (uint8_t)((uint16_t)v >> 8);
+  }
+  const uint8_t *u8 = s16;            // reuse the random bytes
+  const int8_t *s8 = (const int8_t *)s16;
+  int bad = 0;
+
+#ifdef PCM_HAVE_NEON
+  fprintf(out, "PCM kernels (NEON vs scalar reference):\n");
+#else
+  fprintf(out, "PCM kernels (scalar build, reference only):\n");
+#endif
+  pcm_s16_to_s8(s16, a, n * 2u);
+  ref_s16_to_s8(s16, b, n * 2u);
+  bad += selftest_diff("s16_to_s8", a, b, n * 2u, out);
+
+  pcm_u8_to_s8(u8, a, n);
+  ref_u8_to_s8(u8, b, n);
+  bad += selftest_diff("u8_to_s8", a, b, n, out);
+
+  pcm_s8_to_u8(s8, (uint8_t *)a, n);
+  ref_s8_to_u8(s8, (uint8_t *)b, n);
+  bad += selftest_diff("s8_to_u8", a, b, n, out);
+
+  pcm_deinterleave_s8(s8, a, a + n, n);
+  ref_deinterleave_s8(s8, b, b + n, n);
+  bad += selftest_diff("deinterleave_s8", a, b, n * 2u, out);
+
+  pcm_downmix_s8(s8, a, n);
+  ref_downmix_s8(s8, b, n);
+  bad += selftest_diff("downmix_s8", a, b, n, out);
+
+  pcm_downmix_s16_to_s8(s16, a, n);
+  ref_downmix_s16_to_s8(s16, b, n);
+  bad += selftest_diff("downmix_s16_to_s8", a, b, n, out);
+
+  pcm_split14(NULL, s16, a, a + n, n);
+  ref_split14(s16, 2u, b, b + n, n);
+  bad += selftest_diff("split14", a, b, n * 2u, out);
+
+  pcm_split14_stereo(NULL, s16, a, a + n, c, e, n);
+  ref_split14(s16, 4u, b, b + n, n);
+  bad += selftest_diff("split14_stereo hi_l", a, b, n, out);
+  bad += selftest_diff("split14_stereo lo_l", c, b + n, n, out);
+  ref_split14(s16 + 2u, 4u, b, b + n, n);
+  bad += selftest_diff("split14_stereo hi_r", a + n, b, n, out);
+  bad += selftest_diff("split14_stereo lo_r", e, b + n, n, out);
+
+  // A calibration of an ideal DAC must give the linear split, and every
+  // calibrated pair must add back up to the 14-bit value it came from.
+  pcm_split14_cal_t *cal = (pcm_split14_cal_t *)malloc(sizeof(*cal));
+  int32_t level[256];
+  for (int h = 0; h < 256; h++) level[h] = (h - 128) * 64;
+  if (cal && pcm_split14_cal_init(cal, level) == 0) {
+    pcm_split14(cal, s16, b, b + n, n);
+    pcm_split14(NULL, s16, a, a + n, n);
+    bad += selftest_diff("split14 linear table", a, b, n * 2u, out);
+    for (int h = 0; h < 256; h++) level[h] = (h - 128) * 64 + ((h * 37) % 23) - 11;
+    pcm_split14_cal_init(cal, level);
+    int sum_bad = 0;
+    for (int t = -8192 + 64; t < 8192 - 64; t++) {
+      uint16_t pair = cal->pair[t + 8192];
+      sum_bad += level[(int8_t)(pair >> 8) + 128] + (int8_t)(pair & 0xFFu) != t;
+    }
+    fprintf(out, "  %-22s %s\n", "split14 table sums", sum_bad ? "MISMATCH" : "ok");
+    bad += sum_bad;
+  } else {
+    fprintf(out, "  %-22s MISMATCH\n", "split14 table");
+    bad++;
+  }
+  free(cal);
+
+  // Dither: block boundaries must not change the output, including ones
+  // that split a stereo frame.
+  pcm_dither_t d1;
+  pcm_dither_t d2;
+  pcm_dither_init(&d1, 2, 1, 99u);
+  pcm_dither_init(&d2, 2, 1, 99u);
+  pcm_s16_to_s8_dither(&d1, s16, c, n);
+  for (size_t off = 0; off < n;) {
+    size_t len = selftest_block(&seed, 1u, n - off);
+    pcm_s16_to_s8_dither(&d2, s16 + off * 2u, e + off, len);
+    off += len;
+  }
+  bad += selftest_diff("dither blocks", c, e, n, out);
+
+  // Dithered output stays within one output LSB of the exact value
+  // (plus the shaped error carried from the previous sample).
+  int dither_bad = 0;
+  for (size_t i = 0; i < n; i++) {
+    int exact = load_s16le(s16 + i * 2u);
+    int diff = c[i] * 256 - exact;
+    if (diff > 3 * 256 || diff < -3 * 256) {
+      if (!(exact > 32000 || exact < -32000)) dither_bad++;
+    }
+  }
+  fprintf(out, "  %-22s %s\n", "dither bound", dither_bad ? "MISMATCH" : "ok");
+  bad += dither_bad;
+
+  fprintf(out, "Throughput:\n");
+  uint64_t t0 = pi_now_ns();
+  for (int k = 0; k < 16; k++) pcm_s16_to_s8(s16, a, n * 2u);
+  bench("s16_to_s8", 16.0 * (double)n * 2.0, pi_now_ns() - t0, out);
+  t0 = pi_now_ns();
+  for (int k = 0; k < 16; k++) pcm_deinterleave_s8(s8, a, a + n, n);
+  bench("deinterleave_s8", 16.0 * (double)n * 2.0, pi_now_ns() - t0, out);
+  t0 = pi_now_ns();
+  for (int k = 0; k < 16; k++) pcm_downmix_s16_to_s8(s16, a, n);
+  bench("downmix_s16_to_s8", 16.0 * (double)n * 2.0, pi_now_ns() - t0, out);
+  t0 = pi_now_ns();
+  for (int k = 0; k < 16; k++) pcm_split14_stereo(NULL, s16, a, a + n, c, e, n);
+  bench("split14_stereo", 16.0 * (double)n * 2.0, pi_now_ns() - t0, out);
+  t0 = pi_now_ns();
+  for (int k = 0; k < 16; k++) pcm_s16_to_s8_dither(&d1, s16, a, n);
+  bench("s16_to_s8_dither", 16.0 * (double)n, pi_now_ns() - t0, out);
+
+  fprintf(out, "%s\n", bad ? "FAILED" : "PASSED");
+  free(s16);
+  free(a);
+  free(b);
+  free(c);
+  free(e);
+  return bad;
+}
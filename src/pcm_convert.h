@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: MIT
+// PCM sample conversion kernels for the audio ingest path.
+//
+// NEON versions are used when the compiler targets it; the scalar versions
+// are the reference and give bit-identical results. 16-bit input is
+// little-endian as stored in WAV files. Rounding follows C integer
+// division (toward zero), which is what the original per-sample loops did.
+// Single-output kernels write no faster than they read, so out may alias in.
+
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// s16 -> s8 by truncation (s / 256). n is the number of samples.
+void pcm_s16_to_s8(const uint8_t *in, int8_t *out, size_t n);
+
+// u8 <-> s8 (flip the sign bit).
+void pcm_u8_to_s8(const uint8_t *in, int8_t *out, size_t n);
+void pcm_s8_to_u8(const int8_t *in, uint8_t *out, size_t n);
+
+// Interleaved LR s8 -> separate planes.
+void pcm_deinterleave_s8(const int8_t *in, int8_t *l, int8_t *r, size_t frames);
+
+// Stereo downmix to mono: (l + r) / 2 for s8, (l + r) / 512 for s16.
+void pcm_downmix_s8(const int8_t *in, int8_t *out, size_t frames);
+void pcm_downmix_s16_to_s8(const uint8_t *in, int8_t *out, size_t frames);
+
+// s16 -> s8 with triangular (TPDF) dither and first-order error-feedback
+// noise shaping, which moves requantisation noise up and out of the band
+// Paula's output filter passes. The state carries across calls, so
+// splitting a stream into blocks does not change the output.
+typedef struct {
+  uint32_t rng;
+  int32_t err[2];           // per-channel shaped error, in s16 units
+  unsigned channels;        // 1 or 2, for interleaved input
+  unsigned ch;              // channel of the next sample; a call may end mid-frame
+  int shape;                // 0 = plain TPDF dither
+} pcm_dither_t;
+
+void pcm_dither_init(pcm_dither_t *d, unsigned channels, int shape, uint32_t seed);
+void pcm_s16_to_s8_dither(pcm_dither_t *d, const uint8_t *in, int8_t *out,
+                          size_t n);
+
+// Paula 14-bit output: each sample plays on two channels of one side,
+// hi at volume 64 and lo at volume 1, so the pair sums to hi * 64 + lo
+// volume-1 steps. The linear split is hi = s >> 8, lo = (s >> 2) & 63.
+//
+// Real DACs are not that even, so cal may carry a measured split instead:
+// pair[(s >> 2) + 8192] is (hi << 8) | (uint8_t)lo. NULL means linear.
+// The calibrated split is a table gather and stays scalar.
+#define PCM_SPLIT14_LEVELS 16384u
+
+typedef struct {
+  uint16_t pair[PCM_SPLIT14_LEVELS];
+} pcm_split14_cal_t;
+
+// level[h + 128] is the output of hi byte h at volume 64, in volume-1
+// steps (h * 64 on an ideal machine). Returns -1 unless it is strictly
+// increasing.
+int pcm_split14_cal_init(pcm_split14_cal_t *cal, const int32_t level[256]);
+
+// Mono s16 -> hi/lo planes, and interleaved LR s16 -> four planes.
+void pcm_split14(const pcm_split14_cal_t *cal, const uint8_t *in, int8_t *hi,
+                 int8_t *lo, size_t n);
+void pcm_split14_stereo(const pcm_split14_cal_t *cal, const uint8_t *in,
+                        int8_t *hi_l, int8_t *hi_r, int8_t *lo_l, int8_t *lo_r,
+                        size_t frames);
+
+// Checks every kernel against the scalar reference on random data and
+// prints throughput. Returns the number of mismatches.
+int pcm_convert_selftest(FILE *out);
+
+#endif /* PCM_CONVERT_H */
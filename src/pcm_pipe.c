@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: MIT
+// Streaming PCM input: reader thread -> convert thread -> consumer.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcm_convert.h"
+#include "pcm_pipe.h"
+
+static int pipe_quit(pcm_pipe_t *p) {
+  return __atomic_load_n(&p->quit, __ATOMIC_ACQUIRE) || (p->stop && *p->stop);
+}
+
+static size_t read_full(int fd, uint8_t *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    got += (size_t)n;
+  }
+  return got;
+}
+
+static int skip_bytes(int fd, uint32_t len) {
+  uint8_t tmp[256];
+  while (len > 0) {
+    size_t n = len > sizeof(tmp) ? sizeof(tmp) : len;
+    if (read_full(fd, tmp, n) != n) return -1;
+    len -= (uint32_t)n;
+  }
+  return 0;
+}
+
+static uint32_t le32(const uint8_t *b) {
+  return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) |
+         ((uint32_t)b[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *b) {
+  return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+// Reads chunks up to and including the "data" chunk header, without
+// seeking, so pipes work.
+static int parse_wav_header(pcm_pipe_t *p) {
+  uint8_t hdr[12];
+  if (read_full(p->fd, hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) != 0 ||
+      memcmp(hdr + 8, "WAVE", 4) != 0) {
+    return -1;
+  }
+  uint16_t format = 0;
+  for (;;) {
+    uint8_t ch[8];
+    if (read_full(p->fd, ch, 8) != 8) return -1;
+    uint32_t size = le32(ch + 4);
+    if (!memcmp(ch, "fmt ", 4)) {
+      uint8_t fmt[16];
+      if (size < 16 || read_full(p->fd, fmt, 16) != 16) return -1;
+      format = le16(fmt);
+      p->in_channels = le16(fmt + 2);
+      p->rate_hz = le32(fmt + 4);
+      p->bits = le16(fmt + 14);
+      if (skip_bytes(p->fd, size - 16u + (size & 1u)) != 0) return -1;
+    } else if (!memcmp(ch, "data", 4)) {
+      // Streaming writers leave the size at 0 or 0xFFFFFFFF.
+      p->data_left = (size == 0 || size == 0xFFFFFFFFu) ? UINT64_MAX : size;
+      break;
+    } else if (skip_bytes(p->fd, size + (size & 1u)) != 0) {
+      return -1;
+    }
+  }
+  if (format != 1 || p->rate_hz == 0 || (p->bits != 8 && p->bits != 16) ||
+      (p->in_channels != 1 && p->in_channels != 2)) {
+    return -1;
+  }
+  return 0;
+}
+
+int pcm_pipe_open(pcm_pipe_t *p, const char *path, pcm_in_format_t format,
+                  unsigned raw_channels, int force_mono) {
+  memset(p, 0, sizeof(*p));
+  p->fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+  if (p->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  p->force_mono = force_mono;
+  if (format == PCM_IN_WAV) {
+    if (parse_wav_header(p) != 0) {
+      fprintf(stderr, "%s: not a PCM WAV (8/16-bit, mono/stereo)\n", path);
+      pcm_pipe_close(p);
+      return -1;
+    }
+  } else {
+    p->bits = 8;
+    p->in_channels = raw_channels == 2 ? 2u : 1u;
+    p->signed_8 = format == PCM_IN_RAW_S8;
+    p->data_left = UINT64_MAX;
+  }
+  p->out_channels = (p->in_channels == 2 && !force_mono) ? 2u : 1u;
+  // Only a hint; pipes return ESPIPE and that is fine.
+  posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return 0;
+}
+
+static void *reader_main(void *arg) {
+  pcm_pipe_t *p = (pcm_pipe_t *)arg;
+  for (;;) {
+    uint8_t *blk = spsc_ring_write_begin(&p->raw);
+    if (!blk) {
+      if (pipe_quit(p)) break;
+      spsc_ring_wait();
+      continue;
+    }
+    ssize_t n = read(p->fd, blk, p->raw.block_bytes);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    p->bytes_read += (uint64_t)n;
+    spsc_ring_write_commit(&p->raw, (size_t)n);
+  }
+  spsc_ring_close(&p->raw);
+  return NULL;
+}
+
+// Converts whole input frames into out_channels signed 8-bit samples each.
+static void convert_frames(pcm_pipe_t *p, const uint8_t *in, size_t frames,
+                           int8_t *out) {
+  size_t n = frames * p->in_channels;
+  int downmix = p->in_channels == 2 && p->out_channels == 1;
+  if (p->bits == 16) {
+    if (downmix) {
+      pcm_downmix_s16_to_s8(in, out, frames);
+    } else if (p->dither) {
+      pcm_s16_to_s8_dither(&p->dither_state, in, out, n);
+    } else {
+      pcm_s16_to_s8(in, out, n);
+    }
+  } else {
+    if (p->signed_8) {
+      memcpy(out, in, n);
+    } else {
+      pcm_u8_to_s8(in, out, n);
+    }
+    if (downmix) pcm_downmix_s8(out, out, frames);
+  }
+}
+
+// Widens whole input frames to s16 at out_channels, for the resampler.
+static void widen_frames(pcm_pipe_t *p, const uint8_t *in, size_t frames,
+                         int16_t *out) {
+  unsigned in_ch = p->in_channels;
+  for (size_t i = 0; i < frames; i++) {
+    int s[2];
+    for (unsigned c = 0; c < in_ch; c++) {
+      size_t k = i * in_ch + c;
+      if (p->bits == 16) {
+        s[c] = (int16_t)le16(in + k * 2u);
+      } else {
+        s[c] = (p->signed_8 ? (int)(int8_t)in[k] : (int)in[k] - 128) * 256;
+      }
+    }
+    if (in_ch == 2 && p->out_channels == 1) {
+      out[i] = (int16_t)((s[0] + s[1]) / 2);
+    } else {
+      for (unsigned c = 0; c < in_ch; c++) out[i * in_ch + c] = (int16_t)s[c];
+    }
+  }
+}
+
+// Waits for space in the output ring. Returns the free frames in the
+// current block, or 0 when the pipe is shutting down.
+static size_t out_room(pcm_pipe_t *p) {
+  while (!p->out_blk) {
+    p->out_blk = spsc_ring_write_begin(&p->pcm);
+    if (p->out_blk) break;
+    if (pipe_quit(p)) return 0;
+    spsc_ring_wait();
+  }
+  return (p->out_cap - p->out_len) / p->out_frame;
+}
+
+static void out_commit(pcm_pipe_t *p, size_t frames) {
+  p->out_len += frames * p->out_frame;
+  if (p->out_len >= p->out_cap) {
+    spsc_ring_write_commit(&p->pcm, p->out_len);
+    p->out_blk = NULL;
+    p->out_len = 0;
+  }
+}
+
+// Runs frames of p->wide through the resampler and the DSP chain, then
+// queues them as s8, or as s16 for the 14-bit split.
+static int push_wide(pcm_pipe_t *p, size_t frames) {
+  const unsigned ch = p->out_channels;
+  int16_t *src = p->wide;
+  while (frames > 0) {
+    size_t room = out_room(p);
+    if (room == 0) return -1;
+    if (room > PCM_PIPE_RS_FRAMES) room = PCM_PIPE_RS_FRAMES;
+    int16_t *s16 = NULL;
+    size_t made = 0;
+    if (p->resampling) {
+      size_t used = frames;
+      made = resample_process(&p->rs, src, &used, p->narrow, room);
+      s16 = p->narrow;
+      src += used * ch;
+      frames -= used;
+    } else {
+      made = frames < room ? frames : room;
+      s16 = src;
+      src += made * ch;
+      frames -= made;
+    }
+    dsp_chain_process(&p->dsp, s16, made);
+    // s16 is native; the Pi is little-endian like WAV data.
+    int8_t *dst = (int8_t *)p->out_blk + p->out_len;
+    if (p->split14) {
+      memcpy(dst, s16, made * ch * sizeof(int16_t));
+    } else if (p->dither) {
+      pcm_s16_to_s8_dither(&p->dither_state, (const uint8_t *)s16, dst, made * ch);
+    } else {
+      pcm_s16_to_s8((const uint8_t *)s16, dst, made * ch);
+    }
+    out_commit(p, made);
+  }
+  return 0;
+}
+
+static void *converter_main(void *arg) {
+  pcm_pipe_t *p = (pcm_pipe_t *)arg;
+  size_t frame_in = p->in_channels * (p->bits / 8u);
+
+  while (p->data_left > 0) {
+    size_t len = 0;
+    const uint8_t *in = spsc_ring_read_begin(&p->raw, &len);
+    if (!in) {
+      if (spsc_ring_drained(&p->raw) || pipe_quit(p)) break;
+      spsc_ring_wait();
+      continue;
+    }
+    if (len > p->data_left) len = (size_t)p->data_left;
+    p->data_left -= len;
+
+    size_t pos = 0;
+    while (pos < len) {
+      const uint8_t *src = NULL;
+      size_t frames = 0;
+      if (p->carry_len) {
+        // Finish the frame split across the previous block boundary.
+        while (p->carry_len < frame_in && pos < len) p->carry[p->carry_len++] = in[pos++];
+        if (p->carry_len < frame_in) break;
+        src = p->carry;
+        frames = 1;
+      } else if (len - pos < frame_in) {
+        while (pos < len) p->carry[p->carry_len++] = in[pos++];
+        break;
+      } else {
+        src = in + pos;
+        frames = (len - pos) / frame_in;
+      }
+      if (p->wide_path) {
+        if (frames > PCM_PIPE_RS_FRAMES) frames = PCM_PIPE_RS_FRAMES;
+        widen_frames(p, src, frames, p->wide);
+        if (push_wide(p, frames) != 0) goto done;
+      } else {
+        size_t room = out_room(p);
+        if (room == 0) goto done;
+        if (frames > room) frames = room;
+        convert_frames(p, src, frames, (int8_t *)p->out_blk + p->out_len);
+        out_commit(p, frames);
+      }
+      if (src == p->carry) {
+        p->carry_len = 0;
+      } else {
+        pos += frames * frame_in;
+      }
+    }
+    spsc_ring_read_commit(&p->raw);
+  }
+  if (p->resampling && !pipe_quit(p)) {
+    // Push the tail of the input out of the filter.
+    size_t tail = resample_latency(&p->rs);
+    memset(p->wide, 0, tail * p->out_channels * sizeof(int16_t));
+    push_wide(p, tail);
+  }
+
+done:
+  if (p->out_blk && p->out_len) spsc_ring_write_commit(&p->pcm, p->out_len);
+  // Let the reader go if we stopped early at the end of the data chunk.
+  __atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+  spsc_ring_close(&p->pcm);
+  return NULL;
+}
+
+int pcm_pipe_start(pcm_pipe_t *p, double rate_hz, volatile sig_atomic_t *stop) {
+  p->stop = stop;
+  if (p->dsp.count && dsp_chain_prepare(&p->dsp, p->out_channels, rate_hz) != 0) {
+    return -1;
+  }
+  if (p->dither) pcm_dither_init(&p->dither_state, p->out_channels, p->dither > 1, 0);
+  double in_hz = p->in_rate_hz > 0.0 ? p->in_rate_hz : (double)p->rate_hz;
+  if (p->out_rate_hz > 0.0 && in_hz != p->out_rate_hz) {
+    if (resample_init(&p->rs, p->out_channels, in_hz, p->out_rate_hz) != 0) return -1;
+    p->resampling = 1;
+  }
+  // Resampling, the DSP chain and the 14-bit split work on s16; plain
+  // conversion goes straight to s8.
+  p->wide_path = p->resampling || p->dsp.count > 0 || p->split14;
+  if (p->wide_path) {
+    p->wide = (int16_t *)malloc(PCM_PIPE_RS_FRAMES * 2u * sizeof(int16_t));
+    p->narrow = (int16_t *)malloc(PCM_PIPE_RS_FRAMES * 2u * sizeof(int16_t));
+    if (!p->wide || !p->narrow) {
+      fprintf(stderr, "pcm pipe: out of memory\n");
+      return -1;
+    }
+  }
+  if (spsc_ring_init(&p->raw, PCM_PIPE_BLOCKS, PCM_PIPE_BLOCK_BYTES) != 0 ||
+      spsc_ring_init(&p->pcm, PCM_PIPE_BLOCKS, PCM_PIPE_BLOCK_BYTES) != 0) {
+    fprintf(stderr, "pcm pipe: out of memory\n");
+    return -1;
+  }
+  p->out_frame = p->out_channels * (p->split14 ? sizeof(int16_t) : 1u);
+  p->out_cap = (p->pcm.block_bytes / p->out_frame) * p->out_frame;
+  if (pthread_create(&p->reader, NULL, reader_main, p) != 0) {
+    fprintf(stderr, "pcm pipe: cannot start reader thread\n");
+    return -1;
+  }
+  if (pthread_create(&p->converter, NULL, converter_main, p) != 0) {
+    fprintf(stderr, "pcm pipe: cannot start converter thread\n");
+    __atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(p->reader, NULL);
+    return -1;
+  }
+  p->started = 1;
+  return 0;
+}
+
+size_t pcm_pipe_fill(void *ctx, uint8_t *const *bufs, size_t max_frames) {
+  pcm_pipe_t *p = (pcm_pipe_t *)ctx;
+  size_t ch = p->out_channels;
+  size_t frame = p->out_frame;
+  size_t got = 0;
+  while (got < max_frames) {
+    if (!p->cur) {
+      p->cur = spsc_ring_read_begin(&p->pcm, &p->cur_len);
+      p->cur_pos = 0;
+      if (!p->cur) {
+        if (spsc_ring_drained(&p->pcm) || (p->stop && *p->stop)) break;
+        spsc_ring_wait();
+        continue;
+      }
+    }
+    size_t n = (p->cur_len - p->cur_pos) / frame;
+    if (n > max_frames - got) n = max_frames - got;
+    const uint8_t *src = p->cur + p->cur_pos;
+    if (p->split14 && ch == 2) {
+      pcm_split14_stereo(p->split14_cal, src, (int8_t *)bufs[0] + got,
+                         (int8_t *)bufs[1] + got, (int8_t *)bufs[3] + got,
+                         (int8_t *)bufs[2] + got, n);
+    } else if (p->split14) {
+      pcm_split14(p->split14_cal, src, (int8_t *)bufs[0] + got, (int8_t *)bufs[3] + got, n);
+      memcpy(bufs[1] + got, bufs[0] + got, n);
+      memcpy(bufs[2] + got, bufs[3] + got, n);
+    } else if (ch == 1) {
+      memcpy(bufs[0] + got, src, n);
+    } else {
+      pcm_deinterleave_s8((const int8_t *)src, (int8_t *)bufs[0] + got,
+                          (int8_t *)bufs[1] + got, n);
+    }
+    got += n;
+    p->cur_pos += n * frame;
+    if (p->cur_pos >= p->cur_len) {
+      spsc_ring_read_commit(&p->pcm);
+      p->cur = NULL;
+    }
+  }
+  return got;
+}
+
+void pcm_pipe_close(pcm_pipe_t *p) {
+  if (p->started) {
+    __atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(p->converter, NULL);
+    // The reader may be blocked in read() on an idle pipe.
+    pthread_cancel(p->reader);
+    pthread_join(p->reader, NULL);
+    p->started = 0;
+  }
+  spsc_ring_free(&p->raw);
+  spsc_ring_free(&p->pcm);
+  if (p->resampling) resample_free(&p->rs);
+  free(p->wide);
+  free(p->narrow);
+  p->wide = NULL;
+  p->narrow = NULL;
+  p->resampling = 0;
+  if (p->fd > STDIN_FILENO) close(p->fd);
+  p->fd = -1;
+}
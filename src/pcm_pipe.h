@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+// Streaming PCM input: reader thread -> convert thread -> consumer.
+//
+// The reader pulls fixed-size blocks from a file or pipe, the converter
+// turns them into signed 8-bit frames (downmix, resampling and the DSP
+// chain included; 16-bit for 14-bit output), and the consumer - the chip
+// RAM uploader - takes frames out through pcm_pipe_fill(). The stages are
+// joined by SPSC rings, so memory use is the same for a 10 second clip
+// and a 10 hour recording.
+
+#ifndef PCM_PIPE_H
+#define PCM_PIPE_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dsp_chain.h"
+#include "pcm_convert.h"
+#include "resample.h"
+#include "spsc_ring.h"
+
+#define PCM_PIPE_BLOCK_BYTES  0x10000u
+#define PCM_PIPE_BLOCKS       8u
+#define PCM_PIPE_RS_FRAMES    1024u    // frames per resampler pass
+
+typedef enum {
+  PCM_IN_RAW_U8 = 0,
+  PCM_IN_RAW_S8,
+  PCM_IN_WAV
+} pcm_in_format_t;
+
+typedef struct {
+  // Filled in by pcm_pipe_open().
+  unsigned rate_hz;         // from the WAV header, 0 for raw input
+  unsigned in_channels;
+  unsigned out_channels;
+  unsigned bits;
+  uint64_t bytes_read;
+
+  // Set before pcm_pipe_start(): 16-bit input is dithered to 8 bits
+  // (1 = TPDF, 2 = TPDF + noise shaping). Ignored when downmixing
+  // without resampling.
+  int dither;
+  // Set before pcm_pipe_start() to resample from in_rate_hz (the WAV rate
+  // if 0) to out_rate_hz. 0 passes samples through unchanged.
+  double in_rate_hz;
+  double out_rate_hz;
+  // Set before pcm_pipe_start(): filters run after resampling, at rate_hz.
+  dsp_chain_t dsp;
+  // Set before pcm_pipe_start() for Paula 14-bit output: frames stay s16
+  // through the pipe and pcm_pipe_fill() splits them into the four planes
+  // AUD0-3 play (hi L, hi R, lo R, lo L; mono goes to both sides). Dither
+  // is not applied. split14_cal may be NULL for the linear split.
+  int split14;
+  const pcm_split14_cal_t *split14_cal;
+
+  // Internal.
+  int fd;
+  int signed_8;
+  int force_mono;
+  uint64_t data_left;       // WAV data bytes left, UINT64_MAX = until EOF
+  pcm_dither_t dither_state;
+  int resampling;
+  int wide_path;            // convert via s16 (resampler and/or DSP chain)
+  resample_t rs;
+  int16_t *wide;            // converter scratch, s16 before resampling
+  int16_t *narrow;          // converter scratch, s16 after resampling
+  uint8_t *out_blk;         // converter's current output block
+  size_t out_len;
+  size_t out_cap;
+  size_t out_frame;         // bytes per queued frame
+  uint8_t carry[4];         // partial input frame between blocks
+  size_t carry_len;
+  int quit;
+  int started;
+  volatile sig_atomic_t *stop;
+  pthread_t reader;
+  pthread_t converter;
+  spsc_ring_t raw;
+  spsc_ring_t pcm;
+  const uint8_t *cur;       // consumer's current block
+  size_t cur_len;
+  size_t cur_pos;
+} pcm_pipe_t;
+
+// Opens path ("-" for stdin) and, for WAV, parses the header up to the
+// data chunk. raw_channels applies to raw input only. Returns -1 on error.
+int pcm_pipe_open(pcm_pipe_t *p, const char *path, pcm_in_format_t format,
+                  unsigned raw_channels, int force_mono);
+
+// Starts the reader and converter. rate_hz is the output rate, which the
+// DSP chain is designed for.
+int pcm_pipe_start(pcm_pipe_t *p, double rate_hz, volatile sig_atomic_t *stop);
+
+// paula_stream_fill_fn: blocks until max_frames frames are ready or the
+// input ends, and deinterleaves them into bufs[0..out_channels-1], or
+// bufs[0..3] with split14.
+size_t pcm_pipe_fill(void *ctx, uint8_t *const *bufs, size_t max_frames);
+
+void pcm_pipe_close(pcm_pipe_t *p);
+
+#endif /* PCM_PIPE_H */
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: MIT
+// Monotonic clock helpers for the Pi-side tools.
+// Callers need _GNU_SOURCE or _POSIX_C_SOURCE >= 199309L for clock_gettime().
+
+#ifndef PI_TIME_H
+#define PI_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t pi_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void pi_sleep_ns(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000ull);
+  ts.tv_nsec = (long)(ns % 1000000000ull);
+  nanosleep(&ts, NULL);
+}
+
+// Sleeps until the monotonic deadline (pi_now_ns() time) and busy-waits
+// the last spin_ns of it, which the scheduler cannot be trusted to hit.
+static inline void pi_sleep_until_ns(uint64_t deadline, uint64_t spin_ns) {
+  if (deadline > spin_ns) {
+    uint64_t wake = deadline - spin_ns;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(wake / 1000000000ull);
+    ts.tv_nsec = (long)(wake % 1000000000ull);
+    while (pi_now_ns() < wake &&
+           clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+  }
+  while (pi_now_ns() < deadline) {
+  }
+}
+
+#endif /* PI_TIME_H */
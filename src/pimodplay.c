@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: MIT
-// Pi-side Paula DMA audio harness (raw sample playback).
-// MOD replay engine will be layered on top of this.
+// Pi-side Paula DMA audio player: raw and WAV streaming, ProTracker MOD
+// replay, playlists, the wavetable synth and MIDI input, all driven over
+// the PiStorm bus.
 
 #define _GNU_SOURCE
 
@@ -13,9 +14,37 @@
 #include <math.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 #include "gpio/ps_protocol.h"
 #include "paula.h"
+#include "chip_ram.h"
+#include "chip_cache.h"
+#include "xfer_sched.h"
+#include "amiga_detect.h"
+#include "paula_stream.h"
+#include "paula_dat.h"
+#include "paula_attach.h"
+#include "pcm_pipe.h"
+#include "pcm_convert.h"
+#include "pcm_cache.h"
+#include "dsp_chain.h"
+#include "wavesynth.h"
+#include "midi_in.h"
+#include "lat_hist.h"
+#include "pi_time.h"
+#include "paula_writer.h"
+#include "mod_replay.h"
+#include "cia_timer.h"
+#include "mod_upload.h"
+#include "mod_mixer.h"
+#include "mix_stream.h"
+#include "mod_regs.h"
+#include "playlist.h"
 
 // ps_protocol.c expects this symbol from the emulator core.
 void m68k_set_irq(unsigned int level) {
@@ -25,9 +54,15 @@ void m68k_set_irq(unsigned int level) {
 #define DMAF_SETCLR 0x8000
 #define DMAF_MASTER 0x0200
 #define DMAF_AUD0   0x0001
-#define CHIP_ADDR_MASK 0x0FFFFFu
-#define MOD_MAX_SAMPLES 31
-#define MOD_CHANNELS 4
+#define SPLIT14_CAL_DEFAULT "/var/tmp/paula14-%08x.cal"   // by machine fingerprint
+#define SPLIT14_BUS_SHARE   0.75    // of the bus the uploads may take
+#define BUS_PROBE_BYTES     16384u
+
+enum {
+  MOD_CACHE_ON = 0,
+  MOD_CACHE_OFF,
+  MOD_CACHE_RESET
+};
 
 static const uint32_t AUD_LCH[MOD_CHANNELS] = {AUD0LCH, AUD1LCH, AUD2LCH, AUD3LCH};
 static const uint32_t AUD_LCL[MOD_CHANNELS] = {AUD0LCL, AUD1LCL, AUD2LCL, AUD3LCL};
@@ -37,33 +72,34 @@ static const uint32_t AUD_VOL[MOD_CHANNELS] = {AUD0VOL, AUD1VOL, AUD2VOL, AUD3VO
 static const uint16_t AUD_DMA_MASK[MOD_CHANNELS] = {0x0001, 0x0002, 0x0004, 0x0008};
 
 static double paula_clock_hz(int is_pal);
-static void sleep_seconds(double seconds);
-static void audio_program_note(uint32_t addr, const uint8_t *buf, size_t len,
-                               uint16_t period, uint16_t vol);
 static void audio_program_note_ch(int ch, uint32_t addr, const uint8_t *buf,
                                   size_t len, uint16_t period, uint16_t vol);
-static void program_channel(int ch, uint32_t addr, uint32_t len_bytes,
-                            uint16_t period, uint8_t vol);
-static void apply_lpf_mono(int8_t *data, size_t samples, double rate_hz,
-                           double cutoff_hz);
-static void apply_lpf_stereo(int8_t *data, size_t frames, double rate_hz,
-                             double cutoff_hz);
+static void dsp_run_s8(dsp_chain_t *dsp, int8_t *data, size_t frames,
+                       unsigned channels, double rate_hz);
 
 static volatile sig_atomic_t stop_requested = 0;
+static xfer_sched_t xfer;
+static uint32_t chip_ram_limit = 0x200000u;   // replaced by detection
+static int pcm_cache_on = 1;
+static const char *pcm_cache_dir = NULL;        // NULL = PCM_CACHE_DIR_ENV or default
+static uint64_t pcm_cache_bytes = 0;
 
 static void usage(const char *prog) {
   fprintf(stderr,
-          "Usage: %s [--raw <file> | --mod <file>] [options]\n"
+          "Usage: %s [--raw <file> | --mod <file> | --playlist <file>] [options]\n"
           "\n"
           "Raw sample playback (AUD0 DMA):\n"
-          "  --raw <file>        8-bit unsigned sample data\n"
-          "  --wav <file>        WAV PCM mono/stereo (8/16-bit)\n"
+          "  --raw <file>        8-bit unsigned sample data (\"-\" = stdin, streams)\n"
+          "  --wav <file>        WAV PCM mono/stereo (8/16-bit, \"-\" = stdin)\n"
           "  --addr <hex>        Chip RAM load address (default 0x00080000)\n"
           "  --period <val>      Paula period (default 200)\n"
           "  --rate <hz>         Sample rate (overrides --period)\n"
           "  --vol <0-64>        Volume (default 64)\n"
           "  --seconds <n>       Playback duration (default 5)\n"
-          "  --stream            Stream long samples in chunks\n"
+          "  --stream            Stream gaplessly in chunks queued on the AUDx latch\n"
+          "  --dat               Write --raw samples to AUD0DAT/AUD1DAT from the CPU,\n"
+          "                      DMA off: sub-ms latency at low rates. Alone, reports\n"
+          "                      the highest rate this machine sustains\n"
           "  --chunk-bytes <n>   Stream chunk size (default 131070 bytes)\n"
           "  --buffers <n>       Stream buffers in Chip RAM (default 2)\n"
           "  --u8                Raw input is unsigned 8-bit (default for --raw)\n"
@@ -71,19 +107,69 @@ static void usage(const char *prog) {
           "  --stereo            Raw/WAV is stereo interleaved (AUD0/AUD1)\n"
           "  --mono              Force mono (downmix if WAV is stereo)\n"
           "  --lpf <hz>          Apply low-pass filter (Hz)\n"
+          "  --dsp <stages>      Filter chain, comma separated: lpf:HZ lp:HZ[:Q]\n"
+          "                      hp:HZ[:Q] dc[:HZ] fir:HZ[:TAPS] gain:DB limit:DBFS\n"
+          "  --dither            TPDF-dither 16-bit input down to 8 bits\n"
+          "  --noise-shape       Dither with first-order noise shaping\n"
+          "  --resample          Resample to the exact rate of --period (or the\n"
+          "                      period nearest the source rate); streams\n"
+          "  --bus-budget <KB/s> With --resample, lengthen the period until the\n"
+          "                      upload fits in this bus bandwidth; also caps the\n"
+          "                      mix streams of 6/8-channel MODs\n"
+          "  --14bit             Stream 16-bit input as ~14 bits on AUD0-3: volume\n"
+          "                      64 and volume 1 channel pairs per side (--vol and\n"
+          "                      --dither ignored; twice the upload bandwidth)\n"
+          "  --14bit-cal <file>  Calibration for --14bit: 256 levels of the hi byte\n"
+          "                      in volume-1 steps (default: /var/tmp/paula14-<id>.cal\n"
+          "                      for this machine if present, else linear)\n"
+          "  --pcm-cache <dir>   Keep decoded files here and replay them from it\n"
+          "                      (default $PIMODPLAY_PCM_CACHE or /var/tmp/pimodplay-pcm;\n"
+          "                      \"off\" decodes every time)\n"
+          "  --pcm-cache-mb <n>  Cache size, oldest plays evicted first (default 256)\n"
           "\n"
-          "Built-in tune:\n"
-          "  --saints            Play \"When the Saints\" on AUD0\n"
+          "Wavetable synth (tables uploaded once, notes are register writes):\n"
+          "  --synth <file>      Play a note-event score on AUD0-3\n"
+          "  --midi <dev|fifo>   Sound-module mode: play raw MIDI from an ALSA\n"
+          "                      rawmidi device (/dev/snd/midiC1D0) or a FIFO\n"
+          "  --saints            Play \"When the Saints\" on the synth\n"
           "  --tempo <bpm>       Tune tempo (default 180)\n"
           "  --gate <0.0-1.0>    Note gate ratio (default 0.70)\n"
+          "  --attach-demo       Vibrato, tremolo and glides on AUD1/AUD3 swept by\n"
+          "                      AUD0/AUD2 through ADKCON attach: tables in chip RAM\n"
+          "                      at --addr, no Pi writes while a sweep runs\n"
+          "\n"
+          "MOD playback:\n"
+          "  --mod <file>        ProTracker MOD (full effect set); 6/8-channel\n"
+          "                      modules mix their extra channels on the Pi\n"
+          "  --no-cache          Upload all samples, ignore the chip RAM residency cache\n"
+          "  --cache-reset       Discard the residency cache header before loading\n"
+          "  --tick-stats        Print p50/p99 tick lateness once a second\n"
+          "  --cia               Pace ticks from CIAB Timer A, locked to Paula's clock\n"
+          "  --preload           Upload every sample before the first tick (default:\n"
+          "                      start at once, upload the rest between ticks)\n"
+          "  --compile <out>     With --mod, store the song's per-tick Paula writes\n"
+          "                      and sample image in a register stream, then exit\n"
+          "  --regs <file>       Play a compiled register stream (4 channels) at --addr\n"
           "\n"
-          "MOD playback (basic):\n"
-          "  --mod <file>        ProTracker MOD (4-channel, basic effects)\n"
+          "Jukebox:\n"
+          "  --playlist <file>   Play MOD, WAV and raw files listed one per line,\n"
+          "                      preparing the next during the current one; raw/WAV\n"
+          "                      options and --addr (stream buffers) apply to all\n"
+          "\n"
+          "Bus transfers:\n"
+          "  --xfer <mode>       Bulk upload strategy: direct, beam (vblank/border\n"
+          "                      only) or turbo (beam + display DMA off for large\n"
+          "                      uploads); prints KB/s on exit\n"
           "\n"
           "Timing:\n"
-          "  --pal (default)     50 Hz tick base\n"
+          "  --pal               50 Hz tick base (default: detected from Agnus)\n"
           "  --ntsc              60 Hz tick base\n"
           "\n"
+          "Machine:\n"
+          "  --detect            Print detected model, region and chip RAM, then exit\n"
+          "  --redetect          Ignore the cached model and probe the hardware again\n"
+          "  --selftest          Check the PCM conversion and mixer kernels and exit\n"
+          "\n"
           "Control:\n"
           "  --stop              Stop audio DMA and mute\n",
           prog);
@@ -99,6 +185,10 @@ static uint32_t parse_u32(const char *s) {
   return (uint32_t)v;
 }
 
+static void report_xfer(void) {
+  xfer_report(&xfer, stdout);
+}
+
 static void handle_sigint(int sig) {
   (void)sig;
   stop_requested = 1;
@@ -143,9 +233,26 @@ static uint16_t period_from_rate(double rate_hz, int is_pal) {
   return (uint16_t)(period + 0.5);
 }
 
+// Picks the integer period to resample to: the requested one, else the
+// one nearest the source rate, raised until DMA keeps up and the upload
+// (rate x channels bytes/s) fits in budget_kbs when a budget is given.
+static uint16_t choose_period(double src_hz, uint16_t requested, unsigned channels,
+                              unsigned budget_kbs, int is_pal) {
+  double clock = paula_clock_hz(is_pal);
+  uint32_t period = requested ? requested : period_from_rate(src_hz, is_pal);
+  if (period < PAULA_MIN_PERIOD) period = PAULA_MIN_PERIOD;
+  if (budget_kbs) {
+    double bytes_per_s = (double)budget_kbs * 1024.0 / (double)channels;
+    uint32_t floor_period = (uint32_t)ceil(clock / bytes_per_s);
+    if (period < floor_period) period = floor_period;
+  }
+  if (period > 65535u) period = 65535u;
+  return (uint16_t)period;
+}
+
 static uint8_t *read_wav_s8(const char *path, size_t *out_len,
                             unsigned *out_rate_hz, int *out_channels,
-                            int force_mono) {
+                            int force_mono, int dither) {
   FILE *f = fopen(path, "rb");
   if (!f) {
     perror(path);
@@ -228,88 +335,43 @@ static uint8_t *read_wav_s8(const char *path, size_t *out_len,
     return NULL;
   }
 
-  uint8_t *out = NULL;
-  size_t frames = 0;
+  // Read the whole data chunk in one go, then convert it in place.
+  size_t bytes_per_frame = (size_t)channels * (bits_per_sample / 8u);
+  size_t frames = data_size / bytes_per_frame;
+  uint8_t *out = (uint8_t *)malloc(frames * bytes_per_frame);
+  if (!out) {
+    fclose(f);
+    return NULL;
+  }
+  if (fread(out, 1, frames * bytes_per_frame, f) != frames * bytes_per_frame) {
+    fclose(f);
+    free(out);
+    return NULL;
+  }
+  int8_t *s8 = (int8_t *)out;
   if (bits_per_sample == 8) {
-    frames = data_size / channels;
-    size_t out_samples = force_mono ? frames : frames * channels;
-    out = (uint8_t *)malloc(out_samples);
-    if (!out) {
-      fclose(f);
-      return NULL;
-    }
-    if (fread(out, 1, data_size, f) != data_size) {
-      fclose(f);
-      free(out);
-      return NULL;
-    }
+    pcm_u8_to_s8(out, s8, frames * channels);
     if (channels == 2 && force_mono) {
-      for (size_t i = 0; i < frames; i++) {
-        int l = (int)out[i * 2] - 128;
-        int r = (int)out[i * 2 + 1] - 128;
-        int v = (l + r) / 2;
-        out[i] = (uint8_t)(int8_t)v;
-      }
+      pcm_downmix_s8(s8, s8, frames);
       *out_len = frames;
     } else {
-      for (size_t i = 0; i < data_size; i++) {
-        out[i] = (uint8_t)((int)out[i] - 128);
-      }
-      *out_len = data_size;
+      *out_len = frames * channels;
     }
+  } else if (channels == 2 && force_mono) {
+    pcm_downmix_s16_to_s8(out, s8, frames);
+    *out_len = frames;
+  } else if (dither) {
+    pcm_dither_t d;
+    pcm_dither_init(&d, channels, dither > 1, 0);
+    pcm_s16_to_s8_dither(&d, out, s8, frames * channels);
+    *out_len = frames * channels;
   } else {
-    frames = data_size / (2u * channels);
-    size_t out_samples = force_mono ? frames : frames * channels;
-    out = (uint8_t *)malloc(out_samples);
-    if (!out) {
-      fclose(f);
-      return NULL;
-    }
-    if (channels == 1) {
-      for (size_t i = 0; i < frames; i++) {
-        int16_t s = 0;
-        if (fread(&s, sizeof(s), 1, f) != 1) {
-          fclose(f);
-          free(out);
-          return NULL;
-        }
-        int v = s / 256;
-        if (v < -128) v = -128;
-        if (v > 127) v = 127;
-        out[i] = (uint8_t)(int8_t)v;
-      }
-      *out_len = frames;
-    } else if (force_mono) {
-      for (size_t i = 0; i < frames; i++) {
-        int16_t l = 0;
-        int16_t r = 0;
-        if (fread(&l, sizeof(l), 1, f) != 1 ||
-            fread(&r, sizeof(r), 1, f) != 1) {
-          fclose(f);
-          free(out);
-          return NULL;
-        }
-        int v = ((int)l + (int)r) / 512;
-        if (v < -128) v = -128;
-        if (v > 127) v = 127;
-        out[i] = (uint8_t)(int8_t)v;
-      }
-      *out_len = frames;
-    } else {
-      for (size_t i = 0; i < frames * 2u; i++) {
-        int16_t s = 0;
-        if (fread(&s, sizeof(s), 1, f) != 1) {
-          fclose(f);
-          free(out);
-          return NULL;
-        }
-        int v = s / 256;
-        if (v < -128) v = -128;
-        if (v > 127) v = 127;
-        out[i] = (uint8_t)(int8_t)v;
-      }
-      *out_len = frames * 2u;
-    }
+    pcm_s16_to_s8(out, s8, frames * channels);
+    *out_len = frames * channels;
+  }
+  if (*out_len && *out_len < frames * bytes_per_frame) {
+    uint8_t *shrunk = (uint8_t *)realloc(out, *out_len);
+    if (shrunk) out = shrunk;
   }
 
   fclose(f);
@@ -318,17 +380,6 @@ static uint8_t *read_wav_s8(const char *path, size_t *out_len,
   return out;
 }
 
-static void write_chip_ram(uint32_t addr, const uint8_t *buf, size_t len) {
-  size_t i = 0;
-  for (; i + 1 < len; i += 2) {
-    uint16_t v = ((uint16_t)buf[i] << 8) | (uint16_t)buf[i + 1];
-    ps_write_16(addr + (uint32_t)i, v);
-  }
-  if (i < len) {
-    ps_write_8(addr + (uint32_t)i, buf[i]);
-  }
-}
-
 static void audio_stop(void) {
   ps_write_16(AUD0VOL, 0);
   ps_write_16(DMACON, DMAF_MASTER | DMAF_AUD0);
@@ -368,225 +419,271 @@ static void audio_play_raw(uint32_t addr, const uint8_t *buf, size_t len,
   audio_stop();
 }
 
-static void audio_play_stream(uint32_t addr, const uint8_t *buf, size_t len,
-                              uint16_t period, uint16_t vol,
-                              double rate_hz, unsigned seconds,
-                              size_t chunk_bytes, size_t buffers) {
-  uint32_t addr_masked = addr & CHIP_ADDR_MASK;
-  size_t max_chunk = 0xFFFFu * 2u;
-  if (chunk_bytes == 0 || chunk_bytes > max_chunk) chunk_bytes = max_chunk;
-  chunk_bytes &= ~1u;
-  if (chunk_bytes < 2) chunk_bytes = 2;
-  if (buffers < 1) buffers = 1;
-  if (rate_hz <= 0.0) rate_hz = 1.0;
-  if (addr_masked + chunk_bytes * buffers > 0x200000u) {
-    fprintf(stderr, "Stream buffer range exceeds 2MB Chip RAM; use --addr lower or fewer buffers.\n");
-    return;
+static int audio_play_pcm(uint32_t addr, unsigned channels,
+                          paula_stream_fill_fn fill, void *ctx,
+                          uint16_t period, uint16_t vol, const uint16_t *vols,
+                          double rate_hz,
+                          unsigned seconds, size_t chunk_bytes, size_t buffers) {
+  paula_stream_t ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.channels = channels;
+  ps.base = addr & CHIP_ADDR_MASK & ~1u;
+  ps.slot_bytes = chunk_bytes;
+  if (ps.slot_bytes == 0 || ps.slot_bytes > PAULA_STREAM_MAX_SLOT) {
+    ps.slot_bytes = PAULA_STREAM_MAX_SLOT;
   }
-
-  size_t offset = 0;
-  double elapsed = 0.0;
-  size_t slot = 0;
-  while (offset < len && !stop_requested) {
-    size_t chunk = len - offset;
-    if (chunk > chunk_bytes) chunk = chunk_bytes;
-    if (chunk < 2) break;
-
-    uint32_t addr_slot = addr_masked + (uint32_t)(slot * chunk_bytes);
-    write_chip_ram(addr_slot, buf + offset, chunk);
-
-    double chunk_sec = (double)chunk / rate_hz;
-    if (seconds > 0 && elapsed + chunk_sec > (double)seconds) {
-      chunk_sec = (double)seconds - elapsed;
-      if (chunk_sec <= 0.0) break;
-    }
-
-    if (elapsed == 0.0) {
-      program_channel(0, addr_slot, (uint32_t)chunk, period, (uint8_t)vol);
-    } else {
-      sleep_seconds(chunk_sec * 0.95);
-      program_channel(0, addr_slot, (uint32_t)chunk, period, (uint8_t)vol);
-      sleep_seconds(chunk_sec * 0.05);
-    }
-
-    elapsed += chunk_sec;
-    offset += chunk;
-    slot = (slot + 1u) % buffers;
-
-    if (seconds > 0 && elapsed >= (double)seconds) break;
+  ps.slot_bytes &= ~(size_t)1u;
+  if (ps.slot_bytes < 2) ps.slot_bytes = 2;
+  ps.slots = buffers < 2 ? 2u : (unsigned)buffers;
+  ps.period = period;
+  ps.vol = vol;
+  ps.vols = vols;
+  ps.rate_hz = rate_hz > 0.0 ? rate_hz : 1.0;
+  ps.seconds = seconds;
+  if (ps.base + paula_stream_chip_bytes(&ps) > chip_ram_limit) {
+    fprintf(stderr, "Stream buffer range exceeds %uKB Chip RAM; use --addr lower or fewer buffers.\n",
+            chip_ram_limit / 1024u);
+    return -1;
   }
-  audio_stop();
+  int rc = paula_stream_run(&ps, fill, ctx, &stop_requested);
+  paula_stream_report(&ps, stdout);
+  return rc;
 }
 
-static void audio_play_stream_stereo(uint32_t addr, const uint8_t *buf, size_t len,
-                                     uint16_t period, uint16_t vol,
-                                     double rate_hz, unsigned seconds,
-                                     size_t chunk_bytes, size_t buffers) {
-  uint32_t addr_l = addr & CHIP_ADDR_MASK;
-  size_t max_chunk = 0xFFFFu * 2u;
-  if (chunk_bytes == 0 || chunk_bytes > max_chunk) chunk_bytes = max_chunk;
-  if (buffers < 1) buffers = 1;
-  if (rate_hz <= 0.0) rate_hz = 1.0;
-  if (len < 2) return;
-  uint32_t per_chan_bytes = (uint32_t)(chunk_bytes * buffers);
-  uint32_t addr_r = (addr_l + per_chan_bytes) & CHIP_ADDR_MASK;
-  if (addr_r + per_chan_bytes > 0x200000u) {
-    fprintf(stderr, "Stereo buffer range exceeds 2MB chip RAM; use --addr lower or fewer buffers.\n");
-    return;
-  }
-
-  size_t total_frames = len / 2u;
-  size_t offset_frames = 0;
-  double elapsed = 0.0;
-  uint8_t *left = (uint8_t *)malloc(chunk_bytes);
-  uint8_t *right = (uint8_t *)malloc(chunk_bytes);
-  if (!left || !right) {
-    free(left);
-    free(right);
-    return;
+// Reads a 14-bit calibration: 256 numbers, the output of hi bytes -128..127
+// at volume 64 in volume-1 steps, '#' to the end of a line is a comment.
+// Returns 1 when loaded, 0 when an optional file is absent, -1 on error.
+static int load_split14_cal(pcm_split14_cal_t *cal, const char *path, int required) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    if (!required && errno == ENOENT) return 0;
+    perror(path);
+    return -1;
   }
-
-  size_t chunk_frames = chunk_bytes;
-  size_t slot = 0;
-  while (offset_frames < total_frames && !stop_requested) {
-    size_t frames = total_frames - offset_frames;
-    if (frames > chunk_frames) frames = chunk_frames;
-    if (frames < 2) break;
-
-    for (size_t i = 0; i < frames; i++) {
-      left[i] = buf[(offset_frames + i) * 2u + 0];
-      right[i] = buf[(offset_frames + i) * 2u + 1];
-    }
-
-    uint32_t addr_l_slot = addr_l + (uint32_t)(slot * chunk_bytes);
-    uint32_t addr_r_slot = addr_r + (uint32_t)(slot * chunk_bytes);
-    write_chip_ram(addr_l_slot, left, frames);
-    write_chip_ram(addr_r_slot, right, frames);
-
-    double chunk_sec = (double)frames / rate_hz;
-    if (seconds > 0 && elapsed + chunk_sec > (double)seconds) {
-      chunk_sec = (double)seconds - elapsed;
-      if (chunk_sec <= 0.0) break;
+  int32_t level[256];
+  unsigned n = 0;
+  int bad = 0;
+  for (;;) {
+    int c = fgetc(f);
+    if (c == EOF) break;
+    if (isspace(c)) continue;
+    if (c == '#') {
+      while (c != EOF && c != '\n') c = fgetc(f);
+      continue;
     }
-    if (elapsed == 0.0) {
-      program_channel(0, addr_l_slot, (uint32_t)frames, period, (uint8_t)vol);
-      program_channel(1, addr_r_slot, (uint32_t)frames, period, (uint8_t)vol);
-    } else {
-      sleep_seconds(chunk_sec * 0.95);
-      program_channel(0, addr_l_slot, (uint32_t)frames, period, (uint8_t)vol);
-      program_channel(1, addr_r_slot, (uint32_t)frames, period, (uint8_t)vol);
-      sleep_seconds(chunk_sec * 0.05);
+    ungetc(c, f);
+    long v;
+    if (n >= 256u || fscanf(f, "%ld", &v) != 1) {
+      bad = 1;
+      break;
     }
-    elapsed += chunk_sec;
-    offset_frames += frames;
-    slot = (slot + 1u) % buffers;
-
-    if (seconds > 0 && elapsed >= (double)seconds) break;
+    level[n++] = (int32_t)v;
   }
+  fclose(f);
+  if (bad || n != 256u) {
+    fprintf(stderr, "%s: expected 256 levels\n", path);
+    return -1;
+  }
+  if (pcm_split14_cal_init(cal, level) != 0) {
+    fprintf(stderr, "%s: levels must increase with the hi byte\n", path);
+    return -1;
+  }
+  return 1;
+}
 
-  audio_stop_all();
-  free(left);
-  free(right);
+// Times an upload to chip RAM at addr, which the stream overwrites before
+// it plays. Returns bytes per second, 0 if the probe does not fit.
+static double measure_bus_bps(uint32_t addr) {
+  static const uint8_t probe[BUS_PROBE_BYTES];
+  addr &= CHIP_ADDR_MASK & ~1u;
+  if (addr + BUS_PROBE_BYTES > chip_ram_limit) return 0.0;
+  uint64_t t0 = pi_now_ns();
+  write_chip_ram(addr, probe, BUS_PROBE_BYTES);
+  uint64_t ns = pi_now_ns() - t0;
+  return ns ? (double)BUS_PROBE_BYTES * 1e9 / (double)ns : 0.0;
 }
 
-static double paula_clock_hz(int is_pal) {
-  return is_pal ? 3546895.0 : 3579545.0;
+// Describes everything that shapes the decoded output, for the PCM cache
+// key. mode separates the buffered and streaming converters.
+static void describe_pcm(char *out, size_t len, const char *mode, int is_wav,
+                         int raw_unsigned, int stereo, int force_mono, unsigned rate_hz,
+                         uint16_t period, int period_set, int resample, unsigned budget_kbs,
+                         int dither, int is_pal, int split14, const pcm_split14_cal_t *cal,
+                         const dsp_chain_t *dsp) {
+  int n = snprintf(out, len,
+                   "%s wav=%d u8=%d stereo=%d mono=%d rate=%u period=%u/%d resample=%d "
+                   "budget=%u dither=%d pal=%d 14bit=%d cal=%016llx dsp=",
+                   mode, is_wav, raw_unsigned, stereo, force_mono, rate_hz, period,
+                   period_set, resample, budget_kbs, dither, is_pal, split14,
+                   cal ? (unsigned long long)chip_cache_hash((const uint8_t *)cal->pair,
+                                                             sizeof(cal->pair))
+                       : 0ull);
+  for (unsigned i = 0; i < dsp->count && n > 0 && (size_t)n < len; i++) {
+    const dsp_stage_t *st = &dsp->stage[i];
+    n += snprintf(out + n, len - (size_t)n, "%s%d:%g:%g:%g", i ? "," : "", (int)st->kind,
+                  st->hz, st->q, st->db);
+  }
 }
 
-static void gen_sine(uint8_t *dst, size_t samples, double freq_hz, double rate_hz) {
-  const double two_pi = 6.283185307179586;
-  size_t attack = (size_t)(rate_hz * 0.01);
-  size_t release = (size_t)(rate_hz * 0.03);
-  if (attack < 1) attack = 1;
-  if (release < 1) release = 1;
-  if (attack + release > samples) {
-    attack = samples / 4;
-    release = samples / 4;
-  }
-
-  for (size_t i = 0; i < samples; i++) {
-    double amp = 1.0;
-    if (i < attack) {
-      amp = (double)i / (double)attack;
-    } else if (i + release > samples) {
-      amp = (double)(samples - i) / (double)release;
-    }
-    double s = sin(two_pi * freq_hz * ((double)i / rate_hz));
-    int v = 128 + (int)(amp * 127.0 * s);
-    if (v < 0) v = 0;
-    if (v > 255) v = 255;
-    dst[i] = (uint8_t)v;
+// The PCM cache entry for path, hit or miss, or NULL when the cache is
+// off or cannot be used for this input.
+static pcm_cache_t *open_pcm_cache(const char *path, const char *params) {
+  if (!pcm_cache_on || !strcmp(path, "-")) return NULL;
+  pcm_cache_t *c = (pcm_cache_t *)malloc(sizeof(*c));
+  if (!c) return NULL;
+  if (pcm_cache_open(c, pcm_cache_dir, pcm_cache_bytes, path, params) < 0) {
+    pcm_cache_close(c);
+    free(c);
+    return NULL;
   }
+  return c;
 }
 
-static void sleep_seconds(double seconds) {
-  if (seconds <= 0.0) return;
-  struct timespec ts;
-  ts.tv_sec = (time_t)seconds;
-  ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1000000000.0);
-  if (ts.tv_nsec < 0) ts.tv_nsec = 0;
-  if (ts.tv_nsec >= 1000000000L) ts.tv_nsec = 999999999L;
-  nanosleep(&ts, NULL);
+static void close_pcm_cache(pcm_cache_t *c) {
+  if (!c) return;
+  pcm_cache_close(c);
+  free(c);
 }
 
-static void apply_lpf_mono(int8_t *data, size_t samples, double rate_hz,
-                           double cutoff_hz) {
-  if (!data || samples == 0 || cutoff_hz <= 0.0 || rate_hz <= 0.0) return;
-  double x = 2.0 * 3.141592653589793 * cutoff_hz;
-  double alpha = x / (x + rate_hz);
-  double y = 0.0;
-  for (size_t i = 0; i < samples; i++) {
-    double in = (double)data[i];
-    y = y + alpha * (in - y);
-    int v = (int)lrint(y);
-    if (v < -128) v = -128;
-    if (v > 127) v = 127;
-    data[i] = (int8_t)v;
+// Streams a raw or WAV file (or stdin for "-") through the reader/convert
+// pipeline, so memory use does not depend on the input length. split14
+// plays it 14-bit on all four channels, through cal if not NULL.
+static int stream_pcm_file(const char *path, int is_wav, int raw_unsigned,
+                           int stereo, int force_mono, uint32_t addr,
+                           uint16_t period, unsigned rate_hz, uint16_t vol,
+                           unsigned seconds, size_t chunk_bytes, size_t buffers,
+                           dsp_chain_t *dsp, int dither, int resample,
+                           int period_set, unsigned budget_kbs, int is_pal,
+                           int split14, const pcm_split14_cal_t *cal) {
+  // AUD0/AUD3 play left, AUD1/AUD2 right; the hi bytes go out at full
+  // volume and the lo bytes at 1/64 of it.
+  static const uint16_t split14_vols[4] = {64, 64, 1, 1};
+  char params[PCM_CACHE_PARAMS_MAX];
+  describe_pcm(params, sizeof(params), "stream", is_wav, raw_unsigned, stereo, force_mono,
+               rate_hz, period, period_set, resample, budget_kbs, dither, is_pal, split14,
+               cal, dsp);
+  pcm_cache_t *cache = open_pcm_cache(path, params);
+  if (cache && cache->hit) {
+    // Decoded before with these options: play the mapped frames as they are.
+    pcm_cache_report(cache, stdout);
+    printf("[STREAM] %scached addr=0x%06X src=%s period=%u vol=%u rate=%.0fHz seconds=%u PAL=%d\n",
+           split14 ? "14-bit " : "", addr & 0x1FFFFu, path, cache->period, vol,
+           cache->rate_hz, seconds, is_pal);
+    int rc = audio_play_pcm(addr, cache->channels, pcm_cache_fill, cache, cache->period,
+                            vol, split14 ? split14_vols : NULL, cache->rate_hz, seconds,
+                            chunk_bytes, buffers);
+    close_pcm_cache(cache);
+    return rc;
+  }
+  pcm_pipe_t pipe;
+  pcm_in_format_t format = is_wav ? PCM_IN_WAV
+                                  : (raw_unsigned ? PCM_IN_RAW_U8 : PCM_IN_RAW_S8);
+  if (pcm_pipe_open(&pipe, path, format, stereo ? 2u : 1u, force_mono) != 0) {
+    close_pcm_cache(cache);
+    return -1;
+  }
+  if (is_wav && pipe.out_channels == 2 && !stereo) {
+    fprintf(stderr, "WAV is stereo; pass --stereo or --mono.\n");
+    pcm_pipe_close(&pipe);
+    close_pcm_cache(cache);
+    return -1;
+  }
+  pipe.dither = dither;
+  pipe.dsp = *dsp;
+  pipe.split14 = split14;
+  pipe.split14_cal = cal;
+  unsigned paula_channels = split14 ? 4u : pipe.out_channels;
+  double src_hz = is_wav ? (double)pipe.rate_hz : (double)rate_hz;
+  double out_hz = 0.0;
+  if (!resample && src_hz > 0.0 &&
+      paula_clock_hz(is_pal) / src_hz < (double)PAULA_MIN_PERIOD) {
+    fprintf(stderr, "%.0f Hz is above what Paula can play; resampling.\n", src_hz);
+    resample = 1;
   }
+  if (resample) {
+    if (src_hz <= 0.0) {
+      fprintf(stderr, "--resample needs --rate for raw input.\n");
+      pcm_pipe_close(&pipe);
+      close_pcm_cache(cache);
+      return -1;
+    }
+    period = choose_period(src_hz, period_set ? period : 0, paula_channels,
+                           budget_kbs, is_pal);
+    out_hz = paula_clock_hz(is_pal) / (double)period;
+    pipe.in_rate_hz = src_hz;
+    pipe.out_rate_hz = out_hz;
+    rate_hz = (unsigned)(out_hz + 0.5);
+    printf("[RESAMPLE] %.1f Hz -> %.3f Hz (period %u)\n", src_hz, out_hz, period);
+  } else {
+    if (rate_hz == 0) rate_hz = pipe.rate_hz;
+    if (rate_hz) {
+      period = period_from_rate((double)rate_hz, is_pal);
+    } else {
+      rate_hz = (unsigned)(paula_clock_hz(is_pal) / (double)period + 0.5);
+    }
+    out_hz = (double)rate_hz;
+  }
+  if (split14) {
+    // Twice the bytes of the 8-bit stream, and the latch polling and
+    // register writes need their share of the bus too.
+    double need_bps = out_hz * (double)paula_channels;
+    double bus_bps = budget_kbs ? (double)budget_kbs * 1024.0 : measure_bus_bps(addr);
+    printf("[14BIT] %s split, uploads %.1f KB/s, bus %s %.1f KB/s\n",
+           cal ? "calibrated" : "linear", need_bps / 1024.0,
+           budget_kbs ? "budget" : "measured", bus_bps / 1024.0);
+    if (bus_bps > 0.0 && need_bps > bus_bps * SPLIT14_BUS_SHARE) {
+      fprintf(stderr, "Warning: %u Hz 14-bit needs %.1f KB/s, more than the bus sustains "
+              "alongside playback; expect underruns. Lower --rate or use --bus-budget.\n",
+              rate_hz, need_bps / 1024.0);
+    }
+  }
+  if (pcm_pipe_start(&pipe, out_hz, &stop_requested) != 0) {
+    pcm_pipe_close(&pipe);
+    close_pcm_cache(cache);
+    return -1;
+  }
+  // Record what the pipe produces; it is kept if the input plays to the end.
+  paula_stream_fill_fn fill = pcm_pipe_fill;
+  void *fill_ctx = &pipe;
+  if (cache) {
+    cache->channels = paula_channels;
+    cache->period = period;
+    cache->rate_hz = out_hz;
+    if (pcm_cache_record(cache, pcm_pipe_fill, &pipe) == 0) {
+      fill = pcm_cache_record_fill;
+      fill_ctx = cache;
+    }
+  }
+
+  size_t effective_chunk = chunk_bytes ? chunk_bytes : 0xFFFFu * 2u;
+  printf("[STREAM] %s%saddr=0x%06X src=%s period=%u vol=%u rate=%uHz seconds=%u chunk=%zu buffers=%zu PAL=%d\n",
+         split14 ? "14-bit " : "", pipe.out_channels == 2 ? "stereo " : "",
+         addr & 0x1FFFFu, path, period, vol, rate_hz, seconds, effective_chunk, buffers, is_pal);
+  int rc = audio_play_pcm(addr, paula_channels, fill, fill_ctx, period,
+                          vol, split14 ? split14_vols : NULL, out_hz, seconds,
+                          chunk_bytes, buffers);
+  pcm_pipe_close(&pipe);
+  if (cache && rc == 0 && pcm_cache_commit(cache) == 0) pcm_cache_report(cache, stdout);
+  close_pcm_cache(cache);
+  return rc;
 }
 
-static void apply_lpf_stereo(int8_t *data, size_t frames, double rate_hz,
-                             double cutoff_hz) {
-  if (!data || frames == 0 || cutoff_hz <= 0.0 || rate_hz <= 0.0) return;
-  double x = 2.0 * 3.141592653589793 * cutoff_hz;
-  double alpha = x / (x + rate_hz);
-  double yl = 0.0;
-  double yr = 0.0;
-  for (size_t i = 0; i < frames; i++) {
-    double in_l = (double)data[i * 2u + 0];
-    double in_r = (double)data[i * 2u + 1];
-    yl = yl + alpha * (in_l - yl);
-    yr = yr + alpha * (in_r - yr);
-    int vl = (int)lrint(yl);
-    int vr = (int)lrint(yr);
-    if (vl < -128) vl = -128;
-    if (vl > 127) vl = 127;
-    if (vr < -128) vr = -128;
-    if (vr > 127) vr = 127;
-    data[i * 2u + 0] = (int8_t)vl;
-    data[i * 2u + 1] = (int8_t)vr;
-  }
+static double paula_clock_hz(int is_pal) {
+  return is_pal ? 3546895.0 : 3579545.0;
 }
 
-static void audio_program_note(uint32_t addr, const uint8_t *buf, size_t len,
-                               uint16_t period, uint16_t vol) {
-  uint32_t addr_masked = addr & CHIP_ADDR_MASK;
-  size_t len_words_full = (len + 1u) / 2u;
-  if (len_words_full > 0xFFFFu) {
-    len_words_full = 0xFFFFu;
-    len = len_words_full * 2u;
+// Runs the DSP chain over a preloaded buffer, a block at a time.
+static void dsp_run_s8(dsp_chain_t *dsp, int8_t *data, size_t frames,
+                       unsigned channels, double rate_hz) {
+  int16_t tmp[DSP_BLOCK_FRAMES * 2u];
+  if (dsp->count == 0 || dsp_chain_prepare(dsp, channels, rate_hz) != 0) return;
+  for (size_t pos = 0; pos < frames; pos += DSP_BLOCK_FRAMES) {
+    size_t n = frames - pos < DSP_BLOCK_FRAMES ? frames - pos : DSP_BLOCK_FRAMES;
+    int8_t *blk = data + pos * channels;
+    for (size_t i = 0; i < n * channels; i++) tmp[i] = (int16_t)(blk[i] * 256);
+    dsp_chain_process(dsp, tmp, n);
+    pcm_s16_to_s8((const uint8_t *)tmp, blk, n * channels);
   }
-  uint16_t len_words = (uint16_t)len_words_full;
-
-  write_chip_ram(addr, buf, len);
-  ps_write_16(AUD0VOL, 0);
-  ps_write_16(DMACON, DMAF_MASTER | DMAF_AUD0);
-  ps_write_16(AUD0LCH, (addr_masked >> 16) & 0x1Fu);
-  ps_write_16(AUD0LCL, addr_masked & 0xFFFFu);
-  ps_write_16(AUD0LEN, len_words);
-  ps_write_16(AUD0PER, period);
-  ps_write_16(AUD0VOL, vol);
-  ps_write_16(DMACON, DMAF_SETCLR | DMAF_MASTER | DMAF_AUD0);
 }
 
 static void audio_program_note_ch(int ch, uint32_t addr, const uint8_t *buf,
@@ -609,17 +706,13 @@ static void audio_program_note_ch(int ch, uint32_t addr, const uint8_t *buf,
   ps_write_16(DMACON, DMAF_SETCLR | DMAF_MASTER | AUD_DMA_MASK[ch]);
 }
 
-static int play_saints_song(uint32_t addr, double rate_hz, unsigned bpm,
-                            uint16_t period, uint16_t vol, double gate_ratio) {
+static int play_saints_song(uint32_t addr, unsigned bpm, uint16_t vol,
+                            double gate_ratio, int is_pal) {
   struct note {
-    double freq;
+    int note;
     double beats;
   };
-  const double C4 = 261.63;
-  const double D4 = 293.66;
-  const double E4 = 329.63;
-  const double F4 = 349.23;
-  const double G4 = 392.00;
+  enum { C4 = 60, D4 = 62, E4 = 64, F4 = 65, G4 = 67 };
 
   const struct note seq[] = {
     {C4,1},{E4,1},{F4,1},{G4,3},{0,1},
@@ -629,338 +722,1081 @@ static int play_saints_song(uint32_t addr, double rate_hz, unsigned bpm,
     {F4,1},{E4,1},{F4,1},{G4,1},{E4,1},{C4,1},{D4,1},{C4,2},
   };
 
-  const double beat_sec = 60.0 / (double)bpm;
-  const size_t max_samples = 0xFFFFu * 2u;
-  uint8_t *buf = (uint8_t *)malloc(max_samples);
-  if (!buf) return -1;
-
+  if (gate_ratio < 0.05) gate_ratio = 0.05;
+  if (gate_ratio > 0.95) gate_ratio = 0.95;
+  ws_score_t score;
+  ws_score_init(&score, bpm);
+  const ws_env_t env = {10u, 0u, 64u, 30u};
+  double beat = 0.0;
   for (size_t i = 0; i < sizeof(seq) / sizeof(seq[0]); i++) {
-    if (stop_requested) break;
-    double step_sec = seq[i].beats * beat_sec;
-    if (seq[i].freq <= 0.0) {
-      ps_write_16(AUD0VOL, 0);
-      sleep_seconds(step_sec);
-      continue;
-    }
-
-    if (gate_ratio < 0.05) gate_ratio = 0.05;
-    if (gate_ratio > 0.95) gate_ratio = 0.95;
-    double gate_sec = step_sec * gate_ratio;
-    double rest_sec = step_sec - gate_sec;
-    size_t remaining = (size_t)(gate_sec * rate_hz);
-    if (remaining < 16) remaining = 16;
-
-    while (remaining > 0 && !stop_requested) {
-      size_t chunk = remaining > max_samples ? max_samples : remaining;
-      gen_sine(buf, chunk, seq[i].freq, rate_hz);
-      audio_program_note(addr, buf, chunk, period, vol);
-      sleep_seconds((double)chunk / rate_hz);
-      remaining -= chunk;
+    if (seq[i].note &&
+        ws_score_add(&score, beat, seq[i].beats * gate_ratio, seq[i].note, 64,
+                     WS_SINE, &env) != 0) {
+      ws_score_free(&score);
+      return -1;
     }
-    ps_write_16(AUD0VOL, 0);
-    sleep_seconds(rest_sec);
+    beat += seq[i].beats;
   }
 
-  audio_stop();
-  free(buf);
-  return 0;
+  ws_stats_t stats;
+  int rc = ws_play(&score, addr, is_pal, vol, &stop_requested, &stats);
+  ws_report(&stats, stdout);
+  ws_score_free(&score);
+  return rc;
 }
 
-typedef struct {
-  char name[22];
-  uint32_t length_bytes;
-  int8_t finetune;
-  uint8_t volume;
-  uint32_t loop_start_bytes;
-  uint32_t loop_len_bytes;
-  uint32_t chip_addr;
-  const uint8_t *data;
-} mod_sample_t;
+#define ATTACH_CARRIER_BYTES 32u
+#define ATTACH_CARRIER_PER   252u     // 440 Hz on PAL from a 32-byte cycle
+#define ATTACH_TICK_WRITES   2u       // per tick and channel when the Pi sweeps
+
+// ADKCON attach demo: a sine on AUD1 and AUD3, swept by AUD0 and AUD2
+// from tables in chip RAM. Between segments the Pi sets the sweep up;
+// during one it sends nothing.
+static int play_attach_demo(uint32_t addr, uint16_t vol, int is_pal) {
+  struct segment {
+    const char *name;
+    paula_sweep_t sw;
+    double seconds;
+  };
+  const uint16_t v = vol;
+  const struct segment seg[] = {
+    {"vibrato +-50 cents at 5.5 Hz",
+     {PAULA_SWEEP_LFO, 1, 0, ATTACH_CARRIER_PER, 0, 50.0, v, 0, 0, 1.0 / 5.5}, 3.0},
+    {"tremolo at 4 Hz",
+     {PAULA_SWEEP_LFO, 0, 1, ATTACH_CARRIER_PER, 0, 0.0, (uint16_t)(v * 5u / 8u), 0,
+      v * 3u / 8u, 0.25}, 3.0},
+    {"octave glide up, fading in",
+     {PAULA_SWEEP_RAMP, 1, 1, ATTACH_CARRIER_PER, ATTACH_CARRIER_PER / 2u, 0.0, 0, v, 0,
+      2.0}, 3.0},
+    {"two-octave glide down, fading out",
+     {PAULA_SWEEP_RAMP, 1, 1, ATTACH_CARRIER_PER / 2u, ATTACH_CARRIER_PER * 2u, 0.0, v, 0,
+      0, 4.0}, 4.5},
+  };
+  static const unsigned carrier[2] = {1u, 3u};
 
-typedef struct {
-  uint8_t sample;
-  uint16_t period;
-  uint8_t effect;
-  uint8_t param;
-} mod_event_t;
+  uint8_t wave[ATTACH_CARRIER_BYTES];
+  for (unsigned i = 0; i < ATTACH_CARRIER_BYTES; i++) {
+    wave[i] = (uint8_t)(int8_t)lrint(127.0 * sin(2.0 * M_PI * i / ATTACH_CARRIER_BYTES));
+  }
+  addr &= CHIP_ADDR_MASK & ~1u;
+  for (unsigned c = 0; c < 2u; c++) {
+    audio_program_note_ch((int)carrier[c], addr, wave, sizeof(wave), ATTACH_CARRIER_PER,
+                          vol);
+  }
+  double tick_hz = is_pal ? 50.0 : 60.0;
+  int rc = 0;
+  for (size_t i = 0; i < sizeof(seg) / sizeof(seg[0]) && !stop_requested; i++) {
+    const paula_sweep_t *sw = &seg[i].sw;
+    paula_attach_t at[2];
+    uint32_t tab = addr + ATTACH_CARRIER_BYTES;
+    unsigned planned = 0;
+    for (unsigned c = 0; c < 2u; c++) {
+      unsigned ch = carrier[c];
+      if (paula_attach_plan(&at[c], sw, ch - 1u, is_pal) != 0) {
+        rc = -1;
+        break;
+      }
+      planned++;
+      // What the table leaves alone stays where the Pi puts it.
+      if (!sw->use_period) ps_write_16(AUD_PER[ch], sw->period);
+      if (!sw->use_volume) ps_write_16(AUD_VOL[ch], sw->vol);
+      if (paula_attach_start(&at[c], sw, tab) != 0) rc = -1;
+      tab += (uint32_t)paula_attach_chip_bytes(&at[c]);
+    }
+    if (planned < 2u) {
+      for (unsigned c = 0; c < planned; c++) paula_attach_stop(&at[c]);
+      break;
+    }
+    printf("[ATTACH] %s\n", seg[i].name);
+    paula_attach_report(&at[0], stdout);
+    printf("[ATTACH] %.1fs with no Pi writes (a per-tick sweep: %.0f)\n", seg[i].seconds,
+           seg[i].seconds * tick_hz * ATTACH_TICK_WRITES * 2.0);
+    uint64_t end = pi_now_ns() + (uint64_t)(seg[i].seconds * 1e9);
+    while (!stop_requested && pi_now_ns() < end) pi_sleep_ns(10000000ull);
+    for (unsigned c = 0; c < 2u; c++) paula_attach_stop(&at[c]);
+    if (rc != 0) break;
+  }
+  audio_stop_all();
+  return rc;
+}
 
-typedef struct {
-  char name[21];
-  uint8_t song_len;
-  uint8_t restart;
-  uint8_t orders[128];
-  uint8_t num_patterns;
-  mod_sample_t samples[MOD_MAX_SAMPLES];
-  mod_event_t *patterns;
-  uint8_t *data;
-  size_t data_len;
-  size_t pattern_offset;
-  size_t sample_offset;
-} mod_file_t;
+#define DAT_FILL_FRAMES 2u          // per read; more would hold a live input back
 
 typedef struct {
-  uint8_t sample;
-  uint16_t period;
-  uint8_t volume;
-  uint32_t loop_start_bytes;
-  uint32_t loop_len_bytes;
-  double rate_hz;
-  double time_left;
-} mod_chan_t;
-
-static int mod_read_u16(const uint8_t *p) {
-  return ((int)p[0] << 8) | (int)p[1];
+  int fd;
+  unsigned channels;        // interleaved in the input, 1 or 2
+  int is_unsigned;
+  uint8_t part[1];          // first half of a stereo frame
+  size_t part_len;
+} dat_source_t;
+
+// paula_dat_fill_fn over a raw file or pipe, read without blocking so a
+// live source that falls behind costs a held sample, not a stall. Mono
+// input plays on both channels.
+static int dat_source_fill(void *ctx, int8_t *const *bufs, size_t max_frames) {
+  dat_source_t *src = (dat_source_t *)ctx;
+  uint8_t raw[DAT_FILL_FRAMES * 2u];  // up to two input channels
+  if (max_frames > DAT_FILL_FRAMES) max_frames = DAT_FILL_FRAMES;
+  size_t len = src->part_len;
+  if (len) raw[0] = src->part[0];
+  ssize_t n = read(src->fd, raw + len, max_frames * src->channels - len);
+  if (n == 0) return -1;
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR) return -1;
+    n = 0;
+  }
+  len += (size_t)n;
+  size_t frames = len / src->channels;
+  src->part_len = len - frames * src->channels;
+  if (src->part_len) src->part[0] = raw[len - 1u];
+  for (size_t i = 0; i < frames; i++) {
+    for (unsigned c = 0; c < PAULA_DAT_CHANNELS; c++) {
+      uint8_t b = raw[i * src->channels + (src->channels == 2 ? c : 0u)];
+      bufs[c][i] = (int8_t)(src->is_unsigned ? b ^ 0x80u : b);
+    }
+  }
+  return (int)frames;
 }
 
-static int mod_is_4ch_tag(const uint8_t *tag) {
-  return !memcmp(tag, "M.K.", 4) || !memcmp(tag, "M!K!", 4) ||
-         !memcmp(tag, "4CHN", 4) || !memcmp(tag, "FLT4", 4);
+// CPU output through AUD0DAT/AUD1DAT: no chip RAM buffer, so a sample
+// reaches the DAC within a few periods of arriving on the input. Without
+// an input it only reports the rate this machine can sustain.
+static int play_dat(const char *path, int raw_unsigned, int stereo, uint16_t period,
+                    uint16_t vol, unsigned seconds, int is_pal) {
+  paula_dat_probe_t probe;
+  paula_dat_probe(&probe, is_pal);
+  printf("[DAT] bus %.1fus per word (p99.9 %.1fus), max sustainable rate %.0f Hz\n",
+         (double)probe.word_ns / 1e3, (double)probe.worst_ns / 1e3, probe.max_rate_hz);
+  if (!path) return 0;
+
+  double rate_hz = paula_clock_hz(is_pal) / (double)period;
+  if (rate_hz > probe.max_rate_hz) {
+    fprintf(stderr, "Warning: %.0f Hz is above the %.0f Hz this machine sustains; "
+            "expect late words.\n", rate_hz, probe.max_rate_hz);
+  }
+  dat_source_t src;
+  memset(&src, 0, sizeof(src));
+  src.fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+  if (src.fd < 0) {
+    perror(path);
+    return -1;
+  }
+  src.channels = stereo ? 2u : 1u;
+  src.is_unsigned = raw_unsigned;
+  int fl = fcntl(src.fd, F_GETFL);
+  if (fl >= 0) fcntl(src.fd, F_SETFL, fl | O_NONBLOCK);
+
+  paula_dat_t *d = (paula_dat_t *)calloc(1, sizeof(*d));
+  if (!d) {
+    if (src.fd != STDIN_FILENO) close(src.fd);
+    return -1;
+  }
+  d->period = period;
+  d->vol = vol;
+  d->seconds = seconds;
+
+  // Best effort: without privileges we simply run at normal priority.
+  struct sched_param sp = {.sched_priority = 50};
+  int rt = sched_setscheduler(0, SCHED_FIFO, &sp) == 0;
+  mlockall(MCL_CURRENT | MCL_FUTURE);
+  printf("[DAT] %ssrc=%s period=%u rate=%.0fHz vol=%u realtime=%d PAL=%d\n",
+         stereo ? "stereo " : "", path, period, rate_hz, vol, rt, is_pal);
+  int rc = paula_dat_run(d, dat_source_fill, &src, &stop_requested, is_pal);
+  paula_dat_report(d, stdout);
+  if (fl >= 0) fcntl(src.fd, F_SETFL, fl);
+  if (src.fd != STDIN_FILENO) close(src.fd);
+  free(d);
+  return rc;
 }
 
-static int read_mod(const char *path, mod_file_t *out) {
-  memset(out, 0, sizeof(*out));
-  out->data = read_file(path, &out->data_len);
-  if (!out->data || out->data_len < 1084) return -1;
-
-  const uint8_t *p = out->data;
-  memcpy(out->name, p, 20);
-  out->name[20] = '\0';
-  p += 20;
-
-  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
-    mod_sample_t *s = &out->samples[i];
-    memcpy(s->name, p, 22);
-    p += 22;
-    uint16_t len_words = (uint16_t)mod_read_u16(p);
-    p += 2;
-    uint8_t finetune = *p++;
-    uint8_t volume = *p++;
-    uint16_t loop_start = (uint16_t)mod_read_u16(p);
-    p += 2;
-    uint16_t loop_len = (uint16_t)mod_read_u16(p);
-    p += 2;
-
-    s->length_bytes = (uint32_t)len_words * 2u;
-    s->finetune = (int8_t)(finetune & 0x0F);
-    if (s->finetune & 0x08) s->finetune -= 16;
-    s->volume = volume > 64 ? 64 : volume;
-    s->loop_start_bytes = (uint32_t)loop_start * 2u;
-    s->loop_len_bytes = (uint32_t)loop_len * 2u;
-  }
-
-  out->song_len = *p++;
-  out->restart = *p++;
-  memcpy(out->orders, p, 128);
-  p += 128;
-
-  if ((size_t)(p - out->data + 4) > out->data_len) return -1;
-  if (!mod_is_4ch_tag(p)) {
-    fprintf(stderr, "Unsupported MOD tag: %.4s (only 4ch supported)\n", p);
+#define MIDI_LATENCY_TARGET_NS 2000000ull  // note-on to last write, for the report
+
+// Sound-module mode: MIDI bytes in, Paula register writes out. The four
+// channels are synth voices; program change picks the waveform, pitch
+// bend covers +-2 semitones. Latency is measured from read() returning a
+// note-on to the last register write for it, so it covers parsing, voice
+// allocation and bus time but not the kernel's delay in waking us.
+static int play_midi(const char *path, uint32_t addr, uint16_t vol, int is_pal) {
+  midi_in_t in;
+  if (midi_in_open(&in, path) != 0) return -1;
+  lat_hist_t *lat = (lat_hist_t *)malloc(sizeof(*lat));
+  if (!lat) {
+    midi_in_close(&in);
     return -1;
   }
-  p += 4;
-
-  uint8_t max_pat = 0;
-  for (int i = 0; i < 128; i++) {
-    if (out->orders[i] > max_pat) max_pat = out->orders[i];
-  }
-  out->num_patterns = (uint8_t)(max_pat + 1u);
-  out->pattern_offset = 1084;
-  out->sample_offset = out->pattern_offset + (size_t)out->num_patterns * 1024u;
-  if (out->sample_offset > out->data_len) return -1;
-
-  size_t total_events = (size_t)out->num_patterns * 64u * MOD_CHANNELS;
-  out->patterns = (mod_event_t *)calloc(total_events, sizeof(mod_event_t));
-  if (!out->patterns) return -1;
-
-  for (uint8_t pat = 0; pat < out->num_patterns; pat++) {
-    size_t base = out->pattern_offset + (size_t)pat * 1024u;
-    for (int row = 0; row < 64; row++) {
-      for (int ch = 0; ch < MOD_CHANNELS; ch++) {
-        size_t off = base + (size_t)row * 16u + (size_t)ch * 4u;
-        if (off + 3 >= out->data_len) return -1;
-        uint8_t b0 = out->data[off + 0];
-        uint8_t b1 = out->data[off + 1];
-        uint8_t b2 = out->data[off + 2];
-        uint8_t b3 = out->data[off + 3];
-        mod_event_t *e = &out->patterns[(pat * 64u + row) * MOD_CHANNELS + ch];
-        e->sample = (uint8_t)((b0 & 0xF0) | ((b2 & 0xF0) >> 4));
-        e->period = (uint16_t)(((b0 & 0x0F) << 8) | b1);
-        e->effect = (uint8_t)(b2 & 0x0F);
-        e->param = b3;
+  lat_hist_init(lat);
+
+  // Best effort: without privileges we simply run at normal priority.
+  struct sched_param sp = {.sched_priority = 50};
+  int rt = sched_setscheduler(0, SCHED_FIFO, &sp) == 0;
+  mlockall(MCL_CURRENT | MCL_FUTURE);
+
+  ws_synth_t synth;
+  ws_stats_t stats;
+  if (ws_synth_start(&synth, addr, is_pal, vol, &stats) != 0) {
+    free(lat);
+    midi_in_close(&in);
+    return -1;
+  }
+  printf("[MIDI] %s addr=0x%06X vol=%u realtime=%d PAL=%d (Ctrl-C to stop)\n",
+         path, addr & CHIP_ADDR_MASK, vol, rt, is_pal);
+
+  const ws_env_t env = {0u, 0u, 64u, 60u};
+  ws_wave_t wave = WS_SQUARE;
+  uint64_t t0 = pi_now_ns();
+  uint64_t next_tick = WS_TICK_NS;
+  int rc = 0;
+  while (!stop_requested) {
+    uint64_t now = pi_now_ns() - t0;
+    int timeout_ms = next_tick > now ? (int)((next_tick - now + 999999u) / 1000000u) : 0;
+    struct pollfd pfd = {.fd = in.fd, .events = POLLIN, .revents = 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+      uint8_t buf[64];
+      ssize_t n = read(in.fd, buf, sizeof(buf));
+      uint64_t t_read = pi_now_ns() - t0;
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        fprintf(stderr, "%s: input closed\n", path);
+        rc = -1;
+        break;
       }
+      for (ssize_t i = 0; i < n; i++) {
+        midi_msg_t msg;
+        if (!midi_in_parse(&in, buf[i], &msg)) continue;
+        if (msg.type == MIDI_NOTE_ON && msg.d2 > 0) {
+          ws_synth_note_on(&synth, msg.d1, (msg.d2 * 64u + 63u) / 127u, wave, &env,
+                           t_read, WS_HOLD);
+          lat_hist_add(lat, pi_now_ns() - t0 - t_read);
+        } else if (msg.type == MIDI_NOTE_ON || msg.type == MIDI_NOTE_OFF) {
+          ws_synth_note_off(&synth, msg.d1, t_read);
+        } else if (msg.type == MIDI_PITCH_BEND) {
+          int bend = (int)(msg.d1 | (msg.d2 << 7)) - 8192;
+          ws_synth_bend(&synth, (double)bend * 200.0 / 8192.0);
+        } else if (msg.type == MIDI_PROGRAM) {
+          wave = (ws_wave_t)(msg.d1 % WS_WAVE_COUNT);
+        } else if (msg.type == MIDI_CONTROL && (msg.d1 == 120 || msg.d1 == 123)) {
+          for (unsigned ch = 0; ch < WS_VOICES; ch++) {
+            ws_synth_note_off(&synth, synth.voice[ch].note, t_read);
+          }
+        }
+      }
+    }
+    now = pi_now_ns() - t0;
+    if (now >= next_tick) {
+      ws_synth_tick(&synth, now);
+      next_tick = now + WS_TICK_NS;
     }
   }
 
-  size_t sample_pos = out->sample_offset;
+  ws_synth_stop(&synth);
+  ws_report(&stats, stdout);
+  lat_hist_report(lat, "MIDI note-on", MIDI_LATENCY_TARGET_NS, stdout);
+  free(lat);
+  midi_in_close(&in);
+  return rc;
+}
+
+// Reserves cache space for every sample of mod and queues the ones that
+// are not already resident on up. On failure the reservations made for
+// up are dropped again and -1 is returned.
+static int reserve_mod_samples(mod_file_t *mod, chip_cache_t *cache, mod_upload_t *up) {
   for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
-    mod_sample_t *s = &out->samples[i];
-    if (s->length_bytes == 0) {
-      s->data = NULL;
-      continue;
+    mod_sample_t *s = &mod->samples[i];
+    if (!s->data || s->length_bytes == 0) continue;
+    int upload = 0;
+    s->chip_addr = chip_cache_reserve(cache, s->data, s->length_bytes, &upload);
+    if (!s->chip_addr) {
+      for (unsigned k = 0; k < up->count; k++) chip_cache_drop(cache, up->item[k].addr);
+      up->count = 0;
+      up->bytes_total = 0;
+      return -1;
+    }
+    if (upload) mod_upload_add(up, (unsigned)i + 1u, s->chip_addr, s->data, s->length_bytes);
+  }
+  return 0;
+}
+
+// Assigns every sample its chip RAM address below limit and queues the
+// ones that are not already resident on up; nothing is written yet.
+static int place_mod_samples(mod_file_t *mod, uint32_t base_addr, uint32_t limit,
+                             int cache_mode, chip_cache_t *cache, mod_upload_t *up) {
+  uint32_t addr = base_addr & CHIP_ADDR_MASK;
+
+  if (cache_mode == MOD_CACHE_OFF) {
+    uint32_t offset = 0;
+    for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
+      mod_sample_t *s = &mod->samples[i];
+      if (!s->data || s->length_bytes == 0) continue;
+      s->chip_addr = (addr + offset) & CHIP_ADDR_MASK;
+      offset += (s->length_bytes + 1u) & ~1u;
+      if ((addr + offset) > limit) {
+        fprintf(stderr, "MOD samples exceed %uKB Chip RAM. Aborting.\n", limit / 1024u);
+        return -1;
+      }
+      mod_upload_add(up, (unsigned)i + 1u, s->chip_addr, s->data, s->length_bytes);
     }
-    if (sample_pos + s->length_bytes > out->data_len) return -1;
-    s->data = out->data + sample_pos;
-    sample_pos += s->length_bytes;
+    return 0;
+  }
+
+  chip_cache_open(cache, addr, limit, cache_mode == MOD_CACHE_RESET);
+  if (reserve_mod_samples(mod, cache, up) != 0) {
+    fprintf(stderr, "MOD samples exceed %uKB Chip RAM. Aborting.\n", limit / 1024u);
+    return -1;
   }
   return 0;
 }
 
-static void free_mod(mod_file_t *mod) {
-  free(mod->patterns);
-  free(mod->data);
-  memset(mod, 0, sizeof(*mod));
+// Writes the residency header for what actually reached chip RAM.
+static void close_mod_cache(chip_cache_t *cache, const mod_upload_t *up) {
+  for (unsigned i = up->next; i < up->count; i++) {
+    if (up->item[i].done < up->item[i].len) chip_cache_drop(cache, up->item[i].addr);
+  }
+  chip_cache_commit(cache);
+  printf("[CACHE] gen=%u resident=%u uploaded=%u reused=%zuB sent=%zuB\n",
+         cache->generation, cache->hits, cache->misses,
+         cache->bytes_reused, cache->bytes_uploaded);
 }
 
-static void program_channel(int ch, uint32_t addr, uint32_t len_bytes,
-                            uint16_t period, uint8_t vol) {
-  uint32_t addr_masked = addr & CHIP_ADDR_MASK;
-  size_t len_words_full = (len_bytes + 1u) / 2u;
-  if (len_words_full == 0) return;
-  if (len_words_full > 0xFFFFu) len_words_full = 0xFFFFu;
-  uint16_t len_words = (uint16_t)len_words_full;
+#define MOD_SPIN_NS        100000ull      // busy-wait the last 100 us of a tick
+#define MOD_LATE_TARGET_NS 50000ull
+#define MOD_RESYNC_NS      250000000ull   // further behind than this: rebase
 
-  ps_write_16(AUD_VOL[ch], 0);
-  ps_write_16(AUD_LCH[ch], (addr_masked >> 16) & 0x1Fu);
-  ps_write_16(AUD_LCL[ch], addr_masked & 0xFFFFu);
-  ps_write_16(AUD_LEN[ch], len_words);
-  ps_write_16(AUD_PER[ch], period);
-  ps_write_16(AUD_VOL[ch], vol);
-  ps_write_16(DMACON, DMAF_SETCLR | DMAF_MASTER | AUD_DMA_MASK[ch]);
+// How one song is clocked and what shares its spare bus time.
+typedef struct {
+  int is_pal;
+  int tick_stats;
+  int use_cia;
+  uint64_t load_ns;         // when loading started, for the first-tick report
+  uint64_t start_ns;        // first tick due (host clock), 0 = now
+  uint64_t end_ns;          // set on return: when the last tick ended
+  const mod_mix_plan_t *mix;  // which channels Paula plays, from mod_mix_plan()
+  uint32_t mix_addr;        // chip RAM for the mix streams, if any are mixed
+  // Called between ticks once the song's own samples are resident, with
+  // the time by which the bus must be free again.
+  void (*idle)(void *ctx, uint64_t deadline);
+  void *idle_ctx;
+} mod_run_t;
+
+// Runs the look-ahead copy of the engine until the mixer can render need
+// samples.
+static void mix_feed(mod_replay_t *ahead, mod_mixer_t *m, uint64_t need) {
+  paula_frame_t f[MOD_FRAMES];
+  while (mod_mixer_covered(m) < need) {
+    uint64_t song = mod_replay_song_ns(ahead);
+    if (mod_replay_tick(ahead, f) != 0) {
+      mod_mixer_frame(m, f, song, song);
+      mod_mixer_end(m);
+      return;
+    }
+    if (mod_mixer_frame(m, f, song, mod_replay_song_ns(ahead)) != 0) return;
+  }
 }
 
-static int play_mod(const char *path, uint32_t base_addr, int is_pal) {
-  mod_file_t mod;
-  if (read_mod(path, &mod) != 0) {
-    fprintf(stderr, "Failed to load MOD: %s\n", path);
-    free_mod(&mod);
+// Plays mod until it ends or stop is requested, uploading what is left on
+// up between ticks. cache, if not NULL, is committed once up drains.
+// Channels the plan mixes are rendered from a second copy of the engine
+// running ahead of the one that drives Paula; the engine is
+// deterministic, so both play the same song.
+static int run_mod(mod_file_t *mod, mod_upload_t *up, chip_cache_t *cache,
+                   mod_run_t *run) {
+  // Total and per-second lateness of tick writes against their deadline.
+  lat_hist_t *late = (lat_hist_t *)malloc(2u * sizeof(*late));
+  if (!late) {
+    if (cache) close_mod_cache(cache, up);
     return -1;
   }
+  lat_hist_t *window = late + 1;
+  lat_hist_init(late);
+  lat_hist_init(window);
+
+  // Best effort, as for --midi; once per process, as a playlist comes
+  // back here for every song.
+  static int rt = -1;
+  if (rt < 0) {
+    struct sched_param sp = {.sched_priority = 50};
+    rt = sched_setscheduler(0, SCHED_FIFO, &sp) == 0;
+    mlockall(MCL_CURRENT | MCL_FUTURE);
+  }
 
-  uint32_t addr = base_addr & CHIP_ADDR_MASK;
-  uint32_t offset = 0;
-  for (int i = 0; i < MOD_MAX_SAMPLES; i++) {
-    mod_sample_t *s = &mod.samples[i];
-    if (!s->data || s->length_bytes == 0) continue;
-    s->chip_addr = (addr + offset) & CHIP_ADDR_MASK;
-    write_chip_ram(s->chip_addr, s->data, s->length_bytes);
-    offset += (s->length_bytes + 1u) & ~1u;
-    if ((addr + offset) > 0x200000u) {
-      fprintf(stderr, "MOD samples exceed 2MB Chip RAM. Aborting.\n");
-      free_mod(&mod);
+  mod_replay_t replay;
+  paula_writer_t writer;
+  paula_frame_t f[MOD_FRAMES];
+  paula_frame_t frame;
+  mod_replay_init(&replay, mod);
+  paula_writer_init(&writer);
+
+  const mod_mix_plan_t *plan = run->mix;
+  mod_replay_t ahead;
+  mod_mixer_t *mixer = NULL;
+  mix_stream_t ms;
+  memset(&ms, 0, sizeof(ms));
+  if (plan->mixed) {
+    mixer = (mod_mixer_t *)malloc(sizeof(*mixer));
+    if (!mixer) {
+      if (cache) close_mod_cache(cache, up);
+      free(late);
       return -1;
     }
+    mod_mixer_init(mixer, mod, plan);
+    mod_replay_init(&ahead, mod);
+    if (mix_stream_init(&ms, run->mix_addr, mixer) != 0) {
+      if (cache) close_mod_cache(cache, up);
+      free(mixer);
+      free(late);
+      return -1;
+    }
+    writer.voices = plan->native_voices;
   }
 
-  unsigned speed = 6;
-  unsigned bpm = 125;
-  double tick_sec = 2.5 / (double)bpm;
-  uint8_t pos = 0;
-  uint8_t row = 0;
-  unsigned tick = 0;
-  mod_chan_t chan[MOD_CHANNELS];
-  memset(chan, 0, sizeof(chan));
-
-  printf("[MOD] \"%s\" patterns=%u song_len=%u bpm=%u speed=%u PAL=%d\n",
-         mod.name, mod.num_patterns, mod.song_len, bpm, speed, is_pal);
-
-  while (!stop_requested && pos < mod.song_len) {
-    uint8_t pat = mod.orders[pos];
-    if (pat >= mod.num_patterns) break;
-    mod_event_t *row_events = &mod.patterns[(pat * 64u + row) * MOD_CHANNELS];
-
-    if (tick == 0) {
-      int jump_pos = -1;
-      int break_row = -1;
-
-      for (int ch = 0; ch < MOD_CHANNELS; ch++) {
-        mod_event_t *e = &row_events[ch];
-        if (e->sample > 0 && e->sample <= MOD_MAX_SAMPLES) {
-          chan[ch].sample = e->sample;
-          mod_sample_t *s = &mod.samples[e->sample - 1];
-          chan[ch].volume = s->volume;
-          chan[ch].loop_start_bytes = s->loop_start_bytes;
-          chan[ch].loop_len_bytes = s->loop_len_bytes;
-        }
+  cia_timer_t cia;
+  int use_cia = run->use_cia;
+  unsigned cia_bpm = replay.bpm;
+  if (use_cia && cia_timer_start(&cia, run->is_pal, cia_bpm) != 0) {
+    if (cache) close_mod_cache(cache, up);
+    mix_stream_stop(&ms);
+    free(mixer);
+    free(late);
+    return -1;
+  }
 
-        if (e->period) {
-          chan[ch].period = e->period;
-          mod_sample_t *s = &mod.samples[(chan[ch].sample ? chan[ch].sample : 1) - 1];
-          double rate_hz = paula_clock_hz(is_pal) / (double)e->period;
-          chan[ch].rate_hz = rate_hz;
-          uint32_t intro_bytes = s->loop_start_bytes ? s->loop_start_bytes : s->length_bytes;
-          chan[ch].time_left = rate_hz > 0 ? (double)intro_bytes / rate_hz : 0.0;
-          program_channel(ch, s->chip_addr, s->length_bytes, e->period, chan[ch].volume);
-        }
+  printf("[MOD] \"%s\" channels=%u patterns=%u song_len=%u bpm=%u speed=%u PAL=%d "
+         "realtime=%d clock=%s\n",
+         mod->name, mod->channels, mod->num_patterns, mod->song_len, replay.bpm, replay.speed,
+         run->is_pal, rt, use_cia ? "CIAB" : "host");
+  mod_mix_plan_report(plan, stdout);
+  if (mixer) {
+    mix_feed(&ahead, mixer, mix_stream_need(&ms));
+    mix_stream_prime(&ms, mixer);
+  }
 
-        if (e->effect == 0x0C) {
-          uint8_t v = e->param > 64 ? 64 : e->param;
-          chan[ch].volume = v;
-          ps_write_16(AUD_VOL[ch], v);
-        } else if (e->effect == 0x0F) {
-          if (e->param <= 32 && e->param > 0) {
-            speed = e->param;
-          } else if (e->param > 32) {
-            bpm = e->param;
-            tick_sec = 2.5 / (double)bpm;
-          }
-        } else if (e->effect == 0x0B) {
-          jump_pos = e->param;
-        } else if (e->effect == 0x0D) {
-          break_row = ((e->param >> 4) & 0x0F) * 10 + (e->param & 0x0F);
-        }
+  // Tick n is due at t0 plus the song time of tick n, so the time spent
+  // computing and writing a tick never pushes the next one back. A late
+  // tick is followed by the next one straight away until the clock has
+  // caught up; only a stall of MOD_RESYNC_NS moves the clock. With
+  // --cia the deadlines are CIAB Timer A underflows instead, and ticks
+  // missed in a stall are played back to back.
+  uint64_t t0 = run->start_ns ? run->start_ns : pi_now_ns();
+  // The mix streams start with the first tick and run on Paula's clock
+  // from there, so that tick must not be late.
+  if (mixer && t0 < pi_now_ns()) t0 = pi_now_ns();
+  unsigned owed = 0;
+  uint64_t next_report = t0 + 1000000000ull;
+  uint64_t slips = 0;
+  uint64_t slip_ns = 0;
+  uint64_t due = t0;
+  int ended = 0;
+  while (!stop_requested) {
+    due = t0 + mod_replay_song_ns(&replay);
+    uint8_t pos = replay.pos;
+    uint8_t row = replay.row;
+    if (mod_replay_tick(&replay, f) != 0) {
+      ended = 1;
+      break;
+    }
+    mod_mix_route(plan, f, &frame);
+    // A sample this tick starts that has not gone up yet is finished
+    // now, while there is still time to the deadline.
+    for (unsigned ch = 0; ch < mod->channels; ch++) {
+      unsigned smp = replay.v[ch].sample;
+      int pv = plan->paula[ch];
+      if (pv >= 0 && (frame.dma_start & (1u << pv)) && smp && mod_upload_pending(up, smp)) {
+        mod_upload_finish(up, smp, 1);
       }
-
-      if (jump_pos >= 0) {
-        pos = (uint8_t)jump_pos;
-        row = 0;
-        tick = 0;
-        continue;
+    }
+    if (use_cia) {
+      if (replay.bpm != cia_bpm) {
+        cia_bpm = replay.bpm;
+        cia_timer_set_bpm(&cia, cia_bpm);
       }
-      if (break_row >= 0) {
-        pos = (uint8_t)(pos + 1);
-        row = (uint8_t)break_row;
-        tick = 0;
-        continue;
+      uint64_t since = 0;
+      if (owed) {
+        owed--;
+      } else {
+        unsigned n = cia_timer_wait(&cia, &stop_requested, &since);
+        if (!n) break;
+        owed = n - 1u;
       }
+      // Lateness is counted from the underflow, on the Amiga's clock.
+      due = pi_now_ns() - since;
     } else {
-      for (int ch = 0; ch < MOD_CHANNELS; ch++) {
-        if (chan[ch].loop_len_bytes > 2 && chan[ch].rate_hz > 0.0) {
-          chan[ch].time_left -= tick_sec;
-          if (chan[ch].time_left <= 0.0) {
-            mod_sample_t *s = &mod.samples[(chan[ch].sample ? chan[ch].sample : 1) - 1];
-            program_channel(ch,
-                            s->chip_addr + chan[ch].loop_start_bytes,
-                            chan[ch].loop_len_bytes,
-                            chan[ch].period,
-                            chan[ch].volume);
-            chan[ch].time_left = (double)chan[ch].loop_len_bytes / chan[ch].rate_hz;
-          }
-        }
+      pi_sleep_until_ns(due, MOD_SPIN_NS);
+    }
+    uint64_t now = pi_now_ns();
+    paula_writer_commit(&writer, &frame, mod_replay_tick_ns(&replay));
+    if (mixer) {
+      if (replay.ticks == 1u) mix_stream_go(&ms);
+      mix_feed(&ahead, mixer, mix_stream_need(&ms));
+      mix_stream_service(&ms, mixer);
+    }
+    if (replay.ticks == 1u) {
+      printf("[MOD] first tick %.1fms after load started, %llu/%llu sample bytes resident\n",
+             (double)(now - run->load_ns) / 1e6, (unsigned long long)up->bytes_done,
+             (unsigned long long)up->bytes_total);
+    }
+    uint64_t next = use_cia ? cia.last_ns + cia.period_ns : t0 + mod_replay_song_ns(&replay);
+    if (!mod_upload_done(up)) {
+      mod_upload_step(up, next);
+      if (cache && mod_upload_done(up)) {
+        close_mod_cache(cache, up);
+        cache = NULL;
       }
+    } else if (run->idle) {
+      run->idle(run->idle_ctx, next);
+    }
+    lat_hist_add(late, now - due);
+    lat_hist_add(window, now - due);
+    if (!use_cia && now - due > MOD_RESYNC_NS) {
+      t0 += now - due;
+      slip_ns += now - due;
+      slips++;
     }
+    if (run->tick_stats && now >= next_report) {
+      printf("[TICK] %02u:%02u p50=%.1fus p99=%.1fus max=%.1fus\n", pos, row,
+             (double)lat_hist_percentile_ns(window, 0.50) / 1000.0,
+             (double)lat_hist_percentile_ns(window, 0.99) / 1000.0,
+             (double)window->max_ns / 1000.0);
+      fflush(stdout);
+      lat_hist_init(window);
+      next_report += 1000000000ull;
+    }
+  }
+  // The last tick sounds for its full length; a following playlist item
+  // starts where it ends.
+  if (ended) {
+    if (use_cia) {
+      (void)cia_timer_wait(&cia, &stop_requested, NULL);
+      due = pi_now_ns();
+    } else {
+      pi_sleep_until_ns(due, MOD_SPIN_NS);
+    }
+  }
+  run->end_ns = due;
+  uint64_t wall_ns = pi_now_ns() - t0 + slip_ns;
 
-    sleep_seconds(tick_sec);
-    tick++;
-    if (tick >= speed) {
-      tick = 0;
-      row++;
-      if (row >= 64) {
-        row = 0;
-        pos++;
+  paula_writer_stop(&writer);
+  mix_stream_stop(&ms);
+  audio_stop_all();
+  if (cache) close_mod_cache(cache, up);
+  paula_writer_report(&writer, stdout);
+  if (mixer) mix_stream_report(&ms, mixer, stdout);
+  mod_upload_report(up, stdout);
+  if (use_cia) {
+    cia_timer_stop(&cia);
+    cia_timer_report(&cia, stdout);
+  }
+  printf("[TICK] song=%.3fs wall=%.3fs slips=%llu (%.1fms)\n",
+         (double)mod_replay_song_ns(&replay) / 1e9, (double)wall_ns / 1e9,
+         (unsigned long long)slips, (double)slip_ns / 1e6);
+  lat_hist_report(late, "MOD tick lateness", MOD_LATE_TARGET_NS, stdout);
+  free(mixer);
+  free(late);
+  return 0;
+}
+
+// The mix streams of 6/8-channel songs live at the top of chip RAM, out
+// of the way of the samples and the residency cache.
+static uint32_t mix_stream_addr(void) {
+  return (chip_ram_limit - (uint32_t)mix_stream_chip_bytes(0)) & ~7u;
+}
+
+static int play_mod(const char *path, uint32_t base_addr, int is_pal, int cache_mode,
+                    int tick_stats, int use_cia, int preload, unsigned budget_kbs) {
+  uint64_t t_load = pi_now_ns();
+  mod_file_t mod;
+  if (mod_load(path, &mod) != 0) {
+    fprintf(stderr, "Failed to load MOD: %s\n", path);
+    mod_free(&mod);
+    return -1;
+  }
+  mod_mix_plan_t plan;
+  if (mod_mix_plan(&plan, &mod, is_pal, (double)budget_kbs * 1024.0) != 0) {
+    mod_free(&mod);
+    return -1;
+  }
+  uint32_t limit = plan.mixed ? mix_stream_addr() : chip_ram_limit;
+
+  chip_cache_t cache;
+  mod_upload_t up;
+  int cache_open = cache_mode != MOD_CACHE_OFF;
+  mod_upload_init(&up);
+  if (place_mod_samples(&mod, base_addr, limit, cache_mode, &cache, &up) != 0) {
+    if (cache_open) close_mod_cache(&cache, &up);
+    mod_free(&mod);
+    return -1;
+  }
+  // Only the first tick's samples hold up the start; the rest follow
+  // between ticks unless --preload asks for everything first.
+  mod_upload_plan(&up, &mod);
+  if (preload) {
+    mod_upload_step(&up, UINT64_MAX);
+  } else {
+    mod_upload_until(&up, 1u);
+  }
+  if (cache_open && mod_upload_done(&up)) {
+    close_mod_cache(&cache, &up);
+    cache_open = 0;
+  }
+
+  mod_run_t run;
+  memset(&run, 0, sizeof(run));
+  run.is_pal = is_pal;
+  run.tick_stats = tick_stats;
+  run.use_cia = use_cia;
+  run.load_ns = t_load;
+  run.mix = &plan;
+  run.mix_addr = limit;
+  int rc = run_mod(&mod, &up, cache_open ? &cache : NULL, &run);
+  mod_free(&mod);
+  return rc;
+}
+
+// --compile: runs the song through the engine once and stores its frames.
+static int compile_mod(const char *path, const char *out_path) {
+  mod_file_t mod;
+  if (mod_load(path, &mod) != 0) {
+    fprintf(stderr, "Failed to load MOD: %s\n", path);
+    mod_free(&mod);
+    return -1;
+  }
+  mod_regs_info_t info;
+  int rc = mod_regs_compile(&mod, out_path, &info);
+  mod_free(&mod);
+  if (rc != 0) return -1;
+  if (info.truncated) {
+    fprintf(stderr, "\"%s\" still plays after %llu minutes; stream cut there\n", info.name,
+            (unsigned long long)(MOD_REGS_MAX_NS / 60000000000ull));
+  }
+  printf("[REGS] \"%s\" -> %s: ticks=%u song=%.3fs events=%u bytes (%.2f/tick) "
+         "image=%u bytes\n",
+         info.name, out_path, info.ticks, (double)info.song_ns / 1e9, info.events_bytes,
+         info.ticks ? (double)info.events_bytes / info.ticks : 0.0, info.image_bytes);
+  return 0;
+}
+
+// --regs: plays a compiled stream. No pattern, effect or tempo logic runs;
+// each tick is decoded, waited for on the host clock and committed.
+static int play_regs(const char *path, uint32_t base_addr) {
+  mod_regs_t rs;
+  base_addr = (base_addr & CHIP_ADDR_MASK) & ~1u;
+  if (mod_regs_open(&rs, path, base_addr) != 0) return -1;
+  if (base_addr + rs.info.image_bytes > chip_ram_limit) {
+    fprintf(stderr, "Sample image (%u bytes) exceeds %uKB Chip RAM; use --addr lower.\n",
+            rs.info.image_bytes, chip_ram_limit / 1024u);
+    mod_regs_close(&rs);
+    return -1;
+  }
+  lat_hist_t *late = (lat_hist_t *)malloc(sizeof(*late));
+  if (!late) {
+    mod_regs_close(&rs);
+    return -1;
+  }
+  lat_hist_init(late);
+
+  uint64_t t_load = pi_now_ns();
+  write_chip_ram(base_addr, rs.image, rs.info.image_bytes);
+  printf("[REGS] \"%s\" ticks=%u song=%.3fs image=%u bytes at 0x%06X (%.1fms)\n",
+         rs.info.name, rs.info.ticks, (double)rs.info.song_ns / 1e9, rs.info.image_bytes,
+         base_addr, (double)(pi_now_ns() - t_load) / 1e6);
+
+  struct sched_param sp = {.sched_priority = 50};
+  if (sched_setscheduler(0, SCHED_FIFO, &sp) == 0) mlockall(MCL_CURRENT | MCL_FUTURE);
+
+  paula_writer_t writer;
+  paula_writer_init(&writer);
+  uint64_t t0 = pi_now_ns();
+  uint64_t song_ns = 0;
+  uint64_t slips = 0;
+  int rc = 0;
+  while (!stop_requested) {
+    int r = mod_regs_next(&rs, &song_ns);
+    if (r != 0) {
+      if (r < 0) {
+        fprintf(stderr, "%s: corrupt event stream at tick %u\n", path, rs.tick);
+        rc = -1;
       }
+      break;
+    }
+    uint64_t due = t0 + song_ns;
+    pi_sleep_until_ns(due, MOD_SPIN_NS);
+    uint64_t now = pi_now_ns();
+    paula_writer_commit(&writer, &rs.frame, mod_regs_song_ns(&rs) - song_ns);
+    lat_hist_add(late, now - due);
+    if (now - due > MOD_RESYNC_NS) {
+      t0 += now - due;
+      slips++;
     }
   }
+  if (rc == 0 && !stop_requested) pi_sleep_until_ns(t0 + mod_regs_song_ns(&rs), MOD_SPIN_NS);
 
+  paula_writer_stop(&writer);
   audio_stop_all();
-  free_mod(&mod);
+  paula_writer_report(&writer, stdout);
+  printf("[TICK] song=%.3fs ticks=%u slips=%llu\n", (double)mod_regs_song_ns(&rs) / 1e9,
+         rs.tick, (unsigned long long)slips);
+  lat_hist_report(late, "MOD tick lateness", MOD_LATE_TARGET_NS, stdout);
+  mod_regs_close(&rs);
+  free(late);
+  return rc;
+}
+
+// Playlist mode. Item n plays while item n+1 is prepared in the bus time
+// it leaves spare: a MOD is parsed on a worker thread, its samples are
+// reserved in the residency cache next to the pinned samples of the item
+// playing, and uploaded in first-use order; a WAV or raw item starts
+// decoding. MODs follow each other at the tick boundary where the previous
+// song ends. Consecutive WAV/raw items of the same channel count share one
+// stream and follow each other at the sample, resampled to the rate the
+// first of them set.
+typedef enum {
+  TRACK_EMPTY = 0,
+  TRACK_LOADING,            // MOD being parsed by the worker
+  TRACK_READY,              // MOD parsed, or WAV/raw decoding
+  TRACK_PLACED,             // MOD samples reserved and queued for upload
+  TRACK_FAILED
+} track_state_t;
+
+typedef struct {
+  size_t index;             // playlist position
+  track_state_t state;
+  int loaded;               // worker result: 0 running, 1 ok, -1 failed
+  int deferred;             // did not fit next to the item playing
+  int gen_started;
+  int pipe_open;
+  pthread_t worker;
+  const char *path;
+  mod_file_t mod;
+  uint64_t first_ns[MOD_MAX_SAMPLES];
+  int is_pal;
+  double mix_budget_bps;
+  mod_mix_plan_t mix;
+  mod_upload_t up;
+  pcm_pipe_t pipe;
+} jb_track_t;
+
+typedef struct {
+  // Options.
+  int is_pal;
+  int tick_stats;
+  int use_cia;
+  int preload;
+  int raw_unsigned;
+  int stereo;
+  int dither;
+  int resample;
+  unsigned budget_kbs;
+  unsigned rate_hz;
+  uint16_t period;
+  int period_set;
+  uint16_t vol;
+  size_t chunk_bytes;
+  size_t buffers;
+  dsp_chain_t dsp;
+
+  const playlist_t *pl;
+  chip_cache_t cache;
+  jb_track_t track[2];
+  unsigned cur;             // track[cur] is playing, track[cur ^ 1] is next
+  size_t playing;
+  uint32_t ring_addr;       // PCM stream rings, below the cache
+  uint32_t mix_addr;        // MOD mix streams, above the cache
+  size_t slot_bytes;
+  unsigned slots;
+  unsigned played;
+  unsigned skipped;
+  double pcm_hz;            // PCM output rate, fixed by the first WAV/raw item
+  uint16_t pcm_period;
+  unsigned pcm_channels;    // channels of the stream running
+} jukebox_t;
+
+static void *track_load_main(void *arg) {
+  jb_track_t *t = (jb_track_t *)arg;
+  int ok = mod_load(t->path, &t->mod) == 0;
+  if (ok) mod_replay_first_use(&t->mod, t->first_ns, MOD_UPLOAD_SCAN_NS);
+  if (ok) ok = mod_mix_plan(&t->mix, &t->mod, t->is_pal, t->mix_budget_bps) == 0;
+  __atomic_store_n(&t->loaded, ok ? 1 : -1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Opens a WAV or raw item and starts decoding it at the stream rate.
+static int open_pcm_track(jukebox_t *jb, jb_track_t *t) {
+  const playlist_item_t *it = &jb->pl->items[t->index];
+  int is_wav = it->kind == PLAYLIST_WAV;
+  pcm_in_format_t format = is_wav ? PCM_IN_WAV
+                                  : (jb->raw_unsigned ? PCM_IN_RAW_U8 : PCM_IN_RAW_S8);
+  pcm_pipe_t *p = &t->pipe;
+  if (pcm_pipe_open(p, it->path, format, jb->stereo ? 2u : 1u, !jb->stereo) != 0) {
+    return -1;
+  }
+  p->dither = jb->dither;
+  p->dsp = jb->dsp;
+  double clock = paula_clock_hz(jb->is_pal);
+  double src_hz = is_wav ? (double)p->rate_hz
+                         : (jb->rate_hz ? (double)jb->rate_hz : clock / (double)jb->period);
+  if (src_hz <= 0.0) src_hz = clock / (double)jb->period;
+  if (jb->pcm_hz == 0.0) {
+    if (jb->resample || clock / src_hz < (double)PAULA_MIN_PERIOD) {
+      jb->pcm_period = choose_period(src_hz, jb->period_set ? jb->period : 0,
+                                     p->out_channels, jb->budget_kbs, jb->is_pal);
+      jb->pcm_hz = clock / (double)jb->pcm_period;
+    } else {
+      jb->pcm_period = period_from_rate(src_hz, jb->is_pal);
+      jb->pcm_hz = src_hz;
+    }
+  }
+  if (fabs(src_hz - jb->pcm_hz) >= 0.5) {
+    p->in_rate_hz = src_hz;
+    p->out_rate_hz = jb->pcm_hz;
+  }
+  if (pcm_pipe_start(p, jb->pcm_hz, &stop_requested) != 0) {
+    pcm_pipe_close(p);
+    return -1;
+  }
+  t->pipe_open = 1;
+  return 0;
+}
+
+// Starts preparing playlist item index on t without waiting for it.
+static void track_begin(jukebox_t *jb, jb_track_t *t, size_t index) {
+  memset(t, 0, sizeof(*t));
+  t->index = index;
+  t->path = jb->pl->items[index].path;
+  t->is_pal = jb->is_pal;
+  t->mix_budget_bps = (double)jb->budget_kbs * 1024.0;
+  mod_upload_init(&t->up);
+  if (jb->pl->items[index].kind == PLAYLIST_MOD) {
+    t->state = pthread_create(&t->worker, NULL, track_load_main, t) == 0 ? TRACK_LOADING
+                                                                         : TRACK_FAILED;
+  } else {
+    t->state = open_pcm_track(jb, t) == 0 ? TRACK_READY : TRACK_FAILED;
+  }
+}
+
+// Collects the worker's result; with wait set, blocks until it is there.
+static void track_poll(jb_track_t *t, int wait) {
+  if (t->state != TRACK_LOADING) return;
+  if (!wait && !__atomic_load_n(&t->loaded, __ATOMIC_ACQUIRE)) return;
+  pthread_join(t->worker, NULL);
+  if (t->loaded > 0) {
+    t->state = TRACK_READY;
+  } else {
+    fprintf(stderr, "Failed to load MOD: %s\n", t->path);
+    t->state = TRACK_FAILED;
+  }
+}
+
+// Reserves chip RAM for a parsed MOD under a generation of its own.
+// keep_previous leaves the samples of the item still playing pinned.
+static int track_place(jukebox_t *jb, jb_track_t *t, int keep_previous) {
+  if (!t->gen_started) {
+    chip_cache_next_generation(&jb->cache);
+    t->gen_started = 1;
+  }
+  if (!keep_previous) chip_cache_unpin_previous(&jb->cache);
+  if (reserve_mod_samples(&t->mod, &jb->cache, &t->up) != 0) return -1;
+  mod_upload_sort(&t->up, t->first_ns);
+  t->state = TRACK_PLACED;
   return 0;
 }
 
+static void track_end(jb_track_t *t) {
+  track_poll(t, 1);
+  if (t->loaded) mod_free(&t->mod);
+  if (t->pipe_open) pcm_pipe_close(&t->pipe);
+  t->loaded = 0;
+  t->pipe_open = 0;
+  t->state = TRACK_EMPTY;
+}
+
+// Spare bus time of the item playing goes to the next one.
+static void jukebox_idle(void *ctx, uint64_t deadline) {
+  jukebox_t *jb = (jukebox_t *)ctx;
+  size_t next = jb->playing + 1u;
+  if (next >= jb->pl->count || stop_requested) return;
+  jb_track_t *t = &jb->track[jb->cur ^ 1u];
+  if (t->state == TRACK_EMPTY) {
+    track_begin(jb, t, next);
+    return;
+  }
+  track_poll(t, 0);
+  if (t->state == TRACK_READY && jb->pl->items[next].kind == PLAYLIST_MOD && !t->deferred) {
+    // Without room next to the item playing it waits for that to end.
+    if (track_place(jb, t, 1) != 0) t->deferred = 1;
+    return;
+  }
+  if (t->state == TRACK_PLACED && !mod_upload_done(&t->up)) {
+    mod_upload_step(&t->up, deadline);
+    if (mod_upload_done(&t->up)) chip_cache_commit(&jb->cache);
+  }
+}
+
+// Moves the stream on to the next item if it is WAV/raw of the same
+// channel count.
+static int jukebox_next_pcm(jukebox_t *jb) {
+  size_t next = jb->playing + 1u;
+  if (next >= jb->pl->count || jb->pl->items[next].kind == PLAYLIST_MOD) return 0;
+  jb_track_t *t = &jb->track[jb->cur ^ 1u];
+  if (t->state == TRACK_EMPTY) track_begin(jb, t, next);
+  if (t->state != TRACK_READY || t->pipe.out_channels != jb->pcm_channels) return 0;
+  track_end(&jb->track[jb->cur]);
+  jb->cur ^= 1u;
+  jb->playing = next;
+  printf("[PLAYLIST] %zu/%zu %s\n", next + 1u, jb->pl->count, t->path);
+  jb->played++;
+  return 1;
+}
+
+static size_t jukebox_fill(void *ctx, uint8_t *const *bufs, size_t max_frames) {
+  jukebox_t *jb = (jukebox_t *)ctx;
+  size_t n = 0;
+  while (n < max_frames && !stop_requested) {
+    uint8_t *part[PAULA_STREAM_MAX_CHANNELS];
+    for (unsigned c = 0; c < jb->pcm_channels; c++) part[c] = bufs[c] + n;
+    n += pcm_pipe_fill(&jb->track[jb->cur].pipe, part, max_frames - n);
+    if (n < max_frames && !jukebox_next_pcm(jb)) break;
+  }
+  return n;
+}
+
+static int jukebox_stream(jukebox_t *jb) {
+  paula_stream_t ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.channels = jb->track[jb->cur].pipe.out_channels;
+  ps.base = jb->ring_addr;
+  ps.slot_bytes = jb->slot_bytes;
+  ps.slots = jb->slots;
+  ps.period = jb->pcm_period;
+  ps.vol = jb->vol;
+  ps.rate_hz = jb->pcm_hz;
+  ps.idle = jukebox_idle;
+  ps.idle_ctx = jb;
+  jb->pcm_channels = ps.channels;
+  printf("[STREAM] %saddr=0x%06X period=%u rate=%.0fHz chunk=%zu buffers=%u\n",
+         ps.channels == 2 ? "stereo " : "", ps.base, ps.period, ps.rate_hz,
+         ps.slot_bytes, ps.slots);
+  int rc = paula_stream_run(&ps, jukebox_fill, jb, &stop_requested);
+  paula_stream_report(&ps, stdout);
+  return rc;
+}
+
+static int play_playlist(jukebox_t *jb, const char *list_path, uint32_t addr,
+                         int cache_mode) {
+  playlist_t pl;
+  if (playlist_load(&pl, list_path) != 0) return -1;
+  jb->pl = &pl;
+
+  // The stream rings, if any item needs them, sit at addr; the residency
+  // cache manages everything above.
+  uint32_t base = addr & CHIP_ADDR_MASK & ~1u;
+  jb->ring_addr = base;
+  jb->slot_bytes = jb->chunk_bytes;
+  if (jb->slot_bytes == 0 || jb->slot_bytes > PAULA_STREAM_MAX_SLOT) {
+    jb->slot_bytes = PAULA_STREAM_MAX_SLOT;
+  }
+  jb->slot_bytes &= ~(size_t)1u;
+  if (jb->slot_bytes < 2) jb->slot_bytes = 2;
+  jb->slots = jb->buffers < 2 ? 2u : (unsigned)jb->buffers;
+  for (size_t i = 0; i < pl.count; i++) {
+    if (pl.items[i].kind == PLAYLIST_MOD) continue;
+    size_t ring = (jb->stereo ? 2u : 1u) * jb->slots * jb->slot_bytes + 2u;
+    base += (uint32_t)((ring + 7u) & ~(size_t)7u);
+    break;
+  }
+  // Any MOD may turn out to have 6 or 8 channels once parsed.
+  jb->mix_addr = chip_ram_limit;
+  for (size_t i = 0; i < pl.count; i++) {
+    if (pl.items[i].kind != PLAYLIST_MOD) continue;
+    jb->mix_addr = mix_stream_addr();
+    (void)mod_mixer_bench();      // measured once, before the workers plan
+    break;
+  }
+  if (base + CHIP_CACHE_HEADER_BYTES >= jb->mix_addr) {
+    fprintf(stderr, "Stream buffers leave no %uKB Chip RAM for samples; use --addr lower or fewer buffers.\n",
+            chip_ram_limit / 1024u);
+    playlist_free(&pl);
+    return -1;
+  }
+  // Evicting is what lets a long playlist through, so the cache is always
+  // on here; --no-cache just starts it empty.
+  chip_cache_open(&jb->cache, base, jb->mix_addr, cache_mode != MOD_CACHE_ON);
+  printf("[PLAYLIST] %s items=%zu cache=0x%06X-0x%06X\n", list_path, pl.count, base,
+         jb->mix_addr);
+
+  uint64_t start = 0;
+  int rc = 0;
+  while (jb->playing < pl.count && !stop_requested) {
+    jb_track_t *t = &jb->track[jb->cur];
+    const playlist_item_t *it = &pl.items[jb->playing];
+    uint64_t load_ns = pi_now_ns();
+    if (t->state == TRACK_EMPTY) track_begin(jb, t, jb->playing);
+    track_poll(t, 1);
+    if (it->kind == PLAYLIST_MOD && t->state == TRACK_READY && track_place(jb, t, 0) != 0) {
+      fprintf(stderr, "%s: samples do not fit in %uKB Chip RAM, skipped\n", it->path,
+              chip_ram_limit / 1024u);
+      t->state = TRACK_FAILED;
+    }
+    if (t->state == TRACK_FAILED) {
+      jb->skipped++;
+    } else {
+      printf("[PLAYLIST] %zu/%zu %s\n", jb->playing + 1u, pl.count, it->path);
+      jb->played++;
+      if (it->kind == PLAYLIST_MOD) {
+        if (jb->preload) {
+          mod_upload_step(&t->up, UINT64_MAX);
+        } else {
+          mod_upload_until(&t->up, 1u);
+        }
+        // With every sample already up, run_mod has nothing to commit.
+        chip_cache_t *cache = &jb->cache;
+        if (mod_upload_done(&t->up)) {
+          close_mod_cache(cache, &t->up);
+          cache = NULL;
+        }
+        mod_run_t run;
+        memset(&run, 0, sizeof(run));
+        run.is_pal = jb->is_pal;
+        run.tick_stats = jb->tick_stats;
+        run.use_cia = jb->use_cia;
+        run.load_ns = load_ns;
+        run.start_ns = start;
+        run.mix = &t->mix;
+        run.mix_addr = jb->mix_addr;
+        run.idle = jukebox_idle;
+        run.idle_ctx = jb;
+        rc = run_mod(&t->mod, &t->up, cache, &run);
+        start = run.end_ns;
+      } else {
+        rc = jukebox_stream(jb);
+        start = 0;
+      }
+    }
+    // A stream may have moved on to later items.
+    track_end(&jb->track[jb->cur]);
+    jb->cur ^= 1u;
+    jb->playing++;
+    if (rc != 0) break;
+  }
+
+  // The next item may hold reservations it never finished uploading.
+  jb_track_t *t = &jb->track[jb->cur];
+  if (t->state == TRACK_PLACED && !mod_upload_done(&t->up)) {
+    close_mod_cache(&jb->cache, &t->up);
+  }
+  track_end(&jb->track[0]);
+  track_end(&jb->track[1]);
+  printf("[PLAYLIST] played=%u skipped=%u\n", jb->played, jb->skipped);
+  playlist_free(&pl);
+  return rc;
+}
+
 int main(int argc, char **argv) {
   const char *raw_path = NULL;
   const char *wav_path = NULL;
   const char *mod_path = NULL;
+  const char *synth_path = NULL;
+  const char *midi_path = NULL;
+  const char *playlist_path = NULL;
+  const char *compile_path = NULL;
+  const char *regs_path = NULL;
   uint32_t addr = 0x00080000u;
   uint16_t period = 200u;
   unsigned rate_hz = 0;
@@ -969,16 +1805,36 @@ int main(int argc, char **argv) {
   int seconds_set = 0;
   int stop_only = 0;
   int is_pal = 1;
+  int region_set = 0;
+  int detect_only = 0;
+  int redetect = 0;
   int play_saints_flag = 0;
+  int attach_demo = 0;
   unsigned tempo = 180;
   double gate_ratio = 0.70;
   int stream = 0;
+  int dat = 0;
   size_t chunk_bytes = 0;
   size_t buffers = 2;
   int raw_unsigned = 1;
   int stereo = 0;
   int force_mono = 0;
-  double lpf_hz = 0.0;
+  dsp_chain_t dsp;
+  int dither = 0;
+  int selftest = 0;
+  int resample = 0;
+  int split14 = 0;
+  const char *split14_cal_path = NULL;
+  int period_set = 0;
+  unsigned budget_kbs = 0;
+  int cache_mode = MOD_CACHE_ON;
+  int tick_stats = 0;
+  int use_cia = 0;
+  int preload = 0;
+  int xfer_set = 0;
+  xfer_strategy_t xfer_strategy = XFER_DIRECT;
+
+  dsp_chain_init(&dsp);
 
   if (argc < 2) {
     usage(argv[0]);
@@ -1002,6 +1858,50 @@ int main(int argc, char **argv) {
       mod_path = argv[++i];
       continue;
     }
+    if (!strcmp(arg, "--compile")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      compile_path = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--regs")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      regs_path = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--playlist")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      playlist_path = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--xfer")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      if (xfer_strategy_parse(argv[++i], &xfer_strategy) != 0) {
+        fprintf(stderr, "--xfer expects direct, beam or turbo\n");
+        return 1;
+      }
+      xfer_set = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--preload")) {
+      preload = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--cia")) {
+      use_cia = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--tick-stats")) {
+      tick_stats = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--no-cache")) {
+      cache_mode = MOD_CACHE_OFF;
+      continue;
+    }
+    if (!strcmp(arg, "--cache-reset")) {
+      cache_mode = MOD_CACHE_RESET;
+      continue;
+    }
     if (!strcmp(arg, "--addr")) {
       if (i + 1 >= argc) usage(argv[0]);
       addr = parse_u32(argv[++i]);
@@ -1010,6 +1910,7 @@ int main(int argc, char **argv) {
     if (!strcmp(arg, "--period")) {
       if (i + 1 >= argc) usage(argv[0]);
       period = (uint16_t)parse_u32(argv[++i]);
+      period_set = 1;
       continue;
     }
     if (!strcmp(arg, "--rate")) {
@@ -1033,6 +1934,10 @@ int main(int argc, char **argv) {
       stream = 1;
       continue;
     }
+    if (!strcmp(arg, "--dat")) {
+      dat = 1;
+      continue;
+    }
     if (!strcmp(arg, "--chunk-bytes")) {
       if (i + 1 >= argc) usage(argv[0]);
       chunk_bytes = (size_t)parse_u32(argv[++i]);
@@ -1062,13 +1967,78 @@ int main(int argc, char **argv) {
     }
     if (!strcmp(arg, "--lpf")) {
       if (i + 1 >= argc) usage(argv[0]);
-      lpf_hz = strtod(argv[++i], NULL);
+      double lpf_hz = strtod(argv[++i], NULL);
+      if (lpf_hz > 0.0 && dsp_chain_add(&dsp, DSP_LPF1, lpf_hz, 0.0, 0.0) != 0) return 1;
+      continue;
+    }
+    if (!strcmp(arg, "--pcm-cache")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      const char *dir = argv[++i];
+      pcm_cache_on = strcmp(dir, "off") != 0;
+      pcm_cache_dir = pcm_cache_on ? dir : NULL;
+      continue;
+    }
+    if (!strcmp(arg, "--pcm-cache-mb")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      pcm_cache_bytes = (uint64_t)parse_u32(argv[++i]) << 20;
+      if (pcm_cache_bytes == 0) pcm_cache_on = 0;
+      continue;
+    }
+    if (!strcmp(arg, "--dsp")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      if (dsp_chain_parse(&dsp, argv[++i]) != 0) return 1;
+      continue;
+    }
+    if (!strcmp(arg, "--dither")) {
+      if (dither == 0) dither = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--noise-shape")) {
+      dither = 2;
+      continue;
+    }
+    if (!strcmp(arg, "--resample")) {
+      resample = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--bus-budget")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      budget_kbs = (unsigned)parse_u32(argv[++i]);
+      resample = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--14bit")) {
+      split14 = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--14bit-cal")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      split14_cal_path = argv[++i];
+      split14 = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--selftest")) {
+      selftest = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--synth")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      synth_path = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--midi")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      midi_path = argv[++i];
       continue;
     }
     if (!strcmp(arg, "--saints")) {
       play_saints_flag = 1;
       continue;
     }
+    if (!strcmp(arg, "--attach-demo")) {
+      attach_demo = 1;
+      continue;
+    }
     if (!strcmp(arg, "--tempo")) {
       if (i + 1 >= argc) usage(argv[0]);
       tempo = (unsigned)parse_u32(argv[++i]);
@@ -1083,10 +2053,20 @@ int main(int argc, char **argv) {
     }
     if (!strcmp(arg, "--pal")) {
       is_pal = 1;
+      region_set = 1;
       continue;
     }
     if (!strcmp(arg, "--ntsc")) {
       is_pal = 0;
+      region_set = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--detect")) {
+      detect_only = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--redetect")) {
+      redetect = 1;
       continue;
     }
     if (!strcmp(arg, "--stop")) {
@@ -1097,6 +2077,20 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (selftest) {
+    int bad = pcm_convert_selftest(stdout);
+    bad += mod_mixer_selftest(stdout);
+    return bad == 0 ? 0 : 1;
+  }
+
+  if (compile_path) {
+    if (!mod_path) {
+      fprintf(stderr, "--compile needs --mod\n");
+      return 1;
+    }
+    return compile_mod(mod_path, compile_path) == 0 ? 0 : 1;
+  }
+
   ps_setup_protocol();
   signal(SIGINT, handle_sigint);
   signal(SIGTERM, handle_sigint);
@@ -1106,30 +2100,127 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  amiga_detect_t machine;
+  if (amiga_detect(&machine, NULL, redetect ? AMIGA_DETECT_REPROBE : 0) != 0) {
+    fprintf(stderr, "Unrecognised Agnus ID 0x%02X; assuming %s.\n",
+            machine.agnus_id, machine.info->model_name);
+  }
+  if (detect_only) {
+    amiga_detect_print(&machine, stdout);
+    return 0;
+  }
+  chip_ram_limit = machine.chip_ram_bytes;
+  if (!region_set) is_pal = machine.region == REGION_PAL;
+
+  if (xfer_set) {
+    xfer_sched_init(&xfer, xfer_strategy, is_pal);
+    xfer_sched_install(&xfer, 256u);
+    atexit(report_xfer);
+  }
+
   if (play_saints_flag) {
     if (raw_path || mod_path) {
       fprintf(stderr, "--saints cannot be combined with --raw/--mod\n");
       return 1;
     }
-    double clock = paula_clock_hz(is_pal);
-    double rate_hz = clock / (double)period;
     uint32_t addr_masked = addr & CHIP_ADDR_MASK;
-    printf("[SAINTS] addr=0x%06X rate=%.1fHz period=%u vol=%u bpm=%u gate=%.2f PAL=%d\n",
-           addr_masked, rate_hz, period, vol, tempo, gate_ratio, is_pal);
-    if (play_saints_song(addr, rate_hz, tempo, period, vol, gate_ratio) != 0) {
+    printf("[SAINTS] addr=0x%06X vol=%u bpm=%u gate=%.2f PAL=%d\n",
+           addr_masked, vol, tempo, gate_ratio, is_pal);
+    if (play_saints_song(addr, tempo, vol, gate_ratio, is_pal) != 0) {
       fprintf(stderr, "Failed to play tune.\n");
       return 1;
     }
     return 0;
   }
 
+  if (attach_demo) {
+    if (raw_path || wav_path || mod_path) {
+      fprintf(stderr, "--attach-demo cannot be combined with --raw/--wav/--mod\n");
+      return 1;
+    }
+    printf("[ATTACH] addr=0x%06X vol=%u PAL=%d\n", addr & CHIP_ADDR_MASK, vol, is_pal);
+    return play_attach_demo(addr, vol, is_pal) == 0 ? 0 : 1;
+  }
+
+  if (midi_path) {
+    if (raw_path || wav_path || mod_path || synth_path) {
+      fprintf(stderr, "--midi cannot be combined with other sources\n");
+      return 1;
+    }
+    return play_midi(midi_path, addr, vol, is_pal) == 0 ? 0 : 1;
+  }
+
+  if (synth_path) {
+    if (raw_path || wav_path || mod_path) {
+      fprintf(stderr, "--synth cannot be combined with --raw/--wav/--mod\n");
+      return 1;
+    }
+    ws_score_t score;
+    if (ws_score_load(&score, synth_path) != 0) return 1;
+    printf("[SYNTH] addr=0x%06X events=%zu bpm=%u vol=%u PAL=%d\n",
+           addr & CHIP_ADDR_MASK, score.count, score.bpm, vol, is_pal);
+    ws_stats_t stats;
+    int rc = ws_play(&score, addr, is_pal, vol, &stop_requested, &stats);
+    ws_report(&stats, stdout);
+    ws_score_free(&score);
+    return rc == 0 ? 0 : 1;
+  }
+
+  if (playlist_path) {
+    if (raw_path || wav_path || mod_path || synth_path) {
+      fprintf(stderr, "--playlist cannot be combined with other sources\n");
+      return 1;
+    }
+    jukebox_t *jb = (jukebox_t *)calloc(1, sizeof(*jb));
+    if (!jb) return 1;
+    jb->is_pal = is_pal;
+    jb->tick_stats = tick_stats;
+    jb->use_cia = use_cia;
+    jb->preload = preload;
+    jb->raw_unsigned = raw_unsigned;
+    jb->stereo = stereo && !force_mono;
+    jb->dither = dither;
+    jb->resample = resample;
+    jb->budget_kbs = budget_kbs;
+    jb->rate_hz = rate_hz;
+    jb->period = period;
+    jb->period_set = period_set;
+    jb->vol = vol;
+    jb->chunk_bytes = chunk_bytes;
+    jb->buffers = buffers;
+    jb->dsp = dsp;
+    int rc = play_playlist(jb, playlist_path, addr, cache_mode);
+    free(jb);
+    return rc == 0 ? 0 : 1;
+  }
+
+  if (regs_path) {
+    if (raw_path || wav_path || mod_path || synth_path) {
+      fprintf(stderr, "--regs cannot be combined with other sources\n");
+      return 1;
+    }
+    return play_regs(regs_path, addr) == 0 ? 0 : 1;
+  }
+
   if (mod_path && (raw_path || wav_path)) {
     fprintf(stderr, "--mod cannot be combined with --raw/--wav\n");
     return 1;
   }
 
+  if (dat) {
+    if (wav_path || mod_path) {
+      fprintf(stderr, "--dat plays --raw input only\n");
+      return 1;
+    }
+    if (rate_hz) period = period_from_rate((double)rate_hz, is_pal);
+    if (!seconds_set) seconds = 0;
+    return play_dat(raw_path, raw_unsigned, stereo && !force_mono, period, vol, seconds,
+                    is_pal) == 0 ? 0 : 1;
+  }
+
   if (mod_path) {
-    int rc = play_mod(mod_path, addr, is_pal);
+    int rc = play_mod(mod_path, addr, is_pal, cache_mode, tick_stats, use_cia, preload,
+                      budget_kbs);
     return rc == 0 ? 0 : 1;
   }
 
@@ -1138,12 +2229,59 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  const char *in_path = wav_path ? wav_path : raw_path;
+  if (!strcmp(in_path, "-")) stream = 1;   // a pipe can only be streamed
+  if (resample) stream = 1;                // the resampler runs in the pipeline
+  if (split14) stream = 1;                 // so is the 14-bit split
+  if (stream) {
+    if (!seconds_set) seconds = 0;
+    pcm_split14_cal_t *cal = NULL;
+    if (split14) {
+      char cal_default[64];
+      snprintf(cal_default, sizeof(cal_default), SPLIT14_CAL_DEFAULT, machine.fingerprint);
+      cal = (pcm_split14_cal_t *)malloc(sizeof(*cal));
+      int loaded = cal ? load_split14_cal(cal, split14_cal_path ? split14_cal_path : cal_default,
+                                          split14_cal_path != NULL)
+                       : -1;
+      if (loaded < 0) {
+        free(cal);
+        return 1;
+      }
+      if (loaded == 0) {
+        free(cal);
+        cal = NULL;
+      }
+    }
+    int rc = stream_pcm_file(in_path, wav_path != NULL, raw_unsigned, stereo,
+                             force_mono, addr, period, rate_hz, vol, seconds,
+                             chunk_bytes, buffers, &dsp, dither, resample,
+                             period_set, budget_kbs, is_pal, split14, cal);
+    free(cal);
+    return rc == 0 ? 0 : 1;
+  }
+
+  char params[PCM_CACHE_PARAMS_MAX];
+  describe_pcm(params, sizeof(params), "buffered", wav_path != NULL, raw_unsigned, stereo,
+               force_mono, rate_hz, period, period_set, 0, 0, dither, is_pal, 0, NULL, &dsp);
+  pcm_cache_t *cache = open_pcm_cache(in_path, params);
+  if (cache && cache->hit && cache->channels == 1u) {
+    pcm_cache_report(cache, stdout);
+    printf("[RAW] cached addr=0x%06X bytes=%llu period=%u vol=%u seconds=%u PAL=%d\n",
+           addr & 0x1FFFFu, (unsigned long long)cache->frames, cache->period, vol, seconds,
+           is_pal);
+    audio_play_raw(addr, (const uint8_t *)cache->data, (size_t)cache->frames, cache->period,
+                   vol, seconds);
+    close_pcm_cache(cache);
+    return 0;
+  }
+  close_pcm_cache(cache);
+
   size_t len = 0;
   uint8_t *buf = NULL;
   int channels = 1;
   if (wav_path) {
     unsigned wav_rate = 0;
-    buf = read_wav_s8(wav_path, &len, &wav_rate, &channels, force_mono);
+    buf = read_wav_s8(wav_path, &len, &wav_rate, &channels, force_mono, dither);
     if (!buf || len == 0) {
       fprintf(stderr, "Failed to read WAV: %s\n", wav_path);
       free(buf);
@@ -1181,44 +2319,26 @@ int main(int argc, char **argv) {
   } else {
     rate_hz = (unsigned)(paula_clock_hz(is_pal) / (double)period + 0.5);
   }
-  if (stream) {
-    if (!seconds_set) seconds = 0;
-    size_t effective_chunk = chunk_bytes ? chunk_bytes : 0xFFFFu * 2u;
-    if (lpf_hz > 0.0) {
-      if (channels == 2) {
-        apply_lpf_stereo((int8_t *)buf, len / 2u, (double)rate_hz, lpf_hz);
-      } else {
-        apply_lpf_mono((int8_t *)buf, len, (double)rate_hz, lpf_hz);
-      }
-    }
-    if (channels == 2) {
-      printf("[STREAM] stereo addr=0x%06X bytes=%zu period=%u vol=%u rate=%uHz seconds=%u chunk=%zu buffers=%zu PAL=%d\n",
-             addr & 0x1FFFFu, len, period, vol, rate_hz, seconds, effective_chunk, buffers, is_pal);
-      audio_play_stream_stereo(addr, buf, len, period, vol, (double)rate_hz,
-                               seconds, chunk_bytes, buffers);
-    } else {
-      printf("[STREAM] addr=0x%06X bytes=%zu period=%u vol=%u rate=%uHz seconds=%u chunk=%zu buffers=%zu PAL=%d\n",
-             addr & 0x1FFFFu, len, period, vol, rate_hz, seconds, effective_chunk, buffers, is_pal);
-      audio_play_stream(addr, buf, len, period, vol, (double)rate_hz,
-                        seconds, chunk_bytes, buffers);
-    }
-  } else {
-    if (lpf_hz > 0.0) {
-      if (channels == 2) {
-        apply_lpf_stereo((int8_t *)buf, len / 2u, (double)rate_hz, lpf_hz);
-      } else {
-        apply_lpf_mono((int8_t *)buf, len, (double)rate_hz, lpf_hz);
-      }
-    }
-    if (channels == 2) {
-      fprintf(stderr, "Stereo requires --stream (AUD0/AUD1).\n");
-      free(buf);
-      return 1;
+  dsp_run_s8(&dsp, (int8_t *)buf, len / (size_t)channels, (unsigned)channels,
+             (double)rate_hz);
+  if (channels == 2) {
+    fprintf(stderr, "Stereo requires --stream (AUD0/AUD1).\n");
+    free(buf);
+    return 1;
+  }
+  cache = open_pcm_cache(in_path, params);
+  if (cache && !cache->hit) {
+    cache->channels = 1;
+    cache->period = period;
+    cache->rate_hz = (double)rate_hz;
+    if (pcm_cache_write(cache, (const int8_t *)buf, len) == 0 && pcm_cache_commit(cache) == 0) {
+      pcm_cache_report(cache, stdout);
     }
-    printf("[RAW] addr=0x%06X bytes=%zu period=%u vol=%u seconds=%u PAL=%d\n",
-           addr & 0x1FFFFu, len, period, vol, seconds, is_pal);
-    audio_play_raw(addr, buf, len, period, vol, seconds);
   }
+  close_pcm_cache(cache);
+  printf("[RAW] addr=0x%06X bytes=%zu period=%u vol=%u seconds=%u PAL=%d\n",
+         addr & 0x1FFFFu, len, period, vol, seconds, is_pal);
+  audio_play_raw(addr, buf, len, period, vol, seconds);
   free(buf);
   return 0;
 }
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+// Playlist files for the jukebox mode.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "playlist.h"
+
+playlist_kind_t playlist_kind(const char *path) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  const char *dot = strrchr(base, '.');
+  if (!strncasecmp(base, "mod.", 4)) return PLAYLIST_MOD;
+  if (dot && !strcasecmp(dot, ".mod")) return PLAYLIST_MOD;
+  if (dot && !strcasecmp(dot, ".wav")) return PLAYLIST_WAV;
+  return PLAYLIST_RAW;
+}
+
+static char *join_path(const char *list_path, const char *entry) {
+  const char *slash = strrchr(list_path, '/');
+  size_t dir = (entry[0] == '/' || !slash) ? 0u : (size_t)(slash - list_path) + 1u;
+  size_t len = strlen(entry);
+  char *out = (char *)malloc(dir + len + 1u);
+  if (!out) return NULL;
+  memcpy(out, list_path, dir);
+  memcpy(out + dir, entry, len + 1u);
+  return out;
+}
+
+int playlist_load(playlist_t *pl, const char *path) {
+  memset(pl, 0, sizeof(*pl));
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  size_t cap = 0;
+  char line[1024];
+  int rc = 0;
+  while (rc == 0 && fgets(line, sizeof(line), f)) {
+    char *s = line;
+    while (isspace((unsigned char)*s)) s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1u])) s[--n] = '\0';
+    if (n == 0 || s[0] == '#') continue;
+    if (pl->count == cap) {
+      size_t ncap = cap ? cap * 2u : 16u;
+      playlist_item_t *items = (playlist_item_t *)realloc(pl->items, ncap * sizeof(*items));
+      if (!items) {
+        rc = -1;
+        break;
+      }
+      pl->items = items;
+      cap = ncap;
+    }
+    playlist_item_t *it = &pl->items[pl->count];
+    it->path = join_path(path, s);
+    if (!it->path) {
+      rc = -1;
+      break;
+    }
+    it->kind = playlist_kind(it->path);
+    pl->count++;
+  }
+  fclose(f);
+  if (rc != 0) {
+    fprintf(stderr, "%s: out of memory\n", path);
+  } else if (pl->count == 0) {
+    fprintf(stderr, "%s: playlist is empty\n", path);
+    rc = -1;
+  }
+  if (rc != 0) playlist_free(pl);
+  return rc;
+}
+
+void playlist_free(playlist_t *pl) {
+  for (size_t i = 0; i < pl->count; i++) free(pl->items[i].path);
+  free(pl->items);
+  memset(pl, 0, sizeof(*pl));
+}
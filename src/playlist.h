@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: MIT
+// Playlist files for the jukebox mode.
+//
+// One path per line; blank lines and lines starting with '#' are skipped,
+// so plain M3U files work. Relative paths are taken relative to the
+// playlist's own directory. The kind of each entry comes from its name:
+// *.mod or mod.* is a ProTracker module, *.wav a WAV file, anything else
+// raw 8-bit PCM.
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <stddef.h>
+
+typedef enum {
+  PLAYLIST_MOD = 0,
+  PLAYLIST_WAV,
+  PLAYLIST_RAW
+} playlist_kind_t;
+
+typedef struct {
+  char *path;
+  playlist_kind_t kind;
+} playlist_item_t;
+
+typedef struct {
+  playlist_item_t *items;
+  size_t count;
+} playlist_t;
+
+int playlist_load(playlist_t *pl, const char *path);
+void playlist_free(playlist_t *pl);
+
+playlist_kind_t playlist_kind(const char *path);
+
+#endif /* PLAYLIST_H */
@@ -5,10 +5,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "gpio/ps_protocol.h"
 #include "paula.h"
 #include "cia.h"
+#include "chip_ram.h"
+#include "xfer_sched.h"
+#include "amiga_detect.h"
+#include "memtest.h"
 
 // ps_protocol.c expects this symbol from the emulator core.
 void m68k_set_irq(unsigned int level) {
@@ -40,6 +45,25 @@ static void usage(const char *prog) {
           "               [--audio-period <val>] [--audio-vol <val>]\n"
           "  --audio-stop\n"
           "\n"
+          "Chip RAM transfer benchmark:\n"
+          "  [--pal|--ntsc] --xfer-bench <addr> <len>\n"
+          "                              Upload len bytes with each --xfer strategy\n"
+          "                              (direct, beam, turbo) and report KB/s. The\n"
+          "                              beam timing follows the detected region\n"
+          "                              unless --pal or --ntsc is given first\n"
+          "\n"
+          "Chip RAM memtest (64 KB regions, contents saved and restored):\n"
+          "  [--memtest-step <n>] [--memtest-report <file>]\n"
+          "  --memtest <addr> <len>      Test len bytes from addr (len 0 = to end of\n"
+          "                              chip RAM). --memtest-step tests at most n\n"
+          "                              regions per run; later runs resume. Writes a\n"
+          "                              JSON report (default memtest.json)\n"
+          "\n"
+          "Machine detection:\n"
+          "  --detect [--redetect]       Print model, region and chip RAM size\n"
+          "                              (--redetect skips the cached result)\n"
+          "                              Probing chip RAM needs --force\n"
+          "\n"
           "Disk LED (CIAA port A, active low):\n"
           "  --disk-led <on|off>\n"
           "  --kbd-led <on|off>   (alias; same as --disk-led)\n"
@@ -49,7 +73,10 @@ static void usage(const char *prog) {
           "\n"
           "Notes:\n"
           "- Use --force to allow writes.\n"
-          "- CIAA uses odd addresses; CIAB uses even addresses.\n",
+          "- CIAA uses odd addresses; CIAB uses even addresses.\n"
+          "- --force --detect probes chip RAM size with two words at 0x000000 and\n"
+          "  restores them; without --force it reports the cached size, or the\n"
+          "  chipset's standard size.\n",
           prog);
 }
 
@@ -112,6 +139,64 @@ static void audio_stop(void) {
   ps_write_16(DMACON, DMAF_MASTER | DMAF_AUD0);
 }
 
+static void xfer_bench(uint32_t addr, uint32_t len, int is_pal) {
+  uint8_t *buf = (uint8_t *)malloc(len ? len : 1u);
+  if (!buf) {
+    fprintf(stderr, "xfer-bench: out of memory\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    buf[i] = (uint8_t)rand();
+  }
+
+  xfer_sched_t x;
+  xfer_sched_init(&x, XFER_DIRECT, is_pal);
+  for (int s = 0; s < XFER_STRATEGIES; s++) {
+    xfer_write_with(&x, (xfer_strategy_t)s, addr, buf, len);
+  }
+  printf("xfer-bench addr=0x%06X len=%u %s DMACONR=0x%04X\n",
+         addr, len, is_pal ? "PAL" : "NTSC", (unsigned)ps_read_16(DMACONR) & 0xFFFFu);
+  xfer_report(&x, stdout);
+  free(buf);
+}
+
+static int run_memtest(uint32_t addr, uint32_t len, unsigned step,
+                       const char *report) {
+  // The range check needs the measured size, not the chipset's standard
+  // one, so this detect may probe; --memtest already requires --force.
+  amiga_detect_t machine;
+  amiga_detect(&machine, NULL, 0);
+
+  static memtest_t m;
+  if (memtest_init(&m, addr, len, machine.chip_ram_bytes, (uint32_t)time(NULL)) != 0) {
+    fprintf(stderr, "memtest: range is outside %uKB chip RAM\n",
+            machine.chip_ram_bytes / 1024u);
+    return 1;
+  }
+  char state[512];
+  snprintf(state, sizeof(state), "%s.state", report);
+  memtest_load(&m, state);
+  if (!memtest_remaining(&m)) {
+    // The previous sweep finished; start a new one.
+    memtest_init(&m, addr, len, machine.chip_ram_bytes, (uint32_t)time(NULL));
+  }
+
+  int done = memtest_run(&m, step, stdout);
+  if (memtest_save(&m, state) != 0) return 1;
+  if (memtest_write_json(&m, report, machine.info->model_name,
+                         machine.chip_ram_bytes) != 0) {
+    return 1;
+  }
+  printf("memtest: %d region(s) tested, %u remaining, report %s\n",
+         done < 0 ? 0 : done, memtest_remaining(&m), report);
+
+  for (unsigned i = 0; i < m.count; i++) {
+    const memtest_region_t *r = &m.regions[i];
+    if (r->errors[0] | r->errors[1] | r->errors[2]) return 2;
+  }
+  return done < 0 ? 1 : 0;
+}
+
 static void disk_led(int on) {
   uint8_t ddr = (uint8_t)ps_read_8(CIAADDR_A);
   uint8_t pra = (uint8_t)ps_read_8(CIAAPRA);
@@ -139,7 +224,11 @@ static void power_led(int on) {
 
 int main(int argc, char **argv) {
   int force = 0;
+  int redetect = 0;
+  int region = -1;          // 1 PAL, 0 NTSC, -1 from the Agnus
   int width = 8;
+  unsigned memtest_step = 0;
+  const char *memtest_report = "memtest.json";
   uint32_t audio_addr = 0x00010000u;
   uint32_t audio_len = 256u;
   uint16_t audio_period = 200u;
@@ -160,6 +249,44 @@ int main(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(arg, "--redetect")) {
+      redetect = 1;
+      continue;
+    }
+
+    if (!strcmp(arg, "--pal")) {
+      region = 1;
+      continue;
+    }
+
+    if (!strcmp(arg, "--ntsc")) {
+      region = 0;
+      continue;
+    }
+
+    if (!strcmp(arg, "--detect")) {
+      // Allow --redetect after --detect as well.
+      if (i + 1 < argc && !strcmp(argv[i + 1], "--redetect")) redetect = 1;
+      // The chip RAM probe writes two words, so it needs --force.
+      amiga_detect_t machine;
+      int rc = amiga_detect(&machine, NULL, (redetect ? AMIGA_DETECT_REPROBE : 0) |
+                                            (force ? 0 : AMIGA_DETECT_READ_ONLY));
+      amiga_detect_print(&machine, stdout);
+      return rc == 0 ? 0 : 1;
+    }
+
+    if (!strcmp(arg, "--memtest-step")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      memtest_step = parse_u32(argv[++i]);
+      continue;
+    }
+
+    if (!strcmp(arg, "--memtest-report")) {
+      if (i + 1 >= argc) usage(argv[0]);
+      memtest_report = argv[++i];
+      continue;
+    }
+
     if (!strcmp(arg, "--width")) {
       if (i + 1 >= argc) usage(argv[0]);
       width = (int)parse_u32(argv[++i]);
@@ -277,6 +404,35 @@ int main(int argc, char **argv) {
       return 0;
     }
 
+    if (!strcmp(arg, "--xfer-bench")) {
+      if (i + 2 >= argc) usage(argv[0]);
+      if (!force) {
+        fprintf(stderr, "xfer-bench requires --force\n");
+        return 1;
+      }
+      uint32_t addr = parse_u32(argv[++i]);
+      uint32_t len = parse_u32(argv[++i]);
+      if (region < 0) {
+        // Only the region is wanted; do not run the chip RAM probe.
+        amiga_detect_t machine;
+        amiga_detect(&machine, NULL, AMIGA_DETECT_READ_ONLY);
+        region = machine.region == REGION_PAL;
+      }
+      xfer_bench(addr, len, region);
+      return 0;
+    }
+
+    if (!strcmp(arg, "--memtest")) {
+      if (i + 2 >= argc) usage(argv[0]);
+      if (!force) {
+        fprintf(stderr, "memtest requires --force\n");
+        return 1;
+      }
+      uint32_t addr = parse_u32(argv[++i]);
+      uint32_t len = parse_u32(argv[++i]);
+      return run_memtest(addr, len, memtest_step, memtest_report);
+    }
+
     if (!strcmp(arg, "--disk-led")) {
       if (i + 1 >= argc) usage(argv[0]);
       if (!force) {
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: MIT
+// Streaming polyphase resampler, 16-bit fixed point.
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dot_q15.h"
+#include "resample.h"
+
+#define RESAMPLE_HISTORY 4096u      // input frames buffered per channel
+
+static int16_t round_q15(int32_t acc) {
+  int32_t v = (acc + (1 << 14)) >> 15;
+  if (v < -32768) v = -32768;
+  if (v > 32767) v = 32767;
+  return (int16_t)v;
+}
+
+static void build_bank(resample_t *r, double fc) {
+  const double pi = 3.141592653589793;
+  double half = (double)(r->taps / 2u);
+  for (unsigned p = 0; p < RESAMPLE_PHASES; p++) {
+    double frac = (double)p / (double)RESAMPLE_PHASES;
+    double h[RESAMPLE_MAX_TAPS];
+    double sum = 0.0;
+    for (unsigned k = 0; k < r->taps; k++) {
+      double d = ((double)k - (half - 1.0)) - frac;
+      double x = 2.0 * fc * d;
+      double sinc = fabs(x) < 1e-12 ? 1.0 : sin(pi * x) / (pi * x);
+      double w = d / half;
+      double win = fabs(w) >= 1.0 ? 0.0
+                                  : 0.42 + 0.5 * cos(pi * w) + 0.08 * cos(2.0 * pi * w);
+      h[k] = sinc * win;
+      sum += h[k];
+    }
+    // Normalise each phase to unity gain; the rounding residue goes on
+    // the largest tap so DC passes exactly.
+    int16_t *c = r->coef + (size_t)p * r->taps;
+    int32_t total = 0;
+    unsigned peak = 0;
+    for (unsigned k = 0; k < r->taps; k++) {
+      c[k] = (int16_t)lrint(h[k] / sum * 32768.0);
+      total += c[k];
+      if (c[k] > c[peak]) peak = k;
+    }
+    c[peak] = (int16_t)(c[peak] + (32768 - total));
+  }
+}
+
+int resample_init(resample_t *r, unsigned channels, double in_hz, double out_hz) {
+  memset(r, 0, sizeof(*r));
+  if (in_hz <= 0.0 || out_hz <= 0.0 || (channels != 1 && channels != 2)) {
+    fprintf(stderr, "resample: bad rates %.1f -> %.1f\n", in_hz, out_hz);
+    return -1;
+  }
+  double ratio = in_hz / out_hz;
+  // 16 taps per phase when upsampling, more as the pass band narrows.
+  unsigned taps = 16u * (unsigned)ceil(ratio > 1.0 ? ratio : 1.0);
+  taps = (taps + 7u) & ~7u;
+  if (taps > RESAMPLE_MAX_TAPS) taps = RESAMPLE_MAX_TAPS;
+  r->channels = channels;
+  r->taps = taps;
+  r->step = (uint64_t)llround(ratio * 4294967296.0);
+  r->cap = RESAMPLE_HISTORY + taps;
+  r->coef = (int16_t *)malloc((size_t)RESAMPLE_PHASES * taps * sizeof(int16_t));
+  for (unsigned c = 0; c < channels; c++) {
+    r->buf[c] = (int16_t *)calloc(r->cap, sizeof(int16_t));
+    if (!r->buf[c]) break;
+  }
+  if (!r->coef || !r->buf[0] || (channels == 2 && !r->buf[1])) {
+    fprintf(stderr, "resample: out of memory\n");
+    resample_free(r);
+    return -1;
+  }
+  // Cut-off at 90% of the lower Nyquist rate, in input cycles/sample.
+  build_bank(r, 0.45 * (ratio > 1.0 ? 1.0 / ratio : 1.0));
+  // Start with half a filter of silence so the first output lines up with
+  // the first input frame.
+  r->fill = taps / 2u - 1u;
+  r->pos = (uint64_t)r->fill << 32;
+  return 0;
+}
+
+size_t resample_process(resample_t *r, const int16_t *in, size_t *in_frames,
+                        int16_t *out, size_t out_frames) {
+  const unsigned ch = r->channels;
+  const size_t half = r->taps / 2u;
+  size_t consumed = 0;
+  size_t produced = 0;
+  for (;;) {
+    while (produced < out_frames) {
+      size_t n = (size_t)(r->pos >> 32);
+      if (n + half >= r->fill) break;
+      unsigned phase = (unsigned)(r->pos >> 24) & (RESAMPLE_PHASES - 1u);
+      const int16_t *h = r->coef + (size_t)phase * r->taps;
+      size_t base = n - (half - 1u);
+      for (unsigned c = 0; c < ch; c++) {
+        out[produced * ch + c] = round_q15(dot_q15(r->buf[c] + base, h, r->taps));
+      }
+      produced++;
+      r->pos += r->step;
+    }
+    if (produced >= out_frames || consumed >= *in_frames) break;
+
+    if (r->fill == r->cap) {
+      // Drop history the filter no longer reaches. When downsampling the
+      // read position can be past the end of the buffer already.
+      size_t drop = (size_t)(r->pos >> 32) - (half - 1u);
+      if (drop > r->fill) drop = r->fill;
+      for (unsigned c = 0; c < ch; c++) {
+        memmove(r->buf[c], r->buf[c] + drop, (r->fill - drop) * sizeof(int16_t));
+      }
+      r->fill -= drop;
+      r->pos -= (uint64_t)drop << 32;
+    }
+    size_t take = r->cap - r->fill;
+    if (take > *in_frames - consumed) take = *in_frames - consumed;
+    const int16_t *src = in + consumed * ch;
+    if (ch == 1) {
+      memcpy(r->buf[0] + r->fill, src, take * sizeof(int16_t));
+    } else {
+      for (size_t i = 0; i < take; i++) {
+        r->buf[0][r->fill + i] = src[i * 2u + 0];
+        r->buf[1][r->fill + i] = src[i * 2u + 1];
+      }
+    }
+    r->fill += take;
+    consumed += take;
+  }
+  *in_frames = consumed;
+  return produced;
+}
+
+size_t resample_latency(const resample_t *r) {
+  return r->taps / 2u;
+}
+
+void resample_free(resample_t *r) {
+  free(r->coef);
+  free(r->buf[0]);
+  free(r->buf[1]);
+  r->coef = NULL;
+  r->buf[0] = NULL;
+  r->buf[1] = NULL;
+}
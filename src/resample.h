@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// Streaming polyphase resampler, 16-bit fixed point.
+//
+// Converts between arbitrary rates with a windowed-sinc filter bank of
+// RESAMPLE_PHASES phases. The read position is kept in 32.32 fixed point,
+// so the output rate can be the exact Paula rate clock / period rather
+// than a rounded integer. Input is pushed in chunks of any size and memory
+// use is fixed at init time. The inner product uses NEON when available.
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESAMPLE_PHASES   256u
+#define RESAMPLE_MAX_TAPS 128u
+
+typedef struct {
+  unsigned channels;        // 1 or 2, interleaved in and out
+  unsigned taps;            // per phase, multiple of 8
+  uint64_t step;            // input frames per output frame, 32.32
+  uint64_t pos;             // read position in buf, 32.32
+  int16_t *coef;            // RESAMPLE_PHASES * taps, Q15
+  int16_t *buf[2];          // planar input history
+  size_t fill;              // frames in buf
+  size_t cap;
+} resample_t;
+
+// Builds the filter bank. The cut-off sits just below the lower of the two
+// Nyquist rates; downsampling by a large factor lengthens the filter.
+int resample_init(resample_t *r, unsigned channels, double in_hz, double out_hz);
+
+// Consumes up to *in_frames frames from in and writes up to out_frames
+// frames to out. On return *in_frames holds the number consumed. Returns
+// the number of frames written. Call again with the rest of the input when
+// the output fills up.
+size_t resample_process(resample_t *r, const int16_t *in, size_t *in_frames,
+                        int16_t *out, size_t out_frames);
+
+// Frames of silence to push at the end of the input to flush the filter.
+size_t resample_latency(const resample_t *r);
+
+void resample_free(resample_t *r);
+
+#endif /* RESAMPLE_H */
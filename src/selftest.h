@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+// Helpers shared by the --selftest checks of the vector kernels.
+//
+// Each check runs a kernel and its scalar reference on the same input and
+// compares the outputs byte for byte, or feeds a stateful kernel the same
+// input in one call and in randomly sized blocks.
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SELFTEST_MAX_BLOCK 700u     // in units; odd against the vector widths
+
+// Repeatable test data: a plain LCG, top 24 bits.
+static inline uint32_t selftest_rng(uint32_t *s) {
+  *s = *s * 1664525u + 1013904223u;
+  return *s >> 8;
+}
+
+// Prints one result line and returns the number of differing bytes.
+static inline int selftest_diff(const char *name, const void *a, const void *b, size_t n,
+                                FILE *out) {
+  int bad = 0;
+  const uint8_t *x = (const uint8_t *)a;
+  const uint8_t *y = (const uint8_t *)b;
+  for (size_t i = 0; i < n; i++) bad += x[i] != y[i];
+  fprintf(out, "  %-22s %s", name, bad ? "MISMATCH" : "ok");
+  if (bad) fprintf(out, " (%d bytes)", bad);
+  fprintf(out, "\n");
+  return bad;
+}
+
+// Length of the next block, a random multiple of unit up to
+// SELFTEST_MAX_BLOCK units, cut to the left items still to go.
+static inline size_t selftest_block(uint32_t *s, size_t unit, size_t left) {
+  size_t len = unit * (1u + selftest_rng(s) % SELFTEST_MAX_BLOCK);
+  return len < left ? len : left;
+}
+
+#endif /* SELFTEST_H */
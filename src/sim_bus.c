@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: MIT
+// Simulated PiStorm bus: the ps_protocol and chip_ram entry points backed
+// by the Paula model instead of the GPIO block.
+//
+// Linked into pimodplay in place of gpio/ps_protocol.c and src/chip_ram.c
+// (see build_paulasim.sh), it runs the real playback paths on any Linux
+// box, in real time, with every access stamped by the host clock. It is
+// set up from the environment:
+//
+//   PAULASIM_WAV    render the output to this WAV file
+//   PAULASIM_RATE   its sample rate (default 44100)
+//   PAULASIM_TRACE  log every write as "<ns> w<bits> <addr> <value>" for
+//                   replay with paulasim
+//   PAULASIM_NTSC   set to 1 to model an NTSC machine
+//
+// A helper thread keeps the model caught up with the host clock, so an
+// access after a quiet stretch is not delayed by rendering it. The
+// model's report is printed when the program exits.
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "chip_ram.h"
+#include "amiga_detect.h"
+#include "pi_time.h"
+#include "paula_sim.h"
+
+#define SIM_MODEL_CACHE "/tmp/paulasim-model.cache"
+#define SIM_ADVANCE_NS  1000000ull
+
+static paula_sim_t sim;
+static int sim_ready;
+static int sim_quit;
+static pthread_t advance_thread;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace;
+static uint64_t trace_t0;
+
+static chip_ram_writer_fn bulk_writer = NULL;
+static size_t bulk_min_len = 0;
+
+static void *advance_main(void *arg) {
+  (void)arg;
+  while (!__atomic_load_n(&sim_quit, __ATOMIC_ACQUIRE)) {
+    pi_sleep_ns(SIM_ADVANCE_NS);
+    pthread_mutex_lock(&sim_lock);
+    paula_sim_advance(&sim, pi_now_ns());
+    pthread_mutex_unlock(&sim_lock);
+  }
+  return NULL;
+}
+
+static void sim_exit(void) {
+  __atomic_store_n(&sim_quit, 1, __ATOMIC_RELEASE);
+  pthread_join(advance_thread, NULL);
+  paula_sim_finish(&sim, pi_now_ns());
+  paula_sim_report(&sim, stdout);
+  if (trace) fclose(trace);
+  trace = NULL;
+  sim_ready = 0;
+}
+
+void ps_setup_protocol() {
+  if (sim_ready) return;
+  const char *wav = getenv("PAULASIM_WAV");
+  const char *rate = getenv("PAULASIM_RATE");
+  const char *trace_path = getenv("PAULASIM_TRACE");
+  const char *ntsc = getenv("PAULASIM_NTSC");
+  int is_pal = !(ntsc && !strcmp(ntsc, "1"));
+  if (paula_sim_init(&sim, is_pal, rate ? (unsigned)strtoul(rate, NULL, 0) : 0u,
+                     (wav && wav[0]) ? wav : NULL) != 0) {
+    exit(1);
+  }
+  if (trace_path && trace_path[0]) {
+    trace = fopen(trace_path, "w");
+    if (!trace) {
+      perror(trace_path);
+      exit(1);
+    }
+    fprintf(trace, "# paulasim trace, %s\n", is_pal ? "PAL" : "NTSC");
+  }
+  // Keep the simulated machine out of the real model cache.
+  setenv(AMIGA_DETECT_CACHE_ENV, SIM_MODEL_CACHE, 0);
+  trace_t0 = pi_now_ns();
+  paula_sim_advance(&sim, trace_t0);
+  sim_ready = 1;
+  if (pthread_create(&advance_thread, NULL, advance_main, NULL) != 0) {
+    fprintf(stderr, "sim: cannot start the model thread\n");
+    exit(1);
+  }
+  atexit(sim_exit);
+  fprintf(stderr, "[SIM] simulated bus, %s Paula%s%s\n", is_pal ? "PAL" : "NTSC",
+          wav ? ", output to " : "", wav ? wav : "");
+}
+
+static void sim_write(unsigned int address, unsigned int data, unsigned bits) {
+  if (!sim_ready) ps_setup_protocol();
+  pthread_mutex_lock(&sim_lock);
+  uint64_t now = pi_now_ns();
+  if (trace) {
+    fprintf(trace, "%llu w%u %06x %x\n", (unsigned long long)(now - trace_t0), bits,
+            address & 0xFFFFFFu, data);
+  }
+  paula_sim_write(&sim, now, address, bits, data);
+  pthread_mutex_unlock(&sim_lock);
+}
+
+void ps_write_8(unsigned int address, unsigned int data) {
+  sim_write(address, data & 0xFFu, 8);
+}
+
+void ps_write_16(unsigned int address, unsigned int data) {
+  sim_write(address, data & 0xFFFFu, 16);
+}
+
+void ps_write_32(unsigned int address, unsigned int value) {
+  sim_write(address, value, 32);
+}
+
+static unsigned int sim_read(unsigned int address, unsigned bits) {
+  if (!sim_ready) ps_setup_protocol();
+  pthread_mutex_lock(&sim_lock);
+  unsigned int v = paula_sim_read(&sim, pi_now_ns(), address, bits);
+  pthread_mutex_unlock(&sim_lock);
+  return v;
+}
+
+unsigned int ps_read_8(unsigned int address) {
+  return sim_read(address, 8);
+}
+
+unsigned int ps_read_16(unsigned int address) {
+  return sim_read(address, 16);
+}
+
+unsigned int ps_read_32(unsigned int address) {
+  return sim_read(address, 32);
+}
+
+void ps_write_status_reg(unsigned int value) {
+  (void)value;
+}
+
+unsigned int ps_read_status_reg() {
+  return 0;
+}
+
+void ps_reset_state_machine() {
+}
+
+void ps_pulse_reset() {
+}
+
+unsigned int ps_get_ipl_zero() {
+  return 1;
+}
+
+void chip_ram_set_bulk_writer(chip_ram_writer_fn fn, size_t min_len) {
+  bulk_writer = fn;
+  bulk_min_len = min_len;
+}
+
+void write_chip_ram(uint32_t addr, const uint8_t *buf, size_t len) {
+  if (bulk_writer && len >= bulk_min_len) {
+    bulk_writer(addr, buf, len);
+    return;
+  }
+  write_chip_ram_burst(addr, buf, len);
+}
+
+void write_chip_ram_burst(uint32_t addr, const uint8_t *buf, size_t len) {
+  size_t i = 0;
+  for (; i + 1 < len; i += 2) {
+    ps_write_16(addr + (uint32_t)i, ((unsigned)buf[i] << 8) | buf[i + 1]);
+  }
+  if (i < len) ps_write_8(addr + (uint32_t)i, buf[i]);
+}
+
+void write_chip_ram_run(uint32_t addr, const uint8_t *buf, size_t len) {
+  if (bulk_writer && len >= bulk_min_len) {
+    bulk_writer(addr, buf, len);
+    return;
+  }
+  write_chip_ram_burst(addr, buf, len);
+}
+
+void read_chip_ram(uint32_t addr, uint8_t *buf, size_t len) {
+  size_t i = 0;
+  for (; i + 1 < len; i += 2) {
+    uint16_t v = (uint16_t)ps_read_16(addr + (uint32_t)i);
+    buf[i] = (uint8_t)(v >> 8);
+    buf[i + 1] = (uint8_t)v;
+  }
+  if (i < len) buf[i] = (uint8_t)ps_read_8(addr + (uint32_t)i);
+}
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MIT
+// Single-producer/single-consumer ring of fixed-size blocks.
+//
+// One thread writes, one thread reads; head and tail are only ever stored
+// by their owner, so no locks are needed. Both sides poll with a short
+// sleep when the ring is full or empty.
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pi_time.h"
+
+#define SPSC_RING_POLL_NS 200000ull
+
+typedef struct {
+  uint8_t *data;            // count * block_bytes
+  size_t *lens;             // bytes used in each block
+  unsigned count;
+  size_t block_bytes;
+  unsigned head;            // next block to write, owned by the producer
+  unsigned tail;            // next block to read, owned by the consumer
+  int closed;               // producer finished; set after the last commit
+} spsc_ring_t;
+
+static inline int spsc_ring_init(spsc_ring_t *r, unsigned count, size_t block_bytes) {
+  r->data = (uint8_t *)malloc(count * block_bytes);
+  r->lens = (size_t *)calloc(count, sizeof(size_t));
+  r->count = count;
+  r->block_bytes = block_bytes;
+  r->head = 0;
+  r->tail = 0;
+  r->closed = 0;
+  return (r->data && r->lens) ? 0 : -1;
+}
+
+static inline void spsc_ring_free(spsc_ring_t *r) {
+  free(r->data);
+  free(r->lens);
+  r->data = NULL;
+  r->lens = NULL;
+}
+
+// Producer: returns the next free block, or NULL if the ring is full.
+static inline uint8_t *spsc_ring_write_begin(spsc_ring_t *r) {
+  unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  if (r->head - tail >= r->count) return NULL;
+  return r->data + (size_t)(r->head % r->count) * r->block_bytes;
+}
+
+static inline void spsc_ring_write_commit(spsc_ring_t *r, size_t len) {
+  r->lens[r->head % r->count] = len;
+  __atomic_store_n(&r->head, r->head + 1u, __ATOMIC_RELEASE);
+}
+
+static inline void spsc_ring_close(spsc_ring_t *r) {
+  __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: returns the oldest filled block, or NULL if the ring is empty.
+static inline const uint8_t *spsc_ring_read_begin(spsc_ring_t *r, size_t *len) {
+  unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  if (head == r->tail) return NULL;
+  *len = r->lens[r->tail % r->count];
+  return r->data + (size_t)(r->tail % r->count) * r->block_bytes;
+}
+
+static inline void spsc_ring_read_commit(spsc_ring_t *r) {
+  __atomic_store_n(&r->tail, r->tail + 1u, __ATOMIC_RELEASE);
+}
+
+// True once the producer has closed the ring and every block was read.
+static inline int spsc_ring_drained(spsc_ring_t *r) {
+  if (!__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) return 0;
+  return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail;
+}
+
+static inline void spsc_ring_wait(void) {
+  pi_sleep_ns(SPSC_RING_POLL_NS);
+}
+
+#endif /* SPSC_RING_H */
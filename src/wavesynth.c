@@ -0,0 +1,450 @@
+// SPDX-License-Identifier: MIT
+// Resident wavetable synth for Paula.
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "paula_stream.h"
+#include "wavesynth.h"
+
+#define WS_SIZES       6u             // table lengths 256, 128, ... 8 bytes
+#define WS_WAVE_BYTES  512u           // all lengths of one wave
+#define WS_SILENCE     (WS_WAVE_COUNT * WS_WAVE_BYTES)
+
+static const char *const wave_names[WS_WAVE_COUNT] = {
+  "sine", "triangle", "saw", "square", "pulse"
+};
+
+void ws_score_init(ws_score_t *s, unsigned bpm) {
+  memset(s, 0, sizeof(*s));
+  s->bpm = bpm ? bpm : 120u;
+}
+
+int ws_score_add(ws_score_t *s, double beat, double beats, int note, int vel,
+                 ws_wave_t wave, const ws_env_t *env) {
+  if (s->count == s->cap) {
+    size_t cap = s->cap ? s->cap * 2u : 64u;
+    ws_event_t *ev = (ws_event_t *)realloc(s->ev, cap * sizeof(*ev));
+    if (!ev) return -1;
+    s->ev = ev;
+    s->cap = cap;
+  }
+  ws_event_t *e = &s->ev[s->count++];
+  e->beat = beat < 0.0 ? 0.0 : beat;
+  e->beats = beats < 0.0 ? 0.0 : beats;
+  e->note = (uint8_t)(note < 0 ? 0 : (note > 127 ? 127 : note));
+  e->vel = (uint8_t)(vel < 0 ? 0 : (vel > 64 ? 64 : vel));
+  e->wave = (uint8_t)wave;
+  e->env = *env;
+  return 0;
+}
+
+static int parse_wave(const char *s) {
+  for (int w = 0; w < WS_WAVE_COUNT; w++) {
+    if (!strcmp(s, wave_names[w])) return w;
+  }
+  return -1;
+}
+
+// "C4", "F#2", "Bb5" or a MIDI number; -1 if neither.
+static int parse_note(const char *s) {
+  static const int semis[7] = {9, 11, 0, 2, 4, 5, 7};   // A..G
+  char *end = NULL;
+  if (isdigit((unsigned char)s[0])) {
+    long n = strtol(s, &end, 10);
+    return (*end || n > 127) ? -1 : (int)n;
+  }
+  int letter = toupper((unsigned char)s[0]);
+  if (letter < 'A' || letter > 'G') return -1;
+  int semi = semis[letter - 'A'];
+  s++;
+  if (*s == '#') {
+    semi++;
+    s++;
+  } else if (*s == 'b') {
+    semi--;
+    s++;
+  }
+  long octave = strtol(s, &end, 10);
+  if (end == s || *end) return -1;
+  int n = (int)(12 * (octave + 1) + semi);
+  return (n < 0 || n > 127) ? -1 : n;
+}
+
+int ws_score_load(ws_score_t *s, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  ws_score_init(s, 120u);
+  ws_wave_t wave = WS_SINE;
+  ws_env_t env = {10u, 0u, 64u, 30u};
+  char line[256];
+  unsigned lineno = 0;
+  int rc = 0;
+  while (rc == 0 && fgets(line, sizeof(line), f)) {
+    lineno++;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+    char *tok[6];
+    int n = 0;
+    char *save = NULL;
+    for (char *t = strtok_r(line, " \t\r\n", &save); t && n < 6;
+         t = strtok_r(NULL, " \t\r\n", &save)) {
+      tok[n++] = t;
+    }
+    if (n == 0) continue;
+    if (!strcmp(tok[0], "tempo") && n == 2) {
+      s->bpm = (unsigned)strtoul(tok[1], NULL, 10);
+      if (s->bpm == 0) rc = -1;
+    } else if (!strcmp(tok[0], "wave") && n == 2) {
+      int w = parse_wave(tok[1]);
+      if (w < 0) rc = -1;
+      else wave = (ws_wave_t)w;
+    } else if (!strcmp(tok[0], "env") && n == 5) {
+      env.attack_ms = (uint16_t)strtoul(tok[1], NULL, 10);
+      env.decay_ms = (uint16_t)strtoul(tok[2], NULL, 10);
+      unsigned long sus = strtoul(tok[3], NULL, 10);
+      env.sustain = (uint8_t)(sus > 64 ? 64 : sus);
+      env.release_ms = (uint16_t)strtoul(tok[4], NULL, 10);
+    } else if (n >= 3 && n <= 5) {
+      char *end = NULL;
+      double beat = strtod(tok[0], &end);
+      int bad = *end != '\0';
+      double beats = strtod(tok[2], &end);
+      bad |= *end != '\0';
+      int note = parse_note(tok[1]);
+      int vel = 64;
+      int w = (int)wave;
+      for (int i = 3; i < n; i++) {
+        if (isdigit((unsigned char)tok[i][0])) vel = atoi(tok[i]);
+        else if ((w = parse_wave(tok[i])) < 0) bad = 1;
+      }
+      if (bad || note < 0) rc = -1;
+      else rc = ws_score_add(s, beat, beats, note, vel, (ws_wave_t)w, &env);
+    } else {
+      rc = -1;
+    }
+    if (rc != 0) fprintf(stderr, "%s:%u: cannot parse line\n", path, lineno);
+  }
+  fclose(f);
+  if (rc != 0) ws_score_free(s);
+  return rc;
+}
+
+void ws_score_free(ws_score_t *s) {
+  free(s->ev);
+  s->ev = NULL;
+  s->count = 0;
+  s->cap = 0;
+}
+
+size_t ws_chip_bytes(void) {
+  return WS_SILENCE + 2u;
+}
+
+// One band-limited cycle: only harmonics below half the table length, so
+// nothing folds back however fast the table is played.
+static void gen_table(ws_wave_t wave, unsigned len, int8_t *out) {
+  const double pi = 3.141592653589793;
+  unsigned harmonics = wave == WS_SINE ? 1u : len / 2u - 1u;
+  double v[256];
+  double peak = 0.0;
+  for (unsigned i = 0; i < len; i++) {
+    double x = 2.0 * pi * (double)i / (double)len;
+    double sum = 0.0;
+    for (unsigned k = 1; k <= harmonics; k++) {
+      double kd = (double)k;
+      switch (wave) {
+        case WS_SINE:
+          sum += sin(x);
+          break;
+        case WS_SAW:
+          sum += sin(kd * x) / kd;
+          break;
+        case WS_SQUARE:
+          if (k & 1u) sum += sin(kd * x) / kd;
+          break;
+        case WS_TRIANGLE:
+          if (k & 1u) sum += ((k & 2u) ? -1.0 : 1.0) * sin(kd * x) / (kd * kd);
+          break;
+        case WS_PULSE:
+          // 25% duty.
+          sum += sin(kd * pi * 0.25) / kd * cos(kd * (x - pi * 0.25));
+          break;
+        default:
+          break;
+      }
+    }
+    v[i] = sum;
+    if (fabs(sum) > peak) peak = fabs(sum);
+  }
+  for (unsigned i = 0; i < len; i++) {
+    out[i] = (int8_t)lrint(peak > 0.0 ? v[i] / peak * 127.0 : 0.0);
+  }
+}
+
+static uint32_t table_offset(int table) {
+  if (table < 0) return WS_SILENCE;
+  unsigned wave = (unsigned)table / WS_SIZES;
+  unsigned size = (unsigned)table % WS_SIZES;
+  return wave * WS_WAVE_BYTES + (512u - (512u >> size));
+}
+
+static unsigned table_len(int table) {
+  return table < 0 ? 2u : 256u >> ((unsigned)table % WS_SIZES);
+}
+
+static void reg_write(ws_stats_t *st, uint32_t reg, uint16_t v) {
+  ps_write_16(reg, v);
+  st->reg_writes++;
+}
+
+// The longest table whose period for this pitch is still one DMA can fetch.
+static int pick_table(unsigned wave, double note, double clock, uint16_t *period) {
+  double hz = 440.0 * pow(2.0, (note - 69.0) / 12.0);
+  for (unsigned size = 0; size < WS_SIZES; size++) {
+    double p = clock / (hz * (double)(256u >> size));
+    if (p + 0.5 >= (double)PAULA_MIN_PERIOD) {
+      *period = (uint16_t)(p > 65535.0 ? 65535.0 : p + 0.5);
+      return (int)(wave * WS_SIZES + size);
+    }
+  }
+  *period = PAULA_MIN_PERIOD;
+  return (int)(wave * WS_SIZES + WS_SIZES - 1u);
+}
+
+static uint64_t beats_ns(double beats, unsigned bpm) {
+  return (uint64_t)(beats * 60.0e9 / (double)bpm);
+}
+
+// Envelope level 0-64 at t ns after note-on.
+static unsigned env_level(const ws_env_t *e, uint64_t t, uint64_t held) {
+  uint64_t a = (uint64_t)e->attack_ms * 1000000ull;
+  uint64_t d = (uint64_t)e->decay_ms * 1000000ull;
+  uint64_t r = (uint64_t)e->release_ms * 1000000ull;
+  uint64_t at = t < held ? t : held;
+  unsigned lvl;
+  if (at < a) {
+    lvl = (unsigned)(64ull * at / a);
+  } else if (at < a + d) {
+    lvl = 64u - (unsigned)((64ull - e->sustain) * (at - a) / d);
+  } else {
+    lvl = e->sustain;
+  }
+  if (t >= held) {
+    uint64_t rt = t - held;
+    lvl = rt >= r ? 0u : (unsigned)((uint64_t)lvl * (r - rt) / r);
+  }
+  return lvl;
+}
+
+static int cmp_event(const void *a, const void *b) {
+  const ws_event_t *x = *(const ws_event_t *const *)a;
+  const ws_event_t *y = *(const ws_event_t *const *)b;
+  if (x->beat != y->beat) return x->beat < y->beat ? -1 : 1;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void set_location(ws_stats_t *st, unsigned ch, uint32_t addr, unsigned len) {
+  uint32_t reg = AUD0LCH + ch * AUD_STRIDE;
+  reg_write(st, reg, (addr >> 16) & 0x1Fu);
+  reg_write(st, reg + 2u, addr & 0xFFFEu);
+  reg_write(st, reg + 4u, (uint16_t)(len / 2u));
+}
+
+static void voice_pitch(ws_synth_t *w, unsigned ch) {
+  ws_voice_t *v = &w->voice[ch];
+  uint16_t period = 0;
+  int table = pick_table(v->wave, (double)v->note + w->bend_cents / 100.0, w->clock,
+                         &period);
+  if (table != v->table) {
+    // DMA keeps running: Paula takes the new table when the current cycle
+    // ends, so the switch is phase-continuous.
+    set_location(w->stats, ch, w->base + table_offset(table), table_len(table));
+    v->table = table;
+  }
+  if (period != v->period) {
+    reg_write(w->stats, AUD0PER + ch * AUD_STRIDE, period);
+    v->period = period;
+  }
+}
+
+// Writes the voice's envelope volume if it changed; returns 0 once the
+// release has finished.
+static int voice_volume(ws_synth_t *w, unsigned ch, uint64_t now) {
+  ws_voice_t *v = &w->voice[ch];
+  uint16_t want = 0;
+  if (v->active) {
+    uint64_t t = now > v->on_ns ? now - v->on_ns : 0;
+    uint64_t held = v->off_ns - v->on_ns;
+    uint64_t release = (uint64_t)v->env.release_ms * 1000000ull;
+    if (t >= held && t - held >= release) {
+      v->active = 0;
+    } else {
+      unsigned lvl = env_level(&v->env, t, held);
+      want = (uint16_t)((lvl * v->vel * w->vol + 2048u) / 4096u);
+    }
+  }
+  if (want != v->vol) {
+    reg_write(w->stats, AUD0VOL + ch * AUD_STRIDE, want);
+    v->vol = want;
+  }
+  return v->active;
+}
+
+int ws_synth_start(ws_synth_t *w, uint32_t base, int is_pal, uint16_t vol,
+                   ws_stats_t *stats) {
+  memset(w, 0, sizeof(*w));
+  memset(stats, 0, sizeof(*stats));
+  w->base = base;
+  w->clock = is_pal ? 3546895.0 : 3579545.0;
+  w->vol = vol > 64 ? 64 : vol;
+  w->stats = stats;
+  size_t bytes = ws_chip_bytes();
+  int8_t *tables = (int8_t *)calloc(bytes, 1);
+  if (!tables) {
+    fprintf(stderr, "synth: out of memory\n");
+    return -1;
+  }
+  for (unsigned wave = 0; wave < WS_WAVE_COUNT; wave++) {
+    for (unsigned size = 0; size < WS_SIZES; size++) {
+      int t = (int)(wave * WS_SIZES + size);
+      gen_table((ws_wave_t)wave, table_len(t), tables + table_offset(t));
+    }
+  }
+  // The only bulk transfer: every note after this is register writes.
+  write_chip_ram(base, (const uint8_t *)tables, bytes);
+  stats->upload_bytes = bytes;
+  free(tables);
+
+  // Park every channel on a silent word with DMA running, so notes never
+  // have to restart DMA.
+  for (unsigned ch = 0; ch < WS_VOICES; ch++) {
+    w->voice[ch].table = -1;
+    w->voice[ch].period = PAULA_MIN_PERIOD;
+    reg_write(stats, AUD0VOL + ch * AUD_STRIDE, 0);
+    set_location(stats, ch, base + WS_SILENCE, 2u);
+    reg_write(stats, AUD0PER + ch * AUD_STRIDE, PAULA_MIN_PERIOD);
+  }
+  reg_write(stats, DMACON, DMAF_SETCLR | DMAF_MASTER | DMAF_AUDIO);
+  return 0;
+}
+
+int ws_synth_note_on(ws_synth_t *w, unsigned note, unsigned vel, ws_wave_t wave,
+                     const ws_env_t *env, uint64_t now, uint64_t hold_ns) {
+  ws_voice_t *v = NULL;
+  for (unsigned i = 0; i < WS_VOICES && !v; i++) {
+    if (!w->voice[i].active) v = &w->voice[i];
+  }
+  if (!v) {
+    v = &w->voice[0];
+    for (unsigned i = 1; i < WS_VOICES; i++) {
+      if (w->voice[i].on_ns < v->on_ns) v = &w->voice[i];
+    }
+    w->stats->steals++;
+  }
+  unsigned ch = (unsigned)(v - w->voice);
+  v->note = (uint8_t)note;
+  v->vel = (uint8_t)(vel > 64 ? 64 : vel);
+  v->wave = (uint8_t)wave;
+  v->env = *env;
+  v->on_ns = now;
+  v->off_ns = hold_ns == WS_HOLD ? WS_HOLD : now + hold_ns;
+  v->active = 1;
+  voice_pitch(w, ch);
+  voice_volume(w, ch, now);
+  w->stats->notes++;
+  return (int)ch;
+}
+
+void ws_synth_note_off(ws_synth_t *w, unsigned note, uint64_t now) {
+  for (unsigned ch = 0; ch < WS_VOICES; ch++) {
+    ws_voice_t *v = &w->voice[ch];
+    if (v->active && v->note == note && v->off_ns == WS_HOLD) {
+      v->off_ns = now;
+      voice_volume(w, ch, now);
+    }
+  }
+}
+
+void ws_synth_bend(ws_synth_t *w, double cents) {
+  w->bend_cents = cents;
+  for (unsigned ch = 0; ch < WS_VOICES; ch++) {
+    if (w->voice[ch].active) voice_pitch(w, ch);
+  }
+}
+
+unsigned ws_synth_tick(ws_synth_t *w, uint64_t now) {
+  unsigned live = 0;
+  for (unsigned ch = 0; ch < WS_VOICES; ch++) live += (unsigned)voice_volume(w, ch, now);
+  return live;
+}
+
+void ws_synth_stop(ws_synth_t *w) {
+  for (unsigned ch = 0; ch < WS_VOICES; ch++) {
+    reg_write(w->stats, AUD0VOL + ch * AUD_STRIDE, 0);
+    w->voice[ch].active = 0;
+    w->voice[ch].vol = 0;
+  }
+  reg_write(w->stats, DMACON, DMAF_AUDIO);
+}
+
+int ws_play(const ws_score_t *s, uint32_t base, int is_pal, uint16_t vol,
+            volatile sig_atomic_t *stop, ws_stats_t *stats) {
+  const ws_event_t **order =
+      (const ws_event_t **)malloc((s->count ? s->count : 1u) * sizeof(*order));
+  if (!order) {
+    fprintf(stderr, "synth: out of memory\n");
+    return -1;
+  }
+  for (size_t i = 0; i < s->count; i++) order[i] = &s->ev[i];
+  qsort(order, s->count, sizeof(*order), cmp_event);
+
+  ws_synth_t w;
+  if (ws_synth_start(&w, base, is_pal, vol, stats) != 0) {
+    free(order);
+    return -1;
+  }
+  size_t next = 0;
+  uint64_t t0 = pi_now_ns();
+  while (!(stop && *stop)) {
+    uint64_t now = pi_now_ns() - t0;
+    while (next < s->count && beats_ns(order[next]->beat, s->bpm) <= now) {
+      const ws_event_t *e = order[next++];
+      ws_synth_note_on(&w, e->note, e->vel, (ws_wave_t)e->wave, &e->env, now,
+                       beats_ns(e->beats, s->bpm));
+    }
+    unsigned live = ws_synth_tick(&w, now);
+    if (next >= s->count && live == 0) break;
+    uint64_t wake = now + WS_TICK_NS;
+    if (next < s->count) {
+      uint64_t due = beats_ns(order[next]->beat, s->bpm);
+      if (due < wake) wake = due;
+    }
+    uint64_t cur = pi_now_ns() - t0;
+    if (wake > cur) pi_sleep_ns(wake - cur);
+  }
+  ws_synth_stop(&w);
+  free(order);
+  return 0;
+}
+
+void ws_report(const ws_stats_t *st, FILE *out) {
+  fprintf(out, "[SYNTH] notes=%llu steals=%llu reg_writes=%llu (%.1f/note) upload=%zuB\n",
+          (unsigned long long)st->notes, (unsigned long long)st->steals,
+          (unsigned long long)st->reg_writes,
+          st->notes ? (double)st->reg_writes / (double)st->notes : 0.0,
+          st->upload_bytes);
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: MIT
+// Resident wavetable synth for Paula.
+//
+// A handful of band-limited single-cycle waveforms are uploaded to chip
+// RAM once, each at several table lengths. Paula loops the table with DMA
+// and a note is played by pointing a channel at the right table and
+// setting its period, so a note costs a few register writes instead of a
+// sample upload. The table length is picked per note so the period stays
+// at or above the DMA limit. Envelopes are applied with AUDxVOL writes
+// from a tick loop; only changed values are written.
+//
+// Score files are plain text, one directive or note per line:
+//
+//   # comment
+//   tempo 120                      beats per minute (whole score)
+//   wave saw                       sine, triangle, saw, square or pulse
+//   env 10 80 40 120               attack ms, decay ms, sustain 0-64, release ms
+//   0     C4  1                    start beat, note, length in beats
+//   0.5   G#3 0.5 48 square        ... optional velocity 0-64 and wave
+//
+// Notes are names (C4, F#2, Bb5; C4 = middle C) or MIDI numbers. wave and
+// env apply to the notes that follow them. Up to four notes sound at once;
+// a fifth steals the voice that started first.
+
+#ifndef WAVESYNTH_H
+#define WAVESYNTH_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WS_VOICES       4u
+#define WS_TICK_NS      5000000ull    // envelope update rate (200 Hz)
+
+typedef enum {
+  WS_SINE = 0,
+  WS_TRIANGLE,
+  WS_SAW,
+  WS_SQUARE,
+  WS_PULSE,
+  WS_WAVE_COUNT
+} ws_wave_t;
+
+typedef struct {
+  uint16_t attack_ms;
+  uint16_t decay_ms;
+  uint8_t sustain;          // 0-64
+  uint16_t release_ms;
+} ws_env_t;
+
+typedef struct {
+  double beat;
+  double beats;
+  uint8_t note;             // MIDI note number
+  uint8_t vel;              // 0-64
+  uint8_t wave;
+  ws_env_t env;
+} ws_event_t;
+
+typedef struct {
+  ws_event_t *ev;
+  size_t count;
+  size_t cap;
+  unsigned bpm;
+} ws_score_t;
+
+typedef struct {
+  uint64_t notes;
+  uint64_t steals;
+  uint64_t reg_writes;
+  size_t upload_bytes;
+} ws_stats_t;
+
+void ws_score_init(ws_score_t *s, unsigned bpm);
+int ws_score_add(ws_score_t *s, double beat, double beats, int note, int vel,
+                 ws_wave_t wave, const ws_env_t *env);
+int ws_score_load(ws_score_t *s, const char *path);
+void ws_score_free(ws_score_t *s);
+
+// Chip RAM used by the wave tables at the synth's base address.
+size_t ws_chip_bytes(void);
+
+// Live engine, for callers that generate notes themselves.
+#define WS_HOLD UINT64_MAX          // note sounds until ws_synth_note_off()
+
+typedef struct {
+  uint8_t note;
+  uint8_t vel;
+  uint8_t wave;
+  ws_env_t env;
+  uint64_t on_ns;
+  uint64_t off_ns;          // WS_HOLD while the key is down
+  int active;
+  int table;                // wave * sizes + size, -1 = silence
+  uint16_t period;
+  uint16_t vol;             // last value written to AUDxVOL
+} ws_voice_t;
+
+typedef struct {
+  uint32_t base;
+  double clock;
+  uint16_t vol;
+  double bend_cents;
+  ws_voice_t voice[WS_VOICES];
+  ws_stats_t *stats;
+} ws_synth_t;
+
+// Uploads the tables and parks AUD0-3 on silence with DMA running.
+int ws_synth_start(ws_synth_t *w, uint32_t base, int is_pal, uint16_t vol,
+                   ws_stats_t *stats);
+// Writes period, location and volume for the note straight away and
+// returns the channel used. now is on the caller's clock.
+int ws_synth_note_on(ws_synth_t *w, unsigned note, unsigned vel, ws_wave_t wave,
+                     const ws_env_t *env, uint64_t now, uint64_t hold_ns);
+void ws_synth_note_off(ws_synth_t *w, unsigned note, uint64_t now);
+// Shifts every sounding and future note; rewrites AUDxPER as needed.
+void ws_synth_bend(ws_synth_t *w, double cents);
+// Advances envelopes; returns the number of voices still sounding.
+unsigned ws_synth_tick(ws_synth_t *w, uint64_t now);
+void ws_synth_stop(ws_synth_t *w);
+
+// Uploads the tables to base, plays the score on AUD0-3 and leaves the
+// channels silent. vol (0-64) scales every note.
+int ws_play(const ws_score_t *s, uint32_t base, int is_pal, uint16_t vol,
+            volatile sig_atomic_t *stop, ws_stats_t *stats);
+
+void ws_report(const ws_stats_t *stats, FILE *out);
+
+#endif /* WAVESYNTH_H */
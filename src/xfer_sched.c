@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: MIT
+// DMA-contention-aware bulk chip RAM transfer scheduler.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio/ps_protocol.h"
+#include "paula.h"
+#include "chip_ram.h"
+#include "pi_time.h"
+#include "xfer_sched.h"
+
+#define XFER_DISPLAY_DMA (DMAF_RASTER | DMAF_SPRITE)
+
+static xfer_sched_t *installed = NULL;
+
+static const char *const strategy_names[XFER_STRATEGIES] = {
+  "direct", "beam", "turbo"
+};
+
+const char *xfer_strategy_name(xfer_strategy_t strategy) {
+  return strategy < XFER_STRATEGIES ? strategy_names[strategy] : "?";
+}
+
+int xfer_strategy_parse(const char *name, xfer_strategy_t *out) {
+  for (int i = 0; i < XFER_STRATEGIES; i++) {
+    if (!strcmp(name, strategy_names[i])) {
+      *out = (xfer_strategy_t)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void xfer_sched_init(xfer_sched_t *x, xfer_strategy_t strategy, int is_pal) {
+  memset(x, 0, sizeof(*x));
+  x->strategy = strategy;
+  x->lines = is_pal ? 312u : 262u;
+  x->line_ns = is_pal ? 64000u : 63556u;
+  // Standard DIWSTRT/DIWSTOP: display from line 0x2C to 0x12C (PAL) / 0xF4.
+  x->quiet_top = 0x2Cu;
+  x->quiet_bottom = is_pal ? 0x12Cu : 0xF4u;
+  x->word_ns = 1200.0;
+}
+
+// V8 is in VPOSR and V7..V0 in VHPOSR. If the beam crosses from line 255
+// to 256, or wraps to line 0, between the two reads, the old V8 pairs with
+// the new V7..V0; VPOSR is read again until it matches on both sides.
+unsigned xfer_beam_line(void) {
+  unsigned vpos = ps_read_16(VPOSR);
+  for (;;) {
+    unsigned vhpos = ps_read_16(VHPOSR);
+    unsigned again = ps_read_16(VPOSR);
+    if (again == vpos) return ((vpos & 1u) << 8) | (vhpos >> 8);
+    vpos = again;
+  }
+}
+
+static void xfer_chunk(xfer_sched_t *x, uint32_t addr, const uint8_t *buf,
+                       size_t len) {
+  uint64_t t0 = pi_now_ns();
+  write_chip_ram_burst(addr, buf, len);
+  uint64_t dt = pi_now_ns() - t0;
+  size_t words = (len + 1u) / 2u;
+  if (words) {
+    double sample = (double)dt / (double)words;
+    x->word_ns = 0.75 * x->word_ns + 0.25 * sample;
+  }
+}
+
+// Lines of quiet bus left from line v, or 0 if the beam is in the display.
+static unsigned xfer_quiet_lines(const xfer_sched_t *x, unsigned v) {
+  if (v < x->quiet_top) return x->quiet_top - v;
+  if (v >= x->quiet_bottom) {
+    unsigned to_end = v < x->lines ? x->lines - v : 1u;
+    return to_end + x->quiet_top;
+  }
+  return 0;
+}
+
+static void xfer_beam(xfer_sched_t *x, xfer_strategy_t slot, uint32_t addr,
+                      const uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    unsigned v = xfer_beam_line();
+    unsigned quiet = xfer_quiet_lines(x, v);
+    if (quiet == 0) {
+      // Sleep most of the way to the lower border, then poll.
+      uint64_t wait = (uint64_t)(x->quiet_bottom - v) * x->line_ns;
+      uint64_t t0 = pi_now_ns();
+      if (wait > 200000u) pi_sleep_ns(wait - 100000u);
+      x->wait_ns[slot] += pi_now_ns() - t0;
+      continue;
+    }
+
+    double budget_ns = (double)quiet * (double)x->line_ns;
+    double words = x->word_ns > 0.0 ? budget_ns / x->word_ns : (double)XFER_MAX_CHUNK_WORDS;
+    if (words < XFER_MIN_CHUNK_WORDS) words = XFER_MIN_CHUNK_WORDS;
+    if (words > XFER_MAX_CHUNK_WORDS) words = XFER_MAX_CHUNK_WORDS;
+    size_t n = (size_t)words * 2u;
+    if (n > len - done) n = len - done;
+    x->chunk_words = (unsigned)((n + 1u) / 2u);
+    xfer_chunk(x, addr + (uint32_t)done, buf + done, n);
+    done += n;
+  }
+}
+
+void xfer_write_with(xfer_sched_t *x, xfer_strategy_t strategy, uint32_t addr,
+                     const uint8_t *buf, size_t len) {
+  if (len == 0) return;
+  uint64_t t0 = pi_now_ns();
+  uint16_t dmacon = (uint16_t)ps_read_16(DMACONR);
+  uint16_t display = dmacon & XFER_DISPLAY_DMA;
+
+  if (strategy == XFER_DIRECT || !(dmacon & DMAF_MASTER) || !display) {
+    // Nothing is stealing bus slots from us; the beam offers no advantage.
+    xfer_chunk(x, addr, buf, len);
+  } else if (strategy == XFER_TURBO && len >= XFER_TURBO_MIN_BYTES) {
+    ps_write_16(DMACON, display);
+    xfer_chunk(x, addr, buf, len);
+    ps_write_16(DMACON, DMAF_SETCLR | display);
+  } else {
+    xfer_beam(x, strategy, addr, buf, len);
+  }
+
+  x->bytes[strategy] += len;
+  x->busy_ns[strategy] += pi_now_ns() - t0;
+}
+
+void xfer_write(xfer_sched_t *x, uint32_t addr, const uint8_t *buf, size_t len) {
+  xfer_write_with(x, x->strategy, addr, buf, len);
+}
+
+static void xfer_installed_writer(uint32_t addr, const uint8_t *buf, size_t len) {
+  xfer_write(installed, addr, buf, len);
+}
+
+void xfer_sched_install(xfer_sched_t *x, size_t min_len) {
+  installed = x;
+  chip_ram_set_bulk_writer(x ? xfer_installed_writer : NULL, min_len);
+}
+
+void xfer_report(const xfer_sched_t *x, FILE *out) {
+  for (int i = 0; i < XFER_STRATEGIES; i++) {
+    if (!x->bytes[i]) continue;
+    double sec = (double)x->busy_ns[i] / 1e9;
+    double kbs = sec > 0.0 ? ((double)x->bytes[i] / 1024.0) / sec : 0.0;
+    fprintf(out, "[XFER] %-6s bytes=%llu time=%.3fs wait=%.3fs rate=%.1fKB/s word=%.0fns\n",
+            xfer_strategy_name((xfer_strategy_t)i),
+            (unsigned long long)x->bytes[i], sec,
+            (double)x->wait_ns[i] / 1e9, kbs, x->word_ns);
+  }
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// DMA-contention-aware bulk chip RAM transfer scheduler.
+//
+// Bitplane, sprite and copper DMA steal chip bus slots while the beam is in
+// the display window. The beam strategy polls VPOSR/VHPOSR and pushes data
+// in vertical blank and the lower border, sizing each chunk from the
+// measured per-word latency. The turbo strategy clears BPLEN/SPREN for the
+// duration of large uploads and restores them afterwards.
+
+#ifndef XFER_SCHED_H
+#define XFER_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  XFER_DIRECT = 0,      // write straight through, ignore the beam
+  XFER_BEAM,            // only write in vertical blank / border lines
+  XFER_TURBO,           // beam, plus display DMA off during large uploads
+  XFER_STRATEGIES
+} xfer_strategy_t;
+
+#define XFER_MIN_CHUNK_WORDS  16u
+#define XFER_MAX_CHUNK_WORDS  4096u
+#define XFER_TURBO_MIN_BYTES  8192u
+
+typedef struct {
+  xfer_strategy_t strategy;
+  uint16_t lines;          // lines per frame (312 PAL, 262 NTSC)
+  uint32_t line_ns;        // duration of one raster line
+  uint16_t quiet_top;      // lines below this are vertical blank / top border
+  uint16_t quiet_bottom;   // lines at or after this are lower border
+  double word_ns;          // running estimate of bus time per word
+  unsigned chunk_words;    // size of the most recent chunk
+  uint64_t bytes[XFER_STRATEGIES];
+  uint64_t busy_ns[XFER_STRATEGIES];   // wall time including beam waits
+  uint64_t wait_ns[XFER_STRATEGIES];   // time spent waiting for the beam
+} xfer_sched_t;
+
+void xfer_sched_init(xfer_sched_t *x, xfer_strategy_t strategy, int is_pal);
+
+// Writes len bytes to chip RAM using x->strategy and updates its stats.
+void xfer_write(xfer_sched_t *x, uint32_t addr, const uint8_t *buf, size_t len);
+void xfer_write_with(xfer_sched_t *x, xfer_strategy_t strategy, uint32_t addr,
+                     const uint8_t *buf, size_t len);
+
+// Routes write_chip_ram() calls of at least min_len bytes through x.
+// Pass NULL to restore plain writes.
+void xfer_sched_install(xfer_sched_t *x, size_t min_len);
+
+// Prints achieved KB/s for every strategy that moved data.
+void xfer_report(const xfer_sched_t *x, FILE *out);
+
+const char *xfer_strategy_name(xfer_strategy_t strategy);
+int xfer_strategy_parse(const char *name, xfer_strategy_t *out);
+
+// Current beam line (V8..V0) from VPOSR/VHPOSR, read so a line change
+// between the two registers cannot tear it.
+unsigned xfer_beam_line(void);
+
+#endif /* XFER_SCHED_H */